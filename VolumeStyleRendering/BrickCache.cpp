@@ -0,0 +1,425 @@
+#include <algorithm>
+#include <cstring>
+#include <type_traits>
+
+#include "BrickCache.h"
+#include "BrickedVolume.h"
+#include "CompressedVolume.h"
+#include "MappedFile.h"
+#include "ThreadPool.h"
+#include "VolumeSampler.h"
+
+using namespace glm;
+
+namespace
+{
+    /**
+     * \brief Bricks requested by a prefetch call, shared by the pool tasks reading them
+     */
+    struct PrefetchRequest
+    {
+        std::vector<int> bricks;
+        std::atomic<size_t> next;
+        unsigned generation;
+    };
+}
+
+const ivec3& BrickSource::getDimensions() const
+{
+    return dimensions;
+}
+
+const ivec3& BrickSource::getBrickCount() const
+{
+    return brickCount;
+}
+
+int BrickSource::getBrickSize() const
+{
+    return brickSize;
+}
+
+size_t BrickSource::getBrickBytes() const
+{
+    return static_cast<size_t>(brickSize) * brickSize * brickSize * voxelSize;
+}
+
+VoxelType BrickSource::getVoxelType() const
+{
+    return voxelType;
+}
+
+RawBrickSource::RawBrickSource(const std::string& filepath, const ivec3& dimensions, VoxelType voxelType,
+                               int brickSize)
+{
+    this->dimensions = dimensions;
+    this->brickSize = max(brickSize, 1);
+    this->voxelType = voxelType;
+    this->voxelSize = GetVoxelSize(voxelType);
+    brickCount = (dimensions + this->brickSize - 1) / this->brickSize;
+    // bricks are gathered from scattered rows
+    file = std::make_unique<MappedFile>(filepath, false);
+
+    const size_t rawSize = static_cast<size_t>(dimensions.x) * dimensions.y * dimensions.z * voxelSize;
+
+    if (file->isOpen() && file->size() < rawSize) file->close();
+}
+
+RawBrickSource::~RawBrickSource() {}
+
+bool RawBrickSource::isOpen() const
+{
+    return file->isOpen();
+}
+
+void RawBrickSource::readBrick(const ivec3& brick, uint8_t* destination) const
+{
+    const ivec3 origin = brick * brickSize;
+    const ivec3 inside = min(ivec3(brickSize), dimensions - origin);
+    const size_t rowBytes = brickSize * voxelSize;
+
+    for (int z = 0; z < brickSize; z++)
+    {
+        const size_t sz = std::min(origin.z + z, dimensions.z - 1);
+
+        for (int y = 0; y < brickSize; y++)
+        {
+            const size_t sy = std::min(origin.y + y, dimensions.y - 1);
+            const uint8_t* source = file->data() + ((sz * dimensions.y + sy) * dimensions.x + origin.x) * voxelSize;
+            uint8_t* row = destination + (static_cast<size_t>(z) * brickSize + y) * rowBytes;
+            memcpy(row, source, inside.x * voxelSize);
+
+            // pad with the last voxel inside the volume
+            for (size_t x = inside.x * voxelSize; x < rowBytes; x += voxelSize)
+            {
+                memcpy(row + x, source + (inside.x - 1) * voxelSize, voxelSize);
+            }
+        }
+    }
+}
+
+BrickedBrickSource::BrickedBrickSource(const std::string& filepath)
+{
+    volume = std::make_unique<BrickedVolume>(filepath);
+    dimensions = volume->getDimensions();
+    brickCount = volume->getBrickCount();
+    brickSize = volume->getBrickSize();
+    voxelType = volume->getVoxelType();
+    voxelSize = GetVoxelSize(voxelType);
+}
+
+BrickedBrickSource::~BrickedBrickSource() {}
+
+bool BrickedBrickSource::isOpen() const
+{
+    return volume->isOpen();
+}
+
+void BrickedBrickSource::readBrick(const ivec3& brick, uint8_t* destination) const
+{
+    const int index = (brick.z * brickCount.y + brick.y) * brickCount.x + brick.x;
+    memcpy(destination, volume->getBrickData(index), getBrickBytes());
+}
+
+BrickCache::BrickCache(std::unique_ptr<BrickSource> source, size_t budget) : source(move(source)), budget(budget),
+                                                                             residentBytes(0),
+                                                                             prefetchGeneration(0), hits(0),
+                                                                             misses(0), evictions(0), prefetched(0)
+{
+}
+
+BrickCache::~BrickCache()
+{
+    // pending prefetch tasks find the cache gone or the generation changed
+    ++prefetchGeneration;
+}
+
+int BrickCache::brickIndex(const ivec3& brick) const
+{
+    const ivec3& count = source->getBrickCount();
+
+    return (brick.z * count.y + brick.y) * count.x + brick.x;
+}
+
+BrickCache::BrickData BrickCache::getBrick(const ivec3& brick)
+{
+    if (BrickData data = findBrick(brick)) return data;
+
+    return load(brickIndex(brick));
+}
+
+BrickCache::BrickData BrickCache::findBrick(const ivec3& brick)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    auto entry = entries.find(brickIndex(brick));
+
+    if (entry == entries.end())
+    {
+        ++misses;
+        return nullptr;
+    }
+
+    // move to the front of the lru list
+    lru.splice(lru.begin(), lru, entry->second.lru);
+    ++hits;
+
+    return entry->second.data;
+}
+
+BrickCache::BrickData BrickCache::load(int index)
+{
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+
+        // another thread is reading this brick
+        brickLoaded.wait(lock, [this, index] { return loading.count(index) == 0; });
+        auto entry = entries.find(index);
+
+        if (entry != entries.end()) return entry->second.data;
+
+        loading.insert(index);
+    }
+
+    // read outside the lock so other bricks can be served meanwhile
+    const ivec3& count = source->getBrickCount();
+    const ivec3 brick = ivec3(index % count.x, index / count.x % count.y, index / (count.x * count.y));
+    auto voxels = std::make_shared<std::vector<uint8_t>>(source->getBrickBytes());
+    source->readBrick(brick, voxels->data());
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        lru.push_front(index);
+        entries[index] = Entry{ voxels, lru.begin() };
+        residentBytes += voxels->size();
+        loading.erase(index);
+        evict();
+    }
+
+    brickLoaded.notify_all();
+
+    return voxels;
+}
+
+void BrickCache::evict()
+{
+    // the most recently used brick always stays
+    while (residentBytes > budget && lru.size() > 1)
+    {
+        auto entry = entries.find(lru.back());
+        residentBytes -= entry->second.data->size();
+        entries.erase(entry);
+        lru.pop_back();
+        ++evictions;
+    }
+}
+
+void BrickCache::prefetch(const std::vector<ivec3>& bricks)
+{
+    auto request = std::make_shared<PrefetchRequest>();
+    request->next = 0;
+    request->generation = ++prefetchGeneration;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        // only bricks that aren't resident or being read
+        for (const auto& brick : bricks)
+        {
+            const int index = brickIndex(brick);
+
+            if (!entries.count(index) && !loading.count(index)) request->bricks.push_back(index);
+        }
+    }
+
+    if (request->bricks.empty()) return;
+
+    std::weak_ptr<BrickCache> cache = shared_from_this();
+    const int tasks = std::min(static_cast<int>(ThreadPool::instance().getThreadCount()) - 1,
+                               static_cast<int>(request->bricks.size()));
+
+    for (int i = 0; i < std::max(tasks, 1); i++)
+    {
+        ThreadPool::instance().enqueue([cache, request]
+        {
+            for (size_t i = request->next++; i < request->bricks.size(); i = request->next++)
+            {
+                auto self = cache.lock();
+
+                // cache destroyed or superseded by a newer prefetch
+                if (!self || self->prefetchGeneration != request->generation) return;
+
+                self->load(request->bricks[i]);
+                ++self->prefetched;
+            }
+        });
+    }
+}
+
+void BrickCache::prefetchView(const mat4& modelViewProjection, const vec3& eye)
+{
+    const ivec3& count = source->getBrickCount();
+    const vec3 brickExtent = vec3(static_cast<float>(source->getBrickSize())) / vec3(source->getDimensions());
+    std::vector<std::pair<float, ivec3>> visible;
+
+    for (int z = 0; z < count.z; z++)
+    {
+        for (int y = 0; y < count.y; y++)
+        {
+            for (int x = 0; x < count.x; x++)
+            {
+                const vec3 boxMin = vec3(x, y, z) * brickExtent;
+                const vec3 boxMax = min(boxMin + brickExtent, vec3(1));
+                // count corners outside each clip plane
+                int outside[6] = { 0, 0, 0, 0, 0, 0 };
+
+                for (int c = 0; c < 8; c++)
+                {
+                    const vec3 corner = vec3(c & 1 ? boxMax.x : boxMin.x, c & 2 ? boxMax.y : boxMin.y,
+                                             c & 4 ? boxMax.z : boxMin.z);
+                    const vec4 clip = modelViewProjection * vec4(corner, 1);
+
+                    for (int axis = 0; axis < 3; axis++)
+                    {
+                        outside[axis * 2] += clip[axis] < -clip.w;
+                        outside[axis * 2 + 1] += clip[axis] > clip.w;
+                    }
+                }
+
+                // culled when all corners are outside the same plane
+                if (std::any_of(outside, outside + 6, [](int corners) { return corners == 8; })) continue;
+
+                // bricks closer to the eye hold the ray entry points
+                const vec3 nearest = clamp(eye, boxMin, boxMax);
+                visible.emplace_back(distance(eye, nearest), ivec3(x, y, z));
+            }
+        }
+    }
+
+    // no more bricks than the budget can hold
+    const size_t maxBricks = std::max<size_t>(budget / source->getBrickBytes(), 1);
+    const size_t requested = std::min(visible.size(), maxBricks);
+    std::partial_sort(visible.begin(), visible.begin() + requested, visible.end(),
+                      [](const std::pair<float, ivec3>& a, const std::pair<float, ivec3>& b)
+                      {
+                          return a.first < b.first;
+                      });
+
+    std::vector<ivec3> bricks(requested);
+
+    for (size_t i = 0; i < requested; i++) { bricks[i] = visible[i].second; }
+
+    prefetch(bricks);
+}
+
+float BrickCache::fetch(const ivec3& voxel)
+{
+    const int size = source->getBrickSize();
+    const ivec3 p = clamp(voxel, ivec3(0), source->getDimensions() - 1);
+    const BrickData brick = getBrick(p / size);
+    float value = 0;
+
+    DispatchVoxelType(source->getVoxelType(), [&](auto tag)
+    {
+        using T = std::remove_pointer_t<decltype(tag)>;
+        value = VolumeSampler<T>(reinterpret_cast<const T*>(brick->data()), ivec3(size)).fetch(p % size);
+    });
+
+    return value;
+}
+
+float BrickCache::sample(const vec3& position)
+{
+    const int size = source->getBrickSize();
+    const ivec3 base = clamp(ivec3(floor(position)), ivec3(0), source->getDimensions() - 1);
+    const ivec3 local = base % size;
+
+    // the footprint crosses a brick boundary, gather the corners one by one
+    if (any(equal(local, ivec3(size - 1))))
+    {
+        const vec3 t = position - floor(position);
+        float corners[8];
+
+        for (int i = 0; i < 8; i++) { corners[i] = fetch(ivec3(floor(position)) + ivec3(i & 1, (i >> 1) & 1, i >> 2)); }
+
+        const float y0 = mix(mix(corners[0], corners[1], t.x), mix(corners[2], corners[3], t.x), t.y);
+        const float y1 = mix(mix(corners[4], corners[5], t.x), mix(corners[6], corners[7], t.x), t.y);
+
+        return mix(y0, y1, t.z);
+    }
+
+    const BrickData brick = getBrick(base / size);
+    float value = 0;
+
+    DispatchVoxelType(source->getVoxelType(), [&](auto tag)
+    {
+        using T = std::remove_pointer_t<decltype(tag)>;
+        value = VolumeSampler<T>(reinterpret_cast<const T*>(brick->data()), ivec3(size))
+                    .sample(position - vec3(base - local));
+    });
+
+    return value;
+}
+
+void BrickCache::setBudget(size_t value)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    budget = value;
+    evict();
+}
+
+size_t BrickCache::getBudget() const
+{
+    return budget;
+}
+
+size_t BrickCache::getResidentBytes() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return residentBytes;
+}
+
+size_t BrickCache::getResidentBricks() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return entries.size();
+}
+
+BrickCache::Counters BrickCache::getCounters() const
+{
+    return Counters{ hits, misses, evictions, prefetched };
+}
+
+void BrickCache::resetCounters()
+{
+    hits = misses = evictions = prefetched = 0;
+}
+
+const BrickSource& BrickCache::getSource() const
+{
+    return *source;
+}
+
+std::unique_ptr<BrickSource> BrickCache::OpenSource(const std::string& filepath, const ivec3& dimensions,
+                                                    VoxelType voxelType, int brickSize)
+{
+    // compressed raws have no random access to their voxels
+    if (CompressedVolume::IsCompressed(filepath)) return nullptr;
+
+    std::unique_ptr<BrickSource> source;
+    const std::string extension = std::string(".") + BrickedVolume::Extension;
+    const bool isBricked = filepath.size() >= extension.size() &&
+                           filepath.compare(filepath.size() - extension.size(), extension.size(), extension) == 0;
+
+    if (isBricked)
+    {
+        source = std::make_unique<BrickedBrickSource>(filepath);
+    }
+    else
+    {
+        source = std::make_unique<RawBrickSource>(filepath, dimensions, voxelType, brickSize);
+    }
+
+    if (!source->isOpen()) return nullptr;
+
+    return source;
+}
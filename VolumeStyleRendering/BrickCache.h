@@ -0,0 +1,293 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include <cinder/CinderGlm.h>
+
+#include "VoxelType.h"
+#include "VolumeSampler.h"
+
+class MappedFile;
+class BrickedVolume;
+
+/**
+ * \brief Provides the voxels of fixed size cubic bricks of a volume stored on disk
+ */
+class BrickSource
+{
+public:
+    virtual ~BrickSource() {}
+
+    /**
+     * \brief Determines if the source can be read
+     * \return True if the underlying file is open
+     */
+    virtual bool isOpen() const = 0;
+    /**
+     * \brief Reads the given brick, voxels outside the volume repeat the edge values
+     * \param brick Brick coordinates
+     * \param destination Buffer with room for getBrickBytes() bytes
+     */
+    virtual void readBrick(const glm::ivec3& brick, uint8_t* destination) const = 0;
+
+    const glm::ivec3 &getDimensions() const;
+    const glm::ivec3 &getBrickCount() const;
+    int getBrickSize() const;
+    size_t getBrickBytes() const;
+    VoxelType getVoxelType() const;
+protected:
+    glm::ivec3 dimensions;
+    glm::ivec3 brickCount;
+    int brickSize;
+    VoxelType voxelType;
+    size_t voxelSize;
+};
+
+/**
+ * \brief Gathers bricks from a headerless raw volume, each brick is read row by row
+ */
+class RawBrickSource : public BrickSource
+{
+public:
+    RawBrickSource(const std::string& filepath, const glm::ivec3& dimensions, VoxelType voxelType, int brickSize);
+    ~RawBrickSource();
+
+    bool isOpen() const override;
+    void readBrick(const glm::ivec3& brick, uint8_t* destination) const override;
+private:
+    std::unique_ptr<MappedFile> file;
+};
+
+/**
+ * \brief Reads bricks straight from a bricked volume file
+ */
+class BrickedBrickSource : public BrickSource
+{
+public:
+    explicit BrickedBrickSource(const std::string& filepath);
+    ~BrickedBrickSource();
+
+    bool isOpen() const override;
+    void readBrick(const glm::ivec3& brick, uint8_t* destination) const override;
+private:
+    std::unique_ptr<BrickedVolume> volume;
+};
+
+/**
+ * \brief Keeps the bricks of an out-of-core volume in host memory. Bricks are paged in on
+ * demand or prefetched in the background, once the cache exceeds its byte budget the least
+ * recently used bricks are evicted
+ */
+class BrickCache : public std::enable_shared_from_this<BrickCache>
+{
+public:
+    typedef std::shared_ptr<const std::vector<uint8_t>> BrickData;
+
+    struct Counters
+    {
+        uint64_t hits;
+        uint64_t misses;
+        uint64_t evictions;
+        uint64_t prefetched;
+    };
+
+    /**
+     * \brief Creates a cache reading its bricks from the given source
+     * \param source The volume bricks source
+     * \param budget Maximum amount of brick data kept in host memory
+     */
+    BrickCache(std::unique_ptr<BrickSource> source, size_t budget);
+    ~BrickCache();
+
+    BrickCache(const BrickCache&) = delete;
+    BrickCache& operator=(const BrickCache&) = delete;
+
+    /**
+     * \brief Returns the voxels of the given brick, reading it from disk if it isn't resident
+     * \param brick Brick coordinates
+     * \return brickSize^3 voxels, stays valid even if the brick is evicted meanwhile
+     */
+    BrickData getBrick(const glm::ivec3& brick);
+    /**
+     * \brief Returns the voxels of the given brick only if it's resident
+     * \param brick Brick coordinates
+     * \return The brick voxels, null on a miss
+     */
+    BrickData findBrick(const glm::ivec3& brick);
+    /**
+     * \brief Reads the given bricks in the background, a later prefetch call supersedes the
+     * bricks of previous calls that weren't read yet
+     * \param bricks Bricks in the order they should be read
+     */
+    void prefetch(const std::vector<glm::ivec3>& bricks);
+    /**
+     * \brief Prefetches the bricks inside the view frustum, ordered by distance to the eye so
+     * the bricks rays enter first are read first. At most the budget's worth of bricks is requested
+     * \param modelViewProjection Transforms the [0..1] volume box to clip space
+     * \param eye Eye position in [0..1] volume coordinates
+     */
+    void prefetchView(const glm::mat4& modelViewProjection, const glm::vec3& eye);
+    /**
+     * \brief Reads a single voxel, paging its brick in if needed
+     * \param voxel Voxel coordinates, clamped to the volume
+     * \return The voxel value as read from the volume texture, normalized for integer volumes
+     */
+    float fetch(const glm::ivec3& voxel);
+    /**
+     * \brief Trilinear interpolation of the voxels around the given position, positions whose
+     * eight voxels lie in one brick are sampled with a single brick lookup
+     * \param position Position in voxel coordinates, voxel centers lie at integer coordinates
+     * \return The interpolated value as read from the volume texture
+     */
+    float sample(const glm::vec3& position);
+
+    void setBudget(size_t value);
+    size_t getBudget() const;
+    size_t getResidentBytes() const;
+    size_t getResidentBricks() const;
+    Counters getCounters() const;
+    void resetCounters();
+    const BrickSource &getSource() const;
+
+    /**
+     * \brief Opens the brick source matching the file's extension, bricked volumes use their own
+     * bricks and raw volumes are split in bricks of the given size
+     * \param filepath The volume filepath
+     * \param dimensions The raw volume dimensions, ignored for bricked volumes
+     * \param voxelType The raw volume voxel type, ignored for bricked volumes
+     * \param brickSize Size of the bricks a raw volume is split in
+     * \return The brick source, null if the file can't be read or is compressed
+     */
+    static std::unique_ptr<BrickSource> OpenSource(const std::string& filepath, const glm::ivec3& dimensions,
+                                                   VoxelType voxelType, int brickSize = 64);
+private:
+    struct Entry
+    {
+        BrickData data;
+        std::list<int>::iterator lru;
+    };
+
+    std::unique_ptr<BrickSource> source;
+    size_t budget;
+
+    // resident bricks, most recently used at the front
+    mutable std::mutex mutex;
+    std::condition_variable brickLoaded;
+    std::unordered_map<int, Entry> entries;
+    std::list<int> lru;
+    std::unordered_set<int> loading;
+    size_t residentBytes;
+
+    // prefetch requests older than the current generation are dropped
+    std::atomic<unsigned> prefetchGeneration;
+
+    std::atomic<uint64_t> hits;
+    std::atomic<uint64_t> misses;
+    std::atomic<uint64_t> evictions;
+    std::atomic<uint64_t> prefetched;
+
+    /**
+     * \brief Linear index of the given brick
+     */
+    int brickIndex(const glm::ivec3& brick) const;
+    /**
+     * \brief Reads a non resident brick and inserts it, evicting bricks over the budget. If
+     * another thread is already reading it this waits for its result
+     * \param index Linear brick index
+     * \return The brick voxels
+     */
+    BrickData load(int index);
+    /**
+     * \brief Evicts least recently used bricks until the cache fits its budget, the mutex has to be held
+     */
+    void evict();
+};
+
+/**
+ * \brief Samples a volume paged through a brick cache like VolumeSampler samples voxels in
+ * memory. The bricks of the last lookups are kept by the sampler, so most samples skip the cache's
+ * lock. A sampler is meant for a single thread, each thread tracing the volume uses its own
+ */
+template <typename T>
+class BrickSampler
+{
+public:
+    /**
+     * \brief Creates a sampler over the volume of the given cache, whose voxels have to be of type T
+     * \param cache The brick cache, has to outlive the sampler
+     */
+    explicit BrickSampler(BrickCache& cache) : cache(cache), dimensions(cache.getSource().getDimensions()),
+                                               brickSize(cache.getSource().getBrickSize())
+    {
+        for (auto& slot : slots) { slot.brick = glm::ivec3(-1); }
+    }
+
+    /**
+     * \brief Reads a single voxel, coordinates outside the volume read zero like a texture
+     * clamped to a black border
+     * \param voxel Voxel coordinates
+     * \return The voxel value
+     */
+    float fetchBorder(const glm::ivec3& voxel)
+    {
+        if (glm::any(glm::lessThan(voxel, glm::ivec3(0))) || glm::any(glm::greaterThanEqual(voxel, dimensions)))
+        {
+            return 0;
+        }
+
+        const glm::ivec3 brick = voxel / brickSize;
+        const glm::ivec3 local = voxel - brick * brickSize;
+        // the eight bricks around a brick corner land in distinct slots
+        Slot& slot = slots[(brick.x & 1) | (brick.y & 1) << 1 | (brick.z & 1) << 2];
+
+        if (slot.brick != brick)
+        {
+            slot.data = cache.getBrick(brick);
+            slot.brick = brick;
+        }
+
+        const T* voxels = reinterpret_cast<const T*>(slot.data->data());
+
+        return VolumeSampler<T>::ToTexture(voxels[(static_cast<size_t>(local.z) * brickSize + local.y) * brickSize +
+                                                  local.x]);
+    }
+
+    /**
+     * \brief Trilinear interpolation like the volume texture lookup of the raycast shader
+     * \param coordinates Texture coordinates, [0..1] covers the volume and the voxel centers lie
+     * half a voxel inside it. The black border is blended in outside the outer voxel centers
+     * \return The interpolated value
+     */
+    float sampleTexture(const glm::vec3& coordinates)
+    {
+        const glm::vec3 position = coordinates * glm::vec3(dimensions) - 0.5f;
+        const glm::vec3 base = glm::floor(position);
+        const glm::vec3 t = position - base;
+        const glm::ivec3 p = glm::ivec3(base);
+
+        const float x00 = glm::mix(fetchBorder(p), fetchBorder(p + glm::ivec3(1, 0, 0)), t.x);
+        const float x10 = glm::mix(fetchBorder(p + glm::ivec3(0, 1, 0)), fetchBorder(p + glm::ivec3(1, 1, 0)), t.x);
+        const float x01 = glm::mix(fetchBorder(p + glm::ivec3(0, 0, 1)), fetchBorder(p + glm::ivec3(1, 0, 1)), t.x);
+        const float x11 = glm::mix(fetchBorder(p + glm::ivec3(0, 1, 1)), fetchBorder(p + glm::ivec3(1, 1, 1)), t.x);
+
+        return glm::mix(glm::mix(x00, x10, t.y), glm::mix(x01, x11, t.y), t.z);
+    }
+private:
+    struct Slot
+    {
+        glm::ivec3 brick;
+        BrickCache::BrickData data;
+    };
+
+    BrickCache& cache;
+    glm::ivec3 dimensions;
+    int brickSize;
+    // bricks stay valid while held here even if the cache evicts them
+    Slot slots[8];
+};
@@ -0,0 +1,351 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <type_traits>
+#include <vector>
+
+#include "BrickedVolume.h"
+#include "HistogramEngine.h"
+#include "MappedFile.h"
+#include "ThreadPool.h"
+
+using namespace glm;
+
+const char* BrickedVolume::Extension = "bvol";
+
+namespace
+{
+    const char Magic[4] = { 'B', 'V', 'O', 'L' };
+    const uint32_t Version = 2;
+
+    /**
+     * \brief Histogram bin of a voxel value, integers are binned by their high byte and floats
+     * evenly over the volume's value domain
+     */
+    struct Binning
+    {
+        float low;
+        float scale;
+
+        int operator()(uint8_t value) const { return value; }
+        int operator()(uint16_t value) const { return value >> 8; }
+        int operator()(float value) const
+        {
+            return clamp(static_cast<int>((value - low) * scale), 0, 255);
+        }
+    };
+
+    /**
+     * \brief Copies a brick from a raw volume, padding outside voxels with the edge values, and
+     * computes its metadata over the voxels inside the volume
+     * \param raw Start of the raw volume voxels
+     * \param dimensions The raw volume dimensions
+     * \param origin First voxel of the brick
+     * \param brickSize Size of the cubic brick
+     * \param binning Maps voxel values to histogram bins
+     * \param brick Destination for brickSize^3 voxels
+     * \param info Destination for the brick metadata
+     */
+    template <typename T>
+    void gatherBrick(const T* raw, const ivec3& dimensions, const ivec3& origin, int brickSize, const Binning& binning,
+                     T* brick, BrickInfo& info)
+    {
+        const ivec3 inside = min(ivec3(brickSize), dimensions - origin);
+        T minValue = std::numeric_limits<T>::max();
+        T maxValue = std::numeric_limits<T>::lowest();
+        memset(&info, 0, sizeof(BrickInfo));
+
+        for (int z = 0; z < brickSize; z++)
+        {
+            const size_t sz = std::min(origin.z + z, dimensions.z - 1);
+
+            for (int y = 0; y < brickSize; y++)
+            {
+                const size_t sy = std::min(origin.y + y, dimensions.y - 1);
+                const T* source = raw + (sz * dimensions.y + sy) * dimensions.x + origin.x;
+                T* row = brick + (static_cast<size_t>(z) * brickSize + y) * brickSize;
+                memcpy(row, source, inside.x * sizeof(T));
+                // pad with the last voxel inside the volume
+                std::fill(row + inside.x, row + brickSize, source[inside.x - 1]);
+
+                // metadata only accounts for voxels inside the volume
+                if (z >= inside.z || y >= inside.y) continue;
+
+                for (int x = 0; x < inside.x; x++)
+                {
+                    const T value = row[x];
+
+                    if (!VoxelTraits<T>::Normalized && !std::isfinite(static_cast<float>(value))) continue;
+
+                    info.histogram[binning(value)]++;
+                    minValue = std::min(minValue, value);
+                    maxValue = std::max(maxValue, value);
+                }
+            }
+        }
+
+        info.minValue = static_cast<float>(minValue);
+        info.maxValue = static_cast<float>(maxValue);
+    }
+}
+
+BrickedVolume::BrickedVolume(const std::string& filepath) : voxelType(VoxelType::UInt8), bricks(nullptr)
+{
+    memset(&header, 0, sizeof(BrickedVolumeHeader));
+    file = std::make_unique<MappedFile>(filepath, false);
+
+    // error opening given filepath
+    if (!file->isOpen())
+    {
+        error = "Couldn't open bricked volume " + filepath;
+        return;
+    }
+
+    if (file->size() < sizeof(BrickedVolumeHeader))
+    {
+        error = filepath + " is too small to be a bricked volume";
+        file->close();
+        return;
+    }
+
+    memcpy(&header, file->data(), sizeof(BrickedVolumeHeader));
+
+    const bool validHeader = memcmp(header.magic, Magic, sizeof(Magic)) == 0 && header.version == Version &&
+                             VoxelTypeFromSize(header.bytesPerVoxel, voxelType) && header.brickSize > 0 &&
+                             all(greaterThan(getDimensions(), ivec3(0))) &&
+                             getBrickCount() == (getDimensions() + getBrickSize() - 1) / getBrickSize();
+
+    if (!validHeader)
+    {
+        error = filepath + " doesn't have a valid bricked volume header";
+        file->close();
+        return;
+    }
+
+    const size_t expectedSize = header.dataOffset + getTotalBricks() * getBrickBytes();
+
+    if (file->size() < expectedSize || header.bricksOffset + getTotalBricks() * sizeof(BrickInfo) > header.dataOffset)
+    {
+        error = filepath + " is truncated, " + std::to_string(expectedSize) + " bytes are needed";
+        file->close();
+        return;
+    }
+
+    bricks = reinterpret_cast<const BrickInfo*>(file->data() + header.bricksOffset);
+}
+
+BrickedVolume::~BrickedVolume() {}
+
+bool BrickedVolume::isOpen() const
+{
+    return bricks != nullptr;
+}
+
+const std::string& BrickedVolume::getError() const
+{
+    return error;
+}
+
+void BrickedVolume::copySlices(int zOffset, int depth, uint8_t* destination) const
+{
+    const ivec3 dimensions = getDimensions();
+    const ivec3 brickCount = getBrickCount();
+    const size_t brickSize = header.brickSize;
+    const size_t voxelSize = header.bytesPerVoxel;
+
+    ThreadPool::instance().parallelFor(zOffset, zOffset + depth, [&](int z)
+    {
+        const int bz = z / brickSize;
+        const size_t lz = z % brickSize;
+
+        for (int by = 0; by < brickCount.y; by++)
+        {
+            const int rows = std::min<int>(brickSize, dimensions.y - by * brickSize);
+
+            for (int bx = 0; bx < brickCount.x; bx++)
+            {
+                const int columns = std::min<int>(brickSize, dimensions.x - bx * brickSize);
+                const uint8_t* brick = getBrickData((bz * brickCount.y + by) * brickCount.x + bx);
+
+                for (int ly = 0; ly < rows; ly++)
+                {
+                    const size_t y = by * brickSize + ly;
+                    const size_t x = bx * brickSize;
+                    const uint8_t* source = brick + ((lz * brickSize + ly) * brickSize) * voxelSize;
+                    uint8_t* target = destination + ((z - zOffset) * dimensions.y + y) * dimensions.x * voxelSize +
+                                      x * voxelSize;
+                    memcpy(target, source, columns * voxelSize);
+                }
+            }
+        }
+    });
+}
+
+void BrickedVolume::prefetchSlices(int zOffset, int depth) const
+{
+    if (!isOpen() || depth <= 0) return;
+
+    // bricks of a z layer are contiguous in the file
+    const size_t layerBytes = static_cast<size_t>(header.brickCount[0]) * header.brickCount[1] * getBrickBytes();
+    const int firstLayer = zOffset / header.brickSize;
+    const int lastLayer = (zOffset + depth - 1) / header.brickSize;
+    file->prefetch(header.dataOffset + firstLayer * layerBytes, (lastLayer - firstLayer + 1) * layerBytes);
+}
+
+const uint8_t* BrickedVolume::getBrickData(int index) const
+{
+    return file->data() + header.dataOffset + index * getBrickBytes();
+}
+
+const BrickInfo& BrickedVolume::getBrickInfo(int index) const
+{
+    return bricks[index];
+}
+
+ivec3 BrickedVolume::getDimensions() const
+{
+    return ivec3(header.dimensions[0], header.dimensions[1], header.dimensions[2]);
+}
+
+vec3 BrickedVolume::getRatios() const
+{
+    return vec3(header.ratios[0], header.ratios[1], header.ratios[2]);
+}
+
+ivec3 BrickedVolume::getBrickCount() const
+{
+    return ivec3(header.brickCount[0], header.brickCount[1], header.brickCount[2]);
+}
+
+int BrickedVolume::getBrickSize() const
+{
+    return static_cast<int>(header.brickSize);
+}
+
+int BrickedVolume::getTotalBricks() const
+{
+    return header.brickCount[0] * header.brickCount[1] * header.brickCount[2];
+}
+
+size_t BrickedVolume::getBrickBytes() const
+{
+    return static_cast<size_t>(header.brickSize) * header.brickSize * header.brickSize * header.bytesPerVoxel;
+}
+
+VoxelType BrickedVolume::getVoxelType() const
+{
+    return voxelType;
+}
+
+vec2 BrickedVolume::getValueDomain() const
+{
+    return vec2(header.valueDomain[0], header.valueDomain[1]);
+}
+
+bool BrickedVolume::ConvertRaw(const std::string& rawPath, const std::string& outputPath, const ivec3& dimensions,
+                               const vec3& ratios, VoxelType voxelType, int brickSize, std::atomic<int>* bricksDone,
+                               std::string* error)
+{
+    auto fail = [error](const std::string& message)
+    {
+        if (error) *error = message;
+        return false;
+    };
+
+    MappedFile raw(rawPath);
+
+    // error opening given filepath
+    if (!raw.isOpen()) return fail("Couldn't open volume file " + rawPath);
+
+    const size_t voxelSize = GetVoxelSize(voxelType);
+    const size_t rawSize = static_cast<size_t>(dimensions.x) * dimensions.y * dimensions.z * voxelSize;
+
+    if (raw.size() < rawSize)
+    {
+        return fail("Volume file " + rawPath + " has " + std::to_string(raw.size()) + " bytes, " +
+                    std::to_string(rawSize) + " bytes are needed for the given dimensions");
+    }
+
+    // describe bricked layout
+    BrickedVolumeHeader header;
+    memset(&header, 0, sizeof(BrickedVolumeHeader));
+    memcpy(header.magic, Magic, sizeof(Magic));
+    header.version = Version;
+    header.bytesPerVoxel = static_cast<uint32_t>(voxelSize);
+    header.brickSize = static_cast<uint32_t>(max(brickSize, 1));
+    header.valueDomain[0] = 0;
+    header.valueDomain[1] = voxelType == VoxelType::UInt16 ? 65536.0f : 256.0f;
+
+    if (voxelType == VoxelType::Float32)
+    {
+        const vec2 range = HistogramEngine::FindValueRange(voxelType, raw.data(), rawSize / voxelSize);
+
+        // constant or empty volumes still get a valid domain
+        header.valueDomain[0] = range.x <= range.y ? range.x : 0;
+        header.valueDomain[1] = range.x < range.y ? range.y : header.valueDomain[0] + 1;
+    }
+
+    Binning binning;
+    binning.low = header.valueDomain[0];
+    binning.scale = 256 / (header.valueDomain[1] - header.valueDomain[0]);
+    const ivec3 brickCount = (dimensions + static_cast<int>(header.brickSize) - 1) / static_cast<int>(header.brickSize);
+
+    for (int i = 0; i < 3; i++)
+    {
+        header.dimensions[i] = dimensions[i];
+        header.ratios[i] = ratios[i];
+        header.brickCount[i] = brickCount[i];
+    }
+
+    const int layerBricks = brickCount.x * brickCount.y;
+    const size_t brickBytes = static_cast<size_t>(header.brickSize) * header.brickSize * header.brickSize * voxelSize;
+    const size_t pageSize = 4096;
+    header.bricksOffset = sizeof(BrickedVolumeHeader);
+    header.dataOffset = header.bricksOffset + layerBricks * brickCount.z * sizeof(BrickInfo);
+    header.dataOffset = (header.dataOffset + pageSize - 1) / pageSize * pageSize;
+
+    std::ofstream output(outputPath, std::ios::binary | std::ios::trunc);
+
+    if (!output.good()) return fail("Couldn't create bricked volume " + outputPath);
+
+    // metadata is written once all bricks are converted
+    std::vector<BrickInfo> bricks(layerBricks * brickCount.z);
+    std::vector<uint8_t> layer(layerBricks * brickBytes);
+    output.seekp(header.dataOffset);
+
+    for (int bz = 0; bz < brickCount.z; bz++)
+    {
+        // gather the bricks of this z layer in parallel
+        ThreadPool::instance().parallelFor(0, layerBricks, [&](int i)
+        {
+            const ivec3 origin = ivec3(i % brickCount.x, i / brickCount.x, bz) * static_cast<int>(header.brickSize);
+            BrickInfo& info = bricks[bz * layerBricks + i];
+
+            DispatchVoxelType(voxelType, [&](auto tag)
+            {
+                using T = std::remove_pointer_t<decltype(tag)>;
+                gatherBrick(reinterpret_cast<const T*>(raw.data()), dimensions, origin, header.brickSize, binning,
+                            reinterpret_cast<T*>(layer.data() + i * brickBytes), info);
+            });
+
+            if (bricksDone) ++*bricksDone;
+        });
+
+        // the raw slices of this layer aren't needed anymore
+        const size_t sliceBytes = static_cast<size_t>(dimensions.x) * dimensions.y * voxelSize;
+        raw.release(bz * header.brickSize * sliceBytes, header.brickSize * sliceBytes);
+
+        output.write(reinterpret_cast<const char*>(layer.data()), layer.size());
+    }
+
+    output.seekp(0);
+    output.write(reinterpret_cast<const char*>(&header), sizeof(BrickedVolumeHeader));
+    output.seekp(header.bricksOffset);
+    output.write(reinterpret_cast<const char*>(bricks.data()), bricks.size() * sizeof(BrickInfo));
+
+    if (!output.good()) return fail("Couldn't write bricked volume " + outputPath);
+
+    return true;
+}
@@ -0,0 +1,136 @@
+#pragma once
+#include <atomic>
+#include <memory>
+#include <string>
+#include <cinder/CinderGlm.h>
+
+#include "VoxelType.h"
+
+class MappedFile;
+
+/**
+ * \brief Fixed size header at the start of a bricked volume file
+ */
+struct BrickedVolumeHeader
+{
+    char magic[4];
+    uint32_t version;
+    int32_t dimensions[3];
+    float ratios[3];
+    uint32_t bytesPerVoxel;
+    uint32_t brickSize;
+    int32_t brickCount[3];
+    // value range covered by the brick histograms
+    float valueDomain[2];
+    uint32_t reserved;
+    // byte offset of the brick metadata array
+    uint64_t bricksOffset;
+    // byte offset of the first brick's voxels
+    uint64_t dataOffset;
+};
+
+/**
+ * \brief Metadata stored for every brick, computed over the brick voxels inside the volume.
+ * 16 bits values are binned by their high byte, float values in 256 even bins over the
+ * volume's value domain
+ */
+struct BrickInfo
+{
+    float minValue;
+    float maxValue;
+    uint32_t histogram[256];
+};
+
+/**
+ * \brief Volume stored as fixed size cubic bricks. The file header describes the volume so
+ * no parameters have to be provided to load it, and each brick carries its value range and
+ * histogram. Bricks are stored in x, y, z order, bricks on the volume boundary are padded
+ * by repeating the edge voxels
+ */
+class BrickedVolume
+{
+public:
+    /**
+     * \brief Maps the bricked volume at the given path and validates its header
+     * \param filepath The bricked volume file path
+     */
+    explicit BrickedVolume(const std::string& filepath);
+    ~BrickedVolume();
+
+    /**
+     * \brief Determines if the file was mapped and has a valid header
+     * \return True if the bricked volume can be read
+     */
+    bool isOpen() const;
+    /**
+     * \brief Describes why the file couldn't be opened
+     * \return The error message, empty if the volume is open
+     */
+    const std::string &getError() const;
+    /**
+     * \brief Copies the given range of z slices into a raw, tightly packed buffer
+     * \param zOffset First slice to copy
+     * \param depth Number of slices to copy
+     * \param destination Buffer with room for depth slices
+     */
+    void copySlices(int zOffset, int depth, uint8_t* destination) const;
+    /**
+     * \brief Asks the operating system to read the bricks covering the given slices from disk
+     * \param zOffset First slice
+     * \param depth Number of slices
+     */
+    void prefetchSlices(int zOffset, int depth) const;
+    /**
+     * \brief Voxel data of the brick at the given index
+     * \param index Linear brick index
+     * \return Pointer to brickSize^3 voxels
+     */
+    const uint8_t* getBrickData(int index) const;
+    /**
+     * \brief Metadata of the brick at the given index
+     * \param index Linear brick index
+     * \return The brick's value range and histogram
+     */
+    const BrickInfo &getBrickInfo(int index) const;
+
+    glm::ivec3 getDimensions() const;
+    glm::vec3 getRatios() const;
+    glm::ivec3 getBrickCount() const;
+    int getBrickSize() const;
+    int getTotalBricks() const;
+    size_t getBrickBytes() const;
+    VoxelType getVoxelType() const;
+    /**
+     * \brief Value range binned by the brick histograms
+     * \return Lower and upper bound of the histogram bins
+     */
+    glm::vec2 getValueDomain() const;
+
+    /**
+     * \brief Converts a headerless raw volume to the bricked format, the bricks of each z layer
+     * are gathered and their metadata is computed in parallel. Float volumes are scanned once
+     * beforehand to find the value domain of the brick histograms
+     * \param rawPath The raw volume file path
+     * \param outputPath The bricked volume file to write
+     * \param dimensions The raw volume dimensions
+     * \param ratios The raw volume aspect ratios
+     * \param voxelType The raw volume voxel type
+     * \param brickSize Size of the cubic bricks
+     * \param bricksDone Optional counter of converted bricks, for progress reporting
+     * \param error Optional error description if the conversion fails
+     * \return True if the bricked volume was written
+     */
+    static bool ConvertRaw(const std::string& rawPath, const std::string& outputPath, const glm::ivec3& dimensions,
+                           const glm::vec3& ratios, VoxelType voxelType, int brickSize,
+                           std::atomic<int>* bricksDone = nullptr, std::string* error = nullptr);
+    /**
+     * \brief Extension used by bricked volume files
+     */
+    static const char* Extension;
+private:
+    std::unique_ptr<MappedFile> file;
+    BrickedVolumeHeader header;
+    VoxelType voxelType;
+    const BrickInfo* bricks;
+    std::string error;
+};
@@ -0,0 +1,389 @@
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <zlib.h>
+#include <zstd.h>
+
+#include "CompressedVolume.h"
+#include "MappedFile.h"
+#include "ThreadPool.h"
+
+const char* CompressedVolume::Extensions[2] = { "gz", "zst" };
+
+namespace
+{
+    const uint8_t GzipMagic[2] = { 0x1f, 0x8b };
+    const uint8_t ZstdMagic[4] = { 0x28, 0xb5, 0x2f, 0xfd };
+    const uint32_t SkippableMagic = 0x184d2a50;
+    const uint32_t SeekTableMagic = 0x8f92eab1;
+    // decompressed bytes skipped at once when seeking forward in an unindexed file
+    const size_t SkipBytes = 4 * 1024 * 1024;
+
+    uint16_t readLittle16(const uint8_t* data)
+    {
+        return static_cast<uint16_t>(data[0] | data[1] << 8);
+    }
+
+    uint32_t readLittle32(const uint8_t* data)
+    {
+        return static_cast<uint32_t>(data[0]) | static_cast<uint32_t>(data[1]) << 8 |
+               static_cast<uint32_t>(data[2]) << 16 | static_cast<uint32_t>(data[3]) << 24;
+    }
+
+    bool hasExtension(const std::string& filepath, const std::string& extension)
+    {
+        const std::string suffix = "." + extension;
+
+        return filepath.size() >= suffix.size() &&
+               filepath.compare(filepath.size() - suffix.size(), suffix.size(), suffix) == 0;
+    }
+}
+
+struct CompressedVolume::Stream
+{
+    z_stream zlib;
+    ZSTD_DStream* zstd;
+    Format format;
+    size_t inputOffset;
+    size_t position;
+    bool finished;
+    std::vector<uint8_t> scratch;
+
+    explicit Stream(Format format) : format(format), inputOffset(0), position(0), finished(false)
+    {
+        memset(&zlib, 0, sizeof(z_stream));
+        // automatic gzip header detection
+        if (format == Format::Gzip) inflateInit2(&zlib, 16 + MAX_WBITS);
+
+        zstd = format == Format::Zstd ? ZSTD_createDStream() : nullptr;
+    }
+
+    ~Stream()
+    {
+        if (format == Format::Gzip) inflateEnd(&zlib);
+
+        if (zstd) ZSTD_freeDStream(zstd);
+    }
+
+    /**
+     * \brief Decompresses the next bytes of the stream
+     * \return False if the data is corrupt or ends before
+     */
+    bool decompress(const MappedFile& file, uint8_t* destination, size_t bytes)
+    {
+        size_t produced = 0;
+
+        while (produced < bytes)
+        {
+            if (finished || inputOffset >= file.size()) return false;
+
+            // large ranges are decompressed in chunks that fit the 32 bits counters
+            const size_t input = std::min<size_t>(file.size() - inputOffset, 1u << 30);
+            const size_t output = std::min<size_t>(bytes - produced, 1u << 30);
+            size_t consumed = 0, written = 0;
+
+            if (format == Format::Gzip)
+            {
+                zlib.next_in = const_cast<Bytef*>(file.data() + inputOffset);
+                zlib.avail_in = static_cast<uInt>(input);
+                zlib.next_out = destination + produced;
+                zlib.avail_out = static_cast<uInt>(output);
+                const int result = inflate(&zlib, Z_NO_FLUSH);
+                consumed = input - zlib.avail_in;
+                written = output - zlib.avail_out;
+
+                if (result == Z_STREAM_END)
+                {
+                    // concatenated members continue the stream
+                    if (inputOffset + consumed < file.size()) inflateReset(&zlib);
+                    else finished = true;
+                }
+                else if (result != Z_OK && result != Z_BUF_ERROR) return false;
+            }
+            else
+            {
+                ZSTD_inBuffer in = { file.data() + inputOffset, input, 0 };
+                ZSTD_outBuffer out = { destination + produced, output, 0 };
+                const size_t result = ZSTD_decompressStream(zstd, &out, &in);
+
+                if (ZSTD_isError(result)) return false;
+
+                consumed = in.pos;
+                written = out.pos;
+            }
+
+            // no progress, the data is truncated
+            if (consumed == 0 && written == 0) return false;
+
+            inputOffset += consumed;
+            produced += written;
+            position += written;
+        }
+
+        return true;
+    }
+};
+
+CompressedVolume::CompressedVolume(const std::string& filepath) : format(Format::Gzip)
+{
+    file = std::make_unique<MappedFile>(filepath);
+
+    if (!file->isOpen())
+    {
+        error = "Couldn't open compressed volume " + filepath;
+        return;
+    }
+
+    const bool gzip = file->size() >= sizeof(GzipMagic) && memcmp(file->data(), GzipMagic, sizeof(GzipMagic)) == 0;
+    const bool zstd = file->size() >= sizeof(ZstdMagic) && memcmp(file->data(), ZstdMagic, sizeof(ZstdMagic)) == 0;
+
+    if (!gzip && !zstd)
+    {
+        error = filepath + " isn't a gzip or zstd file";
+        file->close();
+        return;
+    }
+
+    format = gzip ? Format::Gzip : Format::Zstd;
+
+    // without frames the file is decompressed front to back
+    const bool indexed = gzip ? indexGzipMembers() : indexZstdFrames();
+
+    if (!indexed) frames.clear();
+}
+
+CompressedVolume::~CompressedVolume() {}
+
+bool CompressedVolume::indexGzipMembers()
+{
+    const uint8_t* data = file->data();
+    size_t offset = 0, uncompressed = 0;
+
+    while (offset < file->size())
+    {
+        // header with the extra field, then the BC subfield holding the member size
+        if (file->size() - offset < 18 || memcmp(data + offset, GzipMagic, sizeof(GzipMagic)) != 0) return false;
+
+        const uint8_t* header = data + offset;
+
+        if (!(header[3] & 0x04) || readLittle16(header + 10) < 6 || header[12] != 'B' || header[13] != 'C') return false;
+
+        Frame frame;
+        frame.compressedOffset = offset;
+        frame.compressedBytes = readLittle16(header + 16) + 1;
+
+        if (frame.compressedBytes > file->size() - offset) return false;
+
+        // decompressed size is stored at the end of the member
+        frame.offset = uncompressed;
+        frame.bytes = readLittle32(data + offset + frame.compressedBytes - 4);
+        offset += frame.compressedBytes;
+        uncompressed += frame.bytes;
+
+        // empty end of file marker
+        if (frame.bytes > 0) frames.push_back(frame);
+    }
+
+    return !frames.empty();
+}
+
+bool CompressedVolume::indexZstdFrames()
+{
+    const uint8_t* data = file->data();
+    const size_t size = file->size();
+
+    // seekable format, the seek table is a skippable frame at the end of the file
+    if (size >= 9 && readLittle32(data + size - 4) == SeekTableMagic)
+    {
+        const uint32_t frameCount = readLittle32(data + size - 9);
+        const size_t entryBytes = data[size - 5] & 0x80 ? 12 : 8;
+        const size_t tableBytes = frameCount * entryBytes;
+
+        if (size >= 9 + 8 + tableBytes)
+        {
+            const uint8_t* entry = data + size - 9 - tableBytes;
+            size_t compressedOffset = 0, offset = 0;
+
+            for (uint32_t i = 0; i < frameCount; i++, entry += entryBytes)
+            {
+                Frame frame = { compressedOffset, readLittle32(entry), offset, readLittle32(entry + 4) };
+                compressedOffset += frame.compressedBytes;
+                offset += frame.bytes;
+
+                if (frame.bytes > 0) frames.push_back(frame);
+            }
+
+            if (compressedOffset == size - 9 - 8 - tableBytes) return !frames.empty();
+        }
+
+        frames.clear();
+    }
+
+    // walk the frame headers, each frame has to store its decompressed size
+    size_t compressedOffset = 0, offset = 0;
+
+    while (compressedOffset < size)
+    {
+        const size_t compressedBytes = ZSTD_findFrameCompressedSize(data + compressedOffset, size - compressedOffset);
+        const unsigned long long bytes = ZSTD_getFrameContentSize(data + compressedOffset, size - compressedOffset);
+
+        if (ZSTD_isError(compressedBytes) || bytes == ZSTD_CONTENTSIZE_ERROR) return false;
+
+        // skippable frames hold metadata
+        if ((readLittle32(data + compressedOffset) & 0xfffffff0) != SkippableMagic)
+        {
+            if (bytes == ZSTD_CONTENTSIZE_UNKNOWN) return false;
+
+            frames.push_back({ compressedOffset, compressedBytes, offset, static_cast<size_t>(bytes) });
+            offset += static_cast<size_t>(bytes);
+        }
+
+        compressedOffset += compressedBytes;
+    }
+
+    return !frames.empty();
+}
+
+bool CompressedVolume::isOpen() const
+{
+    return file->isOpen();
+}
+
+const std::string& CompressedVolume::getError() const
+{
+    return error;
+}
+
+bool CompressedVolume::read(size_t offset, size_t bytes, uint8_t* destination)
+{
+    if (!isOpen()) return false;
+
+    if (frames.empty()) return readStream(offset, bytes, destination);
+
+    // frames overlapping the range
+    auto first = std::upper_bound(frames.begin(), frames.end(), offset,
+                                  [](size_t value, const Frame& frame) { return value < frame.offset; });
+    auto last = std::lower_bound(frames.begin(), frames.end(), offset + bytes,
+                                 [](const Frame& frame, size_t value) { return frame.offset < value; });
+
+    if (first == frames.begin() || frames.back().offset + frames.back().bytes < offset + bytes)
+    {
+        error = "Compressed volume ends before the requested range";
+        return false;
+    }
+
+    const Frame* range = &*(first - 1);
+    std::atomic<bool> failed(false);
+
+    ThreadPool::instance().parallelFor(0, static_cast<int>(last - (first - 1)), [&](int index)
+    {
+        const Frame& frame = range[index];
+        const size_t begin = std::max(frame.offset, offset);
+        const size_t end = std::min(frame.offset + frame.bytes, offset + bytes);
+
+        // partially requested frames go through a temporary buffer
+        if (begin == frame.offset && end == frame.offset + frame.bytes)
+        {
+            if (!decompressFrame(frame, destination + (frame.offset - offset))) failed = true;
+        }
+        else
+        {
+            std::vector<uint8_t> temporary(frame.bytes);
+
+            if (!decompressFrame(frame, temporary.data())) failed = true;
+            else memcpy(destination + (begin - offset), temporary.data() + (begin - frame.offset), end - begin);
+        }
+
+        // compressed pages aren't needed anymore
+        file->release(frame.compressedOffset, frame.compressedBytes);
+    });
+
+    if (failed) error = "Corrupt frame in compressed volume";
+
+    return !failed;
+}
+
+bool CompressedVolume::decompressFrame(const Frame& frame, uint8_t* destination) const
+{
+    const uint8_t* source = file->data() + frame.compressedOffset;
+
+    if (format == Format::Gzip)
+    {
+        z_stream zlib;
+        memset(&zlib, 0, sizeof(z_stream));
+
+        if (inflateInit2(&zlib, 16 + MAX_WBITS) != Z_OK) return false;
+
+        // blocked gzip members are at most 64KB
+        zlib.next_in = const_cast<Bytef*>(source);
+        zlib.avail_in = static_cast<uInt>(frame.compressedBytes);
+        zlib.next_out = destination;
+        zlib.avail_out = static_cast<uInt>(frame.bytes);
+        const int result = inflate(&zlib, Z_FINISH);
+        inflateEnd(&zlib);
+
+        return result == Z_STREAM_END && zlib.avail_out == 0;
+    }
+
+    const size_t result = ZSTD_decompress(destination, frame.bytes, source, frame.compressedBytes);
+
+    return !ZSTD_isError(result) && result == frame.bytes;
+}
+
+bool CompressedVolume::readStream(size_t offset, size_t bytes, uint8_t* destination)
+{
+    // no way back in a compressed stream but starting over
+    if (!stream || offset < stream->position) stream = std::make_unique<Stream>(format);
+
+    while (stream->position < offset)
+    {
+        const size_t skip = std::min(SkipBytes, offset - stream->position);
+        stream->scratch.resize(skip);
+
+        if (!stream->decompress(*file, stream->scratch.data(), skip))
+        {
+            error = "Compressed volume is corrupt or ends before the requested range";
+            return false;
+        }
+    }
+
+    stream->scratch = std::vector<uint8_t>();
+
+    if (!stream->decompress(*file, destination, bytes))
+    {
+        error = "Compressed volume is corrupt or ends before the requested range";
+        return false;
+    }
+
+    // compressed pages already decompressed
+    file->release(0, stream->inputOffset);
+
+    return true;
+}
+
+CompressedVolume::Format CompressedVolume::getFormat() const
+{
+    return format;
+}
+
+size_t CompressedVolume::getCompressedBytes() const
+{
+    return file->size();
+}
+
+size_t CompressedVolume::getUncompressedBytes() const
+{
+    if (frames.empty()) return 0;
+
+    return frames.back().offset + frames.back().bytes;
+}
+
+int CompressedVolume::getFrameCount() const
+{
+    return static_cast<int>(frames.size());
+}
+
+bool CompressedVolume::IsCompressed(const std::string& filepath)
+{
+    return hasExtension(filepath, Extensions[0]) || hasExtension(filepath, Extensions[1]);
+}
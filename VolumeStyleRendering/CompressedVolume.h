@@ -0,0 +1,114 @@
+#pragma once
+#include <memory>
+#include <string>
+#include <vector>
+
+class MappedFile;
+
+/**
+ * \brief A gzip or zstd compressed raw volume. Files made of independent frames, such as
+ * blocked gzip (bgzip), multi-frame zstd (pzstd) or the zstd seekable format, are indexed
+ * when opened so any range can be decompressed with one thread per frame. Other files are
+ * decompressed front to back
+ */
+class CompressedVolume
+{
+public:
+    enum class Format
+    {
+        Gzip,
+        Zstd
+    };
+
+    /**
+     * \brief Maps the compressed file and indexes its frames
+     * \param filepath The compressed raw volume
+     */
+    explicit CompressedVolume(const std::string& filepath);
+    ~CompressedVolume();
+
+    CompressedVolume(const CompressedVolume&) = delete;
+    CompressedVolume& operator=(const CompressedVolume&) = delete;
+
+    /**
+     * \brief Determines if the file was mapped and holds gzip or zstd data
+     * \return True if the volume can be decompressed
+     */
+    bool isOpen() const;
+    /**
+     * \brief Describes why the file couldn't be opened or a range couldn't be decompressed
+     * \return The error message
+     */
+    const std::string &getError() const;
+    /**
+     * \brief Decompresses a range of the raw volume into the destination. Indexed frames
+     * overlapping the range are decompressed in parallel, straight into the destination when
+     * they are fully inside it. Not thread safe, unindexed files keep the position of the last
+     * read and go back to the start for ranges before it
+     * \param offset Byte offset of the range within the raw volume
+     * \param bytes Length of the range in bytes
+     * \param destination Buffer with room for the range
+     * \return False if the data is corrupt or ends before the range
+     */
+    bool read(size_t offset, size_t bytes, uint8_t* destination);
+
+    Format getFormat() const;
+    size_t getCompressedBytes() const;
+    /**
+     * \brief Size of the raw volume, known without decompressing for indexed files
+     * \return The decompressed size, zero if unknown
+     */
+    size_t getUncompressedBytes() const;
+    /**
+     * \brief Number of independently decompressable frames
+     * \return The frame count, zero if the file isn't indexed
+     */
+    int getFrameCount() const;
+
+    /**
+     * \brief Determines if the given file is a compressed raw volume by its extension
+     * \param filepath The file path
+     * \return True for gz and zst files
+     */
+    static bool IsCompressed(const std::string& filepath);
+    static const char* Extensions[2];
+private:
+    struct Frame
+    {
+        size_t compressedOffset;
+        size_t compressedBytes;
+        size_t offset;
+        size_t bytes;
+    };
+
+    // state of front to back decompression
+    struct Stream;
+
+    std::unique_ptr<MappedFile> file;
+    Format format;
+    std::vector<Frame> frames;
+    std::unique_ptr<Stream> stream;
+    std::string error;
+
+    /**
+     * \brief Indexes blocked gzip members by the block size stored in their extra field
+     * \return False if the file isn't blocked
+     */
+    bool indexGzipMembers();
+    /**
+     * \brief Indexes zstd frames from the seekable format's seek table or by walking the frame
+     * headers
+     * \return False if a frame doesn't store its decompressed size
+     */
+    bool indexZstdFrames();
+    /**
+     * \brief Decompresses a single indexed frame
+     * \return False if the frame is corrupt
+     */
+    bool decompressFrame(const Frame& frame, uint8_t* destination) const;
+    /**
+     * \brief Decompresses front to back, restarting when the range is behind the position
+     * \return False if the data is corrupt or ends before the range
+     */
+    bool readStream(size_t offset, size_t bytes, uint8_t* destination);
+};
@@ -0,0 +1,111 @@
+#include <cstdint>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#elif defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#endif
+
+#include "CpuFeatures.h"
+
+namespace
+{
+    /**
+     * \brief Executes cpuid for the given leaf and subleaf
+     * \param registers Receives eax, ebx, ecx and edx
+     */
+    void cpuid(int leaf, int subleaf, uint32_t registers[4])
+    {
+#if defined(_MSC_VER)
+        int values[4];
+        __cpuidex(values, leaf, subleaf);
+
+        for (int i = 0; i < 4; i++) { registers[i] = static_cast<uint32_t>(values[i]); }
+#elif defined(__x86_64__) || defined(__i386__)
+        __cpuid_count(leaf, subleaf, registers[0], registers[1], registers[2], registers[3]);
+#else
+        registers[0] = registers[1] = registers[2] = registers[3] = 0;
+#endif
+    }
+
+    /**
+     * \brief Reads the extended control register telling which register states the
+     * operating system saves on context switches
+     */
+    uint64_t enabledRegisterStates()
+    {
+#if defined(_MSC_VER)
+        return _xgetbv(0);
+#elif defined(__x86_64__) || defined(__i386__)
+        uint32_t low, high;
+        __asm__ volatile("xgetbv" : "=a"(low), "=d"(high) : "c"(0));
+        return (static_cast<uint64_t>(high) << 32) | low;
+#else
+        return 0;
+#endif
+    }
+}
+
+const CpuFeatures::Features& CpuFeatures::Detect()
+{
+    static const Features features = []
+    {
+        Features detected = { false, false, false, false };
+        uint32_t registers[4];
+        cpuid(0, 0, registers);
+        const uint32_t maxLeaf = registers[0];
+
+        if (maxLeaf < 1) return detected;
+
+        cpuid(1, 0, registers);
+        detected.sse2 = (registers[3] & (1u << 26)) != 0;
+        detected.sse41 = (registers[2] & (1u << 19)) != 0;
+
+        // wide registers are only usable if the operating system saves them
+        const bool osxsave = (registers[2] & (1u << 27)) != 0;
+        const uint64_t states = osxsave ? enabledRegisterStates() : 0;
+        const bool avxStates = (states & 0x6) == 0x6;
+        const bool avx512States = (states & 0xe6) == 0xe6;
+
+        if (maxLeaf >= 7)
+        {
+            cpuid(7, 0, registers);
+            detected.avx2 = avxStates && (registers[1] & (1u << 5)) != 0;
+            // foundation and byte/word instructions
+            detected.avx512 = avx512States && (registers[1] & (1u << 16)) != 0 && (registers[1] & (1u << 30)) != 0;
+        }
+
+        return detected;
+    }();
+
+    return features;
+}
+
+bool CpuFeatures::HasSse2()
+{
+    return Detect().sse2;
+}
+
+bool CpuFeatures::HasSse41()
+{
+    return Detect().sse41;
+}
+
+bool CpuFeatures::HasAvx2()
+{
+    return Detect().avx2;
+}
+
+bool CpuFeatures::HasAvx512()
+{
+    return Detect().avx512;
+}
+
+const char* CpuFeatures::GetBestExtension()
+{
+    if (HasAvx512()) return "AVX-512";
+    if (HasAvx2()) return "AVX2";
+    if (HasSse41()) return "SSE4.1";
+    if (HasSse2()) return "SSE2";
+
+    return "scalar";
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+/**
+ * \brief Instruction set extensions supported by the running processor and operating system,
+ * used to select vectorized code paths at runtime
+ */
+class CpuFeatures
+{
+public:
+    static bool HasSse2();
+    static bool HasSse41();
+    static bool HasAvx2();
+    static bool HasAvx512();
+    /**
+     * \brief Name of the widest supported vector extension, for reports
+     * \return AVX-512, AVX2, SSE4.1, SSE2 or scalar
+     */
+    static const char* GetBestExtension();
+private:
+    struct Features
+    {
+        bool sse2;
+        bool sse41;
+        bool avx2;
+        bool avx512;
+    };
+
+    /**
+     * \brief Queries cpuid once and caches the result
+     */
+    static const Features &Detect();
+};
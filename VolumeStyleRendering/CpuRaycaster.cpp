@@ -0,0 +1,1094 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <type_traits>
+#include <immintrin.h>
+
+#include "CpuRaycaster.h"
+#include "BrickCache.h"
+#include "CpuFeatures.h"
+#include "VolumeSampler.h"
+
+#if defined(__GNUC__)
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define TARGET_AVX2
+#endif
+
+using namespace glm;
+
+namespace
+{
+    // composited opacity at which rays stop, like the shader
+    const float OpacityCutoff = 0.95f;
+
+    /**
+     * \brief Converts a half float to a float
+     */
+    float fromHalf(uint16_t half)
+    {
+        const int exponent = half >> 10 & 0x1f;
+        const int mantissa = half & 0x3ff;
+        float value;
+
+        if (exponent == 0) value = std::ldexp(static_cast<float>(mantissa), -24);
+        else if (exponent == 31) value = mantissa ? std::numeric_limits<float>::quiet_NaN() :
+                                                    std::numeric_limits<float>::infinity();
+        else value = std::ldexp(static_cast<float>(mantissa | 0x400), exponent - 25);
+
+        return half & 0x8000 ? -value : value;
+    }
+
+    /**
+     * \brief Every half float converted, spheremap gradients are read eight at a time per sample
+     */
+    const std::vector<float>& halfTable()
+    {
+        static const std::vector<float> table = []
+        {
+            std::vector<float> values(1 << 16);
+
+            for (size_t i = 0; i < values.size(); i++) { values[i] = fromHalf(static_cast<uint16_t>(i)); }
+
+            return values;
+        }();
+
+        return table;
+    }
+
+    /**
+     * \brief Inverse spheremap transform, the shader's decode. Zero encodings have no direction
+     * and keep only their z
+     */
+    vec3 decodeSpheremap(const vec2& encoded)
+    {
+        const float z = dot(encoded, encoded) * 2 - 1;
+        const float xyLength = length(encoded);
+        const vec2 xy = xyLength > 0 ? encoded / xyLength * std::sqrt(std::max(1 - z * z, 0.0f)) : vec2(0);
+
+        return vec3(xy, z);
+    }
+
+    /**
+     * \brief Octahedral decode, the lower hemisphere is unfolded over the diagonals of the square
+     */
+    vec3 decodeOctahedral(const vec2& encoded)
+    {
+        vec3 n(encoded, 1 - std::abs(encoded.x) - std::abs(encoded.y));
+        const float fold = std::max(-n.z, 0.0f);
+        n.x += n.x >= 0 ? -fold : fold;
+        n.y += n.y >= 0 ? -fold : fold;
+
+        return normalize(n);
+    }
+
+    /**
+     * \brief Texture coordinate of a sampler of the given size, linear filtering blends entry
+     * i0 and the next one with weight t
+     */
+    int texelCoordinate(float coordinate, int size, float& t)
+    {
+        const float position = coordinate * size - 0.5f;
+        const float base = std::floor(position);
+        t = position - base;
+
+        return static_cast<int>(base);
+    }
+
+    /**
+     * \brief Direction of a reflection on the litsphere seen along eye, the shader's lookup
+     */
+    vec2 litsphere(const vec3& eye, const vec3& normal)
+    {
+        const vec3 reflected = reflect(eye, normal);
+        const float m = 2 * std::sqrt(reflected.x * reflected.x + reflected.y * reflected.y +
+                                      (reflected.z + 1) * (reflected.z + 1));
+
+        return vec2(reflected) / m + 0.5f;
+    }
+
+    /**
+     * \brief Number of lanes set in a movemask
+     */
+    int countLanes(int mask)
+    {
+        int count = 0;
+
+        for (; mask; mask &= mask - 1) { count++; }
+
+        return count;
+    }
+
+    /**
+     * \brief Linear blend of eight lanes, in the order glm::mix blends so packets match single rays
+     */
+    TARGET_AVX2 inline __m256 mixAvx2(__m256 x, __m256 y, __m256 a)
+    {
+        return _mm256_add_ps(_mm256_mul_ps(x, _mm256_sub_ps(_mm256_set1_ps(1), a)), _mm256_mul_ps(y, a));
+    }
+
+    /**
+     * \brief Float mask of the lanes set in a movemask
+     */
+    TARGET_AVX2 inline __m256 laneMask(int lanes)
+    {
+        const __m256i bits = _mm256_and_si256(_mm256_set1_epi32(lanes), _mm256_setr_epi32(1, 2, 4, 8, 16, 32, 64, 128));
+
+        return _mm256_castsi256_ps(_mm256_cmpgt_epi32(bits, _mm256_setzero_si256()));
+    }
+
+    /**
+     * \brief Reads a channel of vec4 table entries for eight lanes
+     * \param table The entries as floats
+     * \param entries Index of each lane's entry
+     * \param channel 0 to 3 for x to w
+     */
+    TARGET_AVX2 inline __m256 gatherChannel(const float* table, __m256i entries, int channel)
+    {
+        return _mm256_i32gather_ps(table + channel, _mm256_slli_epi32(entries, 2), 4);
+    }
+
+    /**
+     * \brief Texture coordinates of eight lanes, like texelCoordinate
+     * \param t Receives the blend weight of each lane
+     * \return The first entry of each lane
+     */
+    TARGET_AVX2 inline __m256i texelCoordinateAvx2(__m256 coordinate, float size, __m256& t)
+    {
+        const __m256 position = _mm256_sub_ps(_mm256_mul_ps(coordinate, _mm256_set1_ps(size)), _mm256_set1_ps(0.5f));
+        const __m256 base = _mm256_floor_ps(position);
+        t = _mm256_sub_ps(position, base);
+
+        return _mm256_cvttps_epi32(base);
+    }
+
+    /**
+     * \brief Clamps the entries of eight lanes to [0..last]
+     */
+    TARGET_AVX2 inline __m256i clampEntries(__m256i entries, int last)
+    {
+        return _mm256_min_epi32(_mm256_max_epi32(entries, _mm256_setzero_si256()), _mm256_set1_epi32(last));
+    }
+}
+
+const int CpuRaycaster::StyleSize;
+const int CpuRaycaster::NoiseSize;
+const int CpuRaycaster::TileSize;
+const int CpuRaycaster::MinTileSize;
+const int CpuRaycaster::PacketSize;
+
+class CpuRaycaster::View
+{
+public:
+    const CpuRaycaster& raycaster;
+    const Parameters& parameters;
+    Frame& frame;
+    mat4 modelView;
+    // clip space back to the unit cube
+    mat4 inverseModelViewProjection;
+    mat3 normalMatrix;
+    mat3 modelInverseTranspose;
+    vec3 lightDirection;
+    vec2 threshold;
+    vec3 texel;
+    GradientMode gradientMode;
+    bool preintegrated;
+    // shading reads the normal only for lighting and styles
+    bool shadingNormals;
+    std::atomic<size_t> rays;
+    std::atomic<size_t> samples;
+
+    View(const CpuRaycaster& raycaster, const Parameters& parameters, Frame& frame);
+
+    /**
+     * \brief Where the ray of a pixel enters the unit cube and its step, the cube front and back
+     * positions the shader reads from the face render targets. Rays are clipped to the view frustum
+     * \return False if the ray misses the volume
+     */
+    bool findRay(int x, int y, vec3& front, vec3& step) const;
+    /**
+     * \brief Offset of the first sample in steps, the baked noise of the pixel
+     */
+    float jitter(int x, int y) const;
+    /**
+     * \brief texture(volume, pos) mapped to the transfer function domain, read with a VolumeSampler
+     * or a BrickSampler
+     */
+    template <typename Sampler>
+    float density(Sampler& sampler, const vec3& pos) const;
+    /**
+     * \brief Normal from the encoded gradients or differences taken on-the-fly, like sampleNormal
+     */
+    template <typename Sampler>
+    vec3 sampleNormal(Sampler& sampler, const vec3& pos, float value) const;
+    /**
+     * \brief Encoded gradient of a voxel, zero on the border
+     */
+    vec2 fetchEncoded(const ivec3& voxel) const;
+    /**
+     * \brief texture(colorMappingFunction, value), clamped to the edge
+     */
+    vec4 colorLookup(float value) const;
+    /**
+     * \brief texture(preintegratedFunction, vec2(back, front)), clamped to the edge
+     */
+    vec4 segmentLookup(float back, float front) const;
+    /**
+     * \brief Style at the litsphere reflection of the view normal, like styleMapping
+     */
+    vec4 styleMapping(const vec3& eye, const vec3& normal, float value) const;
+    /**
+     * \brief texture(styleFunction, vec3(uv, layer)), clamped to the edge
+     */
+    vec4 styleLookup(const vec2& uv, int layer) const;
+    /**
+     * \brief Styles, corrects the opacity and lights a visible sample
+     * \param src Color and opacity from the transfer function or the segment
+     * \param extinction Mean extinction of the pre-integrated segment
+     * \return The shaded sample, not premultiplied
+     */
+    vec4 shade(const vec3& pos, float value, const vec3& normal, vec4 src, float extinction) const;
+    /**
+     * \brief Writes the render targets of a pixel
+     */
+    void store(int x, int y, const vec4& color, const vec3& normal, const vec3& pos);
+
+    /**
+     * \brief Traces the rays of a tile one at a time
+     * \param sampler Reads the volume, owned by the tracing thread
+     */
+    template <typename Sampler>
+    void traceTile(Sampler& sampler, const TileScheduler::Tile& tile);
+    /**
+     * \brief Traces the rays of a tile in packets of 4 x 2 pixels, 8 bit volumes only
+     */
+    void tracePackets(const TileScheduler::Tile& tile);
+private:
+    const std::vector<float>& halves;
+
+    /**
+     * \brief Trilinear texture lookups of eight lanes with a black border, mapped to the
+     * transfer function domain
+     */
+    __m256 densityAvx2(__m256 x, __m256 y, __m256 z) const;
+};
+
+CpuRaycaster::View::View(const CpuRaycaster& raycaster, const Parameters& parameters, Frame& frame) :
+    raycaster(raycaster), parameters(parameters), frame(frame), rays(0), samples(0), halves(halfTable())
+{
+    modelView = parameters.view * parameters.model;
+    inverseModelViewProjection = inverse(parameters.projection * modelView);
+    normalMatrix = transpose(inverse(mat3(modelView)));
+    modelInverseTranspose = transpose(inverse(mat3(parameters.model)));
+    lightDirection = normalize(-parameters.light.direction);
+    threshold = vec2(parameters.threshold) / 255.0f;
+    texel = 1.0f / vec3(raycaster.dimensions);
+    // like the volume without a gradient texture
+    gradientMode = parameters.gradientMode == GradientMode::Precomputed && !raycaster.gradients ?
+                   GradientMode::Central : parameters.gradientMode;
+    preintegrated = parameters.preintegrated && raycaster.preintegrated.size() == 256 * 256;
+    shadingNormals = parameters.diffuseShading ||
+                     std::any_of(raycaster.indexFunction.begin(), raycaster.indexFunction.end(),
+                                 [](int style) { return style >= 0; });
+}
+
+bool CpuRaycaster::View::findRay(int x, int y, vec3& front, vec3& step) const
+{
+    // pixel center on the near and far planes, in the unit cube
+    const vec2 ndc = (vec2(x, y) + 0.5f) / vec2(frame.size) * 2.0f - 1.0f;
+    const vec4 nearPoint = inverseModelViewProjection * vec4(ndc, -1, 1);
+    const vec4 farPoint = inverseModelViewProjection * vec4(ndc, 1, 1);
+    const vec3 origin = vec3(nearPoint) / nearPoint.w;
+    const vec3 ray = vec3(farPoint) / farPoint.w - origin;
+
+    // slabs of the unit cube
+    float entry = 0;
+    float exit = 1;
+
+    for (int axis = 0; axis < 3; axis++)
+    {
+        if (std::abs(ray[axis]) < 1e-12f)
+        {
+            if (origin[axis] < 0 || origin[axis] > 1) return false;
+
+            continue;
+        }
+
+        const float t0 = -origin[axis] / ray[axis];
+        const float t1 = (1 - origin[axis]) / ray[axis];
+        entry = std::max(entry, std::min(t0, t1));
+        exit = std::min(exit, std::max(t0, t1));
+    }
+
+    if (entry >= exit) return false;
+
+    front = origin + ray * entry;
+    step = normalize(origin + ray * exit - front) * parameters.stepSize;
+
+    return true;
+}
+
+float CpuRaycaster::View::jitter(int x, int y) const
+{
+    const std::vector<float>& noise = raycaster.noise;
+
+    return noise.empty() ? 0.0f : noise[(y % NoiseSize) * NoiseSize + x % NoiseSize];
+}
+
+template <typename Sampler>
+float CpuRaycaster::View::density(Sampler& sampler, const vec3& pos) const
+{
+    return sampler.sampleTexture(pos) * parameters.valueMapping.x + parameters.valueMapping.y;
+}
+
+vec2 CpuRaycaster::View::fetchEncoded(const ivec3& voxel) const
+{
+    const ivec3& dimensions = raycaster.dimensions;
+
+    if (any(lessThan(voxel, ivec3(0))) || any(greaterThanEqual(voxel, dimensions))) return vec2(0);
+
+    const size_t index = (static_cast<size_t>(voxel.z) * dimensions.y + voxel.y) * dimensions.x + voxel.x;
+
+    if (raycaster.gradientEncoding == GradientEngine::Encoding::Octahedral)
+    {
+        const int8_t* encoded = reinterpret_cast<const int8_t*>(raycaster.gradients) + index * 2;
+        // snorm, -128 clamps to -1
+        return max(vec2(encoded[0], encoded[1]) / 127.0f, vec2(-1));
+    }
+
+    const uint16_t* encoded = reinterpret_cast<const uint16_t*>(raycaster.gradients) + index * 2;
+
+    return vec2(halves[encoded[0]], halves[encoded[1]]);
+}
+
+template <typename Sampler>
+vec3 CpuRaycaster::View::sampleNormal(Sampler& sampler, const vec3& pos, float value) const
+{
+    if (gradientMode == GradientMode::Precomputed)
+    {
+        // encodings are interpolated before decoding, like the texture lookup
+        const vec3 position = pos * vec3(raycaster.dimensions) - 0.5f;
+        const vec3 base = floor(position);
+        const vec3 t = position - base;
+        const ivec3 p = ivec3(base);
+        const vec2 x00 = mix(fetchEncoded(p), fetchEncoded(p + ivec3(1, 0, 0)), t.x);
+        const vec2 x10 = mix(fetchEncoded(p + ivec3(0, 1, 0)), fetchEncoded(p + ivec3(1, 1, 0)), t.x);
+        const vec2 x01 = mix(fetchEncoded(p + ivec3(0, 0, 1)), fetchEncoded(p + ivec3(1, 0, 1)), t.x);
+        const vec2 x11 = mix(fetchEncoded(p + ivec3(0, 1, 1)), fetchEncoded(p + ivec3(1, 1, 1)), t.x);
+        const vec2 encoded = mix(mix(x00, x10, t.y), mix(x01, x11, t.y), t.z);
+
+        return raycaster.gradientEncoding == GradientEngine::Encoding::Octahedral ? decodeOctahedral(encoded) :
+                                                                                     decodeSpheremap(encoded);
+    }
+
+    vec3 gradient;
+
+    if (gradientMode == GradientMode::Central)
+    {
+        gradient = vec3(density(sampler, pos + vec3(texel.x, 0, 0)) - density(sampler, pos - vec3(texel.x, 0, 0)),
+                        density(sampler, pos + vec3(0, texel.y, 0)) - density(sampler, pos - vec3(0, texel.y, 0)),
+                        density(sampler, pos + vec3(0, 0, texel.z)) - density(sampler, pos - vec3(0, 0, texel.z)));
+    }
+    else
+    {
+        gradient = vec3(density(sampler, pos + vec3(texel.x, 0, 0)), density(sampler, pos + vec3(0, texel.y, 0)),
+                        density(sampler, pos + vec3(0, 0, texel.z))) - value;
+    }
+
+    const float magnitude = length(gradient);
+
+    return magnitude > 0 ? gradient / magnitude : vec3(0, 0, 1);
+}
+
+vec4 CpuRaycaster::View::colorLookup(float value) const
+{
+    const std::array<vec4, 256>& colorMapping = raycaster.colorMapping;
+    float t;
+    const int i = texelCoordinate(value, 256, t);
+
+    return mix(colorMapping[clamp(i, 0, 255)], colorMapping[clamp(i + 1, 0, 255)], t);
+}
+
+vec4 CpuRaycaster::View::segmentLookup(float back, float front) const
+{
+    const std::vector<vec4>& table = raycaster.preintegrated;
+    vec2 t;
+    const ivec2 i(texelCoordinate(back, 256, t.x), texelCoordinate(front, 256, t.y));
+    const int x0 = clamp(i.x, 0, 255);
+    const int x1 = clamp(i.x + 1, 0, 255);
+    const int y0 = clamp(i.y, 0, 255) * 256;
+    const int y1 = clamp(i.y + 1, 0, 255) * 256;
+
+    return mix(mix(table[y0 + x0], table[y0 + x1], t.x), mix(table[y1 + x0], table[y1 + x1], t.x), t.y);
+}
+
+vec4 CpuRaycaster::View::styleLookup(const vec2& uv, int layer) const
+{
+    if (raycaster.styleCount == 0) return vec4(1);
+
+    const uint8_t* image = raycaster.styles.data() + static_cast<size_t>(clamp(layer, 0, raycaster.styleCount - 1)) *
+                                                     StyleSize * StyleSize * 4;
+    vec2 t;
+    const ivec2 i(texelCoordinate(uv.x, StyleSize, t.x), texelCoordinate(uv.y, StyleSize, t.y));
+    vec4 texels[4];
+
+    for (int k = 0; k < 4; k++)
+    {
+        const int x = clamp(i.x + (k & 1), 0, StyleSize - 1);
+        const int y = clamp(i.y + (k >> 1), 0, StyleSize - 1);
+        const uint8_t* texel = image + (static_cast<size_t>(y) * StyleSize + x) * 4;
+        texels[k] = vec4(texel[0], texel[1], texel[2], texel[3]) / 255.0f;
+    }
+
+    return mix(mix(texels[0], texels[1], t.x), mix(texels[2], texels[3], t.x), t.y);
+}
+
+vec4 CpuRaycaster::View::styleMapping(const vec3& eye, const vec3& normal, float value) const
+{
+    const std::vector<vec2>& transferFunction = raycaster.transferFunction;
+    const std::vector<int>& indexFunction = raycaster.indexFunction;
+
+    if (transferFunction.empty()) return vec4(1);
+
+    // the style position is repeated outside [0..1]
+    float t;
+    const int size = static_cast<int>(transferFunction.size());
+    const int i = texelCoordinate(value, size, t);
+    const float index = mix(transferFunction[(i % size + size) % size].x,
+                            transferFunction[((i + 1) % size + size) % size].x, t);
+
+    const int index0 = static_cast<int>(std::floor(index));
+    const int index1 = index0 + 1;
+    const float weight = index - index0;
+
+    // positions past the index function have no style
+    auto styleAt = [&](int position)
+    {
+        return position >= 0 && position < static_cast<int>(indexFunction.size()) ? indexFunction[position] : -1;
+    };
+
+    const int styleIndex0 = styleAt(index0);
+    const int styleIndex1 = styleAt(index1);
+
+    if (styleIndex0 < 0 && styleIndex1 < 0) return vec4(1);
+
+    const vec2 uv = litsphere(eye, normal);
+
+    if (styleIndex0 < 0) return styleLookup(uv, styleIndex1);
+    if (styleIndex1 < 0) return styleLookup(uv, styleIndex0);
+
+    return mix(styleLookup(uv, styleIndex0), styleLookup(uv, styleIndex1), weight);
+}
+
+vec4 CpuRaycaster::View::shade(const vec3& pos, float value, const vec3& normal, vec4 src, float extinction) const
+{
+    // style transfer, view space calculation
+    const vec3 eye = vec3(normalize(modelView * vec4(pos, 1)));
+    const vec3 vsNormal = normalize(normalMatrix * normal);
+    src *= styleMapping(eye, vsNormal, value);
+
+    // opacity correction, pre-integrated segments hold their mean extinction per half voxel
+    src.w = preintegrated ? src.w * (1 - std::exp(-extinction * parameters.stepScale / 0.5f)) :
+                            1 - std::pow(1 - src.w, parameters.stepScale / 0.5f);
+
+    // no ambient occlusion, it comes from the previous GPU frame
+    if (parameters.diffuseShading)
+    {
+        const vec3 wsNormal = normalize(modelInverseTranspose * normal);
+        const float lambert = std::max(dot(wsNormal, lightDirection), 0.0f);
+        const vec3 diffuse = parameters.light.diffuse * lambert * vec3(src);
+        const vec3 ambient = parameters.light.ambient * vec3(src);
+        src = vec4(ambient + diffuse, src.w);
+    }
+
+    return src;
+}
+
+void CpuRaycaster::View::store(int x, int y, const vec4& color, const vec3& normal, const vec3& pos)
+{
+    // normal and position in view space
+    const size_t pixel = static_cast<size_t>(y) * frame.size.x + x;
+    frame.color[pixel] = color;
+    frame.normal[pixel] = normalMatrix * normal;
+    frame.position[pixel] = vec3(modelView * vec4(pos, 1));
+}
+
+template <typename Sampler>
+void CpuRaycaster::View::traceTile(Sampler& sampler, const TileScheduler::Tile& tile)
+{
+    const ivec2 first = tile.offset;
+    const ivec2 last = tile.offset + tile.size;
+    size_t tileRays = 0;
+    size_t tileSamples = 0;
+
+    for (int y = first.y; y < last.y; y++)
+    {
+        for (int x = first.x; x < last.x; x++)
+        {
+            vec3 front, step;
+
+            if (!findRay(x, y, front, step)) continue;
+
+            tileRays++;
+
+            // jitter ray starting position to reduce artifacts
+            vec3 pos = front + step * jitter(x, y);
+            vec4 dst(0);
+            vec3 normal(0);
+            float previous = 0;
+            bool restart = true;
+
+            for (int i = 0; i < parameters.iterations; i++)
+            {
+                const float value = density(sampler, pos);
+                tileSamples++;
+
+                // transfer function integrated over the segment from the previous sample
+                vec4 segment(0);
+
+                if (preintegrated)
+                {
+                    segment = segmentLookup(value, restart ? value : previous);
+                    previous = value;
+                    restart = false;
+                }
+
+                if (preintegrated ? segment.w > 0 : value >= threshold.x && value <= threshold.y)
+                {
+                    normal = sampleNormal(sampler, pos, value);
+                    vec4 src = shade(pos, value, normal, preintegrated ? vec4(vec3(segment), 1) : colorLookup(value),
+                                     segment.w);
+
+                    // front to back blending
+                    src = vec4(vec3(src) * src.w, src.w);
+                    dst = (1 - dst.w) * src + dst;
+
+                    if (dst.w >= OpacityCutoff) break;
+                }
+
+                pos += step;
+
+                // out of bounds
+                if (pos.x > 1 || pos.y > 1 || pos.z > 1) break;
+            }
+
+            store(x, y, dst, normal, pos);
+        }
+    }
+
+    rays += tileRays;
+    samples += tileSamples;
+}
+
+TARGET_AVX2 __m256 CpuRaycaster::View::densityAvx2(__m256 x, __m256 y, __m256 z) const
+{
+    const ivec3& dimensions = raycaster.dimensions;
+    const int total = dimensions.x * dimensions.y * dimensions.z;
+    const __m256i one = _mm256_set1_epi32(1);
+    const __m256i byte = _mm256_set1_epi32(0xff);
+    __m256 t[3];
+    __m256i p[3];
+    const __m256 coordinates[3] = { x, y, z };
+
+    // voxel coordinates like VolumeSampler::sampleTexture
+    for (int axis = 0; axis < 3; axis++)
+    {
+        const __m256 position = _mm256_sub_ps(_mm256_mul_ps(coordinates[axis],
+                                                            _mm256_set1_ps(static_cast<float>(dimensions[axis]))),
+                                              _mm256_set1_ps(0.5f));
+        const __m256 base = _mm256_floor_ps(position);
+        t[axis] = _mm256_sub_ps(position, base);
+        p[axis] = _mm256_cvttps_epi32(base);
+    }
+
+    // a voxel and its x neighbour are read with a single 32 bit gather, voxels outside are zero
+    const __m256i x0 = p[0];
+    const __m256i x0Inside = _mm256_andnot_si256(_mm256_cmpgt_epi32(_mm256_setzero_si256(), x0),
+                                                 _mm256_cmpgt_epi32(_mm256_set1_epi32(dimensions.x), x0));
+    const __m256i x1 = _mm256_add_epi32(x0, one);
+    const __m256i x1Inside = _mm256_andnot_si256(_mm256_cmpgt_epi32(_mm256_setzero_si256(), x1),
+                                                 _mm256_cmpgt_epi32(_mm256_set1_epi32(dimensions.x), x1));
+    // left of the volume the pair starts at its first voxel
+    const __m256i leftEdge = _mm256_cmpeq_epi32(x0, _mm256_set1_epi32(-1));
+    __m256 rows[4];
+
+    for (int row = 0; row < 4; row++)
+    {
+        const __m256i y = _mm256_add_epi32(p[1], _mm256_set1_epi32(row & 1));
+        const __m256i z = _mm256_add_epi32(p[2], _mm256_set1_epi32(row >> 1));
+        const __m256i rowInside = _mm256_and_si256(
+            _mm256_andnot_si256(_mm256_cmpgt_epi32(_mm256_setzero_si256(), y),
+                                _mm256_cmpgt_epi32(_mm256_set1_epi32(dimensions.y), y)),
+            _mm256_andnot_si256(_mm256_cmpgt_epi32(_mm256_setzero_si256(), z),
+                                _mm256_cmpgt_epi32(_mm256_set1_epi32(dimensions.z), z)));
+        const __m256i mask = _mm256_and_si256(rowInside, _mm256_or_si256(x0Inside, x1Inside));
+
+        // the last voxels are read from a word ending at the volume end, shifted down
+        const __m256i rowStart = _mm256_mullo_epi32(_mm256_add_epi32(_mm256_mullo_epi32(z,
+                                                    _mm256_set1_epi32(dimensions.y)), y),
+                                                    _mm256_set1_epi32(dimensions.x));
+        const __m256i index = _mm256_add_epi32(_mm256_add_epi32(rowStart, x0), _mm256_and_si256(leftEdge, one));
+        const __m256i clamped = _mm256_min_epi32(index, _mm256_set1_epi32(total - 4));
+        const __m256i shift = _mm256_slli_epi32(_mm256_sub_epi32(index, clamped), 3);
+        const __m256i words = _mm256_srlv_epi32(
+            _mm256_mask_i32gather_epi32(_mm256_setzero_si256(), reinterpret_cast<const int*>(raycaster.voxels),
+                                        _mm256_and_si256(clamped, mask), mask, 1), shift);
+
+        const __m256i first = _mm256_and_si256(_mm256_and_si256(words, byte), x0Inside);
+        const __m256i second = _mm256_and_si256(_mm256_blendv_epi8(_mm256_and_si256(_mm256_srli_epi32(words, 8), byte),
+                                                                   _mm256_and_si256(words, byte), leftEdge),
+                                                x1Inside);
+
+        // normalized like the 8 bit texture
+        const __m256 scale = _mm256_set1_ps(255.0f);
+        rows[row] = mixAvx2(_mm256_div_ps(_mm256_cvtepi32_ps(first), scale),
+                            _mm256_div_ps(_mm256_cvtepi32_ps(second), scale), t[0]);
+    }
+
+    const __m256 value = mixAvx2(mixAvx2(rows[0], rows[1], t[1]), mixAvx2(rows[2], rows[3], t[1]), t[2]);
+
+    return _mm256_add_ps(_mm256_mul_ps(value, _mm256_set1_ps(parameters.valueMapping.x)),
+                         _mm256_set1_ps(parameters.valueMapping.y));
+}
+
+TARGET_AVX2 void CpuRaycaster::View::tracePackets(const TileScheduler::Tile& tile)
+{
+    const VolumeSampler<uint8_t> sampler(raycaster.voxels, raycaster.dimensions);
+    const float* colorMapping = &raycaster.colorMapping[0].x;
+    const float* table = preintegrated ? &raycaster.preintegrated[0].x : nullptr;
+    const ivec2 first = tile.offset;
+    const ivec2 last = tile.offset + tile.size;
+    const __m256 one = _mm256_set1_ps(1);
+    const __m256 zero = _mm256_setzero_ps();
+    size_t tileRays = 0;
+    size_t tileSamples = 0;
+
+    // lanes of a packet, spilled for the work done one lane at a time
+    alignas(32) float laneX[PacketSize], laneY[PacketSize], laneZ[PacketSize], laneValue[PacketSize];
+    alignas(32) float laneSrc[4][PacketSize], laneExtinction[PacketSize];
+
+    for (int py = first.y; py < last.y; py += 2)
+    {
+        for (int px = first.x; px < last.x; px += 4)
+        {
+            alignas(32) float position[3][PacketSize], step[3][PacketSize];
+            int active = 0;
+
+            // 4 x 2 pixels, lanes outside the image or missing the volume start inactive
+            for (int lane = 0; lane < PacketSize; lane++)
+            {
+                const int x = px + (lane & 3);
+                const int y = py + (lane >> 2);
+                vec3 front(0), direction(0);
+
+                if (x < last.x && y < last.y && findRay(x, y, front, direction))
+                {
+                    active |= 1 << lane;
+                    front += direction * jitter(x, y);
+                }
+
+                for (int axis = 0; axis < 3; axis++)
+                {
+                    position[axis][lane] = front[axis];
+                    step[axis][lane] = direction[axis];
+                }
+            }
+
+            if (!active) continue;
+
+            const int hits = active;
+            tileRays += countLanes(active);
+
+            __m256 pos[3], stepSize[3];
+
+            for (int axis = 0; axis < 3; axis++)
+            {
+                pos[axis] = _mm256_load_ps(position[axis]);
+                stepSize[axis] = _mm256_load_ps(step[axis]);
+            }
+
+            __m256 dst[4] = { zero, zero, zero, zero };
+            __m256 previous = zero;
+            // position and value of the last visible sample, its normal is the one stored
+            __m256 lastPos[3] = { zero, zero, zero };
+            __m256 lastValue = zero;
+            int lastVisible = 0;
+            bool restart = true;
+
+            for (int i = 0; i < parameters.iterations && active; i++)
+            {
+                const __m256 activeMask = laneMask(active);
+                const __m256 value = densityAvx2(pos[0], pos[1], pos[2]);
+                tileSamples += countLanes(active);
+
+                __m256 src[4];
+                __m256 extinction = zero;
+                __m256 visible;
+
+                if (preintegrated)
+                {
+                    // texture(preintegratedFunction, vec2(back, front))
+                    const __m256 front = restart ? value : previous;
+                    previous = value;
+                    restart = false;
+                    __m256 tx, ty;
+                    const __m256i x = texelCoordinateAvx2(value, 256, tx);
+                    const __m256i y = texelCoordinateAvx2(front, 256, ty);
+                    const __m256i x0 = clampEntries(x, 255);
+                    const __m256i x1 = clampEntries(_mm256_add_epi32(x, _mm256_set1_epi32(1)), 255);
+                    const __m256i y0 = _mm256_slli_epi32(clampEntries(y, 255), 8);
+                    const __m256i y1 = _mm256_slli_epi32(clampEntries(_mm256_add_epi32(y, _mm256_set1_epi32(1)),
+                                                                      255), 8);
+
+                    for (int c = 0; c < 4; c++)
+                    {
+                        const __m256 top = mixAvx2(gatherChannel(table, _mm256_add_epi32(y0, x0), c),
+                                                   gatherChannel(table, _mm256_add_epi32(y0, x1), c), tx);
+                        const __m256 bottom = mixAvx2(gatherChannel(table, _mm256_add_epi32(y1, x0), c),
+                                                      gatherChannel(table, _mm256_add_epi32(y1, x1), c), tx);
+                        src[c] = mixAvx2(top, bottom, ty);
+                    }
+
+                    extinction = src[3];
+                    src[3] = one;
+                    visible = _mm256_cmp_ps(extinction, zero, _CMP_GT_OQ);
+                }
+                else
+                {
+                    // texture(colorMappingFunction, value)
+                    __m256 t;
+                    const __m256i entry = texelCoordinateAvx2(value, 256, t);
+                    const __m256i entry0 = clampEntries(entry, 255);
+                    const __m256i entry1 = clampEntries(_mm256_add_epi32(entry, _mm256_set1_epi32(1)), 255);
+
+                    for (int c = 0; c < 4; c++)
+                    {
+                        src[c] = mixAvx2(gatherChannel(colorMapping, entry0, c),
+                                         gatherChannel(colorMapping, entry1, c), t);
+                    }
+
+                    visible = _mm256_and_ps(_mm256_cmp_ps(value, _mm256_set1_ps(threshold.x), _CMP_GE_OQ),
+                                            _mm256_cmp_ps(value, _mm256_set1_ps(threshold.y), _CMP_LE_OQ));
+                }
+
+                visible = _mm256_and_ps(visible, activeMask);
+                const int visibleLanes = _mm256_movemask_ps(visible);
+
+                if (visibleLanes)
+                {
+                    lastVisible |= visibleLanes;
+
+                    for (int axis = 0; axis < 3; axis++)
+                    {
+                        lastPos[axis] = _mm256_blendv_ps(lastPos[axis], pos[axis], visible);
+                    }
+
+                    lastValue = _mm256_blendv_ps(lastValue, value, visible);
+
+                    // transparent samples leave the composited color as it is, only the others are shaded
+                    const __m256 contributing = _mm256_and_ps(visible, _mm256_cmp_ps(src[3], zero, _CMP_GT_OQ));
+                    const int contributingLanes = _mm256_movemask_ps(contributing);
+
+                    if (contributingLanes)
+                    {
+                        _mm256_store_ps(laneX, pos[0]);
+                        _mm256_store_ps(laneY, pos[1]);
+                        _mm256_store_ps(laneZ, pos[2]);
+                        _mm256_store_ps(laneValue, value);
+                        _mm256_store_ps(laneExtinction, extinction);
+
+                        for (int c = 0; c < 4; c++) { _mm256_store_ps(laneSrc[c], src[c]); }
+
+                        for (int lane = 0; lane < PacketSize; lane++)
+                        {
+                            if (!(contributingLanes & 1 << lane)) continue;
+
+                            const vec3 lanePos(laneX[lane], laneY[lane], laneZ[lane]);
+                            const vec3 normal = shadingNormals ? sampleNormal(sampler, lanePos, laneValue[lane]) :
+                                                                 vec3(0, 0, 1);
+                            const vec4 shaded = shade(lanePos, laneValue[lane], normal,
+                                                      vec4(laneSrc[0][lane], laneSrc[1][lane], laneSrc[2][lane],
+                                                           laneSrc[3][lane]), laneExtinction[lane]);
+
+                            for (int c = 0; c < 4; c++) { laneSrc[c][lane] = shaded[c]; }
+                        }
+
+                        // front to back blending of the contributing lanes
+                        const __m256 alpha = _mm256_and_ps(_mm256_load_ps(laneSrc[3]), contributing);
+                        const __m256 transmittance = _mm256_sub_ps(one, dst[3]);
+
+                        for (int c = 0; c < 3; c++)
+                        {
+                            const __m256 premultiplied = _mm256_mul_ps(_mm256_load_ps(laneSrc[c]), alpha);
+                            dst[c] = _mm256_add_ps(_mm256_mul_ps(transmittance,
+                                                                 _mm256_and_ps(premultiplied, contributing)), dst[c]);
+                        }
+
+                        dst[3] = _mm256_add_ps(_mm256_mul_ps(transmittance, alpha), dst[3]);
+
+                        // rays past the cutoff stop where they are
+                        const __m256 opaque = _mm256_and_ps(contributing, _mm256_cmp_ps(dst[3],
+                                                            _mm256_set1_ps(OpacityCutoff), _CMP_GE_OQ));
+                        active &= ~_mm256_movemask_ps(opaque);
+                    }
+                }
+
+                const __m256 moving = laneMask(active);
+                __m256 outside = zero;
+
+                for (int axis = 0; axis < 3; axis++)
+                {
+                    pos[axis] = _mm256_add_ps(pos[axis], _mm256_and_ps(stepSize[axis], moving));
+                    outside = _mm256_or_ps(outside, _mm256_cmp_ps(pos[axis], one, _CMP_GT_OQ));
+                }
+
+                // out of bounds
+                active &= ~_mm256_movemask_ps(_mm256_and_ps(outside, moving));
+            }
+
+            alignas(32) float color[4][PacketSize];
+
+            for (int c = 0; c < 4; c++) { _mm256_store_ps(color[c], dst[c]); }
+            for (int axis = 0; axis < 3; axis++) { _mm256_store_ps(position[axis], pos[axis]); }
+
+            _mm256_store_ps(laneX, lastPos[0]);
+            _mm256_store_ps(laneY, lastPos[1]);
+            _mm256_store_ps(laneZ, lastPos[2]);
+            _mm256_store_ps(laneValue, lastValue);
+
+            for (int lane = 0; lane < PacketSize; lane++)
+            {
+                if (!(hits & 1 << lane)) continue;
+
+                // normal of the last visible sample, taken once per ray
+                const vec3 lastVisiblePos(laneX[lane], laneY[lane], laneZ[lane]);
+                const vec3 normal = lastVisible & 1 << lane ? sampleNormal(sampler, lastVisiblePos, laneValue[lane]) :
+                                                              vec3(0);
+                store(px + (lane & 3), py + (lane >> 2),
+                      vec4(color[0][lane], color[1][lane], color[2][lane], color[3][lane]), normal,
+                      vec3(position[0][lane], position[1][lane], position[2][lane]));
+            }
+        }
+    }
+
+    rays += tileRays;
+    samples += tileSamples;
+}
+
+CpuRaycaster::Parameters::Parameters() : model(1), view(1), projection(1), threshold(0, 255), valueMapping(1, 0),
+                                         stepSize(1.0f / 256), stepScale(1), iterations(512),
+                                         gradientMode(GradientMode::Precomputed), preintegrated(false),
+                                         diffuseShading(true) {}
+
+CpuRaycaster::Frame::Frame() : size(0), rays(0), samples(0), seconds(0), packets(false) {}
+
+double CpuRaycaster::Frame::getRaysPerSecond() const
+{
+    return seconds > 0 ? rays / seconds : 0;
+}
+
+CpuRaycaster::CpuRaycaster() : voxels(nullptr), voxelType(VoxelType::UInt8), dimensions(0), gradients(nullptr),
+                               gradientEncoding(GradientEngine::Encoding::Spheremap), styleCount(0),
+                               packetTraversal(true), scheduler(TileSize, MinTileSize)
+{
+    colorMapping.fill(vec4(0));
+}
+
+void CpuRaycaster::setVolume(const uint8_t* voxels, VoxelType type, const ivec3& dimensions)
+{
+    this->voxels = voxels;
+    this->voxelType = type;
+    this->dimensions = dimensions;
+    bricks = nullptr;
+}
+
+void CpuRaycaster::setVolume(const std::shared_ptr<BrickCache>& cache)
+{
+    bricks = cache;
+    voxels = nullptr;
+
+    if (!cache) return;
+
+    voxelType = cache->getSource().getVoxelType();
+    dimensions = cache->getSource().getDimensions();
+}
+
+void CpuRaycaster::setGradients(const uint8_t* encoded, GradientEngine::Encoding encoding)
+{
+    gradients = encoded;
+    gradientEncoding = encoding;
+}
+
+void CpuRaycaster::setTransferFunction(const std::array<vec4, 256>& colorMapping,
+                                       const std::vector<vec4>& preintegrated)
+{
+    this->colorMapping = colorMapping;
+    this->preintegrated = preintegrated;
+}
+
+void CpuRaycaster::setStyleFunction(const std::vector<vec2>& transferFunction, const std::vector<int>& indexFunction,
+                                    const std::vector<const uint8_t*>& styles)
+{
+    const size_t styleBytes = static_cast<size_t>(StyleSize) * StyleSize * 4;
+    this->transferFunction = transferFunction;
+    this->indexFunction = indexFunction;
+    this->styles.resize(styles.size() * styleBytes);
+    styleCount = static_cast<int>(styles.size());
+
+    for (size_t i = 0; i < styles.size(); i++)
+    {
+        memcpy(this->styles.data() + i * styleBytes, styles[i], styleBytes);
+    }
+}
+
+void CpuRaycaster::setNoise(const std::vector<float>& noise)
+{
+    this->noise = noise.size() == static_cast<size_t>(NoiseSize) * NoiseSize ? noise : std::vector<float>();
+}
+
+void CpuRaycaster::setNoise(const ci::Surface8u& image)
+{
+    std::vector<float> noise;
+
+    // loaded images start at their bottom row
+    for (int y = image.getHeight() - 1; y >= 0; y--)
+    {
+        for (int x = 0; x < image.getWidth(); x++)
+        {
+            noise.push_back(image.getPixel(ivec2(x, y)).r / 255.0f);
+        }
+    }
+
+    setNoise(noise);
+}
+
+bool CpuRaycaster::isPacketTraversal() const
+{
+    return packetTraversal;
+}
+
+void CpuRaycaster::setPacketTraversal(bool value)
+{
+    packetTraversal = value;
+}
+
+void CpuRaycaster::render(const Parameters& parameters, const ivec2& size)
+{
+    const auto start = std::chrono::steady_clock::now();
+    const size_t pixels = static_cast<size_t>(max(size.x, 0)) * max(size.y, 0);
+
+    frame.size = max(size, ivec2(0));
+    frame.color.assign(pixels, vec4(0));
+    frame.normal.assign(pixels, vec3(0));
+    frame.position.assign(pixels, vec3(0));
+    frame.rays = 0;
+    frame.samples = 0;
+    frame.packets = false;
+    frame.schedule = TileScheduler::Report();
+
+    if ((!voxels && !bricks) || pixels == 0) return;
+
+    View view(*this, parameters, frame);
+    // packets index the volume in memory with 32 bit gathers
+    const size_t voxelCount = static_cast<size_t>(dimensions.x) * dimensions.y * dimensions.z;
+    frame.packets = packetTraversal && voxels && voxelType == VoxelType::UInt8 && CpuFeatures::HasAvx2() &&
+                    voxelCount >= 4 && voxelCount <= static_cast<size_t>(std::numeric_limits<int32_t>::max());
+
+    // rays differ a lot in length, idle threads steal tiles and expensive tiles are split
+    if (frame.packets)
+    {
+        scheduler.run(frame.size, [&](const TileScheduler::Tile& tile) { view.tracePackets(tile); });
+    }
+    else if (bricks)
+    {
+        // the bricks rays enter first are read ahead while the first tiles are traced
+        const mat4 modelView = parameters.view * parameters.model;
+        bricks->prefetchView(parameters.projection * modelView, vec3(inverse(modelView) * vec4(0, 0, 0, 1)));
+
+        DispatchVoxelType(voxelType, [&](auto tag)
+        {
+            using T = std::remove_pointer_t<decltype(tag)>;
+            scheduler.run(frame.size, [&](const TileScheduler::Tile& tile)
+            {
+                BrickSampler<T> sampler(*bricks);
+                view.traceTile(sampler, tile);
+            });
+        });
+    }
+    else
+    {
+        DispatchVoxelType(voxelType, [&](auto tag)
+        {
+            using T = std::remove_pointer_t<decltype(tag)>;
+            const VolumeSampler<T> sampler(reinterpret_cast<const T*>(voxels), dimensions);
+            scheduler.run(frame.size, [&](const TileScheduler::Tile& tile) { view.traceTile(sampler, tile); });
+        });
+    }
+
+    frame.schedule = scheduler.getReport();
+    frame.rays = view.rays;
+    frame.samples = view.samples;
+    frame.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+CpuRaycaster::TraversalBenchmark CpuRaycaster::benchmarkTraversal(const Parameters& parameters, const ivec2& size,
+                                                                  int renders)
+{
+    TraversalBenchmark result = { 0, 0, 0, false };
+    const bool packets = packetTraversal;
+    renders = std::max(renders, 1);
+
+    // single rays first, their image is the reference the packets are compared with
+    packetTraversal = false;
+    double seconds = 0;
+    size_t rays = 0;
+
+    for (int i = 0; i < renders; i++)
+    {
+        render(parameters, size);
+        seconds += frame.seconds;
+        rays += frame.rays;
+    }
+
+    result.scalarRaysPerSecond = seconds > 0 ? rays / seconds : 0;
+    const std::vector<vec4> reference = frame.color;
+
+    packetTraversal = true;
+    seconds = 0;
+    rays = 0;
+
+    for (int i = 0; i < renders; i++)
+    {
+        render(parameters, size);
+        seconds += frame.seconds;
+        rays += frame.rays;
+    }
+
+    result.packets = frame.packets;
+    result.packetRaysPerSecond = seconds > 0 ? rays / seconds : 0;
+
+    for (size_t i = 0; i < reference.size(); i++)
+    {
+        for (int c = 0; c < 4; c++)
+        {
+            result.maxDifference = std::max(result.maxDifference, std::abs(reference[i][c] - frame.color[i][c]));
+        }
+    }
+
+    packetTraversal = packets;
+
+    return result;
+}
+
+const CpuRaycaster::Frame& CpuRaycaster::getFrame() const
+{
+    return frame;
+}
+
+const char* CpuRaycaster::GetKernelName()
+{
+    return CpuFeatures::HasAvx2() ? "AVX2 packets" : "scalar";
+}
@@ -0,0 +1,220 @@
+#pragma once
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include <cinder/CinderGlm.h>
+#include <cinder/Surface.h>
+
+#include "VoxelType.h"
+#include "GradientEngine.h"
+#include "Light.h"
+#include "TileScheduler.h"
+
+class BrickCache;
+
+/**
+ * \brief Reference raycaster running the raycast shader on the CPU, so volumes can be rendered
+ * without a GL context. Rays enter and leave the unit cube of the volume analytically instead of
+ * through the cube face render targets, samples are jittered, styled, corrected and composited
+ * front to back like the shader does until 0.95 opacity. Textures are read like the GL samplers
+ * read them, trilinear with a black border for the volume and gradients. The image is split
+ * into tiles spread across the thread pool threads by a work stealing TileScheduler. On AVX2
+ * processors 8 bit volumes are traced in packets of 4 x 2 neighbouring rays marching together,
+ * sampling and transfer function lookups are vectorized and packets stop once all their rays are
+ * opaque or outside. Volumes larger than host memory are rendered through a BrickCache, whose
+ * bricks in view are prefetched when a render starts
+ */
+class CpuRaycaster
+{
+public:
+    enum class GradientMode
+    {
+        // normals read from the encoded gradients, central differences if there are none
+        Precomputed,
+        // central differences of the six neighbouring voxels
+        Central,
+        // forward differences of three neighbouring voxels and the sample
+        Forward
+    };
+
+    /**
+     * \brief View and raycast settings of a render, the raycast shader uniforms
+     */
+    struct Parameters
+    {
+        // transforms of the unit cube holding the volume
+        glm::mat4 model;
+        glm::mat4 view;
+        glm::mat4 projection;
+        Light light;
+        // window of the visible values in [0..255]
+        glm::ivec2 threshold;
+        // scale and offset mapping volume values to the transfer function domain
+        glm::vec2 valueMapping;
+        // step along each axis of the unit cube, and its length in half voxels for the opacity correction
+        glm::vec3 stepSize;
+        float stepScale;
+        int iterations;
+        GradientMode gradientMode;
+        bool preintegrated;
+        bool diffuseShading;
+
+        Parameters();
+    };
+
+    /**
+     * \brief The raycast render targets, rows from the bottom of the image like GL framebuffers.
+     * Pixels whose ray misses the volume are left zero
+     */
+    struct Frame
+    {
+        glm::ivec2 size;
+        // premultiplied composited color
+        std::vector<glm::vec4> color;
+        // view space normal of the last visible sample
+        std::vector<glm::vec3> normal;
+        // view space position where the ray stopped
+        std::vector<glm::vec3> position;
+        // rays entering the volume and volume samples they took
+        size_t rays;
+        size_t samples;
+        double seconds;
+        // whether the rays were traced in packets
+        bool packets;
+        // how evenly the tiles were spread across the threads
+        TileScheduler::Report schedule;
+
+        Frame();
+        /**
+         * \brief Rays traced per second of the render
+         * \return The ray throughput
+         */
+        double getRaysPerSecond() const;
+    };
+
+    /**
+     * \brief Throughput of single rays and packets rendering the same image
+     */
+    struct TraversalBenchmark
+    {
+        double scalarRaysPerSecond;
+        double packetRaysPerSecond;
+        // largest difference of a color channel between the two images
+        float maxDifference;
+        // false if the packets fell back to single rays, for volumes or processors without them
+        bool packets;
+    };
+
+    CpuRaycaster();
+
+    /**
+     * \brief Sets the volume to render, the voxels aren't copied and have to outlive the renders
+     * \param voxels The volume voxels, tightly packed in x, y, z order
+     * \param type Type of the voxels
+     * \param dimensions The volume dimensions
+     */
+    void setVolume(const uint8_t* voxels, VoxelType type, const glm::ivec3& dimensions);
+    /**
+     * \brief Sets a volume paged through a brick cache instead of voxels in memory, its rays are
+     * traced one at a time. Precomputed gradients have to match the dimensions of the cache's source
+     * \param cache The brick cache, null for no volume
+     */
+    void setVolume(const std::shared_ptr<BrickCache>& cache);
+    /**
+     * \brief Sets the precomputed gradients, they aren't copied and have to outlive the renders
+     * \param encoded Encoded gradients of every voxel as prepared by GradientEngine, null for none
+     * \param encoding Encoding of the gradients
+     */
+    void setGradients(const uint8_t* encoded, GradientEngine::Encoding encoding);
+    /**
+     * \brief Sets the color and opacity of each value
+     * \param colorMapping The indexed transfer function
+     * \param preintegrated Pre-integrated segments in PreintegrationTable layout, empty if unused
+     */
+    void setTransferFunction(const std::array<glm::vec4, 256>& colorMapping,
+                             const std::vector<glm::vec4>& preintegrated);
+    /**
+     * \brief Sets the style transfer function
+     * \param transferFunction Style position in x and opacity in y of the 256 values
+     * \param indexFunction Style of each style position, -1 for none
+     * \param styles Litsphere images of StyleSize x StyleSize RGBA8 pixels, copied
+     */
+    void setStyleFunction(const std::vector<glm::vec2>& transferFunction, const std::vector<int>& indexFunction,
+                          const std::vector<const uint8_t*>& styles);
+    /**
+     * \brief Sets the values jittering the start of the rays
+     * \param noise NoiseSize x NoiseSize values in [0..1], rows in texture order. Empty disables the jitter
+     */
+    void setNoise(const std::vector<float>& noise);
+    /**
+     * \brief Sets the jitter from the red channel of the app's noise texture image
+     * \param image NoiseSize x NoiseSize image, top row first as loaded
+     */
+    void setNoise(const ci::Surface8u& image);
+    bool isPacketTraversal() const;
+    /**
+     * \brief Enables tracing rays in packets when the volume and processor support it, on by default
+     */
+    void setPacketTraversal(bool value);
+
+    /**
+     * \brief Raycasts an image of the volume
+     * \param parameters The view and raycast settings
+     * \param size Image size in pixels
+     */
+    void render(const Parameters& parameters, const glm::ivec2& size);
+    /**
+     * \brief Render targets of the last render
+     * \return The frame
+     */
+    const Frame &getFrame() const;
+    /**
+     * \brief Renders the same image with single rays and with packets, the last packet render is
+     * left as the frame
+     * \param parameters The view and raycast settings
+     * \param size Image size in pixels
+     * \param renders Renders timed with each traversal
+     * \return The throughput of both traversals
+     */
+    TraversalBenchmark benchmarkTraversal(const Parameters& parameters, const glm::ivec2& size, int renders = 3);
+    /**
+     * \brief Name of the traversal render uses for 8 bit volumes on this processor
+     * \return AVX2 packets or scalar
+     */
+    static const char* GetKernelName();
+
+    // litsphere images side
+    static const int StyleSize = 512;
+    // noise texture side, the shader repeats it every NoiseSize pixels
+    static const int NoiseSize = 256;
+    // pixels along each side of the tiles handed to the threads, expensive tiles are split down to
+    // MinTileSize, whole packets
+    static const int TileSize = 32;
+    static const int MinTileSize = 8;
+    // rays of a packet, 4 x 2 pixels
+    static const int PacketSize = 8;
+private:
+    const uint8_t* voxels;
+    // pages the volume in when it isn't in memory
+    std::shared_ptr<BrickCache> bricks;
+    VoxelType voxelType;
+    glm::ivec3 dimensions;
+    const uint8_t* gradients;
+    GradientEngine::Encoding gradientEncoding;
+    std::array<glm::vec4, 256> colorMapping;
+    std::vector<glm::vec4> preintegrated;
+    std::vector<glm::vec2> transferFunction;
+    std::vector<int> indexFunction;
+    // every style image one after the other
+    std::vector<uint8_t> styles;
+    int styleCount;
+    std::vector<float> noise;
+    bool packetTraversal;
+    // keeps the tile costs of the last render to split the expensive ones in the next
+    TileScheduler scheduler;
+    Frame frame;
+
+    // transforms and counters of a render, traces its tiles
+    class View;
+};
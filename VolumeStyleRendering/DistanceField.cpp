@@ -0,0 +1,284 @@
+#include <algorithm>
+#include <memory>
+
+#include "DistanceField.h"
+#include "ThreadPool.h"
+
+using namespace glm;
+
+const int DistanceField::Infinite = 1 << 24;
+
+namespace
+{
+    /**
+     * \brief Chebyshev distance transform along a line of cells holding the distances of the
+     * previous axes, each cell takes the minimum over the line of max(offset, distance). The
+     * search around a cell stops once the offset reaches its best distance
+     * \param values First cell of the line
+     * \param stride Distance between the cells of the line
+     * \param count Number of cells
+     * \param line Scratch room for count values
+     */
+    void transformLine(int* values, size_t stride, int count, int* line)
+    {
+        for (int i = 0; i < count; i++) { line[i] = values[i * stride]; }
+
+        for (int i = 0; i < count; i++)
+        {
+            int best = line[i];
+
+            for (int r = 1; r < best && (i - r >= 0 || i + r < count); r++)
+            {
+                if (i - r >= 0) best = std::min(best, std::max(r, line[i - r]));
+                if (i + r < count) best = std::min(best, std::max(r, line[i + r]));
+            }
+
+            values[i * stride] = best;
+        }
+    }
+
+    int chebyshev(const ivec3& a, const ivec3& b)
+    {
+        const ivec3 offset = abs(a - b);
+
+        return std::max(offset.x, std::max(offset.y, offset.z));
+    }
+}
+
+DistanceField::DistanceField() : size(0), visit(0) {}
+
+void DistanceField::build(const std::vector<uint8_t>& occupancy, const ivec3& size)
+{
+    this->size = size;
+    this->occupancy = occupancy;
+    distances.assign(occupancy.size(), Infinite);
+    visits.assign(occupancy.size(), 0);
+    visit = 0;
+
+    const size_t sliceSize = static_cast<size_t>(size.x) * size.y;
+
+    // distance to the nearest occupied cell of each row, sweeping both ways
+    ThreadPool::instance().parallelFor(0, size.z, [&](int z)
+    {
+        for (int y = 0; y < size.y; y++)
+        {
+            const size_t row = z * sliceSize + static_cast<size_t>(y) * size.x;
+            int distance = Infinite;
+
+            for (int x = 0; x < size.x; x++)
+            {
+                distance = occupancy[row + x] ? 0 : std::min(distance + 1, Infinite);
+                distances[row + x] = distance;
+            }
+
+            distance = Infinite;
+
+            for (int x = size.x - 1; x >= 0; x--)
+            {
+                distance = occupancy[row + x] ? 0 : std::min(distance + 1, Infinite);
+                distances[row + x] = std::min(distances[row + x], distance);
+            }
+        }
+    });
+
+    // the maximum norm is separable, columns and then depth lines extend the row distances
+    ThreadPool::instance().parallelFor(0, size.z, [&](int z)
+    {
+        std::unique_ptr<int[]> line(new int[size.y]);
+
+        for (int x = 0; x < size.x; x++)
+        {
+            transformLine(distances.data() + z * sliceSize + x, size.x, size.y, line.get());
+        }
+    });
+
+    ThreadPool::instance().parallelFor(0, size.y, [&](int y)
+    {
+        std::unique_ptr<int[]> line(new int[size.z]);
+
+        for (int x = 0; x < size.x; x++)
+        {
+            transformLine(distances.data() + static_cast<size_t>(y) * size.x + x, sliceSize, size.z, line.get());
+        }
+    });
+}
+
+size_t DistanceField::update(const std::vector<uint8_t>& occupancy, const ivec3& size)
+{
+    if (size != this->size || occupancy.size() != this->occupancy.size())
+    {
+        build(occupancy, size);
+        return occupancy.size();
+    }
+
+    std::vector<size_t> set;
+    std::vector<size_t> cleared;
+
+    for (size_t i = 0; i < occupancy.size(); i++)
+    {
+        if ((occupancy[i] != 0) == (this->occupancy[i] != 0)) continue;
+
+        if (occupancy[i]) set.push_back(i);
+        else cleared.push_back(i);
+    }
+
+    // the parallel transform is faster for large changes
+    if (set.size() + cleared.size() > occupancy.size() / 8)
+    {
+        build(occupancy, size);
+        return occupancy.size();
+    }
+
+    this->occupancy = occupancy;
+
+    const std::vector<size_t> raised = raise(cleared);
+
+    for (size_t cell : raised) { distances[cell] = Infinite; }
+
+    // new occupied cells and the valid cells around the cleared ones grow back
+    std::vector<size_t> seeds = set;
+
+    for (size_t cell : set) { distances[cell] = 0; }
+
+    for (size_t cell : raised)
+    {
+        const ivec3 p(cell % size.x, (cell / size.x) % size.y, cell / (static_cast<size_t>(size.x) * size.y));
+
+        for (int k = std::max(p.z - 1, 0); k <= std::min(p.z + 1, size.z - 1); k++)
+        {
+            for (int j = std::max(p.y - 1, 0); j <= std::min(p.y + 1, size.y - 1); j++)
+            {
+                for (int i = std::max(p.x - 1, 0); i <= std::min(p.x + 1, size.x - 1); i++)
+                {
+                    const size_t neighbour = cellIndex(ivec3(i, j, k));
+
+                    if (distances[neighbour] < Infinite) seeds.push_back(neighbour);
+                }
+            }
+        }
+    }
+
+    return raised.size() + lower(seeds);
+}
+
+std::vector<size_t> DistanceField::raise(const std::vector<size_t>& cleared)
+{
+    std::vector<size_t> raised;
+    std::vector<size_t> queue;
+
+    for (size_t source : cleared)
+    {
+        if (++visit == 0)
+        {
+            std::fill(visits.begin(), visits.end(), 0);
+            visit = 1;
+        }
+
+        const ivec3 origin(source % size.x, (source / size.x) % size.y, source / (static_cast<size_t>(size.x) * size.y));
+        queue.assign(1, source);
+        visits[source] = visit;
+
+        // cells at exactly their distance from the source may depend on it, every such cell has a
+        // neighbour towards the source that does too, so they are all connected to it
+        for (size_t q = 0; q < queue.size(); q++)
+        {
+            const size_t cell = queue[q];
+            const ivec3 p(cell % size.x, (cell / size.x) % size.y, cell / (static_cast<size_t>(size.x) * size.y));
+            raised.push_back(cell);
+
+            for (int k = std::max(p.z - 1, 0); k <= std::min(p.z + 1, size.z - 1); k++)
+            {
+                for (int j = std::max(p.y - 1, 0); j <= std::min(p.y + 1, size.y - 1); j++)
+                {
+                    for (int i = std::max(p.x - 1, 0); i <= std::min(p.x + 1, size.x - 1); i++)
+                    {
+                        const ivec3 n(i, j, k);
+                        const size_t neighbour = cellIndex(n);
+
+                        if (visits[neighbour] == visit || distances[neighbour] != chebyshev(n, origin)) continue;
+
+                        visits[neighbour] = visit;
+                        queue.push_back(neighbour);
+                    }
+                }
+            }
+        }
+    }
+
+    return raised;
+}
+
+size_t DistanceField::lower(const std::vector<size_t>& seeds)
+{
+    // cells bucketed by distance, stale entries are skipped
+    std::vector<std::vector<size_t>> buckets;
+    size_t lowered = 0;
+
+    for (size_t seed : seeds)
+    {
+        const int distance = distances[seed];
+
+        if (buckets.size() <= static_cast<size_t>(distance)) buckets.resize(distance + 1);
+
+        buckets[distance].push_back(seed);
+    }
+
+    for (size_t distance = 0; distance < buckets.size(); distance++)
+    {
+        for (size_t b = 0; b < buckets[distance].size(); b++)
+        {
+            const size_t cell = buckets[distance][b];
+
+            if (distances[cell] != static_cast<int>(distance)) continue;
+
+            const ivec3 p(cell % size.x, (cell / size.x) % size.y, cell / (static_cast<size_t>(size.x) * size.y));
+            const int next = static_cast<int>(distance) + 1;
+
+            for (int k = std::max(p.z - 1, 0); k <= std::min(p.z + 1, size.z - 1); k++)
+            {
+                for (int j = std::max(p.y - 1, 0); j <= std::min(p.y + 1, size.y - 1); j++)
+                {
+                    for (int i = std::max(p.x - 1, 0); i <= std::min(p.x + 1, size.x - 1); i++)
+                    {
+                        const size_t neighbour = cellIndex(ivec3(i, j, k));
+
+                        if (distances[neighbour] <= next) continue;
+
+                        distances[neighbour] = next;
+
+                        if (buckets.size() <= static_cast<size_t>(next)) buckets.resize(next + 1);
+
+                        buckets[next].push_back(neighbour);
+                        lowered++;
+                    }
+                }
+            }
+        }
+    }
+
+    return lowered;
+}
+
+int DistanceField::getDistance(const ivec3& cell) const
+{
+    return distances[cellIndex(cell)];
+}
+
+std::vector<uint8_t> DistanceField::getDistanceBytes() const
+{
+    std::vector<uint8_t> bytes(distances.size());
+
+    for (size_t i = 0; i < bytes.size(); i++) { bytes[i] = static_cast<uint8_t>(std::min(distances[i], 255)); }
+
+    return bytes;
+}
+
+const ivec3& DistanceField::getSize() const
+{
+    return size;
+}
+
+size_t DistanceField::cellIndex(const ivec3& cell) const
+{
+    return (static_cast<size_t>(cell.z) * size.y + cell.y) * size.x + cell.x;
+}
@@ -0,0 +1,69 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+#include <cinder/CinderGlm.h>
+
+/**
+ * \brief Chebyshev distance from every cell of a grid to its nearest occupied cell. All cells
+ * closer to an empty cell than its distance are empty too, so rays can leap over the cube
+ * around it. The full transform runs as three separable passes split between the thread pool
+ * threads, occupancy changes only revisit the cells around the cells that flipped
+ */
+class DistanceField
+{
+public:
+    DistanceField();
+
+    /**
+     * \brief Computes the distances of every cell
+     * \param occupancy One byte per cell in x, y, z order, non zero for occupied cells
+     * \param size Number of cells along each axis
+     */
+    void build(const std::vector<uint8_t>& occupancy, const glm::ivec3& size);
+    /**
+     * \brief Updates the distances for a new occupancy of the same grid. Cells depending on
+     * cells that became empty are cleared and the distances around the remaining and newly
+     * occupied cells grow back into them. Large changes or a new grid rebuild the field
+     * \param occupancy One byte per cell in x, y, z order, non zero for occupied cells
+     * \param size Number of cells along each axis
+     * \return Number of cells whose distance was recomputed
+     */
+    size_t update(const std::vector<uint8_t>& occupancy, const glm::ivec3& size);
+
+    /**
+     * \brief Distance of a cell, cells of a grid without occupied cells are infinitely far
+     * \param cell Cell coordinates
+     * \return The Chebyshev distance in cells
+     */
+    int getDistance(const glm::ivec3& cell) const;
+    /**
+     * \brief One byte per cell in x, y, z order, distances beyond 255 are stored as 255
+     * \return The clamped distances for a texture upload
+     */
+    std::vector<uint8_t> getDistanceBytes() const;
+    const glm::ivec3 &getSize() const;
+
+    // distance of cells without any occupied cell in the grid
+    static const int Infinite;
+private:
+    glm::ivec3 size;
+    std::vector<uint8_t> occupancy;
+    std::vector<int> distances;
+    // cells visited by the current search, stamped so they don't need clearing
+    std::vector<uint32_t> visits;
+    uint32_t visit;
+
+    size_t cellIndex(const glm::ivec3& cell) const;
+    /**
+     * \brief Clears the cells whose distance came from cells that became empty
+     * \param cleared Cells that became empty
+     * \return The cleared cells
+     */
+    std::vector<size_t> raise(const std::vector<size_t>& cleared);
+    /**
+     * \brief Grows the distances of the seed cells into their neighbours while it shortens them
+     * \param seeds Cells with a valid distance
+     * \return Number of shortened cells
+     */
+    size_t lower(const std::vector<size_t>& seeds);
+};
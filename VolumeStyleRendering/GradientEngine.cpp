@@ -0,0 +1,982 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <memory>
+#include <random>
+#include <emmintrin.h>
+#include <immintrin.h>
+
+#include "GradientEngine.h"
+#include "CpuFeatures.h"
+#include "ThreadPool.h"
+#include "VolumeSampler.h"
+
+#if defined(__GNUC__)
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define TARGET_AVX2
+#endif
+
+using namespace glm;
+
+namespace
+{
+    /**
+     * \brief Seconds elapsed since the given time point
+     */
+    double secondsSince(const std::chrono::steady_clock::time_point& start)
+    {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    /**
+     * \brief Converts a float to the nearest half float, ties to even
+     */
+    uint16_t toHalf(float value)
+    {
+        uint32_t bits;
+        memcpy(&bits, &value, sizeof(bits));
+        const uint16_t sign = static_cast<uint16_t>((bits >> 16) & 0x8000);
+        bits &= 0x7fffffff;
+
+        // infinity and nan
+        if (bits >= 0x7f800000) return sign | 0x7c00 | (bits > 0x7f800000 ? 0x200 : 0);
+        // too large, rounds to infinity
+        if (bits >= 0x47800000) return sign | 0x7c00;
+        // too small, rounds to zero
+        if (bits < 0x33000000) return sign;
+
+        uint32_t half, remainder, halfway;
+
+        if (bits < 0x38800000)
+        {
+            // subnormal half, the implicit bit becomes explicit
+            const uint32_t shift = 126 - (bits >> 23);
+            const uint32_t mantissa = (bits & 0x7fffff) | 0x800000;
+            half = mantissa >> shift;
+            remainder = mantissa & ((1u << shift) - 1);
+            halfway = 1u << (shift - 1);
+        }
+        else
+        {
+            // rebias the exponent, a carry out of the mantissa rounds up to the next exponent
+            half = (bits - 0x38000000) >> 13;
+            remainder = bits & 0x1fff;
+            halfway = 0x1000;
+        }
+
+        if (remainder > halfway || (remainder == halfway && (half & 1))) half++;
+
+        return sign | static_cast<uint16_t>(half);
+    }
+
+    /**
+     * \brief Converts a half float back to a float
+     */
+    float fromHalf(uint16_t half)
+    {
+        const uint32_t sign = static_cast<uint32_t>(half & 0x8000) << 16;
+        const int exponent = half >> 10 & 0x1f;
+        const int mantissa = half & 0x3ff;
+        float value;
+
+        if (exponent == 0) value = std::ldexp(static_cast<float>(mantissa), -24);
+        else if (exponent == 31) value = mantissa ? std::numeric_limits<float>::quiet_NaN() :
+                                                    std::numeric_limits<float>::infinity();
+        else value = std::ldexp(static_cast<float>(mantissa | 0x400), exponent - 25);
+
+        return sign ? -value : value;
+    }
+
+    /**
+     * \brief Spheremap transform of a unit normal, as decoded by the raycast shader
+     */
+    vec2 spheremap(const vec3& n)
+    {
+        const float xyLength = std::sqrt(n.x * n.x + n.y * n.y);
+        const float scale = std::sqrt(n.z * 0.5f + 0.5f);
+
+        return xyLength > 0 ? vec2(n.x, n.y) * (scale / xyLength) : vec2(scale, 0);
+    }
+
+    /**
+     * \brief Inverse spheremap transform, the shader's decode
+     */
+    vec3 inverseSpheremap(const vec2& encoded)
+    {
+        const float z = dot(encoded, encoded) * 2 - 1;
+        const float xyLength = length(encoded);
+        const vec2 xy = xyLength > 0 ? encoded / xyLength * std::sqrt(std::max(1 - z * z, 0.0f)) : vec2(0);
+
+        return vec3(xy.x, xy.y, z);
+    }
+
+    /**
+     * \brief Box filters a single line by sliding the sum of the values inside the footprint, so the
+     * cost per value doesn't depend on the radius. Values are divided by the number of them inside
+     * the volume
+     * \param source The line values
+     * \param destination Receives the filtered values, can't alias source
+     */
+    void filterLine(const float* source, float* destination, int count, int radius)
+    {
+        float sum = 0;
+
+        for (int i = 0; i <= std::min(radius, count - 1); i++) { sum += source[i]; }
+
+        for (int i = 0; i < count; i++)
+        {
+            const int first = std::max(0, i - radius);
+            const int last = std::min(count - 1, i + radius);
+            destination[i] = sum / (last - first + 1);
+
+            if (i + radius + 1 < count) sum += source[i + radius + 1];
+            if (i - radius >= 0) sum -= source[i - radius];
+        }
+    }
+
+    // writes sum * scale to out, then adds the entering and removes the leaving row from sum
+    typedef void (*SlideKernel)(float*, float*, const float*, const float*, float, size_t);
+
+    void slideScalar(float* out, float* sum, const float* entering, const float* leaving, float scale, size_t count)
+    {
+        for (size_t i = 0; i < count; i++)
+        {
+            out[i] = sum[i] * scale;
+            sum[i] += entering[i] - leaving[i];
+        }
+    }
+
+    void slideSse2(float* out, float* sum, const float* entering, const float* leaving, float scale, size_t count)
+    {
+        const __m128 factor = _mm_set1_ps(scale);
+        size_t i = 0;
+
+        for (; i + 4 <= count; i += 4)
+        {
+            const __m128 s = _mm_loadu_ps(sum + i);
+            _mm_storeu_ps(out + i, _mm_mul_ps(s, factor));
+            _mm_storeu_ps(sum + i, _mm_add_ps(s, _mm_sub_ps(_mm_loadu_ps(entering + i), _mm_loadu_ps(leaving + i))));
+        }
+
+        slideScalar(out + i, sum + i, entering + i, leaving + i, scale, count - i);
+    }
+
+    TARGET_AVX2 void slideAvx2(float* out, float* sum, const float* entering, const float* leaving, float scale,
+                               size_t count)
+    {
+        const __m256 factor = _mm256_set1_ps(scale);
+        size_t i = 0;
+
+        for (; i + 8 <= count; i += 8)
+        {
+            const __m256 s = _mm256_loadu_ps(sum + i);
+            _mm256_storeu_ps(out + i, _mm256_mul_ps(s, factor));
+            _mm256_storeu_ps(sum + i, _mm256_add_ps(s, _mm256_sub_ps(_mm256_loadu_ps(entering + i),
+                                                                     _mm256_loadu_ps(leaving + i))));
+        }
+
+        slideScalar(out + i, sum + i, entering + i, leaving + i, scale, count - i);
+    }
+
+    // packs the normals of three component planes into octahedral signed byte pairs
+    typedef void (*EncodeKernel)(const float*, const float*, const float*, int8_t*, size_t);
+    // unpacks octahedral signed byte pairs into unit normals of three component planes
+    typedef void (*DecodeKernel)(const int8_t*, float*, float*, float*, size_t);
+
+    void encodeOctahedralScalar(const float* x, const float* y, const float* z, int8_t* out, size_t count)
+    {
+        for (size_t i = 0; i < count; i++)
+        {
+            const float sum = std::fabs(x[i]) + std::fabs(y[i]) + std::fabs(z[i]);
+            // flat regions have no direction, they encode the center that faces along z
+            const float inverse = sum > 0 ? 1 / sum : 0;
+            float u = x[i] * inverse;
+            float v = y[i] * inverse;
+
+            // the lower hemisphere folds over the diagonals of the square
+            if (z[i] < 0)
+            {
+                const float foldedU = std::copysign(1 - std::fabs(v), u);
+                v = std::copysign(1 - std::fabs(u), v);
+                u = foldedU;
+            }
+
+            out[2 * i] = static_cast<int8_t>(std::nearbyint(u * 127));
+            out[2 * i + 1] = static_cast<int8_t>(std::nearbyint(v * 127));
+        }
+    }
+
+    void decodeOctahedralScalar(const int8_t* in, float* x, float* y, float* z, size_t count)
+    {
+        for (size_t i = 0; i < count; i++)
+        {
+            // snorm conversion, as the texture unit does it
+            float u = std::max(in[2 * i] * (1.0f / 127), -1.0f);
+            float v = std::max(in[2 * i + 1] * (1.0f / 127), -1.0f);
+            const float w = 1 - std::fabs(u) - std::fabs(v);
+            const float fold = std::max(-w, 0.0f);
+            u -= std::copysign(fold, u);
+            v -= std::copysign(fold, v);
+            const float inverse = 1 / std::sqrt(u * u + v * v + w * w);
+            x[i] = u * inverse;
+            y[i] = v * inverse;
+            z[i] = w * inverse;
+        }
+    }
+
+    void encodeOctahedralSse2(const float* x, const float* y, const float* z, int8_t* out, size_t count)
+    {
+        const __m128 signMask = _mm_set1_ps(-0.0f);
+        const __m128 one = _mm_set1_ps(1);
+        const __m128 zero = _mm_setzero_ps();
+        const __m128 scale = _mm_set1_ps(127);
+        size_t i = 0;
+
+        for (; i + 4 <= count; i += 4)
+        {
+            const __m128 vx = _mm_loadu_ps(x + i);
+            const __m128 vy = _mm_loadu_ps(y + i);
+            const __m128 vz = _mm_loadu_ps(z + i);
+            const __m128 sum = _mm_add_ps(_mm_add_ps(_mm_andnot_ps(signMask, vx), _mm_andnot_ps(signMask, vy)),
+                                          _mm_andnot_ps(signMask, vz));
+            const __m128 inverse = _mm_and_ps(_mm_cmpgt_ps(sum, zero), _mm_div_ps(one, sum));
+            const __m128 u = _mm_mul_ps(vx, inverse);
+            const __m128 v = _mm_mul_ps(vy, inverse);
+            const __m128 foldedU = _mm_or_ps(_mm_sub_ps(one, _mm_andnot_ps(signMask, v)), _mm_and_ps(u, signMask));
+            const __m128 foldedV = _mm_or_ps(_mm_sub_ps(one, _mm_andnot_ps(signMask, u)), _mm_and_ps(v, signMask));
+            const __m128 lower = _mm_cmplt_ps(vz, zero);
+            const __m128 eu = _mm_or_ps(_mm_and_ps(lower, foldedU), _mm_andnot_ps(lower, u));
+            const __m128 ev = _mm_or_ps(_mm_and_ps(lower, foldedV), _mm_andnot_ps(lower, v));
+
+            // interleave u and v, then narrow to bytes
+            const __m128i iu = _mm_cvtps_epi32(_mm_mul_ps(eu, scale));
+            const __m128i iv = _mm_cvtps_epi32(_mm_mul_ps(ev, scale));
+            const __m128i words = _mm_packs_epi32(_mm_unpacklo_epi32(iu, iv), _mm_unpackhi_epi32(iu, iv));
+            _mm_storel_epi64(reinterpret_cast<__m128i*>(out + 2 * i), _mm_packs_epi16(words, words));
+        }
+
+        encodeOctahedralScalar(x + i, y + i, z + i, out + 2 * i, count - i);
+    }
+
+    void decodeOctahedralSse2(const int8_t* in, float* x, float* y, float* z, size_t count)
+    {
+        const __m128 signMask = _mm_set1_ps(-0.0f);
+        const __m128 one = _mm_set1_ps(1);
+        const __m128 minimum = _mm_set1_ps(-1);
+        const __m128 zero = _mm_setzero_ps();
+        const __m128 scale = _mm_set1_ps(1.0f / 127);
+        size_t i = 0;
+
+        for (; i + 4 <= count; i += 4)
+        {
+            // sign extend the eight bytes of four normals
+            const __m128i bytes = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(in + 2 * i));
+            const __m128i words = _mm_srai_epi16(_mm_unpacklo_epi8(bytes, bytes), 8);
+            const __m128 low = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(words, words), 16));
+            const __m128 high = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(words, words), 16));
+            __m128 u = _mm_max_ps(_mm_mul_ps(_mm_shuffle_ps(low, high, _MM_SHUFFLE(2, 0, 2, 0)), scale), minimum);
+            __m128 v = _mm_max_ps(_mm_mul_ps(_mm_shuffle_ps(low, high, _MM_SHUFFLE(3, 1, 3, 1)), scale), minimum);
+            const __m128 w = _mm_sub_ps(_mm_sub_ps(one, _mm_andnot_ps(signMask, u)), _mm_andnot_ps(signMask, v));
+            const __m128 fold = _mm_max_ps(_mm_sub_ps(zero, w), zero);
+            u = _mm_sub_ps(u, _mm_or_ps(fold, _mm_and_ps(u, signMask)));
+            v = _mm_sub_ps(v, _mm_or_ps(fold, _mm_and_ps(v, signMask)));
+            const __m128 inverse = _mm_div_ps(one, _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(u, u), _mm_mul_ps(v, v)),
+                                                                          _mm_mul_ps(w, w))));
+            _mm_storeu_ps(x + i, _mm_mul_ps(u, inverse));
+            _mm_storeu_ps(y + i, _mm_mul_ps(v, inverse));
+            _mm_storeu_ps(z + i, _mm_mul_ps(w, inverse));
+        }
+
+        decodeOctahedralScalar(in + 2 * i, x + i, y + i, z + i, count - i);
+    }
+
+    TARGET_AVX2 void encodeOctahedralAvx2(const float* x, const float* y, const float* z, int8_t* out, size_t count)
+    {
+        const __m256 signMask = _mm256_set1_ps(-0.0f);
+        const __m256 one = _mm256_set1_ps(1);
+        const __m256 zero = _mm256_setzero_ps();
+        const __m256 scale = _mm256_set1_ps(127);
+        size_t i = 0;
+
+        for (; i + 8 <= count; i += 8)
+        {
+            const __m256 vx = _mm256_loadu_ps(x + i);
+            const __m256 vy = _mm256_loadu_ps(y + i);
+            const __m256 vz = _mm256_loadu_ps(z + i);
+            const __m256 sum = _mm256_add_ps(_mm256_add_ps(_mm256_andnot_ps(signMask, vx),
+                                                           _mm256_andnot_ps(signMask, vy)),
+                                             _mm256_andnot_ps(signMask, vz));
+            const __m256 inverse = _mm256_and_ps(_mm256_cmp_ps(sum, zero, _CMP_GT_OQ), _mm256_div_ps(one, sum));
+            const __m256 u = _mm256_mul_ps(vx, inverse);
+            const __m256 v = _mm256_mul_ps(vy, inverse);
+            const __m256 foldedU = _mm256_or_ps(_mm256_sub_ps(one, _mm256_andnot_ps(signMask, v)),
+                                                _mm256_and_ps(u, signMask));
+            const __m256 foldedV = _mm256_or_ps(_mm256_sub_ps(one, _mm256_andnot_ps(signMask, u)),
+                                                _mm256_and_ps(v, signMask));
+            const __m256 lower = _mm256_cmp_ps(vz, zero, _CMP_LT_OQ);
+            const __m256 eu = _mm256_blendv_ps(u, foldedU, lower);
+            const __m256 ev = _mm256_blendv_ps(v, foldedV, lower);
+
+            // interleave u and v within each lane, narrow to bytes and join the lanes' low halves
+            const __m256i iu = _mm256_cvtps_epi32(_mm256_mul_ps(eu, scale));
+            const __m256i iv = _mm256_cvtps_epi32(_mm256_mul_ps(ev, scale));
+            const __m256i words = _mm256_packs_epi32(_mm256_unpacklo_epi32(iu, iv), _mm256_unpackhi_epi32(iu, iv));
+            const __m256i bytes = _mm256_permute4x64_epi64(_mm256_packs_epi16(words, words), _MM_SHUFFLE(3, 1, 2, 0));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out + 2 * i), _mm256_castsi256_si128(bytes));
+        }
+
+        encodeOctahedralScalar(x + i, y + i, z + i, out + 2 * i, count - i);
+    }
+
+    TARGET_AVX2 void decodeOctahedralAvx2(const int8_t* in, float* x, float* y, float* z, size_t count)
+    {
+        const __m256 signMask = _mm256_set1_ps(-0.0f);
+        const __m256 one = _mm256_set1_ps(1);
+        const __m256 minimum = _mm256_set1_ps(-1);
+        const __m256 zero = _mm256_setzero_ps();
+        const __m256 scale = _mm256_set1_ps(1.0f / 127);
+        // gathers the u bytes in the low half and the v bytes in the high half
+        const __m128i split = _mm_setr_epi8(0, 2, 4, 6, 8, 10, 12, 14, 1, 3, 5, 7, 9, 11, 13, 15);
+        size_t i = 0;
+
+        for (; i + 8 <= count; i += 8)
+        {
+            const __m128i bytes = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(in + 2 * i)),
+                                                   split);
+            __m256 u = _mm256_max_ps(_mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_cvtepi8_epi32(bytes)), scale), minimum);
+            __m256 v = _mm256_max_ps(_mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_cvtepi8_epi32(_mm_srli_si128(bytes, 8))),
+                                                   scale), minimum);
+            const __m256 w = _mm256_sub_ps(_mm256_sub_ps(one, _mm256_andnot_ps(signMask, u)),
+                                           _mm256_andnot_ps(signMask, v));
+            const __m256 fold = _mm256_max_ps(_mm256_sub_ps(zero, w), zero);
+            u = _mm256_sub_ps(u, _mm256_or_ps(fold, _mm256_and_ps(u, signMask)));
+            v = _mm256_sub_ps(v, _mm256_or_ps(fold, _mm256_and_ps(v, signMask)));
+            const __m256 squared = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(u, u), _mm256_mul_ps(v, v)),
+                                                 _mm256_mul_ps(w, w));
+            const __m256 inverse = _mm256_div_ps(one, _mm256_sqrt_ps(squared));
+            _mm256_storeu_ps(x + i, _mm256_mul_ps(u, inverse));
+            _mm256_storeu_ps(y + i, _mm256_mul_ps(v, inverse));
+            _mm256_storeu_ps(z + i, _mm256_mul_ps(w, inverse));
+        }
+
+        decodeOctahedralScalar(in + 2 * i, x + i, y + i, z + i, count - i);
+    }
+
+    /**
+     * \brief Widest octahedral kernels supported by the processor, selected once
+     */
+    EncodeKernel bestEncodeKernel()
+    {
+        static const EncodeKernel kernel = CpuFeatures::HasAvx2() ? encodeOctahedralAvx2 :
+                                           CpuFeatures::HasSse2() ? encodeOctahedralSse2 : encodeOctahedralScalar;
+        return kernel;
+    }
+
+    DecodeKernel bestDecodeKernel()
+    {
+        static const DecodeKernel kernel = CpuFeatures::HasAvx2() ? decodeOctahedralAvx2 :
+                                           CpuFeatures::HasSse2() ? decodeOctahedralSse2 : decodeOctahedralScalar;
+        return kernel;
+    }
+
+    /**
+     * \brief Widest kernel supported by the processor, selected once
+     */
+    SlideKernel bestKernel()
+    {
+        static const SlideKernel kernel = CpuFeatures::HasAvx2() ? slideAvx2 :
+                                          CpuFeatures::HasSse2() ? slideSse2 : slideScalar;
+        return kernel;
+    }
+
+    /**
+     * \brief Box filters across a set of rows, every column is filtered at once by sliding a
+     * row of sums along them
+     * \param source The rows, tightly packed
+     * \param destination First destination row, can't alias source
+     * \param stride Distance between destination rows
+     * \param rows Number of rows
+     * \param width Values per row
+     * \param scratch Room for two rows, sums and zeros
+     */
+    void filterRows(const float* source, float* destination, size_t stride, int rows, int width, int radius,
+                    float* scratch)
+    {
+        const SlideKernel slide = bestKernel();
+        float* sum = scratch;
+        float* zeros = scratch + width;
+        std::fill(scratch, scratch + 2 * width, 0.0f);
+
+        for (int j = 0; j <= std::min(radius, rows - 1); j++)
+        {
+            const float* row = source + static_cast<size_t>(j) * width;
+
+            for (int i = 0; i < width; i++) { sum[i] += row[i]; }
+        }
+
+        for (int j = 0; j < rows; j++)
+        {
+            const int entering = j + radius + 1;
+            const int leaving = j - radius;
+            const int count = std::min(rows - 1, j + radius) - std::max(0, j - radius) + 1;
+            slide(destination + j * stride, sum, entering < rows ? source + static_cast<size_t>(entering) * width : zeros,
+                  leaving >= 0 ? source + static_cast<size_t>(leaving) * width : zeros, 1.0f / count, width);
+        }
+    }
+}
+
+GradientEngine::Settings::Settings() : difference(Difference::Central), filter(Filter::Box), radius(3),
+                                       encoding(Encoding::Octahedral) {}
+
+uint32_t GradientEngine::Settings::getKey() const
+{
+    return 1u << 16 | static_cast<uint32_t>(encoding) << 10 | static_cast<uint32_t>(filter) << 9 |
+           static_cast<uint32_t>(difference) << 8 | static_cast<uint32_t>(std::min(std::max(radius, 0), 255));
+}
+
+GradientEngine::GradientEngine(const Settings& settings, size_t memoryBudget) : settings(settings),
+    memoryBudget(memoryBudget), timings({ 0, 0, 0 }), cancelled(false), voxelType(VoxelType::UInt8), dimensions(0),
+    slabDepth(0), reach(0), windowStart(0), windowDepth(0), addedSlices(0), encodedSlices(0), planeDepth(0) {}
+
+std::vector<uint8_t> GradientEngine::compute(const uint8_t* voxels, VoxelType type, const ivec3& dimensions)
+{
+    begin(type, dimensions);
+    addSlices(voxels, dimensions.z);
+
+    return finish();
+}
+
+void GradientEngine::begin(VoxelType type, const ivec3& dimensions)
+{
+    voxelType = type;
+    this->dimensions = dimensions;
+    timings = { 0, 0, 0 };
+
+    // the box passes add up to the radius, and the differences read one more slice each side
+    reach = std::max(settings.radius, 0);
+    const size_t sliceSize = static_cast<size_t>(dimensions.x) * dimensions.y;
+    const size_t sliceBytes = sliceSize * GetVoxelSize(type);
+    const size_t sliceCost = std::max<size_t>(sliceSize * 3 * sizeof(float) + sliceBytes, 1);
+    // slabs thinner than the slices recomputed around them would mostly redo their neighbours
+    const int budgetDepth = static_cast<int>(std::min<size_t>(memoryBudget / sliceCost, dimensions.z));
+    slabDepth = std::min(std::max(budgetDepth - 2 * (reach + 1), std::max(2 * reach, 1)), std::max(dimensions.z, 1));
+
+    window.resize((slabDepth + 2 * (reach + 1)) * sliceBytes);
+    windowStart = 0;
+    windowDepth = 0;
+    addedSlices = 0;
+    encodedSlices = 0;
+    planeDepth = 0;
+    encoded.assign(sliceSize * dimensions.z * GetEncodedSize(settings.encoding), 0);
+}
+
+bool GradientEngine::addSlices(const uint8_t* voxels, int depth)
+{
+    const size_t sliceBytes = static_cast<size_t>(dimensions.x) * dimensions.y * GetVoxelSize(voxelType);
+    const int capacity = slabDepth + 2 * (reach + 1);
+    depth = std::min(depth, dimensions.z - addedSlices);
+
+    while (depth > 0 && !cancelled)
+    {
+        const int count = std::min(depth, capacity - windowDepth);
+        std::copy(voxels, voxels + count * sliceBytes, window.data() + windowDepth * sliceBytes);
+        voxels += count * sliceBytes;
+        depth -= count;
+        windowDepth += count;
+        addedSlices += count;
+
+        // a slab is smoothed once the slices its filter reaches are in, a full window always holds one
+        while (!cancelled && encodedSlices < dimensions.z)
+        {
+            const int end = std::min(encodedSlices + slabDepth, dimensions.z);
+
+            if (addedSlices < std::min(end + reach + 1, dimensions.z)) break;
+
+            processSlab(end);
+        }
+    }
+
+    return !cancelled;
+}
+
+std::vector<uint8_t> GradientEngine::finish()
+{
+    while (!cancelled && addedSlices == dimensions.z && encodedSlices < dimensions.z)
+    {
+        processSlab(std::min(encodedSlices + slabDepth, dimensions.z));
+    }
+
+    std::vector<uint8_t> result;
+
+    if (!cancelled && encodedSlices == dimensions.z) result.swap(encoded);
+
+    std::vector<uint8_t>().swap(window);
+    std::vector<float>().swap(planes);
+    std::vector<uint8_t>().swap(encoded);
+
+    return result;
+}
+
+void GradientEngine::processSlab(int end)
+{
+    // the volume is smoothed a slab of slices at a time to stay within the memory budget. gradients
+    // are taken for the slab and the slices its filter reaches, the box sums of those outer slices
+    // are wrong near their edge but the error can't travel back into the slab, so the slabs match
+    // smoothing the whole volume at once
+    const int first = std::max(encodedSlices - reach, 0);
+    planeDepth = std::min(end + reach, dimensions.z) - first;
+    planes.resize(static_cast<size_t>(dimensions.x) * dimensions.y * planeDepth * 3);
+
+    auto start = std::chrono::steady_clock::now();
+
+    DispatchVoxelType(voxelType, [&](auto tag)
+    {
+        using T = std::remove_pointer_t<decltype(tag)>;
+        computeDifferences<T>(first);
+    });
+
+    timings.differences += secondsSince(start);
+    start = std::chrono::steady_clock::now();
+
+    // a gaussian splits its radius between three box passes
+    const int passes = settings.filter == Filter::Gaussian ? 3 : 1;
+    const int radius = std::max(settings.radius, 0);
+
+    for (int pass = 0; pass < passes && !cancelled; pass++)
+    {
+        const int passRadius = radius / passes + (pass < radius % passes ? 1 : 0);
+
+        if (passRadius == 0) continue;
+
+        filterX(passRadius);
+        filterY(passRadius);
+        filterZ(passRadius);
+    }
+
+    timings.smoothing += secondsSince(start);
+
+    if (cancelled) return;
+
+    encodeSlices(encodedSlices, end - encodedSlices, encodedSlices - first);
+    encodedSlices = end;
+
+    // drops the slices the next slab's differences don't read
+    const size_t sliceBytes = static_cast<size_t>(dimensions.x) * dimensions.y * GetVoxelSize(voxelType);
+    const int dropped = std::max(end - reach - 1, 0) - windowStart;
+
+    if (dropped > 0)
+    {
+        std::copy(window.data() + dropped * sliceBytes, window.data() + windowDepth * sliceBytes, window.data());
+        windowStart += dropped;
+        windowDepth -= dropped;
+    }
+}
+
+template <typename T>
+void GradientEngine::computeDifferences(int first)
+{
+    const size_t planeSize = static_cast<size_t>(dimensions.x) * dimensions.y * planeDepth;
+    const T* voxels = reinterpret_cast<const T*>(window.data());
+    const bool sobel = settings.difference == Difference::Sobel;
+    // sobel smoothing weights of the rows next to the differenced one
+    const float weights[3] = { 1, 2, 1 };
+
+    // voxels outside the volume are empty, as in the texture border
+    auto value = [&](int x, int y, int z)
+    {
+        if (x < 0 || y < 0 || z < 0 || x >= dimensions.x || y >= dimensions.y || z >= dimensions.z) return 0.0f;
+
+        const size_t slice = z - windowStart;
+
+        return VolumeSampler<T>::ToTexture(voxels[(slice * dimensions.y + y) * dimensions.x + x]);
+    };
+
+    ThreadPool::instance().parallelFor(0, planeDepth, [&](int plane)
+    {
+        if (cancelled) return;
+
+        const int z = first + plane;
+
+        for (int y = 0; y < dimensions.y; y++)
+        {
+            const size_t row = (static_cast<size_t>(plane) * dimensions.y + y) * dimensions.x;
+
+            for (int x = 0; x < dimensions.x; x++)
+            {
+                vec3 gradient(0);
+
+                if (sobel)
+                {
+                    for (int j = -1; j <= 1; j++)
+                    {
+                        for (int i = -1; i <= 1; i++)
+                        {
+                            const float weight = weights[j + 1] * weights[i + 1];
+                            gradient.x += weight * (value(x + 1, y + i, z + j) - value(x - 1, y + i, z + j));
+                            gradient.y += weight * (value(x + i, y + 1, z + j) - value(x + i, y - 1, z + j));
+                            gradient.z += weight * (value(x + i, y + j, z + 1) - value(x + i, y + j, z - 1));
+                        }
+                    }
+                }
+                else
+                {
+                    gradient = vec3(value(x + 1, y, z) - value(x - 1, y, z),
+                                    value(x, y + 1, z) - value(x, y - 1, z),
+                                    value(x, y, z + 1) - value(x, y, z - 1));
+                }
+
+                // only directions are smoothed, flat regions stay zero
+                const float magnitude = length(gradient);
+
+                if (magnitude > 0) gradient /= magnitude;
+
+                planes[row + x] = gradient.x;
+                planes[planeSize + row + x] = gradient.y;
+                planes[2 * planeSize + row + x] = gradient.z;
+            }
+        }
+    });
+}
+
+void GradientEngine::filterX(int radius)
+{
+    const size_t planeSize = static_cast<size_t>(dimensions.x) * dimensions.y * planeDepth;
+
+    // every pass filters a copy of its lines back into the planes, so no voxel reads a neighbour
+    // that was already smoothed
+    ThreadPool::instance().parallelFor(0, planeDepth, [&](int z)
+    {
+        if (cancelled) return;
+
+        std::unique_ptr<float[]> line(new float[dimensions.x]);
+
+        for (int c = 0; c < 3; c++)
+        {
+            for (int y = 0; y < dimensions.y; y++)
+            {
+                float* row = planes.data() + c * planeSize +
+                             (static_cast<size_t>(z) * dimensions.y + y) * dimensions.x;
+                std::copy(row, row + dimensions.x, line.get());
+                filterLine(line.get(), row, dimensions.x, radius);
+            }
+        }
+    });
+}
+
+void GradientEngine::filterY(int radius)
+{
+    const size_t planeSize = static_cast<size_t>(dimensions.x) * dimensions.y * planeDepth;
+    const size_t sliceSize = static_cast<size_t>(dimensions.x) * dimensions.y;
+
+    ThreadPool::instance().parallelFor(0, planeDepth, [&](int z)
+    {
+        if (cancelled) return;
+
+        std::unique_ptr<float[]> scratch(new float[sliceSize + 2 * dimensions.x]);
+
+        for (int c = 0; c < 3; c++)
+        {
+            float* slice = planes.data() + c * planeSize + z * sliceSize;
+            std::copy(slice, slice + sliceSize, scratch.get());
+            filterRows(scratch.get(), slice, dimensions.x, dimensions.y, dimensions.x, radius, scratch.get() + sliceSize);
+        }
+    });
+}
+
+void GradientEngine::filterZ(int radius)
+{
+    const size_t planeSize = static_cast<size_t>(dimensions.x) * dimensions.y * planeDepth;
+    const size_t sliceSize = static_cast<size_t>(dimensions.x) * dimensions.y;
+    const size_t xzSize = static_cast<size_t>(dimensions.x) * planeDepth;
+
+    // each task filters the x-z plane of a single row index
+    ThreadPool::instance().parallelFor(0, dimensions.y, [&](int y)
+    {
+        if (cancelled) return;
+
+        std::unique_ptr<float[]> scratch(new float[xzSize + 2 * dimensions.x]);
+
+        for (int c = 0; c < 3; c++)
+        {
+            float* first = planes.data() + c * planeSize + static_cast<size_t>(y) * dimensions.x;
+
+            for (int z = 0; z < planeDepth; z++)
+            {
+                std::copy(first + z * sliceSize, first + z * sliceSize + dimensions.x,
+                          scratch.get() + static_cast<size_t>(z) * dimensions.x);
+            }
+
+            // the rows past the plane slices aren't the volume's edge, but only slices outside the
+            // slab are normalized wrongly
+            filterRows(scratch.get(), first, sliceSize, planeDepth, dimensions.x, radius, scratch.get() + xzSize);
+        }
+    });
+}
+
+void GradientEngine::encodeSlices(int first, int count, int plane)
+{
+    const auto start = std::chrono::steady_clock::now();
+    const size_t planeSize = static_cast<size_t>(dimensions.x) * dimensions.y * planeDepth;
+    const size_t sliceSize = static_cast<size_t>(dimensions.x) * dimensions.y;
+
+    if (settings.encoding == Encoding::Octahedral)
+    {
+        const EncodeKernel kernel = bestEncodeKernel();
+
+        // the projection doesn't need normalized gradients
+        ThreadPool::instance().parallelFor(0, count, [&](int z)
+        {
+            const size_t source = (plane + z) * sliceSize;
+            kernel(planes.data() + source, planes.data() + planeSize + source, planes.data() + 2 * planeSize + source,
+                   reinterpret_cast<int8_t*>(encoded.data()) + 2 * (first + z) * sliceSize, sliceSize);
+        });
+    }
+    else
+    {
+        uint16_t* halves = reinterpret_cast<uint16_t*>(encoded.data());
+
+        ThreadPool::instance().parallelFor(0, count, [&](int z)
+        {
+            const size_t source = (plane + z) * sliceSize;
+            const size_t destination = (first + z) * sliceSize;
+
+            for (size_t i = 0; i < sliceSize; i++)
+            {
+                const size_t j = source + i;
+                vec3 n(planes[j], planes[planeSize + j], planes[2 * planeSize + j]);
+                const float magnitude = length(n);
+                // flat regions have no direction, they face along z
+                n = magnitude > 0 ? n / magnitude : vec3(0, 0, 1);
+                const vec2 enc = spheremap(n);
+
+                halves[2 * (destination + i)] = toHalf(enc.x);
+                halves[2 * (destination + i) + 1] = toHalf(enc.y);
+            }
+        });
+    }
+
+    timings.encoding += secondsSince(start);
+}
+
+void GradientEngine::cancel()
+{
+    cancelled = true;
+}
+
+const GradientEngine::Settings& GradientEngine::getSettings() const
+{
+    return settings;
+}
+
+const GradientEngine::Timings& GradientEngine::getTimings() const
+{
+    return timings;
+}
+
+const char* GradientEngine::GetKernelName()
+{
+    const SlideKernel kernel = bestKernel();
+
+    return kernel == slideAvx2 ? "AVX2" : kernel == slideSse2 ? "SSE2" : "scalar";
+}
+
+int GradientEngine::GetEncodedSize(Encoding encoding)
+{
+    return encoding == Encoding::Octahedral ? 2 : 4;
+}
+
+void GradientEngine::DecodeOctahedral(const int8_t* encoded, size_t count, float* x, float* y, float* z)
+{
+    bestDecodeKernel()(encoded, x, y, z, count);
+}
+
+std::array<GradientEngine::EncodingBenchmark, 2> GradientEngine::BenchmarkEncodings(size_t count)
+{
+    // directions uniform over the sphere
+    std::mt19937 generator(1);
+    std::normal_distribution<float> distribution;
+    std::vector<float> normals(count * 3);
+
+    for (size_t i = 0; i < count; i++)
+    {
+        vec3 n;
+
+        do { n = vec3(distribution(generator), distribution(generator), distribution(generator)); }
+        while (length(n) < 1e-6f);
+
+        n = normalize(n);
+        normals[i] = n.x;
+        normals[count + i] = n.y;
+        normals[2 * count + i] = n.z;
+    }
+
+    const float* x = normals.data();
+    const float* y = x + count;
+    const float* z = y + count;
+    std::vector<float> decoded(count * 3);
+    std::array<EncodingBenchmark, 2> results;
+
+    auto measure = [&](EncodingBenchmark& result)
+    {
+        double sum = 0;
+        result.maxError = 0;
+
+        for (size_t i = 0; i < count; i++)
+        {
+            const float cosine = x[i] * decoded[i] + y[i] * decoded[count + i] + z[i] * decoded[2 * count + i];
+            const double error = degrees(std::acos(std::min(std::max(static_cast<double>(cosine), -1.0), 1.0)));
+            sum += error;
+            result.maxError = std::max(result.maxError, error);
+        }
+
+        result.meanError = count ? sum / count : 0;
+    };
+
+    // spheremap, encoded and decoded like the gradient texture and the shader do
+    {
+        EncodingBenchmark& result = results[static_cast<int>(Encoding::Spheremap)];
+        std::vector<uint16_t> halves(count * 2);
+        auto start = std::chrono::steady_clock::now();
+
+        for (size_t i = 0; i < count; i++)
+        {
+            const vec2 enc = spheremap(vec3(x[i], y[i], z[i]));
+            halves[2 * i] = toHalf(enc.x);
+            halves[2 * i + 1] = toHalf(enc.y);
+        }
+
+        result.encodeRate = count / std::max(secondsSince(start), 1e-9);
+        start = std::chrono::steady_clock::now();
+
+        for (size_t i = 0; i < count; i++)
+        {
+            const vec3 n = inverseSpheremap(vec2(fromHalf(halves[2 * i]), fromHalf(halves[2 * i + 1])));
+            decoded[i] = n.x;
+            decoded[count + i] = n.y;
+            decoded[2 * count + i] = n.z;
+        }
+
+        result.decodeRate = count / std::max(secondsSince(start), 1e-9);
+        result.bytesPerVoxel = GetEncodedSize(Encoding::Spheremap);
+        measure(result);
+    }
+
+    // octahedral, with the vector kernels
+    {
+        EncodingBenchmark& result = results[static_cast<int>(Encoding::Octahedral)];
+        std::vector<int8_t> bytes(count * 2);
+        auto start = std::chrono::steady_clock::now();
+        bestEncodeKernel()(x, y, z, bytes.data(), count);
+        result.encodeRate = count / std::max(secondsSince(start), 1e-9);
+        start = std::chrono::steady_clock::now();
+        DecodeOctahedral(bytes.data(), count, decoded.data(), decoded.data() + count, decoded.data() + 2 * count);
+        result.decodeRate = count / std::max(secondsSince(start), 1e-9);
+        result.bytesPerVoxel = GetEncodedSize(Encoding::Octahedral);
+        measure(result);
+    }
+
+    return results;
+}
+
+GradientEngine::SmoothingBenchmark GradientEngine::BenchmarkSmoothing(const ivec3& dimensions, int radius)
+{
+    Settings settings;
+    settings.filter = Filter::Box;
+    settings.radius = std::max(radius, 0);
+    GradientEngine engine(settings);
+    engine.dimensions = max(dimensions, ivec3(1));
+    engine.planeDepth = engine.dimensions.z;
+
+    // directions uniform over the sphere, like the differences of a noisy volume
+    const ivec3 size = engine.dimensions;
+    const size_t planeSize = static_cast<size_t>(size.x) * size.y * size.z;
+    std::mt19937 generator(1);
+    std::normal_distribution<float> distribution;
+    engine.planes.resize(planeSize * 3);
+
+    for (size_t i = 0; i < planeSize; i++)
+    {
+        vec3 n;
+
+        do { n = vec3(distribution(generator), distribution(generator), distribution(generator)); }
+        while (length(n) < 1e-6f);
+
+        n = normalize(n);
+        engine.planes[i] = n.x;
+        engine.planes[planeSize + i] = n.y;
+        engine.planes[2 * planeSize + i] = n.z;
+    }
+
+    const std::vector<float> source = engine.planes;
+    const int r = settings.radius;
+    SmoothingBenchmark result;
+    result.radius = r;
+    result.taps = (2 * r + 1) * (2 * r + 1) * (2 * r + 1);
+    result.voxels = planeSize;
+
+    // every tap of the box inside the volume, divided by their count like the separable passes
+    std::vector<float> direct(source.size());
+    auto start = std::chrono::steady_clock::now();
+
+    ThreadPool::instance().parallelFor(0, size.z, [&](int z)
+    {
+        const int z0 = std::max(z - r, 0);
+        const int z1 = std::min(z + r, size.z - 1);
+
+        for (int y = 0; y < size.y; y++)
+        {
+            const int y0 = std::max(y - r, 0);
+            const int y1 = std::min(y + r, size.y - 1);
+
+            for (int x = 0; x < size.x; x++)
+            {
+                const int x0 = std::max(x - r, 0);
+                const int x1 = std::min(x + r, size.x - 1);
+                vec3 sum(0);
+
+                for (int k = z0; k <= z1; k++)
+                {
+                    for (int j = y0; j <= y1; j++)
+                    {
+                        const size_t row = (static_cast<size_t>(k) * size.y + j) * size.x;
+
+                        for (int i = x0; i <= x1; i++)
+                        {
+                            sum += vec3(source[row + i], source[planeSize + row + i], source[2 * planeSize + row + i]);
+                        }
+                    }
+                }
+
+                const vec3 mean = sum / static_cast<float>((z1 - z0 + 1) * (y1 - y0 + 1) * (x1 - x0 + 1));
+                const size_t voxel = (static_cast<size_t>(z) * size.y + y) * size.x + x;
+                direct[voxel] = mean.x;
+                direct[planeSize + voxel] = mean.y;
+                direct[2 * planeSize + voxel] = mean.z;
+            }
+        }
+    });
+
+    result.bruteForceSeconds = secondsSince(start);
+    start = std::chrono::steady_clock::now();
+
+    if (r > 0)
+    {
+        engine.filterX(r);
+        engine.filterY(r);
+        engine.filterZ(r);
+    }
+
+    result.separableSeconds = secondsSince(start);
+    result.maxDifference = 0;
+
+    for (size_t i = 0; i < direct.size(); i++)
+    {
+        const double difference = std::abs(direct[i] - engine.planes[i]);
+        result.maxDifference = std::max(result.maxDifference, difference);
+    }
+
+    return result;
+}
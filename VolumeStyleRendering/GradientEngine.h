@@ -0,0 +1,234 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <vector>
+#include <cinder/CinderGlm.h>
+
+#include "VoxelType.h"
+
+/**
+ * \brief Prepares the smoothed gradients of a volume on the CPU
+ */
+class GradientEngine
+{
+public:
+    enum class Difference
+    {
+        // neighbour differences along each axis
+        Central,
+        // 3x3x3 Sobel operator, differences weighted over the neighbouring rows
+        Sobel
+    };
+
+    enum class Filter
+    {
+        // a single box pass of the given radius
+        Box,
+        // three box passes adding up to the given radius, close to a gaussian
+        Gaussian
+    };
+
+    enum class Encoding
+    {
+        // two half floats holding the spheremap transform, 4 bytes per voxel
+        Spheremap,
+        // two signed bytes holding the octahedral projection, 2 bytes per voxel
+        Octahedral
+    };
+
+    /**
+     * \brief Parameters of the gradient preparation
+     */
+    struct Settings
+    {
+        Difference difference;
+        Filter filter;
+        // filter footprint along each side of a voxel, zero disables smoothing
+        int radius;
+        Encoding encoding;
+
+        Settings();
+
+        /**
+         * \brief Packs the settings into a single value, used to key cached gradients
+         * \return The packed settings, never zero
+         */
+        uint32_t getKey() const;
+    };
+
+    /**
+     * \brief Time spent in each step of the last computation, in seconds
+     */
+    struct Timings
+    {
+        double differences;
+        double smoothing;
+        double encoding;
+    };
+
+    /**
+     * \brief Accuracy and speed of a normal encoding, measured on random unit vectors
+     */
+    struct EncodingBenchmark
+    {
+        // angle between the normals and their decoded encoding, in degrees
+        double meanError;
+        double maxError;
+        // normals encoded and decoded per second on a single thread
+        double encodeRate;
+        double decodeRate;
+        int bytesPerVoxel;
+    };
+
+    /**
+     * \brief Speed of the separable box passes next to summing every tap of the box directly,
+     * measured on random directions
+     */
+    struct SmoothingBenchmark
+    {
+        // box radius and taps per voxel of the direct filter, 343 for the 7x7x7 box of radius 3
+        int radius;
+        int taps;
+        size_t voxels;
+        // time of the direct filter and of the three separable passes, both on the thread pool
+        double bruteForceSeconds;
+        double separableSeconds;
+        // largest difference between the two smoothed components
+        double maxDifference;
+    };
+
+    /**
+     * \brief Creates an engine for the given settings
+     * \param settings The gradient settings
+     * \param memoryBudget Host memory for the voxels and gradient planes of the slices smoothed at
+     * once, thicker slabs recompute fewer neighbouring slices
+     */
+    explicit GradientEngine(const Settings& settings, size_t memoryBudget = DefaultMemoryBudget);
+
+    /**
+     * \brief Computes the smoothed gradient directions of a volume in host memory
+     * \param voxels The volume voxels, tightly packed in x, y, z order
+     * \param type Type of the voxels
+     * \param dimensions The volume dimensions
+     * \return The gradients in the encoding of the settings, empty if the computation was cancelled
+     */
+    std::vector<uint8_t> compute(const uint8_t* voxels, VoxelType type, const glm::ivec3& dimensions);
+    /**
+     * \brief Starts computing the gradients of a volume handed slice by slice with addSlices, so
+     * the volume never has to be in host memory as a whole
+     * \param type Type of the voxels
+     * \param dimensions The volume dimensions
+     */
+    void begin(VoxelType type, const glm::ivec3& dimensions);
+    /**
+     * \brief Adds the next slices of the volume, the slabs whose neighbouring slices are all
+     * known are smoothed and encoded right away
+     * \param voxels Tightly packed slices following the ones added before
+     * \param depth Number of slices
+     * \return False if the computation was cancelled
+     */
+    bool addSlices(const uint8_t* voxels, int depth);
+    /**
+     * \brief Smooths and encodes the last slabs once every slice was added. Spheremap gradients are
+     * two half floats per voxel, GL_RG and GL_HALF_FLOAT pixel data. Octahedral gradients are two
+     * signed bytes per voxel, GL_RG and GL_BYTE pixel data
+     * \return The encoded gradients, empty if the computation was cancelled or slices are missing
+     */
+    std::vector<uint8_t> finish();
+    /**
+     * \brief Stops a computation running on another thread as soon as possible
+     */
+    void cancel();
+
+    const Settings &getSettings() const;
+    const Timings &getTimings() const;
+
+    /**
+     * \brief Name of the vector extension used by the filter passes, for reports
+     * \return AVX2, SSE2 or scalar
+     */
+    static const char* GetKernelName();
+    /**
+     * \brief Size of an encoded gradient
+     * \param encoding The gradient encoding
+     * \return Bytes per voxel
+     */
+    static int GetEncodedSize(Encoding encoding);
+    /**
+     * \brief Decodes octahedral normals with the fastest kernel available
+     * \param encoded Two signed bytes per normal
+     * \param count Number of normals
+     * \param x Receives the x component of each unit normal, y and z likewise
+     */
+    static void DecodeOctahedral(const int8_t* encoded, size_t count, float* x, float* y, float* z);
+    /**
+     * \brief Encodes random unit vectors with every encoding and decodes them back
+     * \param count Number of normals
+     * \return Results in Encoding order
+     */
+    static std::array<EncodingBenchmark, 2> BenchmarkEncodings(size_t count = 1 << 20);
+    /**
+     * \brief Smooths random unit vectors with a box filter, once tap by tap and once with the
+     * separable passes
+     * \param dimensions Size of the random gradient planes
+     * \param radius The box radius
+     * \return Timings of both filters and how far their results differ
+     */
+    static SmoothingBenchmark BenchmarkSmoothing(const glm::ivec3& dimensions = glm::ivec3(96), int radius = 3);
+
+    // host memory used for the slabs by default
+    static const size_t DefaultMemoryBudget = 256 * 1024 * 1024;
+private:
+    Settings settings;
+    size_t memoryBudget;
+    Timings timings;
+    std::atomic<bool> cancelled;
+
+    VoxelType voxelType;
+    glm::ivec3 dimensions;
+    // slices smoothed at once, and the slices of gradients the filter reaches along z
+    int slabDepth;
+    int reach;
+    // voxels of the slices the next slab reads, starting at slice windowStart
+    std::vector<uint8_t> window;
+    int windowStart;
+    int windowDepth;
+    // slices added and slices whose gradients are encoded
+    int addedSlices;
+    int encodedSlices;
+    // one plane of x, y and z components for the slices of a slab and its neighbours
+    std::vector<float> planes;
+    int planeDepth;
+    std::vector<uint8_t> encoded;
+
+    /**
+     * \brief Smooths and encodes the slices from the first one not encoded yet up to the given one
+     */
+    void processSlab(int end);
+    /**
+     * \brief Normalized differences of every voxel of the plane slices into the gradient planes
+     * \param first Volume slice of the first plane slice
+     */
+    template <typename T>
+    void computeDifferences(int first);
+    /**
+     * \brief Box filter pass along the rows of the planes
+     */
+    void filterX(int radius);
+    /**
+     * \brief Box filter pass along the columns of each plane slice
+     */
+    void filterY(int radius);
+    /**
+     * \brief Box filter pass across the plane slices
+     */
+    void filterZ(int radius);
+    /**
+     * \brief Encodes plane slices into the gradients of the given volume slices
+     * \param first First volume slice
+     * \param count Number of slices
+     * \param plane Plane slice holding the first volume slice
+     */
+    void encodeSlices(int first, int count, int plane);
+};
\ No newline at end of file
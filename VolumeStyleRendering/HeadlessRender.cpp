@@ -0,0 +1,380 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <thread>
+#include <cinder/app/AppBase.h>
+#include <cinder/ImageIo.h>
+#include <cinder/Log.h>
+
+#include "HeadlessRender.h"
+#include "PreintegrationTable.h"
+#include "StyleTransferFunction.h"
+#include "ThreadPool.h"
+
+using namespace glm;
+using namespace ci;
+
+namespace
+{
+    /**
+     * \brief Drives a load job in place of the rendering thread, each slab handed for upload is
+     * copied into host memory
+     */
+    bool loadVolume(VolumeLoadJob& job, std::vector<uint8_t>& voxels)
+    {
+        VolumeSlab slab;
+
+        while (job.isActive() && job.getStage() != VolumeLoadJob::Stage::Ready)
+        {
+            if (job.pendingUpload(slab))
+            {
+                // the dimensions of bricked volumes and image stacks are known once the first slab is read
+                const ivec3 size = job.getDimensions();
+                const size_t sliceBytes = static_cast<size_t>(size.x) * size.y * GetVoxelSize(job.getVoxelType());
+
+                if (voxels.empty()) voxels.assign(sliceBytes * size.z, 0);
+
+                memcpy(voxels.data() + slab.zOffset * sliceBytes, slab.data, slab.depth * sliceBytes);
+                job.uploaded(slab.depth);
+            }
+            else
+            {
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+        }
+
+        if (job.getStage() != VolumeLoadJob::Stage::Ready)
+        {
+            CI_LOG_E("Couldn't load " << job.getFilepath() << ": " << job.getError());
+            return false;
+        }
+
+        return true;
+    }
+
+    /**
+     * \brief Writes three float channels per pixel as a PFM image, which stores its rows from the
+     * bottom like the frame does
+     */
+    bool writePfm(const std::string& filepath, const ivec2& size, const std::vector<vec3>& pixels)
+    {
+        std::ofstream output(filepath, std::ios::binary | std::ios::trunc);
+
+        if (!output.good()) return false;
+
+        // negative scale for little endian floats
+        output << "PF\n" << size.x << " " << size.y << "\n-1.0\n";
+        output.write(reinterpret_cast<const char*>(pixels.data()), pixels.size() * sizeof(vec3));
+
+        return output.good();
+    }
+
+    /**
+     * \brief Writes the premultiplied color over black as an 8 bits PPM image, top row first
+     */
+    bool writePpm(const std::string& filepath, const ivec2& size, const std::vector<vec4>& pixels)
+    {
+        std::ofstream output(filepath, std::ios::binary | std::ios::trunc);
+
+        if (!output.good()) return false;
+
+        output << "P6\n" << size.x << " " << size.y << "\n255\n";
+        std::vector<uint8_t> row(size.x * 3);
+
+        for (int y = size.y - 1; y >= 0; y--)
+        {
+            for (int x = 0; x < size.x; x++)
+            {
+                const vec4& color = pixels[static_cast<size_t>(y) * size.x + x];
+
+                for (int c = 0; c < 3; c++)
+                {
+                    row[x * 3 + c] = static_cast<uint8_t>(clamp(color[c], 0.0f, 1.0f) * 255.0f + 0.5f);
+                }
+            }
+
+            output.write(reinterpret_cast<const char*>(row.data()), row.size());
+        }
+
+        return output.good();
+    }
+
+    /**
+     * \brief White with the opacity ramping up over the threshold window, used without a saved
+     * transfer function
+     */
+    std::array<vec4, 256> rampTransferFunction(const ivec2& threshold)
+    {
+        std::array<vec4, 256> colorMapping;
+        const float width = static_cast<float>(std::max(threshold.y - threshold.x, 1));
+
+        for (int i = 0; i < 256; i++)
+        {
+            const float opacity = i < threshold.x || i > threshold.y ? 0 : (i - threshold.x) / width;
+            colorMapping[i] = vec4(1, 1, 1, opacity);
+        }
+
+        return colorMapping;
+    }
+}
+
+HeadlessRender::Options::Options() : dimensions(0), ratios(1), voxelType(VoxelType::UInt8), size(1280, 720), yaw(0),
+                                     pitch(0), distance(4), threshold(0, 255), stepScale(1),
+                                     gradientMode(CpuRaycaster::GradientMode::Precomputed), preintegrated(true),
+                                     diffuseShading(true), output("frame") {}
+
+bool HeadlessRender::IsRequested(const std::vector<std::string>& args)
+{
+    return std::find(args.begin(), args.end(), "--cpu-render") != args.end();
+}
+
+bool HeadlessRender::ParseArguments(const std::vector<std::string>& args, Options& options)
+{
+    auto request = std::find(args.begin(), args.end(), "--cpu-render");
+
+    if (request == args.end() || ++request == args.end())
+    {
+        CI_LOG_E("--cpu-render needs a volume filepath");
+        return false;
+    }
+
+    options = Options();
+    options.filepath = *request;
+
+    // values following the option at the given argument, false if some are missing
+    auto values = [&](std::vector<std::string>::const_iterator& arg, int count, float* result)
+    {
+        for (int i = 0; i < count; i++)
+        {
+            if (++arg == args.end()) return false;
+
+            result[i] = static_cast<float>(std::atof(arg->c_str()));
+        }
+
+        return true;
+    };
+
+    for (auto arg = request + 1; arg != args.end(); ++arg)
+    {
+        const std::string option = *arg;
+        vec3 v(0);
+        bool valid = true;
+
+        if (*arg == "--dimensions")
+        {
+            valid = values(arg, 3, &v.x);
+            options.dimensions = ivec3(v);
+        }
+        else if (*arg == "--voxel-bytes")
+        {
+            valid = values(arg, 1, &v.x) && VoxelTypeFromSize(static_cast<size_t>(v.x), options.voxelType);
+        }
+        else if (*arg == "--ratios")
+        {
+            valid = values(arg, 3, &v.x);
+            options.ratios = v;
+        }
+        else if (*arg == "--size")
+        {
+            valid = values(arg, 2, &v.x);
+            options.size = ivec2(v);
+        }
+        else if (*arg == "--yaw") valid = values(arg, 1, &options.yaw);
+        else if (*arg == "--pitch") valid = values(arg, 1, &options.pitch);
+        else if (*arg == "--distance") valid = values(arg, 1, &options.distance);
+        else if (*arg == "--step-scale") valid = values(arg, 1, &options.stepScale);
+        else if (*arg == "--threshold")
+        {
+            valid = values(arg, 2, &v.x);
+            options.threshold = clamp(ivec2(v), ivec2(0), ivec2(255));
+        }
+        else if (*arg == "--transfer-function")
+        {
+            valid = ++arg != args.end();
+            if (valid) options.transferFunction = *arg;
+        }
+        else if (*arg == "--gradients")
+        {
+            const char* modes[] = { "precomputed", "central", "forward" };
+            valid = false;
+
+            for (int i = 0; i < 3 && arg + 1 != args.end(); i++)
+            {
+                if (arg[1] != modes[i]) continue;
+
+                options.gradientMode = static_cast<CpuRaycaster::GradientMode>(i);
+                valid = true;
+            }
+
+            if (valid) ++arg;
+        }
+        else if (*arg == "--no-preintegration") options.preintegrated = false;
+        else if (*arg == "--no-shading") options.diffuseShading = false;
+        else if (*arg == "--output")
+        {
+            valid = ++arg != args.end();
+            if (valid) options.output = *arg;
+        }
+        else
+        {
+            CI_LOG_E("Unknown argument " << *arg);
+            return false;
+        }
+
+        if (!valid)
+        {
+            CI_LOG_E("Missing or invalid values for " << option);
+            return false;
+        }
+    }
+
+    options.stepScale = std::max(options.stepScale, 0.1f);
+
+    if (any(lessThanEqual(options.size, ivec2(0))))
+    {
+        CI_LOG_E("Invalid image size " << options.size.x << " x " << options.size.y);
+        return false;
+    }
+
+    return true;
+}
+
+int HeadlessRender::Run(const Options& options)
+{
+    // raw volumes are described on the command line, the other inputs describe themselves
+    VolumeLoadOptions loadOptions = options.loadOptions;
+    loadOptions.precomputeGradients = options.gradientMode == CpuRaycaster::GradientMode::Precomputed;
+    std::unique_ptr<VolumeLoadJob> job;
+
+    if (all(greaterThan(options.dimensions, ivec3(0))))
+    {
+        job.reset(new VolumeLoadJob(options.dimensions, options.ratios, options.filepath, options.voxelType,
+                                    loadOptions));
+    }
+    else
+    {
+        job.reset(new VolumeLoadJob(options.filepath, loadOptions));
+    }
+
+    std::vector<uint8_t> voxels;
+
+    if (!loadVolume(*job, voxels)) return 1;
+
+    const ivec3 dimensions = job->getDimensions();
+    CI_LOG_I("Loaded a " << dimensions.x << " x " << dimensions.y << " x " << dimensions.z << " "
+             << GetVoxelTypeName(job->getVoxelType()) << " volume at level " << job->getLevel());
+
+    CpuRaycaster raycaster;
+    raycaster.setVolume(voxels.data(), job->getVoxelType(), dimensions);
+    raycaster.setGradients(job->getGradients(), loadOptions.gradientSettings.encoding);
+
+    // the style textures' images, the first is the default style style points fall back to
+    StyleTransferFunction transferFunction;
+    std::vector<Surface> styles;
+    std::vector<std::string> stylePaths;
+
+    // a style is loaded once per file like Style::AddStyle does
+    auto addStyle = [&](const std::string& name, const std::string& path)
+    {
+        auto loaded = std::find(stylePaths.begin(), stylePaths.end(), path);
+
+        if (loaded != stylePaths.end()) return static_cast<int>(loaded - stylePaths.begin());
+
+        try
+        {
+            styles.push_back(Style::LoadLitsphere(loadImage(path)));
+            stylePaths.push_back(path);
+
+            return static_cast<int>(styles.size()) - 1;
+        }
+        catch (const std::exception& e)
+        {
+            CI_LOG_W("Couldn't load the style " << name << " from " << path << ", using the default: " << e.what());
+            return 0;
+        }
+    };
+
+    try
+    {
+        styles.push_back(Style::LoadLitsphere(loadImage(app::loadAsset("images/default.png"))));
+        stylePaths.push_back(app::getAssetPath("images/default.png").string());
+        raycaster.setNoise(Surface8u(loadImage(app::loadAsset("images/noise.png"))));
+
+        if (!options.transferFunction.empty())
+        {
+            transferFunction.read(JsonTree(loadFile(options.transferFunction)), addStyle);
+        }
+    }
+    catch (const std::exception& e)
+    {
+        CI_LOG_E("Couldn't read the assets or transfer function " << options.transferFunction << ": " << e.what());
+        return 1;
+    }
+
+    const bool styled = !options.transferFunction.empty();
+    const ivec2 threshold = styled ? transferFunction.getThreshold() : options.threshold;
+    const std::array<vec4, 256> colorMapping = styled ? transferFunction.getIndexedTransferFunction() :
+                                                        rampTransferFunction(threshold);
+    PreintegrationTable preintegration;
+    preintegration.update(colorMapping, threshold);
+    raycaster.setTransferFunction(colorMapping, preintegration.getTable());
+    std::vector<const uint8_t*> styleData;
+
+    for (auto& style : styles) { styleData.push_back(style.getData()); }
+
+    // the ramp has no style points
+    raycaster.setStyleFunction(styled ? transferFunction.getTransferFunction() : std::vector<vec2>(),
+                               styled ? transferFunction.getIndexFunction() : std::vector<int>(), styleData);
+
+    CpuRaycaster::Parameters parameters;
+    // the volume box is scaled and centered like the app draws it
+    const int largest = max(dimensions.x, max(dimensions.y, dimensions.z));
+    const vec3 scale = vec3(dimensions) * job->getRatios() / static_cast<float>(largest);
+    parameters.model = translate(mat4(1), -0.5f * scale) * glm::scale(mat4(1), scale);
+    const vec3 eye = vec3(rotate(mat4(1), radians(options.yaw), vec3(0, 1, 0)) *
+                          rotate(mat4(1), radians(options.pitch), vec3(1, 0, 0)) *
+                          vec4(0, 0, -options.distance, 1));
+    parameters.view = lookAt(eye, vec3(0), vec3(0, 1, 0));
+    // lit along the view direction, the app's default light for its default camera
+    parameters.light.direction = normalize(-eye);
+    parameters.projection = perspective(radians(35.0f), static_cast<float>(options.size.x) / options.size.y, 0.1f,
+                                        1000.0f);
+    parameters.threshold = threshold;
+
+    // float values are mapped from the histogram domain like the app does
+    if (job->getVoxelType() == VoxelType::Float32)
+    {
+        const vec2 domain = job->getStatistics().getDomain();
+        parameters.valueMapping = vec2(1.0f / (domain.y - domain.x), -domain.x / (domain.y - domain.x));
+    }
+
+    parameters.stepSize = vec3(options.stepScale / largest);
+    parameters.stepScale = options.stepScale;
+    parameters.iterations = static_cast<int>(largest * (1.0f / options.stepScale) * 2.0f);
+    parameters.gradientMode = options.gradientMode;
+    parameters.preintegrated = options.preintegrated;
+    parameters.diffuseShading = options.diffuseShading;
+
+    raycaster.render(parameters, options.size);
+    job->complete();
+
+    const CpuRaycaster::Frame& frame = raycaster.getFrame();
+    CI_LOG_I("Raycast a " << frame.size.x << " x " << frame.size.y << " frame in " << frame.seconds * 1000
+             << " ms, " << frame.getRaysPerSecond() / 1e6 << " million rays per second on "
+             << ThreadPool::instance().getThreadCount() << " threads, "
+             << (frame.packets ? "ray packets" : "single rays"));
+
+    const bool written = writePpm(options.output + "_color.ppm", frame.size, frame.color) &&
+                         writePfm(options.output + "_normal.pfm", frame.size, frame.normal) &&
+                         writePfm(options.output + "_position.pfm", frame.size, frame.position);
+
+    if (!written)
+    {
+        CI_LOG_E("Couldn't write the frame to " << options.output);
+        return 1;
+    }
+
+    return 0;
+}
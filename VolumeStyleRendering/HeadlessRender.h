@@ -0,0 +1,72 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <cinder/CinderGlm.h>
+
+#include "VoxelType.h"
+#include "VolumeLoader.h"
+#include "CpuRaycaster.h"
+
+/**
+ * \brief Renders a volume with the CPU raycaster without a window or GL context. The volume is
+ * loaded through VolumeLoadJob with its slabs copied to host memory instead of a texture, so it
+ * gets the same conversion, reduction and gradients as in the app. The noise and litsphere assets
+ * are read as images, the styles like the app's transfer functions manager loads them. The frame is
+ * written to disk, the color as a PPM image and the normals and positions as PFM images
+ */
+class HeadlessRender
+{
+public:
+    /**
+     * \brief Volume, view and output of a headless render
+     */
+    struct Options
+    {
+        // raw volumes need their dimensions and voxel type, bricked volumes and image stacks don't
+        std::string filepath;
+        glm::ivec3 dimensions;
+        glm::vec3 ratios;
+        VoxelType voxelType;
+        VolumeLoadOptions loadOptions;
+        glm::ivec2 size;
+        // orbit of the camera around the volume center in degrees, and its distance
+        float yaw;
+        float pitch;
+        float distance;
+        // window of the visible values in [0..255], the opacity ramps up over it on white
+        glm::ivec2 threshold;
+        // style transfer function saved by the transfer functions manager, replaces the ramp and threshold
+        std::string transferFunction;
+        float stepScale;
+        CpuRaycaster::GradientMode gradientMode;
+        bool preintegrated;
+        bool diffuseShading;
+        // the frame is written to <output>_color.ppm, <output>_normal.pfm and <output>_position.pfm
+        std::string output;
+
+        Options();
+    };
+
+    /**
+     * \brief Determines if the command line asks for a headless render
+     * \param args The command line arguments
+     * \return True if --cpu-render is given
+     */
+    static bool IsRequested(const std::vector<std::string>& args);
+    /**
+     * \brief Reads the render options from the command line, --cpu-render <volume> followed by
+     * --dimensions x y z, --voxel-bytes 1|2|4, --ratios x y z, --size w h, --yaw, --pitch,
+     * --distance, --threshold low high, --transfer-function <file.stf>, --step-scale,
+     * --gradients precomputed|central|forward, --no-preintegration, --no-shading and --output
+     * \param args The command line arguments
+     * \param options Receives the parsed options
+     * \return False if an argument is missing or invalid
+     */
+    static bool ParseArguments(const std::vector<std::string>& args, Options& options);
+    /**
+     * \brief Loads the volume, renders it and writes the frame
+     * \param options The render options
+     * \return Process exit code, zero on success
+     */
+    static int Run(const Options& options);
+};
@@ -0,0 +1,635 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <emmintrin.h>
+#include <immintrin.h>
+
+#include "HistogramEngine.h"
+#include "CpuFeatures.h"
+#include "ThreadPool.h"
+
+#if defined(__GNUC__)
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define TARGET_AVX2
+#endif
+
+using namespace glm;
+
+namespace
+{
+    // voxels scanned and binned at once, small enough to stay in cache
+    const size_t BlockSize = 4096;
+    // voxels a part counts before its 32 bits counters are merged
+    const size_t PartVoxels = static_cast<size_t>(1) << 31;
+    const float Infinity = std::numeric_limits<float>::infinity();
+
+    template <typename T>
+    void rangeScalar(const T* values, size_t count, float& minValue, float& maxValue)
+    {
+        for (size_t i = 0; i < count; i++)
+        {
+            const float value = static_cast<float>(values[i]);
+
+            if (!VoxelTraits<T>::Normalized && !std::isfinite(value)) continue;
+
+            minValue = std::min(minValue, value);
+            maxValue = std::max(maxValue, value);
+        }
+    }
+
+    /**
+     * \brief Bin of each value, -1 for non finite values. Values are clamped before the
+     * conversion so the vector paths truncate exactly like the scalar one
+     */
+    void binFloatScalar(const float* values, size_t count, float low, float scale, float lastBin, int32_t* bins)
+    {
+        for (size_t i = 0; i < count; i++)
+        {
+            const float bin = std::min(std::max((values[i] - low) * scale, 0.0f), lastBin);
+            bins[i] = std::isfinite(values[i]) ? static_cast<int32_t>(bin) : -1;
+        }
+    }
+
+    void range8Sse2(const uint8_t* values, size_t count, float& minValue, float& maxValue)
+    {
+        __m128i low = _mm_set1_epi8(-1);
+        __m128i high = _mm_setzero_si128();
+        size_t i = 0;
+
+        for (; i + 16 <= count; i += 16)
+        {
+            const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(values + i));
+            low = _mm_min_epu8(low, v);
+            high = _mm_max_epu8(high, v);
+        }
+
+        alignas(16) uint8_t lows[16], highs[16];
+        _mm_store_si128(reinterpret_cast<__m128i*>(lows), low);
+        _mm_store_si128(reinterpret_cast<__m128i*>(highs), high);
+
+        if (i > 0)
+        {
+            minValue = std::min<float>(minValue, *std::min_element(lows, lows + 16));
+            maxValue = std::max<float>(maxValue, *std::max_element(highs, highs + 16));
+        }
+
+        rangeScalar(values + i, count - i, minValue, maxValue);
+    }
+
+    /**
+     * \brief SSE2 has no unsigned 16 bits min/max, values are flipped to signed order instead
+     */
+    void range16Sse2(const uint16_t* values, size_t count, float& minValue, float& maxValue)
+    {
+        const __m128i flip = _mm_set1_epi16(static_cast<short>(0x8000));
+        __m128i low = _mm_set1_epi16(0x7fff);
+        __m128i high = flip;
+        size_t i = 0;
+
+        for (; i + 8 <= count; i += 8)
+        {
+            const __m128i v = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(values + i)), flip);
+            low = _mm_min_epi16(low, v);
+            high = _mm_max_epi16(high, v);
+        }
+
+        alignas(16) uint16_t lows[8], highs[8];
+        _mm_store_si128(reinterpret_cast<__m128i*>(lows), _mm_xor_si128(low, flip));
+        _mm_store_si128(reinterpret_cast<__m128i*>(highs), _mm_xor_si128(high, flip));
+
+        if (i > 0)
+        {
+            minValue = std::min<float>(minValue, *std::min_element(lows, lows + 8));
+            maxValue = std::max<float>(maxValue, *std::max_element(highs, highs + 8));
+        }
+
+        rangeScalar(values + i, count - i, minValue, maxValue);
+    }
+
+    void rangeFloatSse2(const float* values, size_t count, float& minValue, float& maxValue)
+    {
+        const __m128 absMask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+        const __m128 infinity = _mm_set1_ps(Infinity);
+        const __m128 negativeInfinity = _mm_set1_ps(-Infinity);
+        __m128 low = infinity;
+        __m128 high = negativeInfinity;
+        size_t i = 0;
+
+        for (; i + 4 <= count; i += 4)
+        {
+            const __m128 v = _mm_loadu_ps(values + i);
+            const __m128 finite = _mm_cmplt_ps(_mm_and_ps(v, absMask), infinity);
+            low = _mm_min_ps(low, _mm_or_ps(_mm_and_ps(finite, v), _mm_andnot_ps(finite, infinity)));
+            high = _mm_max_ps(high, _mm_or_ps(_mm_and_ps(finite, v), _mm_andnot_ps(finite, negativeInfinity)));
+        }
+
+        alignas(16) float lows[4], highs[4];
+        _mm_store_ps(lows, low);
+        _mm_store_ps(highs, high);
+        minValue = std::min(minValue, *std::min_element(lows, lows + 4));
+        maxValue = std::max(maxValue, *std::max_element(highs, highs + 4));
+
+        rangeScalar(values + i, count - i, minValue, maxValue);
+    }
+
+    void binFloatSse2(const float* values, size_t count, float low, float scale, float lastBin, int32_t* bins)
+    {
+        const __m128 absMask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+        const __m128 infinity = _mm_set1_ps(Infinity);
+        const __m128 lowVector = _mm_set1_ps(low);
+        const __m128 scaleVector = _mm_set1_ps(scale);
+        const __m128 lastVector = _mm_set1_ps(lastBin);
+        const __m128 zero = _mm_setzero_ps();
+        const __m128i none = _mm_set1_epi32(-1);
+        size_t i = 0;
+
+        for (; i + 4 <= count; i += 4)
+        {
+            const __m128 v = _mm_loadu_ps(values + i);
+            const __m128i finite = _mm_castps_si128(_mm_cmplt_ps(_mm_and_ps(v, absMask), infinity));
+            const __m128 bin = _mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_sub_ps(v, lowVector), scaleVector), zero),
+                                          lastVector);
+            const __m128i index = _mm_cvttps_epi32(bin);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(bins + i),
+                             _mm_or_si128(_mm_and_si128(finite, index), _mm_andnot_si128(finite, none)));
+        }
+
+        binFloatScalar(values + i, count - i, low, scale, lastBin, bins + i);
+    }
+
+    TARGET_AVX2 void range8Avx2(const uint8_t* values, size_t count, float& minValue, float& maxValue)
+    {
+        __m256i low = _mm256_set1_epi8(-1);
+        __m256i high = _mm256_setzero_si256();
+        size_t i = 0;
+
+        for (; i + 32 <= count; i += 32)
+        {
+            const __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(values + i));
+            low = _mm256_min_epu8(low, v);
+            high = _mm256_max_epu8(high, v);
+        }
+
+        alignas(32) uint8_t lows[32], highs[32];
+        _mm256_store_si256(reinterpret_cast<__m256i*>(lows), low);
+        _mm256_store_si256(reinterpret_cast<__m256i*>(highs), high);
+
+        if (i > 0)
+        {
+            minValue = std::min<float>(minValue, *std::min_element(lows, lows + 32));
+            maxValue = std::max<float>(maxValue, *std::max_element(highs, highs + 32));
+        }
+
+        rangeScalar(values + i, count - i, minValue, maxValue);
+    }
+
+    TARGET_AVX2 void range16Avx2(const uint16_t* values, size_t count, float& minValue, float& maxValue)
+    {
+        __m256i low = _mm256_set1_epi16(-1);
+        __m256i high = _mm256_setzero_si256();
+        size_t i = 0;
+
+        for (; i + 16 <= count; i += 16)
+        {
+            const __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(values + i));
+            low = _mm256_min_epu16(low, v);
+            high = _mm256_max_epu16(high, v);
+        }
+
+        alignas(32) uint16_t lows[16], highs[16];
+        _mm256_store_si256(reinterpret_cast<__m256i*>(lows), low);
+        _mm256_store_si256(reinterpret_cast<__m256i*>(highs), high);
+
+        if (i > 0)
+        {
+            minValue = std::min<float>(minValue, *std::min_element(lows, lows + 16));
+            maxValue = std::max<float>(maxValue, *std::max_element(highs, highs + 16));
+        }
+
+        rangeScalar(values + i, count - i, minValue, maxValue);
+    }
+
+    TARGET_AVX2 void rangeFloatAvx2(const float* values, size_t count, float& minValue, float& maxValue)
+    {
+        const __m256 absMask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff));
+        const __m256 infinity = _mm256_set1_ps(Infinity);
+        const __m256 negativeInfinity = _mm256_set1_ps(-Infinity);
+        __m256 low = infinity;
+        __m256 high = negativeInfinity;
+        size_t i = 0;
+
+        for (; i + 8 <= count; i += 8)
+        {
+            const __m256 v = _mm256_loadu_ps(values + i);
+            const __m256 finite = _mm256_cmp_ps(_mm256_and_ps(v, absMask), infinity, _CMP_LT_OQ);
+            low = _mm256_min_ps(low, _mm256_blendv_ps(infinity, v, finite));
+            high = _mm256_max_ps(high, _mm256_blendv_ps(negativeInfinity, v, finite));
+        }
+
+        alignas(32) float lows[8], highs[8];
+        _mm256_store_ps(lows, low);
+        _mm256_store_ps(highs, high);
+        minValue = std::min(minValue, *std::min_element(lows, lows + 8));
+        maxValue = std::max(maxValue, *std::max_element(highs, highs + 8));
+
+        rangeScalar(values + i, count - i, minValue, maxValue);
+    }
+
+    TARGET_AVX2 void binFloatAvx2(const float* values, size_t count, float low, float scale, float lastBin,
+                                  int32_t* bins)
+    {
+        const __m256 absMask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff));
+        const __m256 infinity = _mm256_set1_ps(Infinity);
+        const __m256 lowVector = _mm256_set1_ps(low);
+        const __m256 scaleVector = _mm256_set1_ps(scale);
+        const __m256 lastVector = _mm256_set1_ps(lastBin);
+        const __m256 zero = _mm256_setzero_ps();
+        const __m256i none = _mm256_set1_epi32(-1);
+        size_t i = 0;
+
+        for (; i + 8 <= count; i += 8)
+        {
+            const __m256 v = _mm256_loadu_ps(values + i);
+            const __m256 finite = _mm256_cmp_ps(_mm256_and_ps(v, absMask), infinity, _CMP_LT_OQ);
+            // separate multiply and subtract, a fused one would round differently than the scalar path
+            const __m256 offset = _mm256_sub_ps(v, lowVector);
+            const __m256 bin = _mm256_min_ps(_mm256_max_ps(_mm256_mul_ps(offset, scaleVector), zero), lastVector);
+            const __m256i index = _mm256_cvttps_epi32(bin);
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(bins + i),
+                                _mm256_blendv_epi8(none, index, _mm256_castps_si256(finite)));
+        }
+
+        binFloatScalar(values + i, count - i, low, scale, lastBin, bins + i);
+    }
+
+    /**
+     * \brief Vectorized kernels of one instruction set
+     */
+    struct Kernels
+    {
+        const char* name;
+        void (*range8)(const uint8_t*, size_t, float&, float&);
+        void (*range16)(const uint16_t*, size_t, float&, float&);
+        void (*rangeFloat)(const float*, size_t, float&, float&);
+        void (*binFloat)(const float*, size_t, float, float, float, int32_t*);
+    };
+
+    const Kernels& bestKernels()
+    {
+        static const Kernels scalar = { "scalar", rangeScalar<uint8_t>, rangeScalar<uint16_t>, rangeScalar<float>,
+                                        binFloatScalar };
+        static const Kernels sse2 = { "SSE2", range8Sse2, range16Sse2, rangeFloatSse2, binFloatSse2 };
+        static const Kernels avx2 = { "AVX2", range8Avx2, range16Avx2, rangeFloatAvx2, binFloatAvx2 };
+
+        return CpuFeatures::HasAvx2() ? avx2 : CpuFeatures::HasSse2() ? sse2 : scalar;
+    }
+
+    void scanRange(VoxelType type, const uint8_t* voxels, size_t count, float& minValue, float& maxValue)
+    {
+        const Kernels& kernels = bestKernels();
+
+        switch (type)
+        {
+        case VoxelType::UInt8: kernels.range8(voxels, count, minValue, maxValue); break;
+        case VoxelType::UInt16:
+            kernels.range16(reinterpret_cast<const uint16_t*>(voxels), count, minValue, maxValue);
+            break;
+        case VoxelType::Float32:
+            kernels.rangeFloat(reinterpret_cast<const float*>(voxels), count, minValue, maxValue);
+            break;
+        }
+    }
+
+    /**
+     * \brief Counts integer values, consecutive values go to different copies of the histogram
+     * so increments of equal bins don't wait on each other
+     */
+    template <typename T>
+    void countIntegers(const T* values, size_t count, int rightShift, int leftShift, uint32_t* counts,
+                       size_t stride)
+    {
+        uint32_t* c0 = counts;
+        uint32_t* c1 = counts + stride;
+        uint32_t* c2 = counts + 2 * stride;
+        uint32_t* c3 = counts + 3 * stride;
+        size_t i = 0;
+
+        for (; i + 4 <= count; i += 4)
+        {
+            c0[(values[i] >> rightShift) << leftShift]++;
+            c1[(values[i + 1] >> rightShift) << leftShift]++;
+            c2[(values[i + 2] >> rightShift) << leftShift]++;
+            c3[(values[i + 3] >> rightShift) << leftShift]++;
+        }
+
+        for (; i < count; i++) { c0[(values[i] >> rightShift) << leftShift]++; }
+    }
+
+    /**
+     * \brief Counts integer values with a shift known at compile time. A word of values is loaded
+     * at once and its lanes count into the histogram copies in turn. Varied values count about as
+     * fast as a plain loop, values falling in a few bins count a lot faster
+     */
+    template <typename T, int RightShift>
+    void countLanes(const T* values, size_t count, uint32_t* counts, size_t stride)
+    {
+        const int lanes = sizeof(uint64_t) / sizeof(T);
+        const int bits = sizeof(T) * 8;
+        const uint64_t mask = (static_cast<uint64_t>(1) << bits) - 1;
+        uint32_t* c0 = counts;
+        uint32_t* c1 = counts + stride;
+        uint32_t* c2 = counts + 2 * stride;
+        uint32_t* c3 = counts + 3 * stride;
+        size_t i = 0;
+
+        for (; i + lanes <= count; i += lanes)
+        {
+            uint64_t word;
+            memcpy(&word, values + i, sizeof(word));
+
+            // which value lands in which copy doesn't matter, so the byte order doesn't either
+            for (int lane = 0; lane < lanes; lane += 4)
+            {
+                c0[(word >> (lane * bits) & mask) >> RightShift]++;
+                c1[(word >> ((lane + 1) * bits) & mask) >> RightShift]++;
+                c2[(word >> ((lane + 2) * bits) & mask) >> RightShift]++;
+                c3[(word >> ((lane + 3) * bits) & mask) >> RightShift]++;
+            }
+        }
+
+        for (; i < count; i++) { c0[values[i] >> RightShift]++; }
+    }
+
+    /**
+     * \brief Counts integer values, 256 bins and one bin per value have their own kernels since
+     * shifts by a variable amount cost more than the increments
+     */
+    template <typename T>
+    void countBlock(const T* values, size_t count, int rightShift, int leftShift, uint32_t* counts, size_t stride)
+    {
+        const int typeBits = sizeof(T) * 8;
+
+        if (leftShift == 0 && rightShift == 0)
+        {
+            countLanes<T, 0>(values, count, counts, stride);
+        }
+        else if (leftShift == 0 && rightShift == typeBits - 8)
+        {
+            countLanes<T, typeBits - 8>(values, count, counts, stride);
+        }
+        else
+        {
+            countIntegers(values, count, rightShift, leftShift, counts, stride);
+        }
+    }
+
+    void countBins(const int32_t* bins, size_t count, uint32_t* counts, size_t stride)
+    {
+        uint32_t* copies[4] = { counts, counts + stride, counts + 2 * stride, counts + 3 * stride };
+
+        for (size_t i = 0; i < count; i++)
+        {
+            if (bins[i] >= 0) copies[i & 3][bins[i]]++;
+        }
+    }
+}
+
+HistogramEngine::HistogramEngine(VoxelType type, int binCount) : type(type), binCount(clamp(binCount, 1, 65536)),
+                                                                  rightShift(0), leftShift(0), domainLow(0),
+                                                                  domainScale(0), copies(binCount <= 256 ? 4 : 1),
+                                                                  minValue(Infinity), maxValue(-Infinity), total(0)
+{
+    int bits = 0;
+
+    while ((1 << bits) < this->binCount) bits++;
+
+    // integer bins cover the whole range of the type
+    const int typeBits = static_cast<int>(GetVoxelSize(type) * 8);
+    rightShift = std::max(typeBits - bits, 0);
+    leftShift = std::max(bits - typeBits, 0);
+    counts.assign(this->binCount, 0);
+    // floats default to the normalized range
+    setDomain(0, 1);
+}
+
+void HistogramEngine::setDomain(float low, float high)
+{
+    domainLow = low;
+    domainScale = binCount / (high - low);
+}
+
+void HistogramEngine::accumulate(const uint8_t* voxels, size_t count)
+{
+    const size_t voxelSize = GetVoxelSize(type);
+
+    // linear runs are counted as rows of one block
+    countRows((count + BlockSize - 1) / BlockSize, BlockSize, [=](size_t row, size_t& rowVoxels)
+    {
+        rowVoxels = std::min(BlockSize, count - row * BlockSize);
+        return voxels + row * BlockSize * voxelSize;
+    });
+}
+
+void HistogramEngine::accumulate(const uint8_t* volume, const ivec3& dimensions, const ivec3& origin,
+                                 const ivec3& size)
+{
+    const ivec3 begin = clamp(origin, ivec3(0), dimensions);
+    const ivec3 box = clamp(origin + size, ivec3(0), dimensions) - begin;
+    const size_t voxelSize = GetVoxelSize(type);
+
+    if (any(lessThanEqual(box, ivec3(0)))) return;
+
+    countRows(static_cast<size_t>(box.y) * box.z, box.x, [=](size_t row, size_t& rowVoxels)
+    {
+        const size_t y = begin.y + row % box.y;
+        const size_t z = begin.z + row / box.y;
+        rowVoxels = box.x;
+        return volume + ((z * dimensions.y + y) * dimensions.x + begin.x) * voxelSize;
+    });
+}
+
+void HistogramEngine::reset()
+{
+    std::fill(counts.begin(), counts.end(), 0);
+    minValue = Infinity;
+    maxValue = -Infinity;
+    total = 0;
+}
+
+template <typename RowData>
+void HistogramEngine::countRows(size_t rows, size_t rowVoxels, const RowData& rowData)
+{
+    if (rows == 0) return;
+
+    ThreadPool& pool = ThreadPool::instance();
+    const int partCount = static_cast<int>(std::min<size_t>(pool.getThreadCount(), rows));
+    // rows counted per batch, no 32 bits counter of a part can overflow within a batch
+    const size_t batchRows = std::max<size_t>(PartVoxels / rowVoxels, 1) * partCount;
+
+    if (parts.size() < static_cast<size_t>(partCount)) parts.resize(partCount);
+
+    for (size_t first = 0; first < rows; first += batchRows)
+    {
+        const size_t batch = std::min(batchRows, rows - first);
+
+        // each thread counts its own rows into its own part
+        pool.parallelFor(0, partCount, [&](int index)
+        {
+            Part& part = parts[index];
+            part.counts.assign(static_cast<size_t>(binCount) * copies, 0);
+            part.minValue = Infinity;
+            part.maxValue = -Infinity;
+
+            const size_t end = first + batch * (index + 1) / partCount;
+
+            for (size_t row = first + batch * index / partCount; row < end; row++)
+            {
+                size_t voxels;
+                const uint8_t* data = rowData(row, voxels);
+                countRun(part, data, voxels);
+            }
+
+            // with one bin per value the range is read from the first and last counted bins
+            if (hasExactBins())
+            {
+                for (int bin = 0; bin < binCount; bin++)
+                {
+                    for (int copy = 0; copy < copies; copy++)
+                    {
+                        if (part.counts[copy * binCount + bin] == 0) continue;
+
+                        part.minValue = std::min(part.minValue, static_cast<float>(bin));
+                        part.maxValue = std::max(part.maxValue, static_cast<float>(bin));
+                    }
+                }
+            }
+        });
+
+        // merge the parts, big histograms are merged by bin ranges in parallel
+        const int mergeChunk = 4096;
+        std::vector<uint64_t> chunkTotals((binCount + mergeChunk - 1) / mergeChunk, 0);
+
+        pool.parallelFor(0, static_cast<int>(chunkTotals.size()), [&](int chunk)
+        {
+            const int end = std::min(binCount, (chunk + 1) * mergeChunk);
+
+            for (int bin = chunk * mergeChunk; bin < end; bin++)
+            {
+                uint64_t sum = 0;
+
+                for (int index = 0; index < partCount; index++)
+                {
+                    for (int copy = 0; copy < copies; copy++) { sum += parts[index].counts[copy * binCount + bin]; }
+                }
+
+                counts[bin] += sum;
+                chunkTotals[chunk] += sum;
+            }
+        });
+
+        for (uint64_t chunkTotal : chunkTotals) { total += chunkTotal; }
+
+        for (int index = 0; index < partCount; index++)
+        {
+            minValue = std::min(minValue, parts[index].minValue);
+            maxValue = std::max(maxValue, parts[index].maxValue);
+        }
+    }
+}
+
+void HistogramEngine::countRun(Part& part, const uint8_t* voxels, size_t count) const
+{
+    const size_t voxelSize = GetVoxelSize(type);
+    const size_t stride = copies > 1 ? binCount : 0;
+    const float lastBin = static_cast<float>(binCount - 1);
+    int32_t bins[BlockSize];
+
+    const bool scan = !hasExactBins();
+
+    // the block is scanned for its range and counted while it's in cache
+    for (size_t offset = 0; offset < count; offset += BlockSize)
+    {
+        const size_t blockCount = std::min(BlockSize, count - offset);
+        const uint8_t* block = voxels + offset * voxelSize;
+
+        if (scan) scanRange(type, block, blockCount, part.minValue, part.maxValue);
+
+        switch (type)
+        {
+        case VoxelType::UInt8:
+            countBlock(block, blockCount, rightShift, leftShift, part.counts.data(), stride);
+            break;
+        case VoxelType::UInt16:
+            countBlock(reinterpret_cast<const uint16_t*>(block), blockCount, rightShift, leftShift,
+                       part.counts.data(), stride);
+            break;
+        case VoxelType::Float32:
+            bestKernels().binFloat(reinterpret_cast<const float*>(block), blockCount, domainLow, domainScale, lastBin,
+                                   bins);
+            countBins(bins, blockCount, part.counts.data(), stride);
+            break;
+        }
+    }
+}
+
+bool HistogramEngine::hasExactBins() const
+{
+    return type != VoxelType::Float32 && rightShift == 0 && leftShift == 0;
+}
+
+const std::vector<uint64_t>& HistogramEngine::getCounts() const
+{
+    return counts;
+}
+
+vec2 HistogramEngine::getValueRange() const
+{
+    return minValue > maxValue ? vec2(0) : vec2(minValue, maxValue);
+}
+
+uint64_t HistogramEngine::getTotal() const
+{
+    return total;
+}
+
+int HistogramEngine::getBinCount() const
+{
+    return binCount;
+}
+
+VoxelType HistogramEngine::getVoxelType() const
+{
+    return type;
+}
+
+vec2 HistogramEngine::FindValueRange(VoxelType type, const uint8_t* voxels, size_t count)
+{
+    ThreadPool& pool = ThreadPool::instance();
+    const int partCount = static_cast<int>(std::max<size_t>(std::min<size_t>(pool.getThreadCount(), count), 1));
+    const size_t voxelSize = GetVoxelSize(type);
+    std::vector<vec2> ranges(partCount, vec2(Infinity, -Infinity));
+
+    pool.parallelFor(0, partCount, [&](int part)
+    {
+        const size_t begin = count * part / partCount;
+        const size_t end = count * (part + 1) / partCount;
+        scanRange(type, voxels + begin * voxelSize, end - begin, ranges[part].x, ranges[part].y);
+    });
+
+    vec2 range(Infinity, -Infinity);
+
+    for (const vec2& part : ranges)
+    {
+        range.x = std::min(range.x, part.x);
+        range.y = std::max(range.y, part.y);
+    }
+
+    return range;
+}
+
+const char* HistogramEngine::GetKernelName()
+{
+    return bestKernels().name;
+}
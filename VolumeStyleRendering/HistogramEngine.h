@@ -0,0 +1,119 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+#include <cinder/CinderGlm.h>
+
+#include "VoxelType.h"
+
+/**
+ * \brief Counts voxel histograms on the CPU. The voxels are split between the thread pool
+ * threads, each counting into its own sub-histograms so no counter is shared, and the
+ * sub-histograms are merged once all threads are done. Binning and value range scans use
+ * SSE2 or AVX2 when available. Counts add up over calls, so a volume can be counted slab by slab
+ */
+class HistogramEngine
+{
+public:
+    /**
+     * \brief Creates an empty histogram
+     * \param type Type of the counted voxels
+     * \param binCount Number of bins, a power of two up to 65536. Integer values are binned by
+     * their high bits, 256 bins bin 16 bits values by their high byte
+     */
+    HistogramEngine(VoxelType type, int binCount = 256);
+
+    /**
+     * \brief Sets the float values covered by the bins, values outside are counted in the
+     * first or last bin and non finite values aren't counted
+     * \param low Value at the start of the first bin
+     * \param high Value at the end of the last bin
+     */
+    void setDomain(float low, float high);
+    /**
+     * \brief Counts tightly packed voxels
+     * \param voxels The voxels
+     * \param count Number of voxels
+     */
+    void accumulate(const uint8_t* voxels, size_t count);
+    /**
+     * \brief Counts the voxels of a box inside a volume, rows of the box are split between threads
+     * \param volume The volume voxels, tightly packed in x, y, z order
+     * \param dimensions The volume dimensions
+     * \param origin First voxel of the box
+     * \param size Box size, clipped to the volume
+     */
+    void accumulate(const uint8_t* volume, const glm::ivec3& dimensions, const glm::ivec3& origin,
+                    const glm::ivec3& size);
+    /**
+     * \brief Clears the counts and the value range, the domain is kept
+     */
+    void reset();
+
+    const std::vector<uint64_t> &getCounts() const;
+    /**
+     * \brief Minimum and maximum finite value counted so far
+     * \return The value range, zero if nothing was counted
+     */
+    glm::vec2 getValueRange() const;
+    uint64_t getTotal() const;
+    int getBinCount() const;
+    VoxelType getVoxelType() const;
+
+    /**
+     * \brief Finds the finite value range of tightly packed voxels, in parallel
+     * \param type Type of the voxels
+     * \param voxels The voxels
+     * \param count Number of voxels
+     * \return Minimum and maximum value, min > max if no value is finite
+     */
+    static glm::vec2 FindValueRange(VoxelType type, const uint8_t* voxels, size_t count);
+    /**
+     * \brief Name of the vector extension used for binning and range scans, for reports
+     * \return AVX2, SSE2 or scalar
+     */
+    static const char* GetKernelName();
+private:
+    /**
+     * \brief Counters of a single thread
+     */
+    struct Part
+    {
+        std::vector<uint32_t> counts;
+        float minValue;
+        float maxValue;
+    };
+
+    VoxelType type;
+    int binCount;
+    // 8 and 16 bits values are binned as (value >> rightShift) << leftShift
+    int rightShift;
+    int leftShift;
+    float domainLow;
+    float domainScale;
+    // small histograms interleave increments between copies to break store dependencies
+    int copies;
+
+    std::vector<uint64_t> counts;
+    std::vector<Part> parts;
+    float minValue;
+    float maxValue;
+    uint64_t total;
+
+    /**
+     * \brief Determines if each integer value has a bin of its own, their range is then found from
+     * the counts instead of scanning the voxels
+     */
+    bool hasExactBins() const;
+    /**
+     * \brief Counts a run of voxels into the given part
+     */
+    void countRun(Part& part, const uint8_t* voxels, size_t count) const;
+    /**
+     * \brief Splits rows between the thread pool threads, counts them and merges the parts
+     * \param rows Number of rows
+     * \param rowVoxels Number of voxels of each row
+     * \param rowData Start of the given row
+     */
+    template <typename RowData>
+    void countRows(size_t rows, size_t rowVoxels, const RowData& rowData);
+};
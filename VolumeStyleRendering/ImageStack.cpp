@@ -0,0 +1,212 @@
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <mutex>
+#include <cinder/Filesystem.h>
+#include <cinder/ImageIo.h>
+#if defined(CINDER_MSW)
+#include <cinder/msw/CinderMsw.h>
+#endif
+
+#include "ImageStack.h"
+#include "ThreadPool.h"
+
+using namespace ci;
+using namespace glm;
+
+namespace
+{
+    /**
+     * \brief Image target writing the decoded rows of a slice straight into the volume buffer,
+     * the image source converts its pixels to single channel gray values of the volume's voxel type
+     */
+    class SliceTarget : public ImageTarget
+    {
+    public:
+        SliceTarget(int width, int height, VoxelType type, uint8_t* slice) : slice(slice),
+                                                                             rowBytes(width * GetVoxelSize(type))
+        {
+            setSize(width, height);
+            setChannelOrder(ImageIo::Y);
+            setColorModel(ImageIo::CM_GRAY);
+            setDataType(type == VoxelType::Float32 ? ImageIo::FLOAT32 :
+                        type == VoxelType::UInt16 ? ImageIo::UINT16 : ImageIo::UINT8);
+        }
+
+        void* getRowPointer(int32_t row) override
+        {
+            return slice + static_cast<size_t>(row) * rowBytes;
+        }
+    private:
+        uint8_t* slice;
+        size_t rowBytes;
+    };
+
+    /**
+     * \brief Compares file names so that digit runs are ordered by their numeric value
+     */
+    bool naturalLess(const std::string& a, const std::string& b)
+    {
+        size_t i = 0, j = 0;
+
+        while (i < a.size() && j < b.size())
+        {
+            if (isdigit(a[i]) && isdigit(b[j]))
+            {
+                // skip leading zeros, a longer digit run is a bigger number
+                while (i < a.size() && a[i] == '0') i++;
+                while (j < b.size() && b[j] == '0') j++;
+
+                size_t endA = i, endB = j;
+
+                while (endA < a.size() && isdigit(a[endA])) endA++;
+                while (endB < b.size() && isdigit(b[endB])) endB++;
+
+                if (endA - i != endB - j) return endA - i < endB - j;
+
+                const int order = a.compare(i, endA - i, b, j, endB - j);
+
+                if (order != 0) return order < 0;
+
+                i = endA;
+                j = endB;
+            }
+            else
+            {
+                if (a[i] != b[j]) return a[i] < b[j];
+
+                i++;
+                j++;
+            }
+        }
+
+        return a.size() - i < b.size() - j;
+    }
+
+    /**
+     * \brief Image decoding may rely on COM, every decoding thread needs it initialized
+     */
+    void initializeDecoderThread()
+    {
+#if defined(CINDER_MSW)
+        msw::initializeCom();
+#endif
+    }
+}
+
+ImageStack::ImageStack(const std::string& directory) : dimensions(0), voxelType(VoxelType::UInt8)
+{
+    if (!fs::is_directory(directory))
+    {
+        error = directory + " is not a directory";
+        return;
+    }
+
+    for (fs::directory_iterator it(directory), end; it != end; ++it)
+    {
+        if (fs::is_regular_file(it->path()) && IsSliceImage(it->path().string()))
+        {
+            files.push_back(it->path().string());
+        }
+    }
+
+    if (files.empty())
+    {
+        error = "No slice images found in " + directory;
+        return;
+    }
+
+    std::sort(files.begin(), files.end(), naturalLess);
+
+    // the first slice determines the stack layout
+    try
+    {
+        initializeDecoderThread();
+        auto source = loadImage(files.front());
+        dimensions = ivec3(source->getWidth(), source->getHeight(), static_cast<int>(files.size()));
+        const ImageIo::DataType dataType = source->getDataType();
+
+        if (dataType == ImageIo::FLOAT32 || dataType == ImageIo::FLOAT16) voxelType = VoxelType::Float32;
+        else if (dataType == ImageIo::UINT16) voxelType = VoxelType::UInt16;
+    }
+    catch (const Exception& e)
+    {
+        error = "Couldn't read slice " + files.front() + ": " + e.what();
+        files.clear();
+    }
+}
+
+bool ImageStack::isOpen() const
+{
+    return !files.empty();
+}
+
+const std::string& ImageStack::getError() const
+{
+    return error;
+}
+
+bool ImageStack::decodeSlices(int zOffset, int depth, uint8_t* destination)
+{
+    const size_t sliceBytes = static_cast<size_t>(dimensions.x) * dimensions.y * GetVoxelSize(voxelType);
+    std::atomic<bool> decoded(true);
+    std::mutex errorMutex;
+
+    ThreadPool::instance().parallelFor(zOffset, zOffset + depth, [&](int z)
+    {
+        if (!decoded) return;
+
+        try
+        {
+            initializeDecoderThread();
+            auto source = loadImage(files[z]);
+
+            if (source->getWidth() != dimensions.x || source->getHeight() != dimensions.y)
+            {
+                throw ImageIoException("slice is " + std::to_string(source->getWidth()) + "x" +
+                                       std::to_string(source->getHeight()) + ", expected " +
+                                       std::to_string(dimensions.x) + "x" + std::to_string(dimensions.y));
+            }
+
+            uint8_t* slice = destination + (z - zOffset) * sliceBytes;
+            source->load(std::make_shared<SliceTarget>(dimensions.x, dimensions.y, voxelType, slice));
+        }
+        catch (const Exception& e)
+        {
+            std::lock_guard<std::mutex> lock(errorMutex);
+            error = "Couldn't decode slice " + files[z] + ": " + e.what();
+            decoded = false;
+        }
+    });
+
+    return decoded;
+}
+
+const ivec3& ImageStack::getDimensions() const
+{
+    return dimensions;
+}
+
+VoxelType ImageStack::getVoxelType() const
+{
+    return voxelType;
+}
+
+const std::vector<std::string>& ImageStack::getFiles() const
+{
+    return files;
+}
+
+bool ImageStack::IsSliceImage(const std::string& filepath)
+{
+    std::string extension = fs::path(filepath).extension().string();
+    std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+
+    return extension == ".png" || extension == ".tif" || extension == ".tiff" || extension == ".bmp" ||
+           extension == ".jpg" || extension == ".jpeg";
+}
+
+bool ImageStack::IsStackDirectory(const std::string& path)
+{
+    return fs::is_directory(path);
+}
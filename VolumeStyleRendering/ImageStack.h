@@ -0,0 +1,63 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <cinder/CinderGlm.h>
+
+#include "VoxelType.h"
+
+/**
+ * \brief A volume stored as a directory of per-slice images. Slices are ordered by file name,
+ * numbers inside the names are compared by value so slice_2 comes before slice_10
+ */
+class ImageStack
+{
+public:
+    /**
+     * \brief Lists the slice images in the given directory and reads the volume dimensions and
+     * voxel type from the first one, float images such as 32 bits tiffs give float volumes
+     * \param directory The directory containing the slices
+     */
+    explicit ImageStack(const std::string& directory);
+
+    /**
+     * \brief Determines if slices were found and the first one could be read
+     * \return True if the stack can be decoded
+     */
+    bool isOpen() const;
+    /**
+     * \brief Describes why the stack couldn't be opened or a slice couldn't be decoded
+     * \return The error message
+     */
+    const std::string &getError() const;
+    /**
+     * \brief Decodes the given range of slices in parallel, each slice is written straight into
+     * its place of the destination buffer
+     * \param zOffset First slice to decode
+     * \param depth Number of slices to decode
+     * \param destination Buffer with room for depth tightly packed slices
+     * \return False if a slice couldn't be decoded or doesn't match the stack dimensions
+     */
+    bool decodeSlices(int zOffset, int depth, uint8_t* destination);
+
+    const glm::ivec3 &getDimensions() const;
+    VoxelType getVoxelType() const;
+    const std::vector<std::string> &getFiles() const;
+
+    /**
+     * \brief Determines if the given file has an extension used for slice images
+     * \param filepath The file path
+     * \return True for png, tif, tiff, bmp and jpg files
+     */
+    static bool IsSliceImage(const std::string& filepath);
+    /**
+     * \brief Determines if the given path is a directory, and thus should hold an image stack
+     * \param path The file or directory path
+     * \return True for directories
+     */
+    static bool IsStackDirectory(const std::string& path);
+private:
+    std::vector<std::string> files;
+    glm::ivec3 dimensions;
+    VoxelType voxelType;
+    std::string error;
+};
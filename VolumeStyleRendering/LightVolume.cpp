@@ -0,0 +1,249 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
+#include "LightVolume.h"
+#include "ThreadPool.h"
+#include "VolumeSampler.h"
+
+using namespace glm;
+
+namespace
+{
+    /**
+     * \brief Adds the voxels of the given slices and rows to the sums of a row of cells
+     */
+    template <typename T>
+    void addCellRow(const T* voxels, const ivec3& dimensions, const std::vector<int>& xBounds, int z0, int z1,
+                    int y0, int y1, double* sums, uint32_t* counts)
+    {
+        const int cells = static_cast<int>(xBounds.size()) - 1;
+
+        for (int k = z0; k < z1; k++)
+        {
+            for (int j = y0; j < y1; j++)
+            {
+                const T* row = voxels + (static_cast<size_t>(k) * dimensions.y + j) * dimensions.x;
+
+                for (int x = 0; x < cells; x++)
+                {
+                    for (int i = xBounds[x]; i < xBounds[x + 1]; i++)
+                    {
+                        const float value = VolumeSampler<T>::ToTexture(row[i]);
+
+                        if (!std::isfinite(value)) continue;
+
+                        sums[x] += value;
+                        counts[x]++;
+                    }
+                }
+            }
+        }
+    }
+
+    /**
+     * \brief Opacity of a volume texture value, as the raycast reads it from the linearly
+     * filtered transfer function
+     */
+    float opacity(const LightVolume::Parameters& parameters, float value)
+    {
+        const float mapped = value * parameters.valueMapping.x + parameters.valueMapping.y;
+
+        if (!(mapped >= parameters.threshold.x / 255.0f && mapped <= parameters.threshold.y / 255.0f)) return 0;
+
+        const float texel = clamp(mapped * 256 - 0.5f, 0.0f, 255.0f);
+        const int first = static_cast<int>(texel);
+        const int second = std::min(first + 1, 255);
+
+        return mix(parameters.opacities[first], parameters.opacities[second], texel - first);
+    }
+}
+
+bool LightVolume::Parameters::operator==(const Parameters& other) const
+{
+    return direction == other.direction && opacities == other.opacities && threshold == other.threshold &&
+           valueMapping == other.valueMapping;
+}
+
+LightVolume::LightVolume() : dimensions(0), size(0), maxSize(0), seconds(0)
+{
+    parameters.direction = vec3(0);
+    parameters.opacities.fill(0);
+    parameters.threshold = ivec2(0);
+    parameters.valueMapping = vec2(0);
+}
+
+void LightVolume::begin(const ivec3& dimensions, const ivec3& size)
+{
+    this->dimensions = dimensions;
+    this->size = clamp(size, ivec3(1), dimensions);
+    maxSize = static_cast<float>(std::max(dimensions.x, std::max(dimensions.y, dimensions.z)));
+    const vec3 cell = vec3(dimensions) / vec3(this->size);
+
+    // cells cover whole voxels, the last one ends with the volume
+    for (int axis = 0; axis < 3; axis++)
+    {
+        bounds[axis].resize(this->size[axis] + 1);
+
+        for (int i = 0; i < this->size[axis]; i++) { bounds[axis][i] = static_cast<int>(i * cell[axis]); }
+
+        bounds[axis].back() = dimensions[axis];
+    }
+
+    const size_t cells = static_cast<size_t>(this->size.x) * this->size.y * this->size.z;
+    sums.assign(cells, 0.0);
+    counts.assign(cells, 0);
+    values.clear();
+    transmittance.assign(cells, 255);
+    // computed again for the new values
+    parameters.direction = vec3(0);
+}
+
+void LightVolume::addSlices(const uint8_t* voxels, VoxelType type, int first, int depth)
+{
+    const std::vector<int>& zBounds = bounds[2];
+    const int end = first + depth;
+    // cells the slices fall in
+    const int firstCell = static_cast<int>(std::upper_bound(zBounds.begin(), zBounds.end(), first) -
+                                           zBounds.begin()) - 1;
+    const int endCell = static_cast<int>(std::lower_bound(zBounds.begin(), zBounds.end(), end) - zBounds.begin());
+    const size_t sliceSize = static_cast<size_t>(size.x) * size.y;
+
+    // each task sums a row of cells, so no cell is shared between threads
+    ThreadPool::instance().parallelFor(0, (endCell - firstCell) * size.y, [&](int task)
+    {
+        const int z = firstCell + task / size.y;
+        const int y = task % size.y;
+        const size_t cell = z * sliceSize + static_cast<size_t>(y) * size.x;
+
+        DispatchVoxelType(type, [&](auto tag)
+        {
+            using T = std::remove_pointer_t<decltype(tag)>;
+            addCellRow(reinterpret_cast<const T*>(voxels), dimensions, bounds[0], std::max(zBounds[z], first) - first,
+                       std::min(zBounds[z + 1], end) - first, bounds[1][y], bounds[1][y + 1], sums.data() + cell,
+                       counts.data() + cell);
+        });
+    });
+}
+
+void LightVolume::finish()
+{
+    values.resize(sums.size());
+
+    for (size_t i = 0; i < values.size(); i++)
+    {
+        values[i] = counts[i] ? static_cast<float>(sums[i] / counts[i]) : 0.0f;
+    }
+
+    // only the averages are kept
+    std::vector<double>().swap(sums);
+    std::vector<uint32_t>().swap(counts);
+}
+
+void LightVolume::compute(const Parameters& parameters)
+{
+    const auto start = std::chrono::steady_clock::now();
+    this->parameters = parameters;
+
+    if (values.empty()) return;
+
+    // the occlusion march looks for occluders along the direction, light comes from that side
+    const vec3 direction = length(parameters.direction) > 0 ? normalize(parameters.direction) : vec3(0, 0, 1);
+    const vec3 magnitude = abs(direction);
+    // slices are swept along the axis closest to the light, u and v span each slice
+    const int axis = magnitude.x >= magnitude.y && magnitude.x >= magnitude.z ? 0 : magnitude.y >= magnitude.z ? 1 : 2;
+    const int u = (axis + 1) % 3;
+    const int v = (axis + 2) % 3;
+    const size_t strides[3] = { 1, static_cast<size_t>(size.x), static_cast<size_t>(size.x) * size.y };
+    // slices nearest to the light come first
+    const int first = direction[axis] > 0 ? size[axis] - 1 : 0;
+    const int order = direction[axis] > 0 ? -1 : 1;
+
+    // a cell receives the light leaving the previous slice at this offset, in cells of u and v
+    const float toSlice = 1.0f / (size[axis] * magnitude[axis]);
+    const vec2 offset(direction[u] * toSlice * size[u], direction[v] * toSlice * size[v]);
+    // the raycast corrects the transfer function opacity from half voxel steps
+    const float exponent = toSlice * maxSize / 0.5f;
+
+    // opacity of each cell along the light path through it
+    std::vector<float> alpha(values.size());
+
+    ThreadPool::instance().parallelFor(0, size.z, [&](int z)
+    {
+        const size_t begin = z * strides[2];
+
+        for (size_t i = begin; i < begin + strides[2]; i++)
+        {
+            alpha[i] = 1 - std::pow(1 - opacity(parameters, values[i]), exponent);
+        }
+    });
+
+    const int width = size[u];
+    const int height = size[v];
+    // light leaving the previous slice and the one being swept
+    std::vector<float> previous(static_cast<size_t>(width) * height, 1.0f);
+    std::vector<float> current(previous.size());
+
+    for (int s = 0; s < size[axis]; s++)
+    {
+        const size_t slice = (first + s * order) * strides[axis];
+
+        // each cell attenuates the light it receives from the cells of the previous slice behind it,
+        // so the rows of a slice are split between the threads and only wait on the slices before
+        ThreadPool::instance().parallelFor(0, height, [&](int j)
+        {
+            const float y = j + offset.y;
+            const int y0 = static_cast<int>(std::floor(y));
+            const float ty = y - y0;
+
+            for (int i = 0; i < width; i++)
+            {
+                const float x = i + offset.x;
+                const int x0 = static_cast<int>(std::floor(x));
+                const float tx = x - x0;
+
+                // light enters unoccluded from outside the volume
+                auto fetch = [&](int a, int b)
+                {
+                    return a < 0 || b < 0 || a >= width || b >= height ? 1.0f :
+                                                                         previous[static_cast<size_t>(b) * width + a];
+                };
+
+                const float received = mix(mix(fetch(x0, y0), fetch(x0 + 1, y0), tx),
+                                           mix(fetch(x0, y0 + 1), fetch(x0 + 1, y0 + 1), tx), ty);
+                const size_t cell = slice + i * strides[u] + j * strides[v];
+                transmittance[cell] = static_cast<uint8_t>(received * 255 + 0.5f);
+                current[static_cast<size_t>(j) * width + i] = received * (1 - alpha[cell]);
+            }
+        });
+
+        previous.swap(current);
+    }
+
+    seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+const std::vector<uint8_t>& LightVolume::getTransmittance() const
+{
+    return transmittance;
+}
+
+const ivec3& LightVolume::getSize() const
+{
+    return size;
+}
+
+ivec3 LightVolume::GetSize(const ivec3& dimensions, float scale)
+{
+    return clamp(ivec3(vec3(dimensions) * scale + 0.5f), ivec3(1), dimensions);
+}
+
+const LightVolume::Parameters& LightVolume::getParameters() const
+{
+    return parameters;
+}
+
+double LightVolume::getSeconds() const
+{
+    return seconds;
+}
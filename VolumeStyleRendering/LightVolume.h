@@ -0,0 +1,97 @@
+#pragma once
+#include <array>
+#include <cstdint>
+#include <vector>
+#include <cinder/CinderGlm.h>
+
+#include "VoxelType.h"
+
+/**
+ * \brief Transmittance of the light reaching each cell of a coarse copy of the volume
+ */
+class LightVolume
+{
+public:
+    /**
+     * \brief Everything the transmittance depends on besides the volume values
+     */
+    struct Parameters
+    {
+        // direction towards the light in volume texture space, like the occlusion march
+        glm::vec3 direction;
+        // transfer function opacities
+        std::array<float, 256> opacities;
+        // window of the visible values in [0..255]
+        glm::ivec2 threshold;
+        // scale and offset mapping volume values to the transfer function domain
+        glm::vec2 valueMapping;
+
+        bool operator==(const Parameters& other) const;
+    };
+
+    LightVolume();
+
+    /**
+     * \brief Starts averaging a volume handed slice by slice with addSlices into the cells of a
+     * coarser grid
+     * \param dimensions The volume dimensions
+     * \param size Cells along each axis of the coarse grid
+     */
+    void begin(const glm::ivec3& dimensions, const glm::ivec3& size);
+    /**
+     * \brief Adds the given slices to the averages of the cells covering them
+     * \param voxels Tightly packed slices of the volume
+     * \param type Type of the voxels
+     * \param first Index of the first slice
+     * \param depth Number of slices
+     */
+    void addSlices(const uint8_t* voxels, VoxelType type, int first, int depth);
+    /**
+     * \brief Takes the cell averages once every slice was added
+     */
+    void finish();
+    /**
+     * \brief Propagates the light through the cells
+     * \param parameters The light and transfer function
+     */
+    void compute(const Parameters& parameters);
+
+    /**
+     * \brief One byte per cell in x, y, z order, 255 for cells reached by all of the light
+     * \return The transmittance for a texture upload
+     */
+    const std::vector<uint8_t> &getTransmittance() const;
+    const glm::ivec3 &getSize() const;
+    /**
+     * \brief Cells of the light volume of a volume
+     * \param dimensions The volume dimensions
+     * \param scale Cells per voxel along each axis
+     * \return The cells along each axis, at least one and at most a cell per voxel
+     */
+    static glm::ivec3 GetSize(const glm::ivec3& dimensions, float scale);
+    /**
+     * \brief Parameters of the last computation
+     * \return The light parameters
+     */
+    const Parameters &getParameters() const;
+    /**
+     * \brief Time the last computation took
+     * \return The computation time in seconds
+     */
+    double getSeconds() const;
+private:
+    glm::ivec3 dimensions;
+    glm::ivec3 size;
+    // largest volume dimension, the raycast steps are measured in its voxels
+    float maxSize;
+    // first voxel of each cell along each axis, the last entry ends the volume
+    std::vector<int> bounds[3];
+    // voxel sums and counts of each cell while slices are added
+    std::vector<double> sums;
+    std::vector<uint32_t> counts;
+    // volume values averaged over each cell
+    std::vector<float> values;
+    std::vector<uint8_t> transmittance;
+    Parameters parameters;
+    double seconds;
+};
@@ -0,0 +1,178 @@
+#include <algorithm>
+
+#include "MappedFile.h"
+
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+    size_t pageSize()
+    {
+#if defined(_WIN32)
+        SYSTEM_INFO info;
+        GetSystemInfo(&info);
+        return static_cast<size_t>(info.dwPageSize);
+#else
+        return static_cast<size_t>(sysconf(_SC_PAGESIZE));
+#endif
+    }
+}
+
+#if defined(_WIN32)
+MappedFile::MappedFile(const std::string& filepath, bool sequential) : mapping(nullptr), length(0),
+                                                                        fileHandle(INVALID_HANDLE_VALUE),
+                                                                        mappingHandle(nullptr)
+{
+    const DWORD flags = FILE_ATTRIBUTE_READONLY | (sequential ? FILE_FLAG_SEQUENTIAL_SCAN : FILE_FLAG_RANDOM_ACCESS);
+    fileHandle = CreateFileA(filepath.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, flags, nullptr);
+
+    // error opening given filepath
+    if (fileHandle == INVALID_HANDLE_VALUE) return;
+
+    LARGE_INTEGER fileSize;
+
+    if (!GetFileSizeEx(fileHandle, &fileSize) || fileSize.QuadPart == 0)
+    {
+        close();
+        return;
+    }
+
+    mappingHandle = CreateFileMappingA(fileHandle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+
+    if (mappingHandle == nullptr)
+    {
+        close();
+        return;
+    }
+
+    mapping = static_cast<const uint8_t*>(MapViewOfFile(mappingHandle, FILE_MAP_READ, 0, 0, 0));
+    length = mapping ? static_cast<size_t>(fileSize.QuadPart) : 0;
+
+    if (!mapping) close();
+}
+
+void MappedFile::prefetch(size_t offset, size_t bytes) const
+{
+    if (!mapping || offset >= length) return;
+
+    const size_t page = pageSize();
+    const size_t begin = offset - offset % page;
+    const size_t end = std::min(offset + bytes, length);
+    WIN32_MEMORY_RANGE_ENTRY range;
+    range.VirtualAddress = const_cast<uint8_t*>(mapping + begin);
+    range.NumberOfBytes = end - begin;
+    PrefetchVirtualMemory(GetCurrentProcess(), 1, &range, 0);
+}
+
+void MappedFile::release(size_t offset, size_t bytes) const
+{
+    if (!mapping || offset >= length) return;
+
+    const size_t page = pageSize();
+    const size_t begin = offset - offset % page;
+    const size_t end = std::min(offset + bytes, length);
+    // unlocking pages that aren't locked removes them from the working set
+    VirtualUnlock(const_cast<uint8_t*>(mapping + begin), end - begin);
+}
+
+void MappedFile::close()
+{
+    if (mapping) UnmapViewOfFile(mapping);
+    if (mappingHandle) CloseHandle(mappingHandle);
+    if (fileHandle != INVALID_HANDLE_VALUE) CloseHandle(fileHandle);
+
+    mapping = nullptr;
+    mappingHandle = nullptr;
+    fileHandle = INVALID_HANDLE_VALUE;
+    length = 0;
+}
+#else
+MappedFile::MappedFile(const std::string& filepath, bool sequential) : mapping(nullptr), length(0),
+                                                                        fileDescriptor(-1)
+{
+    fileDescriptor = open(filepath.c_str(), O_RDONLY);
+
+    // error opening given filepath
+    if (fileDescriptor < 0) return;
+
+    struct stat fileStat;
+
+    if (fstat(fileDescriptor, &fileStat) != 0 || fileStat.st_size == 0)
+    {
+        close();
+        return;
+    }
+
+    void* address = mmap(nullptr, static_cast<size_t>(fileStat.st_size), PROT_READ, MAP_PRIVATE, fileDescriptor, 0);
+
+    if (address == MAP_FAILED)
+    {
+        close();
+        return;
+    }
+
+    mapping = static_cast<const uint8_t*>(address);
+    length = static_cast<size_t>(fileStat.st_size);
+    madvise(address, length, sequential ? MADV_SEQUENTIAL : MADV_RANDOM);
+}
+
+void MappedFile::prefetch(size_t offset, size_t bytes) const
+{
+    if (!mapping || offset >= length) return;
+
+    const size_t page = pageSize();
+    const size_t begin = offset - offset % page;
+    const size_t end = std::min(offset + bytes, length);
+    madvise(const_cast<uint8_t*>(mapping + begin), end - begin, MADV_WILLNEED);
+}
+
+void MappedFile::release(size_t offset, size_t bytes) const
+{
+    if (!mapping || offset >= length) return;
+
+    const size_t page = pageSize();
+    const size_t begin = offset - offset % page;
+    const size_t end = std::min(offset + bytes, length);
+    madvise(const_cast<uint8_t*>(mapping + begin), end - begin, MADV_DONTNEED);
+}
+
+void MappedFile::close()
+{
+    if (mapping) munmap(const_cast<uint8_t*>(mapping), length);
+    if (fileDescriptor >= 0) ::close(fileDescriptor);
+
+    mapping = nullptr;
+    fileDescriptor = -1;
+    length = 0;
+}
+#endif
+
+MappedFile::~MappedFile()
+{
+    close();
+}
+
+bool MappedFile::isOpen() const
+{
+    return mapping != nullptr;
+}
+
+const uint8_t* MappedFile::data() const
+{
+    return mapping;
+}
+
+size_t MappedFile::size() const
+{
+    return length;
+}
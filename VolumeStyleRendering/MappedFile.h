@@ -0,0 +1,65 @@
+#pragma once
+#include <cstdint>
+#include <string>
+
+/**
+ * \brief Read-only memory mapping of a file. The mapped pages are shared with the
+ * operating system's file cache so reading through the mapping doesn't keep an extra
+ * resident copy of the file in the process heap
+ */
+class MappedFile
+{
+public:
+    /**
+     * \brief Maps the whole file at the given path in read-only mode
+     * \param filepath The file to map
+     * \param sequential Hints the operating system that the mapping will be read front to back
+     */
+    explicit MappedFile(const std::string& filepath, bool sequential = true);
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    /**
+     * \brief Determines if the file was opened and mapped successfully
+     * \return True if the mapping is valid
+     */
+    bool isOpen() const;
+    /**
+     * \brief Start of the mapped file contents
+     * \return Pointer to the first mapped byte, null if the mapping isn't valid
+     */
+    const uint8_t* data() const;
+    /**
+     * \brief Size of the mapped file
+     * \return The file size in bytes
+     */
+    size_t size() const;
+    /**
+     * \brief Asks the operating system to start reading the given range from disk
+     * \param offset Byte offset of the range within the file
+     * \param bytes Length of the range in bytes
+     */
+    void prefetch(size_t offset, size_t bytes) const;
+    /**
+     * \brief Tells the operating system that the given range won't be needed anymore,
+     * so its pages can be dropped from the process working set
+     * \param offset Byte offset of the range within the file
+     * \param bytes Length of the range in bytes
+     */
+    void release(size_t offset, size_t bytes) const;
+    /**
+     * \brief Unmaps the file and closes its handles
+     */
+    void close();
+private:
+    const uint8_t* mapping;
+    size_t length;
+#if defined(_WIN32)
+    void* fileHandle;
+    void* mappingHandle;
+#else
+    int fileDescriptor;
+#endif
+};
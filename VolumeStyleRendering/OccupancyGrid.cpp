@@ -0,0 +1,247 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+#include "OccupancyGrid.h"
+#include "ThreadPool.h"
+#include "VolumeSampler.h"
+
+using namespace glm;
+
+namespace
+{
+    /**
+     * \brief Finite value range of a box of voxels, as read from the volume texture
+     */
+    template <typename T>
+    vec2 boxRange(const T* voxels, const ivec3& dimensions, const ivec3& first, const ivec3& last)
+    {
+        T low = std::numeric_limits<T>::max();
+        T high = std::numeric_limits<T>::lowest();
+        bool found = false;
+
+        for (int z = first.z; z <= last.z; z++)
+        {
+            for (int y = first.y; y <= last.y; y++)
+            {
+                const T* row = voxels + (static_cast<size_t>(z) * dimensions.y + y) * dimensions.x;
+
+                for (int x = first.x; x <= last.x; x++)
+                {
+                    const T value = row[x];
+
+                    if (!VoxelTraits<T>::Normalized && !std::isfinite(static_cast<float>(value))) continue;
+
+                    low = std::min(low, value);
+                    high = std::max(high, value);
+                    found = true;
+                }
+            }
+        }
+
+        if (!found) return vec2(std::numeric_limits<float>::infinity(), -std::numeric_limits<float>::infinity());
+
+        return vec2(VolumeSampler<T>::ToTexture(low), VolumeSampler<T>::ToTexture(high));
+    }
+}
+
+OccupancyGrid::OccupancyGrid(int brickSize) : brickSize(std::max(brickSize, 1)), dimensions(0), brickCount(0),
+                                              occupiedCount(0), threshold(0), valueMapping(0), updated(false) {}
+
+void OccupancyGrid::build(const uint8_t* voxels, VoxelType type, const ivec3& dimensions)
+{
+    begin(dimensions);
+    addSlices(voxels, type, 0, dimensions.z);
+}
+
+void OccupancyGrid::begin(const ivec3& dimensions)
+{
+    this->dimensions = dimensions;
+    brickCount = (dimensions + brickSize - 1) / brickSize;
+    const size_t bricks = static_cast<size_t>(brickCount.x) * brickCount.y * brickCount.z;
+    ranges.assign(bricks, vec2(std::numeric_limits<float>::infinity(), -std::numeric_limits<float>::infinity()));
+    occupancy.assign((bricks + 63) / 64, 0);
+    occupiedCount = 0;
+    updated = false;
+
+    for (size_t index = 0; index < bricks; index++)
+    {
+        const ivec3 brick(index % brickCount.x, (index / brickCount.x) % brickCount.y,
+                          index / (brickCount.x * brickCount.y));
+
+        // samples at the volume faces blend with the empty border
+        if (any(equal(brick, ivec3(0))) || any(greaterThanEqual((brick + 1) * brickSize, dimensions)))
+        {
+            ranges[index] = vec2(0);
+        }
+    }
+}
+
+void OccupancyGrid::addSlices(const uint8_t* voxels, VoxelType type, int first, int depth)
+{
+    const int end = std::min(first + depth, dimensions.z);
+
+    if (first >= end) return;
+
+    // brick layers whose padded boxes reach into the slices
+    const int firstLayer = std::max((first + brickSize - 1) / brickSize - 1, 0);
+    const int lastLayer = std::min(end / brickSize, brickCount.z - 1);
+    const int layerBricks = brickCount.x * brickCount.y;
+
+    ThreadPool::instance().parallelFor(0, (lastLayer - firstLayer + 1) * layerBricks, [&](int task)
+    {
+        const ivec3 brick(task % brickCount.x, (task / brickCount.x) % brickCount.y, firstLayer + task / layerBricks);
+        // samples inside the brick interpolate the voxels next to it
+        ivec3 low = max(brick * brickSize - 1, ivec3(0));
+        ivec3 high = min((brick + 1) * brickSize, dimensions - 1);
+        low.z = std::max(low.z, first) - first;
+        high.z = std::min(high.z, end - 1) - first;
+
+        if (low.z > high.z) return;
+
+        vec2 range;
+
+        DispatchVoxelType(type, [&](auto tag)
+        {
+            using T = std::remove_pointer_t<decltype(tag)>;
+            range = boxRange(reinterpret_cast<const T*>(voxels), dimensions, low, high);
+        });
+
+        vec2& merged = ranges[brickIndex(brick)];
+        merged = vec2(std::min(merged.x, range.x), std::max(merged.y, range.y));
+    });
+}
+
+bool OccupancyGrid::update(const std::array<vec4, 256>& transferFunction, const ivec2& threshold,
+                           const vec2& valueMapping)
+{
+    std::array<float, 256> alpha;
+
+    for (size_t i = 0; i < alpha.size(); i++) { alpha[i] = transferFunction[i].w; }
+
+    if (updated && alpha == opacities && threshold == this->threshold && valueMapping == this->valueMapping)
+    {
+        return false;
+    }
+
+    opacities = alpha;
+    this->threshold = threshold;
+    this->valueMapping = valueMapping;
+    updated = true;
+
+    // prefix[i] counts the visible entries before entry i
+    std::array<int, 257> prefix;
+    prefix[0] = 0;
+
+    for (size_t i = 0; i < alpha.size(); i++) { prefix[i + 1] = prefix[i] + (alpha[i] > 0 ? 1 : 0); }
+
+    const float low = threshold.x / 255.0f;
+    const float high = threshold.y / 255.0f;
+    std::fill(occupancy.begin(), occupancy.end(), 0);
+    occupiedCount = 0;
+
+    for (size_t i = 0; i < ranges.size(); i++)
+    {
+        const vec2 range = ranges[i] * valueMapping.x + valueMapping.y;
+        const float a = std::max(range.x, low);
+        const float b = std::min(range.y, high);
+
+        if (!(a <= b)) continue;
+
+        // linear filtering blends the two entries around each value
+        const int first = static_cast<int>(std::floor(clamp(a * 256 - 0.5f, 0.0f, 255.0f)));
+        const int last = static_cast<int>(std::ceil(clamp(b * 256 - 0.5f, 0.0f, 255.0f)));
+
+        if (prefix[last + 1] - prefix[first] == 0) continue;
+
+        occupancy[i / 64] |= static_cast<uint64_t>(1) << (i % 64);
+        occupiedCount++;
+    }
+
+    return true;
+}
+
+std::vector<uint8_t> OccupancyGrid::save() const
+{
+    const int32_t header[4] = { brickSize, dimensions.x, dimensions.y, dimensions.z };
+    std::vector<uint8_t> data(sizeof(header) + ranges.size() * sizeof(vec2));
+    memcpy(data.data(), header, sizeof(header));
+    memcpy(data.data() + sizeof(header), ranges.data(), ranges.size() * sizeof(vec2));
+
+    return data;
+}
+
+bool OccupancyGrid::restore(const uint8_t* data, size_t bytes)
+{
+    int32_t header[4];
+
+    if (bytes < sizeof(header)) return false;
+
+    memcpy(header, data, sizeof(header));
+    const ivec3 size(header[1], header[2], header[3]);
+
+    if (header[0] < 1 || any(lessThan(size, ivec3(1)))) return false;
+
+    const ivec3 count = (size + header[0] - 1) / header[0];
+    const size_t bricks = static_cast<size_t>(count.x) * count.y * count.z;
+
+    if (bytes != sizeof(header) + bricks * sizeof(vec2)) return false;
+
+    brickSize = header[0];
+    dimensions = size;
+    brickCount = count;
+    ranges.resize(bricks);
+    memcpy(ranges.data(), data + sizeof(header), bricks * sizeof(vec2));
+    occupancy.assign((bricks + 63) / 64, 0);
+    occupiedCount = 0;
+    updated = false;
+
+    return true;
+}
+
+bool OccupancyGrid::isOccupied(const ivec3& brick) const
+{
+    const size_t index = brickIndex(brick);
+
+    return (occupancy[index / 64] >> (index % 64) & 1) != 0;
+}
+
+vec2 OccupancyGrid::getRange(const ivec3& brick) const
+{
+    return ranges[brickIndex(brick)];
+}
+
+std::vector<uint8_t> OccupancyGrid::getOccupancyBytes() const
+{
+    std::vector<uint8_t> bytes(ranges.size());
+
+    for (size_t i = 0; i < bytes.size(); i++) { bytes[i] = (occupancy[i / 64] >> (i % 64) & 1) ? 1 : 0; }
+
+    return bytes;
+}
+
+size_t OccupancyGrid::getOccupiedCount() const
+{
+    return occupiedCount;
+}
+
+int OccupancyGrid::getBrickSize() const
+{
+    return brickSize;
+}
+
+const ivec3& OccupancyGrid::getBrickCount() const
+{
+    return brickCount;
+}
+
+const ivec3& OccupancyGrid::getDimensions() const
+{
+    return dimensions;
+}
+
+size_t OccupancyGrid::brickIndex(const ivec3& brick) const
+{
+    return (static_cast<size_t>(brick.z) * brickCount.y + brick.y) * brickCount.x + brick.x;
+}
@@ -0,0 +1,105 @@
+#pragma once
+#include <array>
+#include <cstdint>
+#include <vector>
+#include <cinder/CinderGlm.h>
+
+#include "VoxelType.h"
+
+/**
+ * \brief Coarse grid over the bricks of a volume used for empty space skipping. The value range
+ * of each brick is computed once per volume, every transfer function or threshold change then
+ * marks the bricks whose range maps to a visible opacity. Ranges include the voxels around each
+ * brick, so interpolated samples inside an empty brick are always transparent
+ */
+class OccupancyGrid
+{
+public:
+    /**
+     * \brief Creates an empty grid
+     * \param brickSize Voxels along each side of a brick
+     */
+    explicit OccupancyGrid(int brickSize = 16);
+
+    /**
+     * \brief Computes the value range of every brick, bricks are split between the thread pool threads
+     * \param voxels The volume voxels, tightly packed in x, y, z order
+     * \param type Type of the voxels
+     * \param dimensions The volume dimensions
+     */
+    void build(const uint8_t* voxels, VoxelType type, const glm::ivec3& dimensions);
+    /**
+     * \brief Starts building the grid of a volume handed slice by slice with addSlices
+     * \param dimensions The volume dimensions
+     */
+    void begin(const glm::ivec3& dimensions);
+    /**
+     * \brief Merges the given slices into the ranges of the bricks they touch
+     * \param voxels Tightly packed slices of the volume
+     * \param type Type of the voxels
+     * \param first Index of the first slice
+     * \param depth Number of slices
+     */
+    void addSlices(const uint8_t* voxels, VoxelType type, int first, int depth);
+    /**
+     * \brief Marks the bricks holding values with a non zero transfer function opacity inside the
+     * threshold window. A prefix sum over the opacities makes the check constant per brick
+     * \param transferFunction The indexed transfer function, alpha holds the opacity
+     * \param threshold Window of the visible values in [0..255]
+     * \param valueMapping Scale and offset mapping voxel values to the transfer function domain
+     * \return True if the occupancy changed
+     */
+    bool update(const std::array<glm::vec4, 256>& transferFunction, const glm::ivec2& threshold,
+                const glm::vec2& valueMapping);
+    /**
+     * \brief Serializes the brick ranges for the derived data cache
+     * \return The grid data
+     */
+    std::vector<uint8_t> save() const;
+    /**
+     * \brief Replaces the brick ranges with previously saved ones, the occupancy is cleared
+     * \param data Data written by save
+     * \param bytes Size of data
+     * \return False if the data doesn't hold a grid
+     */
+    bool restore(const uint8_t* data, size_t bytes);
+
+    /**
+     * \brief Determines if a brick may hold visible samples
+     * \param brick Brick coordinates inside the grid
+     * \return True if the brick is occupied
+     */
+    bool isOccupied(const glm::ivec3& brick) const;
+    /**
+     * \brief Value range of a brick and its neighbouring voxels, as read from the volume texture
+     * \param brick Brick coordinates inside the grid
+     * \return Minimum and maximum value
+     */
+    glm::vec2 getRange(const glm::ivec3& brick) const;
+    /**
+     * \brief One byte per brick, in x, y, z order, set for occupied bricks
+     * \return The occupancy for a texture upload
+     */
+    std::vector<uint8_t> getOccupancyBytes() const;
+    size_t getOccupiedCount() const;
+    int getBrickSize() const;
+    const glm::ivec3 &getBrickCount() const;
+    const glm::ivec3 &getDimensions() const;
+private:
+    int brickSize;
+    glm::ivec3 dimensions;
+    glm::ivec3 brickCount;
+    // min and max of each brick
+    std::vector<glm::vec2> ranges;
+    // one bit per brick
+    std::vector<uint64_t> occupancy;
+    size_t occupiedCount;
+
+    // inputs of the last update, unchanged inputs keep the occupancy
+    std::array<float, 256> opacities;
+    glm::ivec2 threshold;
+    glm::vec2 valueMapping;
+    bool updated;
+
+    size_t brickIndex(const glm::ivec3& brick) const;
+};
@@ -0,0 +1,100 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
+#include "PreintegrationTable.h"
+#include "ThreadPool.h"
+
+using namespace glm;
+
+namespace
+{
+    // fully opaque entries would have infinite extinction
+    const float MaxOpacity = 0.999f;
+}
+
+const int PreintegrationTable::Size;
+
+PreintegrationTable::PreintegrationTable() : table(Size * Size), changed(0, Size - 1), seconds(0)
+{
+    // never matches an update, so the first one integrates every entry
+    entries.fill(vec4(-1));
+    integrals.fill(dvec4(0));
+}
+
+bool PreintegrationTable::update(const std::array<vec4, 256>& transferFunction, const ivec2& threshold)
+{
+    const auto start = std::chrono::steady_clock::now();
+    std::array<vec4, Size> next;
+
+    for (int i = 0; i < Size; i++)
+    {
+        // entries outside the threshold are transparent, the raycast tests the entry's value
+        const float value = (i + 0.5f) / Size * 255;
+        const float alpha = value >= threshold.x && value <= threshold.y ? transferFunction[i].w : 0.0f;
+        next[i] = vec4(vec3(transferFunction[i]), -std::log(1 - std::min(alpha, MaxOpacity)));
+    }
+
+    int first = 0;
+    int last = Size - 1;
+
+    while (first < Size && next[first] == entries[first]) first++;
+    while (last >= first && next[last] == entries[last]) last--;
+
+    changed = ivec2(first, last);
+
+    if (first > last) return false;
+
+    entries = next;
+
+    // prefix sums of the extinction and the extinction weighted color find each entry in constant
+    // time, trapezoids between the entries since both functions are linear between them
+    for (int i = first > 0 ? first : 1; i < Size; i++)
+    {
+        const dvec4 a(dvec3(vec3(entries[i - 1])) * static_cast<double>(entries[i - 1].w), entries[i - 1].w);
+        const dvec4 b(dvec3(vec3(entries[i])) * static_cast<double>(entries[i].w), entries[i].w);
+        integrals[i] = integrals[i - 1] + (a + b) * 0.5;
+    }
+
+    // a segment depends on the entries between its front and back values only, so an edit only
+    // revisits the segments covering a changed value
+    ThreadPool::instance().parallelFor(0, Size, [&](int front)
+    {
+        const int begin = front < first ? first : 0;
+        const int end = front > last ? last : Size - 1;
+
+        for (int back = begin; back <= end; back++) { table[front * Size + back] = segment(front, back); }
+    });
+
+    seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    return true;
+}
+
+vec4 PreintegrationTable::segment(int front, int back) const
+{
+    if (front == back) return entries[front];
+
+    const dvec4 integral = (integrals[std::max(front, back)] - integrals[std::min(front, back)]) /
+                           static_cast<double>(std::abs(back - front));
+
+    // without extinction the color doesn't show, the back entry is as good as any
+    if (integral.w < 1e-7) return vec4(vec3(entries[back]), 0.0f);
+
+    return vec4(vec3(dvec3(integral) / integral.w), static_cast<float>(integral.w));
+}
+
+const std::vector<vec4>& PreintegrationTable::getTable() const
+{
+    return table;
+}
+
+const ivec2& PreintegrationTable::getChangedRange() const
+{
+    return changed;
+}
+
+double PreintegrationTable::getSeconds() const
+{
+    return seconds;
+}
@@ -0,0 +1,56 @@
+#pragma once
+#include <array>
+#include <vector>
+#include <cinder/CinderGlm.h>
+
+/**
+ * \brief Transfer function integrated over the ray segment between each front and back sample value
+ */
+class PreintegrationTable
+{
+public:
+    PreintegrationTable();
+
+    /**
+     * \brief Integrates the segments for a new transfer function and threshold
+     * \param transferFunction Color and opacity of the 256 transfer function entries, the
+     * opacity is taken over a half voxel step like the raycast opacity correction
+     * \param threshold Window of the visible values in [0..255]
+     * \return False if the table didn't change
+     */
+    bool update(const std::array<glm::vec4, 256>& transferFunction, const glm::ivec2& threshold);
+
+    /**
+     * \brief Size x Size entries, rows hold the front value and columns the back value. Each entry
+     * is the extinction weighted color of the segment and its mean extinction per half voxel
+     * \return The table for a texture upload
+     */
+    const std::vector<glm::vec4> &getTable() const;
+    /**
+     * \brief Transfer function entries changed by the last update, entries whose segment doesn't
+     * cover them were kept
+     * \return First and last changed entry, empty if x is greater than y
+     */
+    const glm::ivec2 &getChangedRange() const;
+    /**
+     * \brief Time the last update took
+     * \return The update time in seconds
+     */
+    double getSeconds() const;
+
+    // number of transfer function entries
+    static const int Size = 256;
+private:
+    // color and extinction of each entry
+    std::array<glm::vec4, Size> entries;
+    // integrals from the first entry, extinction weighted color in xyz and extinction in w
+    std::array<glm::dvec4, Size> integrals;
+    std::vector<glm::vec4> table;
+    glm::ivec2 changed;
+    double seconds;
+
+    /**
+     * \brief Integrates the segment between two entries
+     */
+    glm::vec4 segment(int front, int back) const;
+};
@@ -0,0 +1,227 @@
+#include <cinder/app/AppBase.h>
+
+#include "ProgressiveRefinement.h"
+
+using namespace ci;
+using namespace glm;
+using namespace app;
+
+namespace
+{
+    const GLenum Buffers[] =
+    {
+        GL_COLOR_ATTACHMENT0,
+        GL_COLOR_ATTACHMENT1,
+        GL_COLOR_ATTACHMENT2,
+        GL_COLOR_ATTACHMENT3
+    };
+
+    /**
+     * \brief Pixel of each block refined by a subset. Subsets follow a Bayer matrix, so the pixels
+     * refined in consecutive frames are spread over the block
+     * \param subset Subset index in [0..factor * factor)
+     * \param factor Pixels along each side of the blocks, a power of two
+     */
+    ivec2 refinementPixel(int subset, int factor)
+    {
+        for (int y = 0; y < factor; y++)
+        {
+            for (int x = 0; x < factor; x++)
+            {
+                // quadrants in the order 0 2 / 3 1, the coarsest split changes fastest
+                int rank = 0;
+
+                for (int half = 1; half < factor; half *= 2)
+                {
+                    const bool right = (x & half) != 0;
+                    const bool top = (y & half) != 0;
+                    rank = rank * 4 + (top ? (right ? 1 : 3) : (right ? 2 : 0));
+                }
+
+                if (rank == subset) return ivec2(x, y);
+            }
+        }
+
+        return ivec2(0);
+    }
+}
+
+ProgressiveRefinement::ProgressiveRefinement() : enabled(false), refining(true), factor(4), refinedSubsets(-1),
+                                                 state()
+{
+    progressiveRect = gl::Batch::create(geom::Rect(), gl::GlslProg::create(gl::GlslProg::Format()
+        .vertex(loadAsset("shaders/fs_quad.vert"))
+        .fragment(loadAsset("shaders/progressive.frag"))));
+}
+
+bool ProgressiveRefinement::State::operator==(const State& other) const
+{
+    return modelViewProjection == other.modelViewProjection && hasSameContent(other);
+}
+
+bool ProgressiveRefinement::State::hasSameContent(const State& other) const
+{
+    return size == other.size && volume == other.volume && gradients == other.gradients &&
+           transferFunction == other.transferFunction &&
+           transferRevision == other.transferRevision && renderingRevision == other.renderingRevision &&
+           lightDirection == other.lightDirection && lightAmbient == other.lightAmbient &&
+           lightDiffuse == other.lightDiffuse && valueMapping == other.valueMapping && stepScale == other.stepScale &&
+           shadowStepScale == other.shadowStepScale && preintegration == other.preintegration &&
+           lightVolumeShadows == other.lightVolumeShadows && gradientMode == other.gradientMode &&
+           level == other.level;
+}
+
+bool ProgressiveRefinement::isEnabled() const
+{
+    return enabled;
+}
+
+void ProgressiveRefinement::setEnabled(const bool value)
+{
+    enabled = value;
+    refinedSubsets = -1;
+}
+
+int ProgressiveRefinement::getFactor() const
+{
+    return factor;
+}
+
+void ProgressiveRefinement::setFactor(const int value)
+{
+    const int rounded = value <= 2 ? 2 : value <= 4 ? 4 : 8;
+
+    if (rounded == factor) return;
+
+    factor = rounded;
+
+    // the coarse targets are created with the first render targets otherwise
+    if (targets) resizeCoarseFbo();
+}
+
+float ProgressiveRefinement::getProgress() const
+{
+    if (!enabled || !refining) return 1.0f;
+
+    const int subsets = factor * factor;
+
+    return static_cast<float>(clamp(refinedSubsets, 0, subsets)) / subsets;
+}
+
+void ProgressiveRefinement::restart()
+{
+    refinedSubsets = -1;
+}
+
+bool ProgressiveRefinement::draw(const gl::GlslProgRef& program, const State& state, bool refine,
+                                 const std::function<void()>& drawCube)
+{
+    const bool progressive = enabled && refine;
+    const int subsets = factor * factor;
+    refining = refine;
+
+    // any change of the view or of what is drawn starts over from the coarse pass
+    if (!progressive || !(state == this->state))
+    {
+        this->state = state;
+        refinedSubsets = -1;
+    }
+
+    program->uniform("pixelStride", 1);
+    program->uniform("pixelSubset", ivec2(0));
+    program->uniform("pixelScale", 1.0f);
+
+    if (!progressive)
+    {
+        const gl::ScopedFramebuffer scopedFramebuffer(targets);
+        gl::drawBuffers(4, Buffers);
+        const gl::ScopedViewport scopedViewport(ivec2(0), targets->getSize());
+        gl::clear();
+        drawCube();
+
+        return true;
+    }
+
+    // the render targets hold the refined view
+    if (refinedSubsets >= subsets) return false;
+
+    const gl::ScopedFramebuffer scopedFramebuffer(targets);
+    gl::drawBuffers(4, Buffers);
+    const gl::ScopedViewport scopedViewport(ivec2(0), targets->getSize());
+    const gl::GlslProgRef& fill = progressiveRect->getGlslProg();
+    fill->uniform("pixelStride", factor);
+
+    // fullscreen passes write the render targets as they are
+    auto drawFill = [this, &state]
+    {
+        const gl::ScopedBlend scopedBlend(false);
+        const gl::ScopedMatrices scopedMatrices;
+        gl::setMatricesWindow(state.size);
+        gl::translate(vec2(state.size) * 0.5f);
+        gl::scale(vec2(state.size));
+        progressiveRect->draw();
+    };
+
+    if (refinedSubsets < 0)
+    {
+        // a ray per block, drawn at the resolution of the blocks
+        {
+            const gl::ScopedFramebuffer scopedCoarseFramebuffer(coarseRBuffer);
+            gl::drawBuffers(4, Buffers);
+            const gl::ScopedViewport scopedCoarseViewport(ivec2(0), coarseRBuffer->getSize());
+            gl::clear();
+            program->uniform("pixelScale", static_cast<float>(factor));
+            drawCube();
+        }
+
+        // every pixel takes the ray of its block until it's refined
+        const gl::ScopedTextureBind color(coarseRBuffer->getTexture2d(GL_COLOR_ATTACHMENT0), 0);
+        const gl::ScopedTextureBind normal(coarseRBuffer->getTexture2d(GL_COLOR_ATTACHMENT1), 1);
+        const gl::ScopedTextureBind shadows(coarseRBuffer->getTexture2d(GL_COLOR_ATTACHMENT2), 2);
+        const gl::ScopedTextureBind position(coarseRBuffer->getTexture2d(GL_COLOR_ATTACHMENT3), 3);
+        fill->uniform("upsample", true);
+        drawFill();
+    }
+    else
+    {
+        // one pixel of each block, cleared first since the cube faces blend
+        const ivec2 pixel = refinementPixel(refinedSubsets, factor);
+        fill->uniform("upsample", false);
+        fill->uniform("pixelSubset", pixel);
+        drawFill();
+
+        program->uniform("pixelStride", factor);
+        program->uniform("pixelSubset", pixel);
+        drawCube();
+    }
+
+    refinedSubsets++;
+
+    return true;
+}
+
+void ProgressiveRefinement::resizeFbos(const gl::FboRef& targets)
+{
+    this->targets = targets;
+    resizeCoarseFbo();
+}
+
+void ProgressiveRefinement::resizeCoarseFbo()
+{
+    const ivec2 size = (targets->getSize() + factor - 1) / factor;
+    gl::Fbo::Format format;
+
+    // each coarse target is read with texel fetches into the full resolution one, in the same format
+    for (GLenum attachment : Buffers)
+    {
+        const GLint internalFormat = targets->getTexture2d(attachment)->getInternalFormat();
+        auto coarseFormat = gl::Texture2d::Format().internalFormat(internalFormat)
+                                                   .magFilter(GL_NEAREST)
+                                                   .minFilter(GL_NEAREST);
+        format.attachment(attachment, gl::Texture2d::create(size.x, size.y, coarseFormat));
+    }
+
+    format.depthBuffer();
+    coarseRBuffer = gl::Fbo::create(size.x, size.y, format);
+    refinedSubsets = -1;
+}
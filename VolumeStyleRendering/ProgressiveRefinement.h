@@ -0,0 +1,109 @@
+#pragma once
+#include <functional>
+#include <cinder/gl/gl.h>
+
+class StyleTransferFunction;
+
+/**
+ * \brief Refines still raycast views over several frames
+ */
+class ProgressiveRefinement
+{
+public:
+    /**
+     * \brief Everything the raycast image depends on, a change restarts the refinement
+     */
+    struct State
+    {
+        glm::mat4 modelViewProjection;
+        glm::ivec2 size;
+        ci::gl::Texture3dRef volume;
+        ci::gl::Texture3dRef gradients;
+        const StyleTransferFunction* transferFunction;
+        unsigned transferRevision;
+        unsigned renderingRevision;
+        glm::vec3 lightDirection;
+        glm::vec3 lightAmbient;
+        glm::vec3 lightDiffuse;
+        glm::vec2 valueMapping;
+        float stepScale;
+        float shadowStepScale;
+        bool preintegration;
+        bool lightVolumeShadows;
+        // RaycastVolume::GradientMode of the view
+        int gradientMode;
+        int level;
+
+        bool operator==(const State& other) const;
+        /**
+         * \brief Compares everything but the view, images of the same content can be reprojected
+         */
+        bool hasSameContent(const State& other) const;
+    };
+
+    ProgressiveRefinement();
+    /**
+     * \brief Determines if still views are refined over several frames, a coarse raycast is drawn
+     * right after any change and the full resolution pixels are raycast a subset per frame after it
+     * \return True if views are refined progressively
+     */
+    bool isEnabled() const;
+    /**
+     * \brief Enables or disables the refinement, disabled views are raycast at full resolution
+     * every frame
+     * \param value True to refine progressively
+     */
+    void setEnabled(const bool value);
+    /**
+     * \brief Pixels along each side of the blocks a single coarse ray covers, refining takes a
+     * frame per pixel of the blocks
+     * \return The refinement factor
+     */
+    int getFactor() const;
+    /**
+     * \brief Sets the coarse pass resolution, restarts the refinement
+     * \param value 2, 4 or 8 pixels, other values are rounded to the nearest of them
+     */
+    void setFactor(const int value);
+    /**
+     * \brief How far the refinement of the current view got
+     * \return Refined share of the full resolution pixels in [0..1], 1 when the last view wasn't refined
+     */
+    float getProgress() const;
+    /**
+     * \brief Starts over from the coarse pass, for changes the state doesn't show
+     */
+    void restart();
+    /**
+     * \brief Raycasts the view to the render targets, entirely or its next refinement step
+     * \param program The raycast shader with its textures bound and parameters set
+     * \param state What the drawn view depends on
+     * \param refine False to raycast the view entirely even if the refinement is enabled
+     * \param drawCube Draws the raycast cube to the bound render targets
+     * \return False if the render targets already hold the refined view and nothing was drawn
+     */
+    bool draw(const ci::gl::GlslProgRef& program, const State& state, bool refine,
+              const std::function<void()>& drawCube);
+    /**
+     * \brief Creates the coarse render targets for the full resolution ones, in the same formats
+     * \param targets The raycast render targets, color, normal, shadow and position attachments
+     */
+    void resizeFbos(const ci::gl::FboRef& targets);
+private:
+    bool enabled;
+    // if the last view was drawn with the refinement
+    bool refining;
+    int factor;
+    // pixel subsets raycast since the last restart, -1 before the coarse pass
+    int refinedSubsets;
+    State state;
+    ci::gl::FboRef targets;
+    ci::gl::FboRef coarseRBuffer;
+    // coarse pass upsampling and refined pixels clearing
+    ci::gl::BatchRef progressiveRect;
+
+    /**
+     * \brief Creates the coarse render targets for the size of the render targets and the refinement factor
+     */
+    void resizeCoarseFbo();
+};
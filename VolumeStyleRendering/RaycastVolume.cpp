@@ -1,3 +1,4 @@
+#include <future>
 #include <cinder/app/AppBase.h>
 #include <cinder/Log.h>
 
@@ -5,12 +6,170 @@
 #include "StyleTransferFunction.h"
 #include "RenderingParams.h"
 #include "PostProcess.h"
+#include "VolumeLoader.h"
+#include "BrickCache.h"
+#include "VolumeCache.h"
+#include "HistogramEngine.h"
+#include "OccupancyGrid.h"
+#include "ThreadPool.h"
 
 using namespace ci;
 using namespace glm;
 using namespace app;
 
-RaycastVolume::RaycastVolume() : aspectRatios(1), scaleFactor(vec3(1)), stepScale(1), shadowStepScale(3)
+namespace
+{
+    // amount of volume data uploaded per frame while a volume is loading
+    const size_t UploadBytesPerFrame = 32 * 1024 * 1024;
+
+    /**
+     * \brief Creates the gradient volume texture, RG16F spheremap or RG8 snorm octahedral encoded normals
+     * \param gradients The encoded gradients
+     * \param size The volume dimensions
+     * \param encoding Encoding of the gradients
+     */
+    gl::Texture3dRef createGradientTexture(const uint8_t* gradients, const ivec3& size,
+                                           GradientEngine::Encoding encoding)
+    {
+        const bool octahedral = encoding == GradientEngine::Encoding::Octahedral;
+        auto format = gl::Texture3d::Format().magFilter(GL_LINEAR)
+                                             .minFilter(GL_LINEAR)
+                                             .wrapS(GL_CLAMP_TO_BORDER)
+                                             .wrapR(GL_CLAMP_TO_BORDER)
+                                             .wrapT(GL_CLAMP_TO_BORDER)
+                                             .internalFormat(octahedral ? GL_RG8_SNORM : GL_RG16F);
+        format.setDataType(octahedral ? GL_BYTE : GL_FLOAT);
+        auto texture = gl::Texture3d::create(size.x, size.y, size.z, format);
+
+        // two byte rows aren't aligned to four bytes
+        GLint unpackAlignment;
+        glGetIntegerv(GL_UNPACK_ALIGNMENT, &unpackAlignment);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        texture->update(gradients, GL_RG, octahedral ? GL_BYTE : GL_HALF_FLOAT, 0, size.x, size.y, size.z);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, unpackAlignment);
+
+        return texture;
+    }
+
+    /**
+     * \brief Format of the light volume texture, R8 transmittance
+     */
+    gl::Texture3d::Format lightVolumeFormat()
+    {
+        return gl::Texture3d::Format().magFilter(GL_LINEAR)
+                                      .minFilter(GL_LINEAR)
+                                      .wrapS(GL_CLAMP_TO_EDGE)
+                                      .wrapR(GL_CLAMP_TO_EDGE)
+                                      .wrapT(GL_CLAMP_TO_EDGE)
+                                      .internalFormat(GL_R8)
+                                      .dataType(GL_UNSIGNED_BYTE);
+    }
+
+    /**
+     * \brief Format of the raycast color render target, unclamped RGBA
+     */
+    gl::Texture2d::Format hdrFormat()
+    {
+        return gl::Texture2d::Format().internalFormat(GL_RGBA16F)
+                                      .magFilter(GL_NEAREST)
+                                      .minFilter(GL_NEAREST)
+                                      .wrap(GL_REPEAT)
+                                      .dataType(GL_FLOAT);
+    }
+
+    /**
+     * \brief Format of the position and normal render targets
+     */
+    gl::Texture2d::Format dataFormat()
+    {
+        return gl::Texture2d::Format().internalFormat(GL_RGB16F)
+                                      .magFilter(GL_NEAREST)
+                                      .minFilter(GL_NEAREST)
+                                      .wrap(GL_REPEAT)
+                                      .dataType(GL_FLOAT);
+    }
+
+    /**
+     * \brief Format of the single channel shadow and occlusion render targets
+     */
+    gl::Texture2d::Format shadowFormat()
+    {
+        return gl::Texture2d::Format().internalFormat(GL_R8)
+                                      .magFilter(GL_LINEAR)
+                                      .minFilter(GL_LINEAR)
+                                      .wrap(GL_REPEAT)
+                                      .dataType(GL_UNSIGNED_BYTE)
+                                      .swizzleMask(GL_RED, GL_RED, GL_RED, GL_RED);
+    }
+
+    /**
+     * \brief Pixel data type the voxels of the given type are uploaded with
+     */
+    GLenum voxelDataType(VoxelType type)
+    {
+        switch (type)
+        {
+        case VoxelType::UInt16: return GL_UNSIGNED_SHORT;
+        case VoxelType::Float32: return GL_FLOAT;
+        default: return GL_UNSIGNED_BYTE;
+        }
+    }
+
+    /**
+     * \brief Reads the voxels of a volume texture back to host memory, tightly packed
+     */
+    std::vector<uint8_t> readVoxels(const gl::Texture3dRef& texture, const ivec3& size, VoxelType type)
+    {
+        std::vector<uint8_t> voxels(static_cast<size_t>(size.x) * size.y * size.z * GetVoxelSize(type));
+        GLint packAlignment;
+        glGetIntegerv(GL_PACK_ALIGNMENT, &packAlignment);
+        glPixelStorei(GL_PACK_ALIGNMENT, 1);
+        gl::ScopedTextureBind scopedTexture(texture);
+        glGetTexImage(GL_TEXTURE_3D, 0, GL_RED, voxelDataType(type), voxels.data());
+        glPixelStorei(GL_PACK_ALIGNMENT, packAlignment);
+
+        return voxels;
+    }
+
+    /**
+     * \brief Reads the encoded gradients of a gradient texture back to host memory, tightly packed
+     */
+    std::vector<uint8_t> readGradients(const gl::Texture3dRef& texture, const ivec3& size,
+                                       GradientEngine::Encoding encoding)
+    {
+        const bool octahedral = encoding == GradientEngine::Encoding::Octahedral;
+        std::vector<uint8_t> gradients(static_cast<size_t>(size.x) * size.y * size.z *
+                                       GradientEngine::GetEncodedSize(encoding));
+        GLint packAlignment;
+        glGetIntegerv(GL_PACK_ALIGNMENT, &packAlignment);
+        glPixelStorei(GL_PACK_ALIGNMENT, 1);
+        gl::ScopedTextureBind scopedTexture(texture);
+        glGetTexImage(GL_TEXTURE_3D, 0, GL_RG, octahedral ? GL_BYTE : GL_HALF_FLOAT, gradients.data());
+        glPixelStorei(GL_PACK_ALIGNMENT, packAlignment);
+
+        return gradients;
+    }
+
+    // frames drawn before each gradient mode is measured, the timer reads the previous frame
+    const int BenchmarkWarmup = 2;
+}
+
+RaycastVolume::RaycastVolume() : voxelType(VoxelType::UInt8), valueMapping(1, 0),
+                                 gradientEncoding(GradientEngine::Encoding::Spheremap),
+                                 gradientMode(GradientMode::Precomputed), emptySpaceSkipping(true),
+                                 sampleCounting(false), sampleCounts(0), raycastMilliseconds(0), benchmarkFrames(0),
+                                 benchmarkFrame(0), brickCacheBudget(512 * 1024 * 1024),
+                                 lightVolumeShadows(false), lightVolumeScale(0.5f), lightVolumeSize(0),
+                                 lightVolumeSeconds(0),
+                                 pyramidFilter(VolumePyramid::Filter::Average), pyramidLevel(-1), levelBias(0),
+                                 drawnLevel(0), residentLevel(0), sourceDimensions(0), aspectRatios(1),
+                                 scaleFactor(vec3(1)), stepScale(1), shadowStepScale(3), preintegration(false),
+                                 isDrawable(false),
+                                 hostMemoryBudget(256 * 1024 * 1024),
+                                 residentMemoryBudget(static_cast<size_t>(2048) * 1024 * 1024),
+                                 derivedDataCaching(true),
+                                 convertTo8Bits(false), windowPercentiles(0.1f, 99.9f), referenceRequested(false),
+                                 referenceBenchmark(false), refinement(), accumulation()
 {
     // positions shader
     positionsProg = gl::GlslProg::create(gl::GlslProg::Format()
@@ -20,14 +179,6 @@ RaycastVolume::RaycastVolume() : aspectRatios(1), scaleFactor(vec3(1)), stepScal
     raycastShaderRendertargets = gl::GlslProg::create(gl::GlslProg::Format()
         .vertex(loadAsset("shaders/raycast.vert"))
         .fragment(loadAsset("shaders/raycast_rendertargets.frag")));
-    // histogram calculation 
-    histogramCompute = gl::GlslProg::create(gl::GlslProg::Format()
-        .compute(loadAsset("shaders/histogram.comp")));
-    // gradient computation
-    gradientsCompute = gl::GlslProg::create(gl::GlslProg::Format()
-        .compute(loadAsset("shaders/gradients.comp")));
-    smoothGradientsCompute = gl::GlslProg::create(gl::GlslProg::Format()
-        .compute(loadAsset("shaders/smooth_gradients.comp")));
     // noise texture to reduce volume banding artifacts
     noiseTexture = gl::Texture2d::create(loadImage(loadAsset("images/noise.png")), gl::Texture2d::Format()
                                          .wrapS(GL_REPEAT)
@@ -40,7 +191,16 @@ RaycastVolume::RaycastVolume() : aspectRatios(1), scaleFactor(vec3(1)), stepScal
     resizeFbos();
 }
 
-RaycastVolume::~RaycastVolume() {}
+RaycastVolume::~RaycastVolume()
+{
+    cancelDerivedData();
+    cancelGradientRebuild();
+    resetPyramid();
+    // a cache being written has to complete
+    if (derivedDataWrite.valid()) derivedDataWrite.wait();
+    // a reference render in progress finishes first
+    if (pendingReference.valid()) pendingReference.wait();
+}
 
 vec3 RaycastVolume::centerPoint() const
 {
@@ -67,6 +227,16 @@ void RaycastVolume::setShadowStepScale(const float& value)
     shadowStepScale = max(value, 0.5f);
 }
 
+bool RaycastVolume::isPreintegrated() const
+{
+    return preintegration;
+}
+
+void RaycastVolume::setPreintegrated(const bool value)
+{
+    preintegration = value;
+}
+
 const vec3& RaycastVolume::getAspectRatios() const
 {
     return aspectRatios;
@@ -79,6 +249,43 @@ void RaycastVolume::setAspectratios(const vec3& value)
     scaleFactor = vec3(1) / ((vec3(1) * maxSize) / (dimensions * aspectRatios));
 }
 
+size_t RaycastVolume::getHostMemoryBudget() const
+{
+    return hostMemoryBudget;
+}
+
+void RaycastVolume::setHostMemoryBudget(const size_t value)
+{
+    hostMemoryBudget = max(value, static_cast<size_t>(1024 * 1024));
+}
+
+size_t RaycastVolume::getResidentMemoryBudget() const
+{
+    return residentMemoryBudget;
+}
+
+void RaycastVolume::setResidentMemoryBudget(const size_t value)
+{
+    residentMemoryBudget = max(value, static_cast<size_t>(1024 * 1024));
+}
+
+size_t RaycastVolume::getBrickCacheBudget() const
+{
+    return brickCacheBudget;
+}
+
+void RaycastVolume::setBrickCacheBudget(const size_t value)
+{
+    brickCacheBudget = max(value, static_cast<size_t>(1024 * 1024));
+
+    if (brickCache) brickCache->setBudget(brickCacheBudget);
+}
+
+const std::shared_ptr<BrickCache>& RaycastVolume::getBrickCache() const
+{
+    return brickCache;
+}
+
 void RaycastVolume::createCubeVbo()
 {
     cubeMesh = TriMesh::create(geom::Cube());
@@ -104,90 +311,265 @@ void RaycastVolume::createCubeVbo()
     }
 }
 
-void RaycastVolume::readVolumeFromFile8(const std::string filepath)
+void RaycastVolume::loadFromFile(const vec3& dimensions, const vec3& ratios, const std::string filepath,
+                                 VoxelType voxelType)
 {
-    // open file and read
-    std::ifstream file(filepath, std::ios::binary | std::ios::ate);
+    // a new load replaces the one in progress
+    cancelDerivedData();
+    loadJob = nullptr;
+    loadJob = std::make_shared<VolumeLoadJob>(ivec3(dimensions), ratios, filepath, voxelType, loadOptions());
+    createPendingTexture();
+}
 
-    // error opening given filepath
-    if (!file.good()) return;
+void RaycastVolume::loadFromFile(const std::string filepath)
+{
+    // a new load replaces the one in progress
+    cancelDerivedData();
+    loadJob = nullptr;
+    loadJob = std::make_shared<VolumeLoadJob>(filepath, loadOptions());
 
-    // determine volume size
-    std::streamsize size = file.tellg();
-    file.seekg(0, std::ios::beg);
-    // reserve space for data
-    std::vector<uint8_t> buffer(size);
+    // invalid header, the volume parameters are unknown
+    if (!loadJob->isActive())
+    {
+        CI_LOG_E(loadJob->getError());
+        return;
+    }
+
+    createPendingTexture();
+}
+
+VolumeLoadOptions RaycastVolume::loadOptions() const
+{
+    VolumeLoadOptions options;
+    options.hostMemoryBudget = hostMemoryBudget;
+    options.residentMemoryBudget = residentMemoryBudget;
+    options.downsampleFilter = pyramidFilter;
+    options.convertTo8Bits = convertTo8Bits;
+    options.windowPercentiles = windowPercentiles;
+    options.gradientSettings = gradientSettings;
+    options.precomputeGradients = gradientMode == GradientMode::Precomputed;
+    // cells for the light volume are averaged while loading, shadows can be turned on without a readback
+    options.lightVolumeScale = lightVolumeScale;
+    // the first pyramid level as well, the pyramid is built from it on demand
+    options.halveResident = true;
+    options.pyramidFilter = pyramidFilter;
+
+    return options;
+}
 
-    if (file.read(reinterpret_cast<char*>(buffer.data()), size))
+void RaycastVolume::createPendingTexture()
+{
+    const ivec3 size = loadJob->getDimensions();
+
+    // empty 3D texture, filled slab by slab while the current volume stays drawable
+    auto format = gl::Texture3d::Format().magFilter(GL_LINEAR)
+                                         .minFilter(GL_LINEAR)
+                                         .wrapS(GL_CLAMP_TO_BORDER)
+                                         .wrapR(GL_CLAMP_TO_BORDER)
+                                         .wrapT(GL_CLAMP_TO_BORDER);
+    const VoxelType voxelType = loadJob->getVoxelType();
+    format.setDataType(voxelDataType(voxelType));
+    // sized formats keep the full precision of each voxel type
+    format.setInternalFormat(voxelType == VoxelType::Float32 ? GL_R32F :
+                             voxelType == VoxelType::UInt16 ? GL_R16 : GL_R8);
+
+    format.setSwizzleMask(GL_RED, GL_RED, GL_RED, GL_RED);
+
+    // clear earlier errors so an allocation failure is told apart
+    while (glGetError() != GL_NO_ERROR) {}
+
+    pendingVolumeTexture = gl::Texture3d::create(size.x, size.y, size.z, format);
+
+    if (glGetError() == GL_OUT_OF_MEMORY)
     {
-        // create 3D texture
-        auto format = gl::Texture3d::Format().magFilter(GL_LINEAR)
-                                             .minFilter(GL_LINEAR)
-                                             .wrapS(GL_CLAMP_TO_BORDER)
-                                             .wrapR(GL_CLAMP_TO_BORDER)
-                                             .wrapT(GL_CLAMP_TO_BORDER);
-        format.setDataType(GL_UNSIGNED_BYTE);
-        format.setInternalFormat(GL_RED);
-        format.setSwizzleMask(GL_RED, GL_RED, GL_RED, GL_RED);
-        volumeTexture = gl::Texture3d::create(buffer.data(), GL_RED,
-                                              dimensions.x, dimensions.y, dimensions.z, format);
-        // finally has drawable data
-        isDrawable = true;
+        CI_LOG_E("Not enough texture memory for a " << size.x << " x " << size.y << " x " << size.z
+                 << " volume, lower the GPU memory budget");
+        cancelLoad();
+        pendingVolumeTexture = nullptr;
     }
+}
+
+void RaycastVolume::update()
+{
+    if (!loadJob || !pendingVolumeTexture) return;
+
+    if (!loadJob->isActive())
+    {
+        if (loadJob->getStage() == VolumeLoadJob::Stage::Failed)
+        {
+            CI_LOG_E(loadJob->getError());
+        }
 
-    file.close();
+        // load won't be swapped in
+        cancelDerivedData();
+        pendingVolumeTexture = nullptr;
+        return;
+    }
+
+    uploadPendingSlabs();
+
+    // all slabs uploaded and their derived data prepared, the volume is swapped in
+    if (loadJob->getStage() == VolumeLoadJob::Stage::Ready)
+    {
+        prepareDerivedData();
+        finishLoad();
+    }
 }
 
-void RaycastVolume::readVolumeFromFile16(const std::string filepath)
+void RaycastVolume::cancelLoad()
 {
-    // open file and read
-    std::ifstream file(filepath, std::ios::binary | std::ios::ate);
+    if (loadJob) loadJob->cancel();
+}
 
-    // error opening given filepath
-    if (!file.good()) return;
+const std::shared_ptr<VolumeLoadJob>& RaycastVolume::getLoadJob() const
+{
+    return loadJob;
+}
 
-    // determine volume size
-    std::streamsize size = file.tellg();
-    file.seekg(0, std::ios::beg);
-    // reserve space for data
-    std::vector<uint16_t> buffer(size);
+void RaycastVolume::uploadPendingSlabs()
+{
+    const ivec3 size = loadJob->getDimensions();
+    const GLenum dataType = voxelDataType(loadJob->getVoxelType());
+    const size_t sliceBytes = static_cast<size_t>(size.x) * size.y * GetVoxelSize(loadJob->getVoxelType());
+    size_t frameBudget = UploadBytesPerFrame;
+
+    // raw slices are tightly packed
+    GLint unpackAlignment;
+    glGetIntegerv(GL_UNPACK_ALIGNMENT, &unpackAlignment);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
 
-    if (file.read(reinterpret_cast<char*>(buffer.data()), size))
+    VolumeSlab slab;
+
+    // upload read slabs within this frame's budget
+    while (frameBudget > 0 && loadJob->pendingUpload(slab))
     {
-        // create 3D texture
-        auto format = gl::Texture3d::Format().magFilter(GL_LINEAR)
-                                             .minFilter(GL_LINEAR)
-                                             .wrapS(GL_CLAMP_TO_BORDER)
-                                             .wrapR(GL_CLAMP_TO_BORDER)
-                                             .wrapT(GL_CLAMP_TO_BORDER);
-        format.setDataType(GL_UNSIGNED_SHORT);
-        format.setInternalFormat(GL_RED);
-        format.setSwizzleMask(GL_RED, GL_RED, GL_RED, GL_RED);
-        volumeTexture = gl::Texture3d::create(buffer.data(), GL_RED,
-                                              dimensions.x, dimensions.y, dimensions.z, format);
-        // finally has drawable data
-        isDrawable = true;
+        const int slices = std::min(slab.depth, std::max(1, static_cast<int>(frameBudget / sliceBytes)));
+        pendingVolumeTexture->update(slab.data, GL_RED, dataType, 0, size.x, size.y, slices, 0, 0, slab.zOffset);
+        loadJob->uploaded(slices);
+        frameBudget -= std::min(frameBudget, slices * sliceBytes);
     }
 
-    file.close();
+    glPixelStorei(GL_UNPACK_ALIGNMENT, unpackAlignment);
 }
 
-void RaycastVolume::loadFromFile(const vec3& dimensions, const vec3& ratios, const std::string filepath,
-                                 bool is16Bits)
+void RaycastVolume::finishLoad()
 {
     // compute step size and number of iterations for the given volume dimensions
-    this->dimensions = dimensions;
+    dimensions = vec3(loadJob->getDimensions());
     maxSize = max(dimensions.x, max(dimensions.y, dimensions.z));
     stepSize = vec3(1.0f / (dimensions.x * (maxSize / dimensions.x)),
                     1.0f / (dimensions.y * (maxSize / dimensions.y)),
                     1.0f / (dimensions.z * (maxSize / dimensions.z)));
-    setAspectratios(ratios);
-    // create volume texture
-    is16Bits ? readVolumeFromFile16(filepath) : readVolumeFromFile8(filepath);
-    // histogram compute
-    extractHistogram();
-    // gradients
-    generateGradients();
+    setAspectratios(loadJob->getRatios());
+    residentLevel = loadJob->getLevel();
+    sourceDimensions = loadJob->getSourceDimensions();
+
+    if (residentLevel > 0)
+    {
+        CI_LOG_I("Reduced the " << sourceDimensions.x << " x " << sourceDimensions.y << " x " << sourceDimensions.z
+                 << " volume " << residentLevel << " times to " << dimensions.x << " x " << dimensions.y << " x "
+                 << dimensions.z << " to fit the " << loadJob->getOptions().residentMemoryBudget / (1024 * 1024)
+                 << " MB budget");
+    }
+
+    // swap the new volume in
+    volumeTexture = pendingVolumeTexture;
+    voxelType = loadJob->getVoxelType();
+    pendingVolumeTexture = nullptr;
+    // histogram accumulated while reading
+    histogram = loadJob->getStatistics().getNormalizedHistogram();
+
+    // float values are mapped from the histogram domain so the transfer function lines up with it
+    if (loadJob->getVoxelType() == VoxelType::Float32)
+    {
+        const vec2 domain = loadJob->getStatistics().getDomain();
+        valueMapping = vec2(1.0f / (domain.y - domain.x), -domain.x / (domain.y - domain.x));
+        CI_LOG_I("Float volume values in [" << loadJob->getStatistics().getValueRange().x << ", "
+                 << loadJob->getStatistics().getValueRange().y << "], transfer function domain [" << domain.x
+                 << ", " << domain.y << "]");
+    }
+    else
+    {
+        valueMapping = vec2(1, 0);
+    }
+
+    if (loadJob->getDecodeThroughput() > 0)
+    {
+        CI_LOG_I("Decoded " << dimensions.z << " slices at " << loadJob->getDecodeThroughput() / (1024 * 1024)
+                 << " MB/s");
+    }
+
+    if (loadJob->getHistogramThroughput() > 0)
+    {
+        CI_LOG_I("Counted the histogram of a " << loadJob->getTotalBytes() / (1024 * 1024) << " MB volume at "
+                 << loadJob->getHistogramThroughput() / (1024 * 1024) << " MB/s using the "
+                 << HistogramEngine::GetKernelName() << " kernel");
+    }
+
+    if (loadJob->isConverted())
+    {
+        const WindowLevel& window = loadJob->getWindow();
+        const vec2 clipped = loadJob->getClippedPercentages();
+        CI_LOG_I("Converted to 8 bits with window [" << window.getLow() << ", " << window.getHigh() << "] using the "
+                 << WindowLevel::GetKernelName() << " kernel, " << clipped.x << "% of the voxels clipped below and "
+                 << clipped.y << "% above");
+    }
+
+    cancelGradientRebuild();
+    resetPyramid();
+    pyramidJob = nullptr;
+    halvedLevel = loadJob->takeHalvedLevel();
+
+    // the filter changed while loading
+    if (loadJob->getOptions().pyramidFilter != pyramidFilter) halvedLevel = VolumePyramid::Level();
+    gradientTexture = pendingGradientTexture;
+    gradientEncoding = loadJob->getOptions().gradientSettings.encoding;
+    pendingGradientTexture = nullptr;
+
+    // occupancy and distances are filled on the first draw, once the transfer function is known
+    occupancyGrid = pendingOccupancyGrid;
+    pendingOccupancyGrid = nullptr;
+    emptyDistance = DistanceField();
+    const ivec3 brickCount = occupancyGrid->getBrickCount();
+    emptyDistanceTexture = gl::Texture3d::create(brickCount.x, brickCount.y, brickCount.z, gl::Texture3d::Format()
+                                             .magFilter(GL_NEAREST)
+                                             .minFilter(GL_NEAREST)
+                                             .wrapS(GL_CLAMP_TO_EDGE)
+                                             .wrapR(GL_CLAMP_TO_EDGE)
+                                             .wrapT(GL_CLAMP_TO_EDGE)
+                                             .internalFormat(GL_R8)
+                                             .dataType(GL_UNSIGNED_BYTE));
+    CI_LOG_I("Empty space skipping over " << brickCount.x << " x " << brickCount.y << " x " << brickCount.z
+             << " bricks of " << occupancyGrid->getBrickSize() << " voxels");
+
+    // the light is propagated through the cells on the next draw with shadows, fully lit until then
+    if (pendingLightVolume.valid()) pendingLightVolume.wait();
+
+    pendingLightVolume = std::future<void>();
+    lightVolumeJob = nullptr;
+    lightVolume = loadJob->getLightVolume();
+    lightVolumeSize = ivec3(0);
+    lightVolumeSeconds = 0;
+    const uint8_t lit = 255;
+    lightVolumeTexture = gl::Texture3d::create(1, 1, 1, lightVolumeFormat());
+    lightVolumeTexture->update(&lit, GL_RED, GL_UNSIGNED_BYTE, 0, 1, 1, 1);
+
+    // the CPU reference pages the bricks of the new volume from its file, unless it's drawn converted
+    brickCache = nullptr;
+
+    if (!loadJob->isConverted())
+    {
+        if (auto source = BrickCache::OpenSource(loadJob->getFilepath(), loadJob->getSourceDimensions(),
+                                                    loadJob->getSourceVoxelType()))
+        {
+            brickCache = std::make_shared<BrickCache>(move(source), brickCacheBudget);
+        }
+    }
+
+    // finally has drawable data
+    isDrawable = true;
+    residentJob = loadJob;
+    loadJob->complete();
 }
 
 void RaycastVolume::drawCubeFaces() const
@@ -237,6 +619,37 @@ void RaycastVolume::drawVolume(const Camera& camera)
         // draw cube positions
         drawCubeFaces();
 
+        // empty bricks under the current transfer function and threshold are skipped
+        updateOccupancy();
+
+        // gradients released by an on-the-fly mode are prepared again for the precomputed one
+        updateGradientTexture();
+        const GradientMode mode = frameGradientMode();
+
+        // light reaching each sample, only rebuilt when the light or transfer function change
+        const bool useLightVolume = RenderingParams::ShadowsEnabled() && lightVolumeShadows;
+
+        if (useLightVolume) updateLightVolume();
+
+        // coarser levels for distant views, each level doubles the step. The pyramid is only built
+        // once a view asks for a coarser level
+        if (pyramidBuild.valid() || selectLevel(camera, getPyramidLevelCount()) > 0) updatePyramid();
+
+        drawnLevel = selectLevel(camera, pyramid ? static_cast<int>(pyramid->getLevels().size()) : 0);
+        const float levelScale = static_cast<float>(1 << drawnLevel);
+
+        if (pyramid)
+        {
+            gl::ScopedTextureBind scopedVolume(volumeTexture);
+            glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_BASE_LEVEL, drawnLevel);
+
+            if (gradientTexture)
+            {
+                gl::ScopedTextureBind scopedGradients(gradientTexture);
+                glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_BASE_LEVEL, drawnLevel);
+            }
+        }
+
         // ray cast cube
         auto program = raycastShaderRendertargets;
         gl::ScopedGlslProg scopedProg(program);
@@ -247,23 +660,48 @@ void RaycastVolume::drawVolume(const Camera& camera)
         gl::ScopedTextureBind frontTex(frontTexture, 0);
         gl::ScopedTextureBind backTex(backTexture, 1);
         gl::ScopedTextureBind volumeTex(volumeTexture, 2);
-        gl::ScopedTextureBind gradientTex(gradientTexture, 3);
+        gl::ScopedTextureBind gradientTex(GL_TEXTURE_3D, gradientTexture ? gradientTexture->getId() : 0, 3);
         gl::ScopedTextureBind noiseTex(noiseTexture, 4);
         gl::ScopedTextureBind colorTex(transferFunction->getColorMappingTexture(), 5);
         gl::ScopedTextureBind transferTex(transferFunction->getTransferFunctionTexture(), 6);
         gl::ScopedTextureBind indexTex(transferFunction->getIndexFunctionTexture(), 7);
         gl::ScopedTextureBind styleTex(transferFunction->getStyleFunctionTexture(), 8);
         gl::ScopedTextureBind ambientOcclusionTex(volumeAO, 9);
+        gl::ScopedTextureBind emptyDistanceTex(emptyDistanceTexture, 10);
+        gl::ScopedTextureBind lightVolumeTex(lightVolumeTexture, 11);
+        gl::ScopedTextureBind preintegratedTex(transferFunction->getPreintegratedTexture(), 12);
 
         // raycast parameters
         program->uniform("threshold", vec2(transferFunction->getThreshold()) / 255.0f);
-        program->uniform("stepSize", stepSize * stepScale);
+        program->uniform("valueMapping", valueMapping);
+        program->uniform("stepSize", stepSize * stepScale * levelScale);
         program->uniform("shadowStepSize", stepSize * shadowStepScale);
-        program->uniform("stepScale", stepScale);
-        program->uniform("iterations", static_cast<int>(maxSize * (1.0f / stepScale) * 2.0f));
+        program->uniform("stepScale", stepScale * levelScale);
+        program->uniform("preintegrated", preintegration);
+        program->uniform("octahedralNormals", gradientEncoding == GradientEngine::Encoding::Octahedral);
+        program->uniform("gradientMode", static_cast<int>(mode));
+        program->uniform("iterations", static_cast<int>(maxSize * (1.0f / (stepScale * levelScale)) * 2.0f));
+        program->uniform("emptySpaceSkipping", emptySpaceSkipping);
+        program->uniform("brickScale", dimensions / static_cast<float>(occupancyGrid->getBrickSize()));
+        // a coarser voxel blends 2^level voxels each side, more than the brick ranges are padded by
+        program->uniform("skipMargin", drawnLevel > 0 ? (2 << drawnLevel) / occupancyGrid->getBrickSize() + 1 : 0);
+        program->uniform("jitterOffset", accumulation.getJitterOffset());
+
+        // samples taken and skipped, added up by every ray
+        program->uniform("countSamples", sampleCounting);
+
+        if (sampleCounting)
+        {
+            if (!sampleCountsBuffer) sampleCountsBuffer = gl::Ssbo::create(sizeof(uvec2), nullptr, GL_DYNAMIC_READ);
+
+            const uvec2 zero(0);
+            sampleCountsBuffer->bufferSubData(0, sizeof(zero), &zero);
+            glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, sampleCountsBuffer->getId());
+        }
 
         // lighting
         program->uniform("raycastShadows", RenderingParams::ShadowsEnabled());
+        program->uniform("lightVolumeShadows", useLightVolume);
         program->uniform("diffuseShading", RenderingParams::DiffuseShadingEnabled());
         program->uniform("ambientOcclusion", RenderingParams::SSAOEnabled());
         program->uniform("light.direction", light.direction);
@@ -272,28 +710,45 @@ void RaycastVolume::drawVolume(const Camera& camera)
         gl::setDefaultShaderVars();
 
         // draw volume to render targets
+        ProgressiveRefinement::State state;
+        state.modelViewProjection = gl::getModelViewProjection();
+        state.size = volumeRBuffer->getSize();
+        state.volume = volumeTexture;
+        state.gradients = gradientTexture;
+        state.transferFunction = transferFunction.get();
+        state.transferRevision = transferFunction->getRevision();
+        state.renderingRevision = RenderingParams::GetRevision();
+        state.lightDirection = light.direction;
+        state.lightAmbient = light.ambient;
+        state.lightDiffuse = light.diffuse;
+        state.valueMapping = valueMapping;
+        state.stepScale = stepScale;
+        state.shadowStepScale = shadowStepScale;
+        state.preintegration = preintegration;
+        state.lightVolumeShadows = useLightVolume;
+        state.gradientMode = static_cast<int>(mode);
+        state.level = drawnLevel;
+
+        // benchmarks measure full resolution frames, accumulated frames are jittered full resolution frames
+        const bool refine = !accumulation.isEnabled() && benchmarkProgress.empty();
+
+        if (refinement.draw(program, state, refine, [this] { drawTimedCube(); }) && sampleCounting)
         {
-            const gl::ScopedFramebuffer scopedFramebuffer(volumeRBuffer);
-            {
-                const static GLenum buffers[] =
-                {
-                    GL_COLOR_ATTACHMENT0,
-                    GL_COLOR_ATTACHMENT1,
-                    GL_COLOR_ATTACHMENT2,
-                    GL_COLOR_ATTACHMENT3
-                };
-                gl::drawBuffers(4, buffers);
-            }
-            const gl::ScopedViewport scopedViewport(ivec2(0), volumeRBuffer->getSize());
-            gl::clear();
-
-            // draw cube
-            gl::drawElements(gl::toGl(cubeMesh->getPrimitive()), cubeMesh->getNumIndices(),
-                             GL_UNSIGNED_INT, static_cast<GLuint *>(nullptr));
+            glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+            sampleCountsBuffer->getBufferSubData(0, sizeof(sampleCounts), &sampleCounts);
         }
+
+        if (accumulation.isEnabled()) accumulation.accumulate(state);
+
+        // the same view raycast on the CPU, for comparisons and hosts without a GPU
+        updateReference(mode);
     }
     // post-process
     {
+        // accumulated frames are shown from the history
+        const gl::Texture2dRef& color = accumulation.isEnabled() ? accumulation.getColorTexture() : volumeColor;
+        const gl::Texture2dRef& shadows = accumulation.isEnabled() ? accumulation.getShadowTexture() : volumeShadows;
+
         // ambient occlusion
         {
             PostProcess::instance().SSAO(volumePosition, volumeNormal, camera);
@@ -318,7 +773,7 @@ void RaycastVolume::drawVolume(const Camera& camera)
         {
             // invert the shadow color map so shadower areas are black
             {
-                PostProcess::instance().inverse(volumeShadows);
+                PostProcess::instance().inverse(shadows);
             }
             // blur to avoid aliasing
             {
@@ -327,7 +782,7 @@ void RaycastVolume::drawVolume(const Camera& camera)
             }
             // final shadowing
             {
-                PostProcess::instance().multiply(volumeColor);
+                PostProcess::instance().multiply(color);
             }
             
             // do tonemapping with resulting postprocess's texture
@@ -335,7 +790,7 @@ void RaycastVolume::drawVolume(const Camera& camera)
         }
         else // tonemapping with volume's texture
         {
-            PostProcess::instance().toneMapping(volumeColor);
+            PostProcess::instance().toneMapping(color);
         }
 
         // anti aliasing
@@ -350,25 +805,37 @@ void RaycastVolume::drawVolume(const Camera& camera)
     }
 }
 
-void RaycastVolume::resizeFbos()
+void RaycastVolume::drawTimedCube()
 {
-    gl::Texture2d::Format hdrFormat = gl::Texture2d::Format().internalFormat(GL_RGBA16F)
-                                                             .magFilter(GL_NEAREST)
-                                                             .minFilter(GL_NEAREST)
-                                                             .wrap(GL_REPEAT)
-                                                             .dataType(GL_FLOAT);
-    gl::Texture2d::Format dataFormat = gl::Texture2d::Format().internalFormat(GL_RGB16F)
-                                                              .magFilter(GL_NEAREST)
-                                                              .minFilter(GL_NEAREST)
-                                                              .wrap(GL_REPEAT)
-                                                              .dataType(GL_FLOAT);
-    gl::Texture2d::Format sFormat = gl::Texture2d::Format().internalFormat(GL_R8)
-                                                           .magFilter(GL_LINEAR)
-                                                           .minFilter(GL_LINEAR)
-                                                           .wrap(GL_REPEAT)
-                                                           .dataType(GL_UNSIGNED_BYTE)
-                                                           .swizzleMask(GL_RED, GL_RED, GL_RED, GL_RED);
+    // draw cube, timed for the gradient modes
+    const bool timed = raycastTimer != nullptr;
+
+    if (!timed) raycastTimer = gl::QueryTimeSwapped::create();
+
+    raycastTimer->begin();
+    gl::drawElements(gl::toGl(cubeMesh->getPrimitive()), cubeMesh->getNumIndices(),
+                     GL_UNSIGNED_INT, static_cast<GLuint *>(nullptr));
+    raycastTimer->end();
+
+    if (!timed) return;
+
+    raycastMilliseconds = raycastTimer->getElapsedMilliseconds();
 
+    if (!benchmarkProgress.empty())
+    {
+        const int block = benchmarkFrames + BenchmarkWarmup;
+
+        if (benchmarkFrame % block >= BenchmarkWarmup)
+        {
+            benchmarkProgress[benchmarkFrame / block].milliseconds += raycastMilliseconds / benchmarkFrames;
+        }
+
+        benchmarkFrame++;
+    }
+}
+
+void RaycastVolume::resizeFbos()
+{
     const ivec2 winSize = getWindowSize();
     const int32_t h = winSize.y;
     const int32_t w = winSize.x;
@@ -377,13 +844,13 @@ void RaycastVolume::resizeFbos()
     {
         // cube positions rendering
         gl::Fbo::Format frontFormat, backFormat;
-        frontTexture = gl::Texture2d::create(w, h, dataFormat);
-        backTexture = gl::Texture2d::create(w, h, dataFormat);
-        volumeColor = gl::Texture2d::create(w, h, hdrFormat);
-        volumeNormal = gl::Texture2d::create(w, h, dataFormat);
-        volumeShadows = gl::Texture2d::create(w, h, sFormat);
-        volumePosition = gl::Texture2d::create(w, h, dataFormat);
-        volumeAO = gl::Texture2d::create(w, h, sFormat);
+        frontTexture = gl::Texture2d::create(w, h, dataFormat());
+        backTexture = gl::Texture2d::create(w, h, dataFormat());
+        volumeColor = gl::Texture2d::create(w, h, hdrFormat());
+        volumeNormal = gl::Texture2d::create(w, h, dataFormat());
+        volumeShadows = gl::Texture2d::create(w, h, shadowFormat());
+        volumePosition = gl::Texture2d::create(w, h, dataFormat());
+        volumeAO = gl::Texture2d::create(w, h, shadowFormat());
 
         // front fbo
         frontFormat.attachment(GL_COLOR_ATTACHMENT0, frontTexture);
@@ -409,6 +876,10 @@ void RaycastVolume::resizeFbos()
         aoFormat.attachment(GL_COLOR_ATTACHMENT0, volumeAO);
         aoFormat.depthBuffer();
         volumeAOFbo = gl::Fbo::create(w, h, aoFormat);
+
+        // the refinement and the accumulation start over at the new size
+        refinement.resizeFbos(volumeRBuffer);
+        accumulation.resizeFbos(volumeRBuffer);
     }
     catch (const Exception& e)
     {
@@ -416,68 +887,730 @@ void RaycastVolume::resizeFbos()
     }
 }
 
-void RaycastVolume::extractHistogram()
+void RaycastVolume::prepareDerivedData()
 {
-    std::array<uint32_t, 256> histogramData = {0};
-    // create shader storage buffer
-    histogramSsbo = gl::Ssbo::create(256 * sizeof(uint32_t), histogramData.data(), GL_DYNAMIC_COPY);
-    histogramSsbo->bindBase(1);
+    // computed by the load job from the slabs it uploaded, or restored from the cache
+    const ivec3 size = loadJob->getDimensions();
+    const GradientEngine::Encoding encoding = loadJob->getOptions().gradientSettings.encoding;
+    const bool precompute = loadJob->getOptions().precomputeGradients;
+
+    if (precompute) pendingGradientTexture = createGradientTexture(loadJob->getGradients(), size, encoding);
+
+    pendingOccupancyGrid = loadJob->getOccupancyGrid();
+
+    if (loadJob->isDerivedDataCached()) return;
 
-    // compute histogram
+    if (precompute)
     {
-        // bind histogram compute shader
-        histogramCompute->bind();
-        // volume texture
-        glBindImageTexture(0, volumeTexture->getId(), 0, true, 0, GL_READ_ONLY, GL_R8UI);
-        bindBufferBase(histogramSsbo->getTarget(), 1, histogramSsbo);
-        // compute histogram
-        gl::dispatchCompute(1, 1, 1);
-        // block to ensure completion
-        gl::memoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+        const auto& timings = loadJob->getGradientTimings();
+        CI_LOG_I("Prepared gradients in " << timings.differences + timings.smoothing + timings.encoding
+                 << " s, differences " << timings.differences << " s, smoothing " << timings.smoothing
+                 << " s using the " << GradientEngine::GetKernelName() << " kernel, "
+                 << (encoding == GradientEngine::Encoding::Octahedral ? "octahedral" : "spheremap") << " encoding "
+                 << timings.encoding << " s");
     }
 
-    // extract histogram values
-    uint32_t* ssboValues = reinterpret_cast<uint32_t*>(histogramSsbo->map(GL_WRITE_ONLY));
-    memcpy(histogramData.data(), ssboValues, 256 * sizeof(uint32_t));
-    histogramSsbo->unmap();
-    // convert to normalized floating values
-    auto maxValue = max_element(histogramData.begin(), histogramData.end());
+    saveDerivedData(loadJob->takeGradients());
+}
+
+void RaycastVolume::cancelDerivedData()
+{
+    pendingGradientTexture = nullptr;
+    pendingOccupancyGrid = nullptr;
+}
+
+void RaycastVolume::saveDerivedData(std::vector<uint8_t> gradients)
+{
+    if (!derivedDataCaching) return;
+
+    VolumeCache::Writer writer(loadJob->getCacheKey());
+    writer.addSection(VolumeCache::HistogramSection, loadJob->getStatistics().save());
+
+    // loads with on-the-fly normals have none
+    if (!gradients.empty()) writer.addSection(VolumeCache::GradientsSection, move(gradients));
 
-    // normalize and insert values
-    for (int i = 0; i < 256; i++)
+    writer.addSection(VolumeCache::BrickRangesSection, pendingOccupancyGrid->save());
+
+    // reloads convert with the same window so the cached gradients match
+    if (loadJob->isConverted())
     {
-        histogram[i] = static_cast<float>(histogramData[i]) / *maxValue;
+        const uint16_t bounds[2] = { loadJob->getWindow().getLow(), loadJob->getWindow().getHigh() };
+        auto data = reinterpret_cast<const uint8_t*>(bounds);
+        writer.addSection(VolumeCache::WindowSection, std::vector<uint8_t>(data, data + sizeof(bounds)));
     }
+
+    // write the cache in the background, a pending write finishes first
+    const std::string path = VolumeCache::PathFor(loadJob->getFilepath());
+
+    if (derivedDataWrite.valid()) derivedDataWrite.wait();
+
+    derivedDataWrite = std::async(std::launch::async, [writer = move(writer), path]
+    {
+        if (!writer.write(path)) CI_LOG_W("Couldn't write volume cache " << path);
+    });
 }
 
-void RaycastVolume::generateGradients()
+bool RaycastVolume::isDerivedDataCaching() const
 {
-    auto format = gl::Texture3d::Format().magFilter(GL_LINEAR)
-                                         .minFilter(GL_LINEAR)
-                                         .wrapS(GL_CLAMP_TO_BORDER)
-                                         .wrapR(GL_CLAMP_TO_BORDER)
-                                         .wrapT(GL_CLAMP_TO_BORDER)
-                                         .internalFormat(GL_RG16F);
-    format.setDataType(GL_FLOAT);
-    gradientTexture = gl::Texture3d::create(dimensions.x, dimensions.y, dimensions.z, format);
+    return derivedDataCaching;
+}
+
+void RaycastVolume::setDerivedDataCaching(const bool value)
+{
+    derivedDataCaching = value;
+}
+
+bool RaycastVolume::isConvertingTo8Bits() const
+{
+    return convertTo8Bits;
+}
 
-    // compute gradients
+void RaycastVolume::setConvertTo8Bits(const bool value)
+{
+    convertTo8Bits = value;
+}
+
+const vec2& RaycastVolume::getWindowPercentiles() const
+{
+    return windowPercentiles;
+}
+
+void RaycastVolume::setWindowPercentiles(const vec2& value)
+{
+    windowPercentiles = clamp(value, vec2(0), vec2(100));
+    windowPercentiles.y = max(windowPercentiles.x, windowPercentiles.y);
+}
+
+void RaycastVolume::updateOccupancy()
+{
+    if (!occupancyGrid->update(transferFunction->getIndexedTransferFunction(), transferFunction->getThreshold(),
+                               valueMapping))
+    {
+        return;
+    }
+
+    // only the bricks around flipped ones are revisited
+    const ivec3 brickCount = occupancyGrid->getBrickCount();
+    emptyDistance.update(occupancyGrid->getOccupancyBytes(), brickCount);
+    const std::vector<uint8_t> distances = emptyDistance.getDistanceBytes();
+
+    // rows of the brick grid are tightly packed
+    GLint unpackAlignment;
+    glGetIntegerv(GL_UNPACK_ALIGNMENT, &unpackAlignment);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    emptyDistanceTexture->update(distances.data(), GL_RED, GL_UNSIGNED_BYTE, 0, brickCount.x, brickCount.y,
+                                 brickCount.z);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, unpackAlignment);
+}
+
+void RaycastVolume::updateReference(GradientMode mode)
+{
+    if (pendingReference.valid())
     {
-        gradientsCompute->bind();
-        // pass textures
-        glBindImageTexture(0, volumeTexture->getId(), 0, true, 0, GL_READ_ONLY, GL_R8UI);
-        glBindImageTexture(1, gradientTexture->getId(), 0, true, 0, GL_WRITE_ONLY, GL_RG16F);
-        // compute gradients
-        gl::dispatchCompute(ceil(dimensions.x / 8), ceil(dimensions.y / 8), ceil(dimensions.z / 8));
+        if (pendingReference.wait_for(std::chrono::seconds(0)) != std::future_status::ready) return;
+
+        pendingReference.get();
+        referenceRaycaster = pendingReferenceRaycaster;
+        pendingReferenceRaycaster = nullptr;
+        const CpuRaycaster::Frame& frame = referenceRaycaster->getFrame();
+        CI_LOG_I("Raycast a " << frame.size.x << " x " << frame.size.y << " reference on the CPU in "
+                 << frame.seconds * 1000 << " ms, " << frame.getRaysPerSecond() / 1e6 << " million rays per second on "
+                 << ThreadPool::instance().getThreadCount() << " threads, load imbalance "
+                 << frame.schedule.getImbalance());
+
+        if (pendingTraversalBenchmark)
+        {
+            traversalBenchmark = pendingTraversalBenchmark;
+            pendingTraversalBenchmark = nullptr;
+            CI_LOG_I("CPU raycast traversal: " << traversalBenchmark->scalarRaysPerSecond / 1e6
+                     << " million single rays per second, " << traversalBenchmark->packetRaysPerSecond / 1e6
+                     << " million packet rays per second, largest difference " << traversalBenchmark->maxDifference);
+
+            if (!traversalBenchmark->packets) CI_LOG_W("Ray packets unavailable, both traversals traced single rays");
+        }
     }
-    // smooth gradients
+
+    if (!referenceRequested) return;
+
+    referenceRequested = false;
+    pendingTraversalBenchmark = referenceBenchmark ? std::make_shared<CpuRaycaster::TraversalBenchmark>() : nullptr;
+    referenceBenchmark = false;
+
+    // the volume is paged from its file at the source resolution, or read back from the volume texture
+    const ivec3 volumeSize = brickCache ? sourceDimensions : ivec3(dimensions);
+    std::vector<uint8_t> voxels;
+    std::vector<uint8_t> gradients;
+
+    if (!brickCache) voxels = readVoxels(volumeTexture, volumeSize, voxelType);
+
+    // gradients of a reduced volume don't match the source, normals are taken on-the-fly then
+    if (gradientTexture && volumeSize == ivec3(dimensions))
     {
-        smoothGradientsCompute->bind();
-        // pass textures
-        glBindImageTexture(0, gradientTexture->getId(), 0, true, 0, GL_READ_WRITE, GL_RG16F);
-        // compute gradients
-        gl::dispatchCompute(ceil(dimensions.x / 8), ceil(dimensions.y / 8), ceil(dimensions.z / 8));
+        gradients = readGradients(gradientTexture, volumeSize, gradientEncoding);
     }
+
+    pendingReferenceRaycaster = std::make_shared<CpuRaycaster>();
+    pendingReferenceRaycaster->setTransferFunction(transferFunction->getIndexedTransferFunction(),
+                                                   transferFunction->getPreintegrationTable().getTable());
+    std::vector<const uint8_t*> styles;
+
+    for (auto& style : Style::GetAvailableStyles()) { styles.push_back(style.getSurface().getData()); }
+
+    pendingReferenceRaycaster->setStyleFunction(transferFunction->getTransferFunction(),
+                                                transferFunction->getIndexFunction(), styles);
+
+    pendingReferenceRaycaster->setNoise(Surface8u(loadImage(loadAsset("images/noise.png"))));
+
+    CpuRaycaster::Parameters parameters;
+    parameters.model = gl::getModelMatrix();
+    parameters.view = gl::getViewMatrix();
+    parameters.projection = gl::getProjectionMatrix();
+    parameters.light = light;
+    parameters.threshold = transferFunction->getThreshold();
+    parameters.valueMapping = valueMapping;
+    // full resolution, the pyramid levels aren't read back
+    const int largest = max(volumeSize.x, max(volumeSize.y, volumeSize.z));
+    parameters.stepSize = vec3(stepScale / largest);
+    parameters.stepScale = stepScale;
+    parameters.iterations = static_cast<int>(largest * (1.0f / stepScale) * 2.0f);
+    parameters.gradientMode = static_cast<CpuRaycaster::GradientMode>(mode);
+    parameters.preintegrated = preintegration;
+    parameters.diffuseShading = RenderingParams::DiffuseShadingEnabled();
+
+    pendingReference = std::async(std::launch::async, [raycaster = pendingReferenceRaycaster, voxels = move(voxels),
+                                                       gradients = move(gradients), cache = brickCache,
+                                                       type = voxelType, dimensions = volumeSize,
+                                                       encoding = gradientEncoding, parameters,
+                                                       size = volumeRBuffer->getSize(),
+                                                       benchmark = pendingTraversalBenchmark]
+    {
+        if (cache) raycaster->setVolume(cache);
+        else raycaster->setVolume(voxels.data(), type, dimensions);
+
+        raycaster->setGradients(gradients.empty() ? nullptr : gradients.data(), encoding);
+
+        if (benchmark) *benchmark = raycaster->benchmarkTraversal(parameters, size);
+        else raycaster->render(parameters, size);
+
+        // the borrowed data goes away with the task
+        raycaster->setVolume(nullptr, type, dimensions);
+        raycaster->setGradients(nullptr, encoding);
+    });
+}
+
+void RaycastVolume::updateLightVolume()
+{
+    const ivec3 size = LightVolume::GetSize(ivec3(dimensions), lightVolumeScale);
+
+    if (pendingLightVolume.valid())
+    {
+        if (pendingLightVolume.wait_for(std::chrono::seconds(0)) != std::future_status::ready) return;
+
+        pendingLightVolume.get();
+        const ivec3 cells = lightVolume->getSize();
+        lightVolumeSize = cells;
+        lightVolumeSeconds = lightVolume->getSeconds();
+
+        if (lightVolumeTexture->getWidth() != cells.x || lightVolumeTexture->getHeight() != cells.y ||
+            lightVolumeTexture->getDepth() != cells.z)
+        {
+            lightVolumeTexture = gl::Texture3d::create(cells.x, cells.y, cells.z, lightVolumeFormat());
+        }
+
+        // rows of the light volume are tightly packed
+        GLint unpackAlignment;
+        glGetIntegerv(GL_UNPACK_ALIGNMENT, &unpackAlignment);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        lightVolumeTexture->update(lightVolume->getTransmittance().data(), GL_RED, GL_UNSIGNED_BYTE, 0, cells.x,
+                                   cells.y, cells.z);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, unpackAlignment);
+        // the shadows changed under an unchanged view
+        refinement.restart();
+        accumulation.restart();
+    }
+
+    // another resolution averages its cells from a reread of the volume, the texture is never read back
+    if (lightVolumeJob)
+    {
+        if (lightVolumeJob->isActive() && lightVolumeJob->getStage() != VolumeLoadJob::Stage::Ready) return;
+
+        if (lightVolumeJob->getStage() == VolumeLoadJob::Stage::Ready)
+        {
+            lightVolume = lightVolumeJob->getLightVolume();
+            lightVolumeJob->complete();
+        }
+        else
+        {
+            CI_LOG_W("Averaging the light volume cells failed, shadows are marched again: "
+                     << lightVolumeJob->getError());
+            lightVolumeShadows = false;
+            lightVolumeJob = nullptr;
+            return;
+        }
+
+        lightVolumeJob = nullptr;
+    }
+
+    if (!lightVolume || lightVolume->getSize() != size)
+    {
+        VolumeLoadOptions options = loadOptions();
+        options.precomputeGradients = false;
+        options.halveResident = false;
+        lightVolumeJob = residentJob->reread(options);
+
+        return;
+    }
+
+    LightVolume::Parameters parameters;
+    parameters.direction = light.direction;
+    const auto& transfer = transferFunction->getIndexedTransferFunction();
+
+    for (size_t i = 0; i < transfer.size(); i++) { parameters.opacities[i] = transfer[i].w; }
+
+    parameters.threshold = transferFunction->getThreshold();
+    parameters.valueMapping = valueMapping;
+
+    if (lightVolume->getParameters() == parameters) return;
+
+    pendingLightVolume = std::async(std::launch::async, [volume = lightVolume, parameters]
+    {
+        volume->compute(parameters);
+    });
+}
+
+void RaycastVolume::updateGradientTexture()
+{
+    if (!isDrawable || gradientMode != GradientMode::Precomputed || gradientTexture) return;
+
+    // the gradients come from the cache or the slabs of the source, like while loading
+    if (!gradientJob)
+    {
+        VolumeLoadOptions options = loadOptions();
+        options.lightVolumeScale = 0;
+        options.halveResident = false;
+        gradientJob = residentJob->reread(options);
+
+        return;
+    }
+
+    if (gradientJob->isActive() && gradientJob->getStage() != VolumeLoadJob::Stage::Ready) return;
+
+    if (gradientJob->getStage() != VolumeLoadJob::Stage::Ready)
+    {
+        CI_LOG_W("Preparing the gradients failed, normals stay on-the-fly: " << gradientJob->getError());
+        gradientMode = GradientMode::Central;
+        gradientJob = nullptr;
+        return;
+    }
+
+    const auto& timings = gradientJob->getGradientTimings();
+    gradientEncoding = gradientJob->getOptions().gradientSettings.encoding;
+    gradientTexture = createGradientTexture(gradientJob->getGradients(), ivec3(dimensions), gradientEncoding);
+    // coarser gradient levels are built with the volume's
+    resetPyramid();
+
+    if (gradientJob->isDerivedDataCached()) CI_LOG_I("Restored the gradients from the volume cache");
+    else CI_LOG_I("Prepared gradients again in " << timings.differences + timings.smoothing + timings.encoding << " s");
+
+    gradientJob->complete();
+    gradientJob = nullptr;
+}
+
+void RaycastVolume::cancelGradientRebuild()
+{
+    // the job stops reading once released
+    gradientJob = nullptr;
+}
+
+RaycastVolume::GradientMode RaycastVolume::frameGradientMode()
+{
+    // on-the-fly normals until the gradient texture is ready
+    const GradientMode current = gradientMode == GradientMode::Precomputed && !gradientTexture ?
+                                 GradientMode::Central : gradientMode;
+
+    if (benchmarkProgress.empty()) return current;
+
+    const int block = benchmarkFrames + BenchmarkWarmup;
+    size_t index = benchmarkFrame / block;
+
+    // modes that can't be drawn are skipped
+    while (index < benchmarkProgress.size() && !benchmarkProgress[index].measured)
+    {
+        benchmarkFrame = static_cast<int>(++index) * block;
+    }
+
+    if (index < benchmarkProgress.size()) return benchmarkProgress[index].mode;
+
+    gradientBenchmark = move(benchmarkProgress);
+    benchmarkProgress.clear();
+
+    for (auto& result : gradientBenchmark)
+    {
+        CI_LOG_I("Gradient mode " << static_cast<int>(result.mode) << ": " << result.gradientBytes / (1024 * 1024)
+                 << " MB of gradients, raycast " << (result.measured ? result.milliseconds : 0.0) << " ms");
+    }
+
+    return current;
+}
+
+void RaycastVolume::benchmarkGradientModes(int frames)
+{
+    const size_t voxels = static_cast<size_t>(dimensions.x) * dimensions.y * dimensions.z;
+    benchmarkFrames = std::max(frames, 1);
+    benchmarkFrame = 0;
+    benchmarkProgress.clear();
+
+    for (GradientMode mode : { GradientMode::Precomputed, GradientMode::Central, GradientMode::Forward })
+    {
+        // the precomputed mode only runs with the gradient texture resident
+        const bool precomputed = mode == GradientMode::Precomputed;
+        const bool measured = isDrawable && (!precomputed || gradientTexture);
+        const size_t bytes = measured && precomputed ? voxels * GradientEngine::GetEncodedSize(gradientEncoding) : 0;
+        benchmarkProgress.push_back({ mode, measured, bytes, 0.0 });
+    }
+}
+
+void RaycastVolume::renderReference(bool benchmark)
+{
+    referenceRequested = isDrawable;
+    referenceBenchmark = isDrawable && benchmark;
+}
+
+bool RaycastVolume::isRenderingReference() const
+{
+    return referenceRequested || pendingReference.valid();
+}
+
+const std::shared_ptr<CpuRaycaster>& RaycastVolume::getReferenceRaycaster() const
+{
+    return referenceRaycaster;
+}
+
+const std::shared_ptr<CpuRaycaster::TraversalBenchmark>& RaycastVolume::getTraversalBenchmark() const
+{
+    return traversalBenchmark;
+}
+
+bool RaycastVolume::isBenchmarkingGradientModes() const
+{
+    return !benchmarkProgress.empty();
+}
+
+const std::vector<RaycastVolume::GradientBenchmark>& RaycastVolume::getGradientBenchmark() const
+{
+    return gradientBenchmark;
+}
+
+double RaycastVolume::getRaycastMilliseconds() const
+{
+    return raycastMilliseconds;
+}
+
+RaycastVolume::GradientMode RaycastVolume::getGradientMode() const
+{
+    return gradientMode;
+}
+
+void RaycastVolume::setGradientMode(const GradientMode value)
+{
+    gradientMode = value;
+
+    // on-the-fly normals don't need the gradient texture resident
+    if (value != GradientMode::Precomputed)
+    {
+        cancelGradientRebuild();
+        gradientTexture = nullptr;
+    }
+}
+
+bool RaycastVolume::isLightVolumeShadows() const
+{
+    return lightVolumeShadows;
+}
+
+void RaycastVolume::setLightVolumeShadows(const bool value)
+{
+    lightVolumeShadows = value;
+}
+
+const float& RaycastVolume::getLightVolumeScale() const
+{
+    return lightVolumeScale;
+}
+
+void RaycastVolume::setLightVolumeScale(const float& value)
+{
+    lightVolumeScale = clamp(value, 1.0f / 16, 1.0f);
+}
+
+const ivec3& RaycastVolume::getLightVolumeSize() const
+{
+    return lightVolumeSize;
+}
+
+double RaycastVolume::getLightVolumeSeconds() const
+{
+    return lightVolumeSeconds;
+}
+
+const std::shared_ptr<VolumePyramid>& RaycastVolume::getPyramid() const
+{
+    return pyramid;
+}
+
+VolumePyramid::Filter RaycastVolume::getPyramidFilter() const
+{
+    return pyramidFilter;
+}
+
+void RaycastVolume::setPyramidFilter(const VolumePyramid::Filter value)
+{
+    if (value == pyramidFilter) return;
+
+    pyramidFilter = value;
+    // the first level is halved again with the new filter
+    resetPyramid();
+    pyramidJob = nullptr;
+    halvedLevel = VolumePyramid::Level();
+}
+
+int RaycastVolume::getPyramidLevel() const
+{
+    return pyramidLevel;
+}
+
+void RaycastVolume::setPyramidLevel(const int value)
+{
+    pyramidLevel = max(value, -1);
+}
+
+float RaycastVolume::getLevelBias() const
+{
+    return levelBias;
+}
+
+void RaycastVolume::setLevelBias(const float value)
+{
+    levelBias = value;
+}
+
+int RaycastVolume::getDrawnLevel() const
+{
+    return drawnLevel;
+}
+
+int RaycastVolume::getPyramidLevelCount() const
+{
+    return VolumePyramid::GetLevelCount(ivec3(dimensions));
+}
+
+int RaycastVolume::getResidentLevel() const
+{
+    return residentLevel;
+}
+
+const ivec3& RaycastVolume::getSourceDimensions() const
+{
+    return sourceDimensions;
+}
+
+void RaycastVolume::updatePyramid()
+{
+    if (pyramid) return;
+
+    // a filter change halves the first level again from a reread of the volume
+    if (halvedLevel.voxels.empty() && !pyramidBuild.valid())
+    {
+        if (!pyramidJob)
+        {
+            VolumeLoadOptions options = loadOptions();
+            options.precomputeGradients = false;
+            options.lightVolumeScale = 0;
+            pyramidJob = residentJob->reread(options);
+
+            return;
+        }
+
+        if (pyramidJob->isActive() && pyramidJob->getStage() != VolumeLoadJob::Stage::Ready) return;
+
+        if (pyramidJob->getStage() != VolumeLoadJob::Stage::Ready)
+        {
+            CI_LOG_W("Halving the volume failed, the full resolution is drawn: " << pyramidJob->getError());
+            pyramidLevel = 0;
+            pyramidJob = nullptr;
+            return;
+        }
+
+        halvedLevel = pyramidJob->takeHalvedLevel();
+        pyramidJob->complete();
+        pyramidJob = nullptr;
+    }
+
+    if (!pyramidBuild.valid())
+    {
+        // gradient levels only for a resident gradient texture, built with the settings it was prepared with
+        GradientEngine::Settings settings = gradientSettings;
+        settings.encoding = gradientEncoding;
+        const bool gradients = gradientTexture != nullptr;
+        const VoxelType type = voxelType;
+        auto first = std::make_shared<VolumePyramid::Level>(std::move(halvedLevel));
+        halvedLevel = VolumePyramid::Level();
+        pendingPyramid = std::make_shared<VolumePyramid>(pyramidFilter);
+        pyramidBuild = std::async(std::launch::async, [pyramid = pendingPyramid, first, type, gradients, settings]
+        {
+            return pyramid->build(std::move(*first), type, gradients ? &settings : nullptr);
+        });
+
+        return;
+    }
+
+    if (pyramidBuild.wait_for(std::chrono::seconds(0)) != std::future_status::ready) return;
+
+    if (!pyramidBuild.get())
+    {
+        halvedLevel = pendingPyramid->takeFirstLevel();
+        pendingPyramid = nullptr;
+        return;
+    }
+
+    pyramid = pendingPyramid;
+    pendingPyramid = nullptr;
+    const auto& levels = pyramid->getLevels();
+    const bool octahedral = gradientEncoding == GradientEngine::Encoding::Octahedral;
+
+    // levels are tightly packed
+    GLint unpackAlignment;
+    glGetIntegerv(GL_UNPACK_ALIGNMENT, &unpackAlignment);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+
+    for (size_t i = 0; i < levels.size(); i++)
+    {
+        const ivec3& size = levels[i].dimensions;
+        const GLint level = static_cast<GLint>(i + 1);
+        {
+            gl::ScopedTextureBind scopedVolume(volumeTexture);
+            glTexImage3D(GL_TEXTURE_3D, level, volumeTexture->getInternalFormat(), size.x, size.y, size.z, 0, GL_RED,
+                         voxelDataType(voxelType), levels[i].voxels.data());
+        }
+
+        if (gradientTexture && !levels[i].gradients.empty())
+        {
+            gl::ScopedTextureBind scopedGradients(gradientTexture);
+            glTexImage3D(GL_TEXTURE_3D, level, gradientTexture->getInternalFormat(), size.x, size.y, size.z, 0,
+                         GL_RG, octahedral ? GL_BYTE : GL_HALF_FLOAT, levels[i].gradients.data());
+        }
+
+        CI_LOG_I("Pyramid level " << level << ": " << size.x << " x " << size.y << " x " << size.z << ", "
+                 << (levels[i].voxels.size() + levels[i].gradients.size()) / 1024 << " KB, reduced in "
+                 << levels[i].seconds * 1000 << " ms, gradients " << levels[i].gradientSeconds * 1000 << " ms");
+    }
+
+    glPixelStorei(GL_UNPACK_ALIGNMENT, unpackAlignment);
+
+    for (auto& texture : { volumeTexture, gradientTexture })
+    {
+        if (!texture) continue;
+
+        gl::ScopedTextureBind scopedTexture(texture);
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAX_LEVEL, static_cast<GLint>(levels.size()));
+    }
+
+    const size_t voxelBytes = GetVoxelSize(voxelType) +
+                              (gradientTexture ? GradientEngine::GetEncodedSize(gradientEncoding) : 0);
+    const size_t fullBytes = static_cast<size_t>(dimensions.x) * dimensions.y * dimensions.z * voxelBytes;
+    CI_LOG_I("Built " << levels.size() << " pyramid levels using the " << VolumePyramid::GetKernelName()
+             << " kernel, " << pyramid->getBytes() / (1024 * 1024) << " MB or "
+             << 100.0 * pyramid->getBytes() / fullBytes << "% over the full resolution");
+}
+
+void RaycastVolume::resetPyramid()
+{
+    if (pendingPyramid) pendingPyramid->cancel();
+    if (pyramidBuild.valid()) pyramidBuild.wait();
+
+    // the voxels of the first level don't change with the gradients, the next build starts from them
+    if (auto& built = pendingPyramid ? pendingPyramid : pyramid) halvedLevel = built->takeFirstLevel();
+
+    pyramidBuild = std::future<bool>();
+    pendingPyramid = nullptr;
+    pyramid = nullptr;
+    drawnLevel = 0;
+
+    // the coarser levels stay allocated until the textures are replaced, only the full resolution is drawn
+    for (auto& texture : { volumeTexture, gradientTexture })
+    {
+        if (!texture) continue;
+
+        gl::ScopedTextureBind scopedTexture(texture);
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_BASE_LEVEL, 0);
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAX_LEVEL, 0);
+    }
+}
+
+int RaycastVolume::selectLevel(const Camera& camera, int levels) const
+{
+    if (pyramidLevel >= 0) return min(pyramidLevel, levels);
+
+    // world size of a pixel at the volume center next to the smallest voxel side
+    const vec3 center = vec3(gl::getModelMatrix() * vec4(vec3(0.5f), 1));
+    const float distance = length(center - camera.getEyePoint());
+    const float pixel = 2 * distance * tan(radians(camera.getFov()) * 0.5f) / volumeRBuffer->getHeight();
+    const vec3 voxel = scaleFactor / dimensions;
+    const float voxelSize = min(voxel.x, min(voxel.y, voxel.z));
+
+    return VolumePyramid::SelectLevel(voxelSize > 0 ? pixel / voxelSize : 1, levelBias, levels);
+}
+
+bool RaycastVolume::isEmptySpaceSkipping() const
+{
+    return emptySpaceSkipping;
+}
+
+void RaycastVolume::setEmptySpaceSkipping(const bool value)
+{
+    emptySpaceSkipping = value;
+}
+
+bool RaycastVolume::isSampleCounting() const
+{
+    return sampleCounting;
+}
+
+void RaycastVolume::setSampleCounting(const bool value)
+{
+    sampleCounting = value;
+    sampleCounts = uvec2(0);
+}
+
+const uvec2& RaycastVolume::getSampleCounts() const
+{
+    return sampleCounts;
+}
+
+ProgressiveRefinement& RaycastVolume::getProgressiveRefinement()
+{
+    return refinement;
+}
+
+TemporalAccumulation& RaycastVolume::getTemporalAccumulation()
+{
+    return accumulation;
+}
+
+const std::shared_ptr<OccupancyGrid>& RaycastVolume::getOccupancyGrid() const
+{
+    return occupancyGrid;
+}
+
+const GradientEngine::Settings& RaycastVolume::getGradientSettings() const
+{
+    return gradientSettings;
+}
+
+void RaycastVolume::setGradientSettings(const GradientEngine::Settings& value)
+{
+    gradientSettings = value;
+    gradientSettings.radius = clamp(value.radius, 0, 16);
 }
 
 const std::array<float, 256>& RaycastVolume::getHistogram() const
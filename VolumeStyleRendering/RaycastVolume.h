@@ -1,8 +1,22 @@
 #pragma once
+#include <future>
 #include <cinder/gl/gl.h>
+#include <cinder/gl/Query.h>
 #include "Light.h"
+#include "VoxelType.h"
+#include "GradientEngine.h"
+#include "OccupancyGrid.h"
+#include "DistanceField.h"
+#include "LightVolume.h"
+#include "VolumePyramid.h"
+#include "CpuRaycaster.h"
+#include "ProgressiveRefinement.h"
+#include "TemporalAccumulation.h"
 
 class StyleTransferFunction;
+class VolumeLoadJob;
+struct VolumeLoadOptions;
+class BrickCache;
 
 /**
  * \brief Defines a volume rendered with volume raycasting
@@ -10,14 +24,59 @@ class StyleTransferFunction;
 class RaycastVolume
 {
 public:
+    enum class GradientMode
+    {
+        // normals read from the gradient texture, smoothed while loading
+        Precomputed,
+        // central differences of the six neighbouring voxels, no gradient texture
+        Central,
+        // forward differences of three neighbouring voxels and the sample, no gradient texture
+        Forward
+    };
+
     /**
-     * \brief Loads the raw data from the given filepath into a 3d texture
+     * \brief Resident gradient memory and raycast time of a gradient mode
+     */
+    struct GradientBenchmark
+    {
+        GradientMode mode;
+        // false if the mode couldn't be measured, precomputed gradients released by an on-the-fly mode
+        bool measured;
+        size_t gradientBytes;
+        // average GPU time of the raycast pass
+        double milliseconds;
+    };
+
+    /**
+     * \brief Starts loading the raw data from the given filepath into a 3d texture in the background.
+     * The current volume stays drawable until the new one is swapped in by update
      * \param dimensions The volume dimensions
      * \param ratios The volume aspect ratios
      * \param filepath The volume's raw data filepath
-     * \param is16Bits Determines if the volume is 8 o 16 bits depth
+     * \param voxelType The volume voxel type
+     */
+    void loadFromFile(const glm::vec3& dimensions, const glm::vec3& ratios, const std::string filepath,
+                      VoxelType voxelType = VoxelType::UInt8);
+    /**
+     * \brief Starts loading a bricked volume or a directory of slice images in the background, the
+     * volume parameters are read from the file header or the images
+     * \param filepath The bricked volume filepath or the slices directory
+     */
+    void loadFromFile(const std::string filepath);
+    /**
+     * \brief Uploads the slabs read by the background load and swaps the new volume in once
+     * all of them are uploaded, has to be called every frame from the rendering thread
+     */
+    void update();
+    /**
+     * \brief Cancels the volume load in progress, the current volume is kept
      */
-    void loadFromFile(const glm::vec3& dimensions, const glm::vec3& ratios, const std::string filepath, bool is16Bits = false);
+    void cancelLoad();
+    /**
+     * \brief The last started volume load, used to query its progress
+     * \return The volume load job, null if no volume has been loaded
+     */
+    const std::shared_ptr<VolumeLoadJob> &getLoadJob() const;
     /**
      * \brief Renders the volume using raycasting to the specified output
      * \param camera Main rendering camera
@@ -59,6 +118,17 @@ public:
     * \param value The new step scale
     */
     void setShadowStepScale(const float& value);
+    /**
+     * \brief Determines if samples are classified with the pre-integrated transfer function, which
+     * integrates it over the segment from the previous sample so larger steps keep sharp features
+     * \return True if the pre-integrated transfer function is used
+     */
+    bool isPreintegrated() const;
+    /**
+     * \brief Enables or disables the pre-integrated classification
+     * \param value True to use the pre-integrated transfer function
+     */
+    void setPreintegrated(const bool value);
     /**
      * \brief Volume's aspect ratios per axis
      * \return Volume's aspect ratios
@@ -69,6 +139,265 @@ public:
      * \param value The new aspect ratio
      */
     void setAspectratios(const glm::vec3& value);
+    /**
+     * \brief Maximum amount of volume data kept in host memory while a volume is loaded
+     * \return The host memory budget in bytes
+     */
+    size_t getHostMemoryBudget() const;
+    /**
+     * \brief Sets the maximum amount of volume data kept in host memory while a volume is loaded,
+     * this determines the thickness of the slabs streamed to the volume texture
+     * \param value The new budget in bytes
+     */
+    void setHostMemoryBudget(const size_t value);
+    /**
+     * \brief Maximum texture memory of a loaded volume and its gradients
+     * \return The resident memory budget in bytes
+     */
+    size_t getResidentMemoryBudget() const;
+    /**
+     * \brief Sets the maximum texture memory of a loaded volume and its gradients, larger volumes
+     * are halved while streaming until they fit
+     * \param value The new budget in bytes
+     */
+    void setResidentMemoryBudget(const size_t value);
+    /**
+     * \brief Determines if histogram and gradients are stored in a sidecar cache next to the volume
+     * file, so reopening the same volume skips their computation
+     * \return True if derived data is cached
+     */
+    bool isDerivedDataCaching() const;
+    /**
+     * \brief Enables or disables writing the derived data cache of loaded volumes
+     * \param value True to cache derived data
+     */
+    void setDerivedDataCaching(const bool value);
+    /**
+     * \brief Determines if 16 bits volumes are windowed down to 8 bits while loading, halving
+     * the texture size. The transfer function and gradients only use 8 bits of precision
+     * \return True if 16 bits volumes are converted
+     */
+    bool isConvertingTo8Bits() const;
+    /**
+     * \brief Enables or disables the 8 bits conversion of the next loaded 16 bits volumes
+     * \param value True to convert
+     */
+    void setConvertTo8Bits(const bool value);
+    /**
+     * \brief Percentiles of the 16 bits values mapped to 0 and 255 by the 8 bits conversion
+     * \return The low and high percentiles
+     */
+    const glm::vec2 &getWindowPercentiles() const;
+    /**
+     * \brief Sets the percentiles the 8 bits conversion window is picked from
+     * \param value The low and high percentiles in [0..100]
+     */
+    void setWindowPercentiles(const glm::vec2& value);
+    /**
+     * \brief Differences and smoothing filter the gradients of loaded volumes are prepared with
+     * \return The gradient settings
+     */
+    const GradientEngine::Settings &getGradientSettings() const;
+    /**
+     * \brief Sets how the gradients of the next loaded volumes are prepared
+     * \param value The new gradient settings
+     */
+    void setGradientSettings(const GradientEngine::Settings& value);
+    /**
+     * \brief Where the normals of the shaded samples come from, normals are only evaluated for samples
+     * passing the opacity test in every mode
+     * \return The gradient mode
+     */
+    GradientMode getGradientMode() const;
+    /**
+     * \brief Sets where the normals come from. On-the-fly modes release the gradient texture and the
+     * next loads skip it, the precomputed mode prepares it again in the background
+     * \param value The new gradient mode
+     */
+    void setGradientMode(const GradientMode value);
+    /**
+     * \brief Draws the given number of frames with each gradient mode and measures the raycast pass
+     * \param frames Frames measured per mode
+     */
+    void benchmarkGradientModes(int frames = 60);
+    /**
+     * \brief Determines if the gradient mode benchmark is running
+     * \return True while the benchmark draws
+     */
+    bool isBenchmarkingGradientModes() const;
+    /**
+     * \brief Results of the last gradient mode benchmark
+     * \return One result per mode, empty until the benchmark finishes
+     */
+    const std::vector<GradientBenchmark> &getGradientBenchmark() const;
+    /**
+     * \brief Refinement of still views over several frames, not used while frames are accumulated
+     * \return The progressive refinement
+     */
+    ProgressiveRefinement &getProgressiveRefinement();
+    /**
+     * \brief Blending of jittered frames over time, replaces the progressive refinement while enabled
+     * \return The temporal accumulation
+     */
+    TemporalAccumulation &getTemporalAccumulation();
+    /**
+     * \brief GPU time of the last measured raycast pass
+     * \return The raycast time in milliseconds
+     */
+    double getRaycastMilliseconds() const;
+    /**
+     * \brief Raycasts the next drawn view on the CPU as well, at the size of the render targets
+     * \param benchmark Renders the view with single rays and with ray packets and compares them
+     */
+    void renderReference(bool benchmark = false);
+    /**
+     * \brief Determines if a CPU reference render is requested or running
+     * \return True until the reference finished
+     */
+    bool isRenderingReference() const;
+    /**
+     * \brief The CPU raycaster of the last finished reference render, holding its render targets and ray throughput
+     * \return The raycaster, null until a reference finished
+     */
+    const std::shared_ptr<CpuRaycaster> &getReferenceRaycaster() const;
+    /**
+     * \brief Single ray and packet throughput of the last benchmarked reference render
+     * \return The benchmark, null until one finished
+     */
+    const std::shared_ptr<CpuRaycaster::TraversalBenchmark> &getTraversalBenchmark() const;
+    /**
+     * \brief Maximum amount of brick data the out-of-core brick cache keeps in host memory
+     * \return The brick cache budget in bytes
+     */
+    size_t getBrickCacheBudget() const;
+    /**
+     * \brief Sets the maximum amount of brick data kept in host memory, least recently used bricks
+     * are evicted when the cache goes over it
+     * \param value The new budget in bytes
+     */
+    void setBrickCacheBudget(const size_t value);
+    /**
+     * \brief Out-of-core access to the voxels of the loaded volume, the CPU reference renders
+     * through it at the source resolution and prefetches the bricks in its view
+     * \return The brick cache, null if no volume is loaded or it's drawn converted to 8 bits
+     */
+    const std::shared_ptr<BrickCache> &getBrickCache() const;
+    /**
+     * \brief Determines if rays skip the bricks the transfer function and threshold make fully
+     * transparent
+     * \return True if empty space is skipped
+     */
+    bool isEmptySpaceSkipping() const;
+    /**
+     * \brief Enables or disables empty space skipping
+     * \param value True to skip empty bricks
+     */
+    void setEmptySpaceSkipping(const bool value);
+    /**
+     * \brief Determines if the samples taken and skipped by the raycast are counted every frame,
+     * reading the counts back stalls the pipeline
+     * \return True if samples are counted
+     */
+    bool isSampleCounting() const;
+    /**
+     * \brief Enables or disables counting the raycast samples
+     * \param value True to count samples
+     */
+    void setSampleCounting(const bool value);
+    /**
+     * \brief Samples taken and skipped by the primary rays of the last drawn frame
+     * \return Taken and skipped sample counts, zero if samples aren't counted
+     */
+    const glm::uvec2 &getSampleCounts() const;
+    /**
+     * \brief Value ranges and occupancy of the bricks of the loaded volume
+     * \return The occupancy grid, null if no volume is loaded
+     */
+    const std::shared_ptr<OccupancyGrid> &getOccupancyGrid() const;
+    /**
+     * \brief Determines if shadows read the light reaching each sample from a precomputed light
+     * volume instead of marching towards the light from every ray
+     * \return True if the light volume is used
+     */
+    bool isLightVolumeShadows() const;
+    /**
+     * \brief Enables or disables the light volume shadows
+     * \param value True to use the light volume
+     */
+    void setLightVolumeShadows(const bool value);
+    /**
+     * \brief Resolution of the light volume relative to the volume
+     * \return The scale applied to the volume dimensions
+     */
+    const float &getLightVolumeScale() const;
+    /**
+     * \brief Sets the resolution of the light volume, the next draw builds it again
+     * \param value The scale applied to the volume dimensions in [1/16..1]
+     */
+    void setLightVolumeScale(const float& value);
+    /**
+     * \brief Cells of the light volume last uploaded, rebuilt only when the light, transfer
+     * function, threshold or resolution change
+     * \return The cells along each axis, zero until shadows are first drawn
+     */
+    const glm::ivec3 &getLightVolumeSize() const;
+    /**
+     * \brief Time the last uploaded light volume took to build
+     * \return The build time in seconds
+     */
+    double getLightVolumeSeconds() const;
+    /**
+     * \brief Coarser levels of the loaded volume and its gradients, uploaded as mip levels of the
+     * volume and gradient textures
+     * \return The pyramid, null until its first draw finished building it
+     */
+    const std::shared_ptr<VolumePyramid> &getPyramid() const;
+    VolumePyramid::Filter getPyramidFilter() const;
+    /**
+     * \brief Sets how the pyramid levels are reduced, the next draw builds them again
+     * \param value The new filter
+     */
+    void setPyramidFilter(const VolumePyramid::Filter value);
+    /**
+     * \brief Pyramid level drawn regardless of the view
+     * \return The level, -1 if it's picked from the screen footprint of the voxels
+     */
+    int getPyramidLevel() const;
+    /**
+     * \brief Sets the pyramid level drawn, zero for the full resolution
+     * \param value The level, -1 picks it from the screen footprint of the voxels
+     */
+    void setPyramidLevel(const int value);
+    /**
+     * \brief Levels added to the one matching the screen footprint, the interactive quality
+     * \return The level bias
+     */
+    float getLevelBias() const;
+    /**
+     * \brief Sets the levels added to the footprint level, positive values trade quality for speed
+     * \param value The new level bias
+     */
+    void setLevelBias(const float value);
+    /**
+     * \brief Pyramid level of the last draw
+     * \return The level, zero for the full resolution
+     */
+    int getDrawnLevel() const;
+    /**
+     * \brief Number of coarser levels of the drawn volume, they are built the first time one is drawn
+     * \return The level count, without the full resolution
+     */
+    int getPyramidLevelCount() const;
+    /**
+     * \brief Halvings applied while loading the volume to fit the resident memory budget
+     * \return The level, zero if the volume is drawn from its full resolution
+     */
+    int getResidentLevel() const;
+    /**
+     * \brief Dimensions of the volume file before it was reduced to fit the budget
+     * \return The source dimensions
+     */
+    const glm::ivec3 &getSourceDimensions() const;
     /**
      * \brief The volume's histogram contains the normalized [0..1] frequencies of each opacity value
      * \return The volume's data histogram
@@ -140,6 +469,62 @@ private:
     // volume texture
     ci::gl::Texture3dRef gradientTexture;
     ci::gl::Texture3dRef volumeTexture;
+    VoxelType voxelType;
+    // scale and offset mapping texture values to the [0..1] transfer function domain
+    glm::vec2 valueMapping;
+
+    // background loading
+    std::shared_ptr<VolumeLoadJob> loadJob;
+    ci::gl::Texture3dRef pendingVolumeTexture;
+    // load of the drawn volume, reread for derived data that wasn't kept
+    std::shared_ptr<VolumeLoadJob> residentJob;
+
+    // gradients prepared in the background before the volume is swapped in
+    GradientEngine::Settings gradientSettings;
+    // encoding of the gradient texture in use
+    GradientEngine::Encoding gradientEncoding;
+    GradientMode gradientMode;
+    // reread preparing the gradient texture again for the precomputed mode
+    std::shared_ptr<VolumeLoadJob> gradientJob;
+    ci::gl::Texture3dRef pendingGradientTexture;
+    std::shared_ptr<OccupancyGrid> pendingOccupancyGrid;
+
+    // empty space skipping
+    std::shared_ptr<OccupancyGrid> occupancyGrid;
+    // distance from each brick to the nearest occupied one
+    DistanceField emptyDistance;
+    ci::gl::Texture3dRef emptyDistanceTexture;
+    bool emptySpaceSkipping;
+    bool sampleCounting;
+    ci::gl::SsboRef sampleCountsBuffer;
+    glm::uvec2 sampleCounts;
+
+    // raycast pass timing and the gradient mode benchmark
+    ci::gl::QueryTimeSwappedRef raycastTimer;
+    double raycastMilliseconds;
+    std::vector<GradientBenchmark> gradientBenchmark;
+    std::vector<GradientBenchmark> benchmarkProgress;
+    int benchmarkFrames;
+    int benchmarkFrame;
+
+    // CPU reference raycast of a drawn view
+    std::shared_ptr<CpuRaycaster> referenceRaycaster;
+    std::shared_ptr<CpuRaycaster> pendingReferenceRaycaster;
+    std::future<void> pendingReference;
+    bool referenceRequested;
+    bool referenceBenchmark;
+    std::shared_ptr<CpuRaycaster::TraversalBenchmark> traversalBenchmark;
+    std::shared_ptr<CpuRaycaster::TraversalBenchmark> pendingTraversalBenchmark;
+
+    // still views refined over several frames
+    ProgressiveRefinement refinement;
+
+    // jittered frames blended over time
+    TemporalAccumulation accumulation;
+
+    // bricks the CPU reference pages from the volume file
+    std::shared_ptr<BrickCache> brickCache;
+    size_t brickCacheBudget;
 
     // fbos
     ci::gl::FboRef frontFbo;
@@ -155,12 +540,33 @@ private:
     // lighting
     ci::gl::GlslProgRef applyBlurredShadows;
     Light light;
+    // transmittance towards the light, computed in the background
+    std::shared_ptr<LightVolume> lightVolume;
+    std::future<void> pendingLightVolume;
+    // reread averaging the cells of another resolution
+    std::shared_ptr<VolumeLoadJob> lightVolumeJob;
+    ci::gl::Texture3dRef lightVolumeTexture;
+    bool lightVolumeShadows;
+    float lightVolumeScale;
+    // copied from the light volume once its build finished, it's written while building
+    glm::ivec3 lightVolumeSize;
+    double lightVolumeSeconds;
 
-    // compute shaders
-    ci::gl::SsboRef histogramSsbo;
-    ci::gl::GlslProgRef histogramCompute;
-    ci::gl::GlslProgRef gradientsCompute;
-    ci::gl::GlslProgRef smoothGradientsCompute;
+    // coarser levels, built in the background once a view needs them
+    std::shared_ptr<VolumePyramid> pyramid;
+    std::shared_ptr<VolumePyramid> pendingPyramid;
+    std::future<bool> pyramidBuild;
+    // first level halved while loading, moved into the pyramid once a view needs it
+    VolumePyramid::Level halvedLevel;
+    // reread halving the drawn volume with another filter
+    std::shared_ptr<VolumeLoadJob> pyramidJob;
+    VolumePyramid::Filter pyramidFilter;
+    int pyramidLevel;
+    float levelBias;
+    int drawnLevel;
+    // halvings done on load, the pyramid starts below them
+    int residentLevel;
+    glm::ivec3 sourceDimensions;
 
     // render targets
     ci::gl::Texture2dRef frontTexture;
@@ -180,9 +586,16 @@ private:
     float stepScale;
     float shadowStepScale;
     float maxSize;
+    bool preintegration;
 
     // model
     bool isDrawable;
+    size_t hostMemoryBudget;
+    size_t residentMemoryBudget;
+    bool derivedDataCaching;
+    std::future<void> derivedDataWrite;
+    bool convertTo8Bits;
+    glm::vec2 windowPercentiles;
     glm::quat modelRotation;
     glm::vec3 modelPosition;
 
@@ -195,23 +608,88 @@ private:
      */
     void createCubeVbo();
     /**
-     * \brief Reads the raw data at filepath and creates a 3d texture
-     * \param filepath The 8 bits depth raw file path 
+     * \brief Collects the load settings for a new volume load
+     * \return The current load options
+     */
+    VolumeLoadOptions loadOptions() const;
+    /**
+     * \brief Creates the empty texture the load job's slabs are uploaded to
+     */
+    void createPendingTexture();
+    /**
+     * \brief Uploads the slabs handed by the load job to the pending volume texture, limited to
+     * a fixed amount of data per frame
+     */
+    void uploadPendingSlabs();
+    /**
+     * \brief Swaps the loaded volume, its gradients and occupancy grid in
+     */
+    void finishLoad();
+    /**
+     * \brief Creates the pending gradient texture and occupancy grid from the derived data the
+     * load job prepared, and caches them if they were computed
+     */
+    void prepareDerivedData();
+    /**
+     * \brief Drops the pending gradient texture and occupancy grid of a load that won't be swapped in
+     */
+    void cancelDerivedData();
+    /**
+     * \brief Writes the histogram, gradients and brick ranges of the loaded volume to its sidecar cache
+     * \param gradients The encoded gradients
+     */
+    void saveDerivedData(std::vector<uint8_t> gradients);
+    /**
+     * \brief Updates the occupancy of the bricks and their distance field for the current transfer
+     * function and threshold
+     */
+    void updateOccupancy();
+    /**
+     * \brief Uploads the finished light volume and starts building it again in the background if
+     * the light, transfer function or threshold changed. Cells of another resolution are averaged
+     * from a reread of the volume
+     */
+    void updateLightVolume();
+    /**
+     * \brief Starts a requested CPU reference render of the view being drawn in the background,
+     * expects the view matrices set
+     * \param mode Gradient mode of the drawn frame
+     */
+    void updateReference(GradientMode mode);
+    /**
+     * \brief Draws the raycast cube to the bound render targets, timed for the gradient mode benchmark
+     */
+    void drawTimedCube();
+    /**
+     * \brief Builds the pyramid below the first level halved while loading in the background and
+     * uploads its levels once they are ready, called once a view selects a coarser level
+     */
+    void updatePyramid();
+    /**
+     * \brief Stops building the pyramid and releases the coarser levels, the first level is kept
+     * for the next build
+     */
+    void resetPyramid();
+    /**
+     * \brief Pyramid level matching the screen size of a voxel at the volume center, expects the
+     * volume's model matrix to be set
+     * \param camera The camera the volume is drawn with
+     * \param levels Number of levels available besides the full resolution
+     * \return The level to draw
      */
-    void readVolumeFromFile8(const std::string filepath);
+    int selectLevel(const ci::Camera& camera, int levels) const;
     /**
-     * \brief Reads the raw data at filepath and creates a 3d texture
-     * \param filepath The 18 bits depth raw file path
+     * \brief Prepares the gradient texture again from a reread of the volume when the precomputed
+     * mode finds it released, on-the-fly normals are used meanwhile
      */
-    void readVolumeFromFile16(const std::string filepath);
+    void updateGradientTexture();
     /**
-     * \brief Uses a compute shader to extract the frequency of each opacity value within the volume
-     * and creates a normalized histogram with this data
+     * \brief Stops preparing the gradient texture again and drops the result
      */
-    void extractHistogram();
+    void cancelGradientRebuild();
     /**
-     * \brief Creates a 3d texture containing the gradient at each voxel and smooths the values using
-     * a 3x3x3 average filter
+     * \brief Gradient mode the raycast uses this frame, advances the gradient mode benchmark
+     * \return The gradient mode to draw with
      */
-    void generateGradients();
+    GradientMode frameGradientMode();
 };
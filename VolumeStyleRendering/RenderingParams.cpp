@@ -4,6 +4,21 @@
 
 using namespace glm;
 
+namespace
+{
+    /**
+     * \brief Sets a parameter, counting the changes
+     */
+    template <typename T>
+    void assign(T& parameter, const T& value, unsigned& revision)
+    {
+        if (parameter == value) return;
+
+        parameter = value;
+        revision++;
+    }
+}
+
 float RenderingParams::gammaValue = 2.2f;
 float RenderingParams::exposureValue = 1.0f;
 bool RenderingParams::fxaa = true;
@@ -13,6 +28,7 @@ bool RenderingParams::ssao = true;
 float RenderingParams::ssaoBias = 0.025f;
 float RenderingParams::ssaoRadius = 0.5f;
 float RenderingParams::ssaoPower = 1.0f;
+unsigned RenderingParams::revision = 0;
 
 float RenderingParams::GetExposure() 
 {
@@ -21,7 +37,7 @@ float RenderingParams::GetExposure()
 
 void RenderingParams::SetExposure(const float exposure)
 {
-    exposureValue = min(max(epsilon<float>(), exposure), 8.0f);
+    assign(exposureValue, min(max(epsilon<float>(), exposure), 8.0f), revision);
 }
 
 float RenderingParams::GetGamma()
@@ -31,12 +47,12 @@ float RenderingParams::GetGamma()
 
 void RenderingParams::SetGamma(const float gamma)
 {
-    gammaValue = min(max(epsilon<float>(), gamma), 10.0f);
+    assign(gammaValue, min(max(epsilon<float>(), gamma), 10.0f), revision);
 }
 
 void RenderingParams::FXAAEnabled(const bool enabled)
 {
-    fxaa = enabled;
+    assign(fxaa, enabled, revision);
 }
 
 bool RenderingParams::FXAAEnabled()
@@ -46,7 +62,7 @@ bool RenderingParams::FXAAEnabled()
 
 void RenderingParams::DiffuseShadingEnabled(const bool enabled)
 {
-    diffuseShading = enabled;
+    assign(diffuseShading, enabled, revision);
 }
 
 bool RenderingParams::DiffuseShadingEnabled()
@@ -56,7 +72,7 @@ bool RenderingParams::DiffuseShadingEnabled()
 
 void RenderingParams::ShadowsEnabled(const bool enabled)
 {
-    shadows = enabled;
+    assign(shadows, enabled, revision);
 }
 
 bool RenderingParams::ShadowsEnabled()
@@ -66,7 +82,7 @@ bool RenderingParams::ShadowsEnabled()
 
 void RenderingParams::SSAOEnabled(const bool enabled)
 {
-    ssao = enabled;
+    assign(ssao, enabled, revision);
 }
 
 bool RenderingParams::SSAOEnabled()
@@ -76,7 +92,7 @@ bool RenderingParams::SSAOEnabled()
 
 void RenderingParams::SSAOBias(const float bias)
 {
-    ssaoBias = clamp(bias, 0.0f, 0.5f);
+    assign(ssaoBias, clamp(bias, 0.0f, 0.5f), revision);
 }
 
 float RenderingParams::SSAOBias()
@@ -86,7 +102,7 @@ float RenderingParams::SSAOBias()
 
 void RenderingParams::SSAORadius(const float radius)
 {
-    ssaoRadius = clamp(radius, 0.001f, 8.0f);
+    assign(ssaoRadius, clamp(radius, 0.001f, 8.0f), revision);
 }
 
 float RenderingParams::SSAORadius()
@@ -96,10 +112,15 @@ float RenderingParams::SSAORadius()
 
 void RenderingParams::SSAOPower(const float power)
 {
-    ssaoPower = clamp(power, 0.0f, 32.0f);
+    assign(ssaoPower, clamp(power, 0.0f, 32.0f), revision);
 }
 
 float RenderingParams::SSAOPower()
 {
     return ssaoPower;
 }
+
+unsigned RenderingParams::GetRevision()
+{
+    return revision;
+}
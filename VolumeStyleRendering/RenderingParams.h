@@ -20,6 +20,11 @@ public:
     static float SSAORadius();
     static void SSAOPower(const float power);
     static float SSAOPower();
+    /**
+     * \brief Counts the parameter changes, compared to find out if any parameter changed
+     * \return The revision
+     */
+    static unsigned GetRevision();
 private:
     static float gammaValue;
     static float exposureValue;
@@ -30,5 +35,6 @@ private:
     static float ssaoBias;
     static float ssaoRadius;
     static float ssaoPower;
+    static unsigned revision;
 };
 
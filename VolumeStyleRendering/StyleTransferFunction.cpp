@@ -36,9 +36,7 @@ void Style::AddStyle(const std::string& name, const std::string& filepath)
     for (auto& s : styles) { if (s.filepath == filepath) return; }
 
     // resize image to fit within 2d array of textures
-    Surface baseImage = loadImage(filepath);
-    Surface resizedImage(512, 512, true, SurfaceChannelOrder::RGBA);
-    ip::resize(baseImage, &resizedImage);
+    Surface resizedImage = LoadLitsphere(loadImage(filepath));
     auto texture = gl::Texture2d::create(resizedImage, gl::Texture2d::Format()
                                          .wrap(GL_CLAMP_TO_BORDER)
                                          .minFilter(GL_LINEAR)
@@ -64,6 +62,15 @@ void Style::RenameStyle(const int index, const std::string& name)
     styles[index].name = name.substr(0, 32);
 }
 
+Surface Style::LoadLitsphere(const ImageSourceRef& image)
+{
+    Surface baseImage(image);
+    Surface resizedImage(512, 512, true, SurfaceChannelOrder::RGBA);
+    ip::resize(baseImage, &resizedImage);
+
+    return resizedImage;
+}
+
 const std::vector<Style>& Style::GetAvailableStyles()
 {
     if (styles.empty()) { GetDefaultStyle(); }
@@ -74,19 +81,6 @@ const std::vector<Style>& Style::GetAvailableStyles()
 StyleTransferFunction::StyleTransferFunction(): textureDataChanged(false)
 {
     transferFunction.resize(256);
-    // transfer function texture has a fixed size initialize at once
-    transferFunctionTexture = gl::Texture1d::create(256, gl::Texture1d::Format()
-                                                    .internalFormat(GL_RG16F)
-                                                    .wrap(GL_REPEAT)
-                                                    .minFilter(GL_LINEAR)
-                                                    .magFilter(GL_LINEAR));
-    // styles function texture has a fixed max size initialize at once
-    auto stylesFormat = gl::Texture3d::Format().target(GL_TEXTURE_2D_ARRAY)
-                                               .magFilter(GL_LINEAR)
-                                               .minFilter(GL_LINEAR)
-                                               .wrap(GL_CLAMP_TO_EDGE)
-                                               .internalFormat(GL_RGBA);
-    styleFunctionTexture = gl::Texture3d::create(512, 512, 128, stylesFormat);
 }
 
 StyleTransferFunction::~StyleTransferFunction() {}
@@ -199,6 +193,24 @@ void StyleTransferFunction::setStylePointIsoValue(const int index, const int iso
 
 void StyleTransferFunction::updateTextures()
 {
+    // the textures are created on first use, so functions can be built without a GL context
+    if (!transferFunctionTexture)
+    {
+        // transfer function texture has a fixed size initialize at once
+        transferFunctionTexture = gl::Texture1d::create(256, gl::Texture1d::Format()
+                                                        .internalFormat(GL_RG16F)
+                                                        .wrap(GL_REPEAT)
+                                                        .minFilter(GL_LINEAR)
+                                                        .magFilter(GL_LINEAR));
+        // styles function texture has a fixed max size initialize at once
+        auto stylesFormat = gl::Texture3d::Format().target(GL_TEXTURE_2D_ARRAY)
+                                                   .magFilter(GL_LINEAR)
+                                                   .minFilter(GL_LINEAR)
+                                                   .wrap(GL_CLAMP_TO_EDGE)
+                                                   .internalFormat(GL_RGBA);
+        styleFunctionTexture = gl::Texture3d::create(512, 512, 128, stylesFormat);
+    }
+
     // update tft with new data
     transferFunctionTexture->update(transferFunction.data(), GL_RG, GL_FLOAT, 0, 256, 0);
 
@@ -225,7 +237,7 @@ void StyleTransferFunction::updateTextures()
 
 const gl::Texture1dRef& StyleTransferFunction::getTransferFunctionTexture()
 {
-    if (textureDataChanged)
+    if (textureDataChanged || !transferFunctionTexture)
     {
         updateTextures();
     }
@@ -235,7 +247,7 @@ const gl::Texture1dRef& StyleTransferFunction::getTransferFunctionTexture()
 
 const gl::Texture1dRef& StyleTransferFunction::getIndexFunctionTexture()
 {
-    if (textureDataChanged)
+    if (textureDataChanged || !transferFunctionTexture)
     {
         updateTextures();
     }
@@ -245,7 +257,7 @@ const gl::Texture1dRef& StyleTransferFunction::getIndexFunctionTexture()
 
 const gl::Texture3dRef& StyleTransferFunction::getStyleFunctionTexture()
 {
-    if (textureDataChanged)
+    if (textureDataChanged || !transferFunctionTexture)
     {
         updateTextures();
     }
@@ -253,6 +265,66 @@ const gl::Texture3dRef& StyleTransferFunction::getStyleFunctionTexture()
     return styleFunctionTexture;
 }
 
+const std::vector<vec2>& StyleTransferFunction::getTransferFunction() const
+{
+    return transferFunction;
+}
+
+const std::vector<int>& StyleTransferFunction::getIndexFunction() const
+{
+    return indexFunction;
+}
+
+void StyleTransferFunction::read(const JsonTree& json,
+                                 const std::function<int(const std::string&, const std::string&)>& addStyle)
+{
+    setThreshold(json["threshold"]["x"].getValue<int>(), json["threshold"]["y"].getValue<int>());
+
+    // clear the transfer function control points
+    reset();
+
+    for (auto& aP : json["alpha_points"].getChildren())
+    {
+        int isoVal = aP["iso_value"].getValue<int>();
+
+        if (isoVal > 0 && isoVal < 256)
+        {
+            addAlphaPoint(aP["alpha"].getValue<float>(), isoVal);
+        }
+        else
+        {
+            setAlpha(isoVal == 0 ? 0 : getAlphaPoints().size() - 1, aP["alpha"].getValue<float>());
+        }
+    }
+
+    for (auto& cP : json["color_points"].getChildren())
+    {
+        vec3 color;
+        int i = 0;
+        int isoVal = cP["iso_value"].getValue<int>();
+
+        for (auto& c : cP["color"].getChildren())
+        {
+            color[i++] = c.getValue<float>();
+        }
+
+        if (isoVal > 0 && isoVal < 256)
+        {
+            addColorPoint(color, isoVal);
+        }
+        else
+        {
+            setColor(isoVal == 0 ? 0 : getAlphaPoints().size() - 1, color);
+        }
+    }
+
+    for (auto& sP : json["style_points"].getChildren())
+    {
+        auto isoVal = sP["iso_value"].getValue<int>();
+        addStylePoint(StylePoint(isoVal, addStyle(sP["style"]["name"].getValue(), sP["style"]["path"].getValue())));
+    }
+}
+
 void StyleTransferFunction::reset()
 {
     stylePoints.clear();
@@ -263,9 +335,7 @@ const Style& Style::GetDefaultStyle()
 {
     if (styles.empty())
     {
-        Surface baseImage = loadImage(loadAsset("images/default.png"));
-        Surface resizedImage(512, 512, true, SurfaceChannelOrder::RGBA);
-        ip::resize(baseImage, &resizedImage);
+        Surface resizedImage = LoadLitsphere(loadImage(loadAsset("images/default.png")));
         auto texture = gl::Texture2d::create(resizedImage);
         styles.push_back(Style("Default", resizedImage, texture, getAssetPath("images/default.png").string()));
 
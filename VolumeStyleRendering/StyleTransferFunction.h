@@ -1,5 +1,7 @@
 #pragma once
+#include <functional>
 #include <cinder/gl/gl.h>
+#include <cinder/Json.h>
 #include "TransferFunction.h"
 
 class Style
@@ -10,6 +12,12 @@ public:
     static void RenameStyle(const int index, const std::string& name);
     static const std::vector<Style> &GetAvailableStyles();
     static const Style &GetDefaultStyle();
+    /**
+     * \brief Resizes a litsphere image to the 512 x 512 RGBA surface the styles keep, needs no GL context
+     * \param image The litsphere image
+     * \return The resized surface
+     */
+    static ci::Surface LoadLitsphere(const ci::ImageSourceRef& image);
 
     const std::string &getName() const { return name; }
     const std::string &getFilepath() const { return filepath; }
@@ -56,10 +64,26 @@ public:
     void updateFunction() override;
     const std::vector<StylePoint> &getStylePoints() const;
     void setStylePointIsoValue(const int index, const int isoValue);
+    /**
+     * \brief Replaces the threshold and points with a function saved by the transfer functions manager
+     * \param json The saved function
+     * \param addStyle Adds the style of a style point given its name and image filepath, returns its index
+     */
+    void read(const ci::JsonTree& json, const std::function<int(const std::string&, const std::string&)>& addStyle);
     void updateTextures();
     const ci::gl::Texture1dRef &getTransferFunctionTexture();
     const ci::gl::Texture1dRef &getIndexFunctionTexture();
     const ci::gl::Texture3dRef &getStyleFunctionTexture();
+    /**
+     * \brief Style position in x and opacity in y of each value, the transfer function texture data
+     * \return The 256 entries
+     */
+    const std::vector<glm::vec2> &getTransferFunction() const;
+    /**
+     * \brief Style of each style position, -1 for none, the index function texture data
+     * \return The style indices
+     */
+    const std::vector<int> &getIndexFunction() const;
     void reset() override;
 private:
     std::vector<StylePoint> stylePoints;
@@ -117,77 +117,28 @@ JsonTree StyleTransferFunctionUi::buildTransferFunctionJSON() const
 
 void StyleTransferFunctionUi::loadTransferFunctionJSON(const JsonTree& second) const
 {
-    transferFunction->setThreshold(second["threshold"]["x"].getValue<int>(),
-                                   second["threshold"]["y"].getValue<int>());
-
-    // clear the transfer function control points
-    transferFunction->reset();
-
-    for (auto& aP : second["alpha_points"].getChildren())
-    {
-        int isoVal = aP["iso_value"].getValue<int>();
-
-        if (isoVal > 0 && isoVal < 256)
-        {
-            transferFunction->addAlphaPoint(aP["alpha"].getValue<float>(), isoVal);
-        }
-        else
-        {
-            transferFunction->setAlpha(isoVal == 0 ? 0 : transferFunction->getAlphaPoints().size() - 1,
-                                       aP["alpha"].getValue<float>());
-        }
-    }
-
-    for (auto& cP : second["color_points"].getChildren())
+    transferFunction->read(second, [](const std::string& name, const std::string& path)
     {
-        vec3 color;
-        int i = 0;
-        int isoVal = cP["iso_value"].getValue<int>();
-
-        for (auto& c : cP["color"].getChildren())
-        {
-            color[i++] = c.getValue<float>();
-        }
-
-        if (isoVal > 0 && isoVal < 256)
-        {
-            transferFunction->addColorPoint(color, isoVal);
-        }
-        else
-        {
-            transferFunction->setColor(isoVal == 0 ? 0 : transferFunction->getAlphaPoints().size() - 1,
-                                       color);
-        }
-    }
-
-    auto& styles = Style::GetAvailableStyles();
-
-    for (auto& sP : second["style_points"].getChildren())
-    {
-        auto isoVal = sP["iso_value"].getValue<int>();
-        auto name = sP["style"]["name"].getValue();
-        auto path = sP["style"]["path"].getValue();
+        auto& styles = Style::GetAvailableStyles();
         auto styleIndex = -1;
 
         auto sourceRef = loadImage(path);
 
-        if(sourceRef)
-        {
-            Style::AddStyle(name, path);
+        if (!sourceRef) return 0;
+
+        Style::AddStyle(name, path);
 
-            for (int i = 0; i < styles.size(); i++)
+        for (int i = 0; i < styles.size(); i++)
+        {
+            if (styles[i].getFilepath() == path)
             {
-                if (styles[i].getFilepath() == path)
-                {
-                    styleIndex = i;
-                    break;
-                }
+                styleIndex = i;
+                break;
             }
-
-            transferFunction->addStylePoint(StylePoint(isoVal, styleIndex));
         }
-        else { transferFunction->addStylePoint(StylePoint(isoVal, 0)); }
-    }
+
+        return styleIndex;
+    });
 }
 
 StyleTransferFunctionUi::StyleTransferFunctionUi() : showTFManager(false)
@@ -0,0 +1,152 @@
+#include <algorithm>
+#include <cinder/app/AppBase.h>
+
+#include "TemporalAccumulation.h"
+
+using namespace ci;
+using namespace glm;
+using namespace app;
+
+namespace
+{
+    // frames blended into a still view's history, and kept of the history of a moving view
+    const int HistoryFrames = 32;
+    const int MovingHistoryFrames = 4;
+    // fractional part of the golden ratio, ray start offsets of successive frames stay evenly spread
+    const double JitterStep = 0.6180339887;
+}
+
+TemporalAccumulation::TemporalAccumulation() : enabled(false), accumulatedFrames(0), frame(0), historyIndex(0),
+                                               historyState()
+{
+    temporalRect = gl::Batch::create(geom::Rect(), gl::GlslProg::create(gl::GlslProg::Format()
+        .vertex(loadAsset("shaders/fs_quad.vert"))
+        .fragment(loadAsset("shaders/temporal.frag"))));
+}
+
+bool TemporalAccumulation::isEnabled() const
+{
+    return enabled;
+}
+
+void TemporalAccumulation::setEnabled(const bool value)
+{
+    enabled = value;
+    accumulatedFrames = 0;
+}
+
+int TemporalAccumulation::getFrames() const
+{
+    return enabled ? accumulatedFrames : 0;
+}
+
+float TemporalAccumulation::getJitterOffset() const
+{
+    return enabled ? static_cast<float>(fract(frame * JitterStep)) : 0.0f;
+}
+
+void TemporalAccumulation::restart()
+{
+    accumulatedFrames = 0;
+}
+
+void TemporalAccumulation::accumulate(const ProgressiveRefinement::State& state)
+{
+    const mat4 modelView = gl::getModelView();
+    const mat4 projection = gl::getProjectionMatrix();
+    const bool moved = state.modelViewProjection != historyState.modelViewProjection;
+
+    // the history of other content is discarded, a moving view keeps what reprojects well
+    if (!state.hasSameContent(historyState)) accumulatedFrames = 0;
+    else if (moved) accumulatedFrames = std::min(accumulatedFrames, MovingHistoryFrames);
+
+    const int previous = historyIndex;
+    historyIndex = 1 - historyIndex;
+
+    const gl::GlslProgRef& resolve = temporalRect->getGlslProg();
+    const mat4 toPreviousView = historyModelView * inverse(modelView);
+    resolve->uniform("reprojection", historyProjection * toPreviousView);
+    resolve->uniform("previousView", toPreviousView);
+    resolve->uniform("historyWeight", accumulatedFrames / (accumulatedFrames + 1.0f));
+    resolve->uniform("clampHistory", moved);
+
+    {
+        const static GLenum buffers[] =
+        {
+            GL_COLOR_ATTACHMENT0,
+            GL_COLOR_ATTACHMENT1,
+            GL_COLOR_ATTACHMENT2
+        };
+
+        const gl::ScopedFramebuffer scopedFramebuffer(historyFbos[historyIndex]);
+        gl::drawBuffers(3, buffers);
+        const gl::ScopedViewport scopedViewport(ivec2(0), historyFbos[historyIndex]->getSize());
+        const gl::ScopedTextureBind color(targets->getTexture2d(GL_COLOR_ATTACHMENT0), 0);
+        const gl::ScopedTextureBind shadows(targets->getTexture2d(GL_COLOR_ATTACHMENT2), 1);
+        const gl::ScopedTextureBind position(targets->getTexture2d(GL_COLOR_ATTACHMENT3), 2);
+        const gl::ScopedTextureBind previousColor(historyColor[previous], 3);
+        const gl::ScopedTextureBind previousShadows(historyShadows[previous], 4);
+        const gl::ScopedTextureBind previousPosition(historyPosition[previous], 5);
+        const gl::ScopedBlend scopedBlend(false);
+        const gl::ScopedMatrices scopedMatrices;
+        gl::setMatricesWindow(state.size);
+        gl::translate(vec2(state.size) * 0.5f);
+        gl::scale(vec2(state.size));
+        temporalRect->draw();
+    }
+
+    historyState = state;
+    historyModelView = modelView;
+    historyProjection = projection;
+    accumulatedFrames = std::min(accumulatedFrames + 1, HistoryFrames);
+    frame++;
+}
+
+const gl::Texture2dRef& TemporalAccumulation::getColorTexture() const
+{
+    return historyColor[historyIndex];
+}
+
+const gl::Texture2dRef& TemporalAccumulation::getShadowTexture() const
+{
+    return historyShadows[historyIndex];
+}
+
+void TemporalAccumulation::resizeFbos(const gl::FboRef& targets)
+{
+    this->targets = targets;
+    const ivec2 size = targets->getSize();
+
+    // reprojected histories are sampled between pixels, shadows are blended beyond 8 bits
+    const auto colorFormat = gl::Texture2d::Format().internalFormat(GL_RGBA16F)
+                                                    .magFilter(GL_LINEAR)
+                                                    .minFilter(GL_LINEAR)
+                                                    .wrap(GL_CLAMP_TO_EDGE)
+                                                    .dataType(GL_FLOAT);
+    const auto shadowFormat = gl::Texture2d::Format().internalFormat(GL_R16F)
+                                                     .magFilter(GL_LINEAR)
+                                                     .minFilter(GL_LINEAR)
+                                                     .wrap(GL_CLAMP_TO_EDGE)
+                                                     .dataType(GL_FLOAT)
+                                                     .swizzleMask(GL_RED, GL_RED, GL_RED, GL_RED);
+    const auto positionFormat = gl::Texture2d::Format().internalFormat(GL_RGB16F)
+                                                       .magFilter(GL_NEAREST)
+                                                       .minFilter(GL_NEAREST)
+                                                       .wrap(GL_REPEAT)
+                                                       .dataType(GL_FLOAT);
+
+    for (int i = 0; i < 2; i++)
+    {
+        historyColor[i] = gl::Texture2d::create(size.x, size.y, colorFormat);
+        historyShadows[i] = gl::Texture2d::create(size.x, size.y, shadowFormat);
+        historyPosition[i] = gl::Texture2d::create(size.x, size.y, positionFormat);
+
+        gl::Fbo::Format format;
+        format.attachment(GL_COLOR_ATTACHMENT0, historyColor[i]);
+        format.attachment(GL_COLOR_ATTACHMENT1, historyShadows[i]);
+        format.attachment(GL_COLOR_ATTACHMENT2, historyPosition[i]);
+        historyFbos[i] = gl::Fbo::create(size.x, size.y, format);
+    }
+
+    accumulatedFrames = 0;
+}
@@ -0,0 +1,79 @@
+#pragma once
+#include <cinder/gl/gl.h>
+
+#include "ProgressiveRefinement.h"
+
+/**
+ * \brief Blends jittered raycast frames into a history reprojected to the current view
+ */
+class TemporalAccumulation
+{
+public:
+    TemporalAccumulation();
+    /**
+     * \brief Determines if frames are blended over time, every frame jitters the ray starts
+     * differently and is blended into a history reprojected to the current view. Replaces the
+     * progressive refinement while enabled
+     * \return True if frames are accumulated
+     */
+    bool isEnabled() const;
+    /**
+     * \brief Enables or disables the accumulation, coarser step scales converge to a clean image
+     * within a few frames of a still view while enabled
+     * \param value True to accumulate frames
+     */
+    void setEnabled(const bool value);
+    /**
+     * \brief Frames blended into the history of the current view
+     * \return The accumulated frames, older frames fade out once 32 have been blended. 0 while disabled
+     */
+    int getFrames() const;
+    /**
+     * \brief Offset of the ray starts of the next frame
+     * \return The offset in steps in [0..1), 0 while disabled
+     */
+    float getJitterOffset() const;
+    /**
+     * \brief Discards the history, for changes the state doesn't show
+     */
+    void restart();
+    /**
+     * \brief Blends the raycast render targets into the history, reprojected from the view the
+     * history was drawn from. Called with the matrices of the raycast cube set
+     * \param state What the drawn view depends on
+     */
+    void accumulate(const ProgressiveRefinement::State& state);
+    /**
+     * \brief Color of the accumulated frames, displayed in place of the raycast color
+     * \return The last written history color
+     */
+    const ci::gl::Texture2dRef &getColorTexture() const;
+    /**
+     * \brief Shadows of the accumulated frames, displayed in place of the raycast shadows
+     * \return The last written history shadows
+     */
+    const ci::gl::Texture2dRef &getShadowTexture() const;
+    /**
+     * \brief Creates the history render targets for the size of the raycast ones, the history starts over
+     * \param targets The raycast render targets, color, normal, shadow and position attachments
+     */
+    void resizeFbos(const ci::gl::FboRef& targets);
+private:
+    // frames in the history and the ray jitter sequence index
+    bool enabled;
+    int accumulatedFrames;
+    unsigned frame;
+    // history targets written alternately, the last written one is displayed
+    int historyIndex;
+    ci::gl::FboRef targets;
+    ci::gl::FboRef historyFbos[2];
+    ci::gl::Texture2dRef historyColor[2];
+    ci::gl::Texture2dRef historyShadows[2];
+    ci::gl::Texture2dRef historyPosition[2];
+    // what the history shows and the view it was drawn from
+    ProgressiveRefinement::State historyState;
+    glm::mat4 historyModelView;
+    glm::mat4 historyProjection;
+    // history reprojection and blending
+    ci::gl::BatchRef temporalRect;
+};
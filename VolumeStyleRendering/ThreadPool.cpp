@@ -0,0 +1,129 @@
+#include <algorithm>
+#include <atomic>
+#include <memory>
+
+#include "ThreadPool.h"
+
+namespace
+{
+    /**
+     * \brief Progress of a parallelFor call, shared by all the threads taking part in it
+     */
+    struct ParallelRange
+    {
+        std::atomic<int> next;
+        std::atomic<int> remaining;
+        int end;
+        std::function<void(int)> function;
+        std::mutex mutex;
+        std::condition_variable finished;
+
+        /**
+         * \brief Processes indices until the range is exhausted
+         */
+        void process()
+        {
+            for (int i = next++; i < end; i = next++)
+            {
+                function(i);
+
+                if (--remaining == 0)
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    finished.notify_all();
+                }
+            }
+        }
+    };
+}
+
+ThreadPool::ThreadPool(unsigned threadCount) : stopping(false)
+{
+    if (threadCount == 0)
+    {
+        threadCount = std::max(std::thread::hardware_concurrency(), 2u) - 1;
+    }
+
+    for (unsigned i = 0; i < threadCount; i++)
+    {
+        workers.emplace_back(&ThreadPool::work, this);
+    }
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+
+    taskAvailable.notify_all();
+
+    for (auto& worker : workers) { worker.join(); }
+}
+
+void ThreadPool::work()
+{
+    while (true)
+    {
+        std::function<void()> task;
+
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            taskAvailable.wait(lock, [this] { return stopping || !tasks.empty(); });
+
+            if (stopping && tasks.empty()) return;
+
+            task = move(tasks.front());
+            tasks.pop_front();
+        }
+
+        task();
+    }
+}
+
+void ThreadPool::enqueue(std::function<void()> task)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        tasks.push_back(move(task));
+    }
+
+    taskAvailable.notify_one();
+}
+
+void ThreadPool::parallelFor(int begin, int end, const std::function<void(int)>& function)
+{
+    if (end <= begin) return;
+
+    auto range = std::make_shared<ParallelRange>();
+    range->next = begin;
+    range->remaining = end - begin;
+    range->end = end;
+    range->function = function;
+
+    // helpers finding the range exhausted just return
+    const int helpers = std::min(static_cast<int>(workers.size()), end - begin - 1);
+
+    for (int i = 0; i < helpers; i++)
+    {
+        enqueue([range] { range->process(); });
+    }
+
+    // the calling thread takes part so nested calls can't starve
+    range->process();
+
+    std::unique_lock<std::mutex> lock(range->mutex);
+    range->finished.wait(lock, [&range] { return range->remaining == 0; });
+}
+
+unsigned ThreadPool::getThreadCount() const
+{
+    return static_cast<unsigned>(workers.size()) + 1;
+}
+
+ThreadPool& ThreadPool::instance()
+{
+    static ThreadPool pool;
+    return pool;
+}
@@ -0,0 +1,60 @@
+#pragma once
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * \brief Fixed set of worker threads shared by the CPU-side volume processing
+ */
+class ThreadPool
+{
+public:
+    /**
+     * \brief Creates the worker threads
+     * \param threadCount Number of workers, zero uses one per hardware thread minus the caller
+     */
+    explicit ThreadPool(unsigned threadCount = 0);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    /**
+     * \brief Calls function for every index in [begin..end) spread across the workers and the
+     * calling thread, returns once all indices have been processed. It is safe to call from
+     * within a running task
+     * \param begin First index
+     * \param end One past the last index
+     * \param function Work for a single index
+     */
+    void parallelFor(int begin, int end, const std::function<void(int)>& function);
+    /**
+     * \brief Queues a task to be executed by any worker
+     * \param task The work to execute
+     */
+    void enqueue(std::function<void()> task);
+    /**
+     * \brief Number of threads taking part in parallelFor, workers plus the calling thread
+     * \return The thread count
+     */
+    unsigned getThreadCount() const;
+    /**
+     * \brief The pool shared by the application, follows a singleton pattern
+     * \return The unique ThreadPool instance
+     */
+    static ThreadPool& instance();
+private:
+    std::vector<std::thread> workers;
+    std::deque<std::function<void()>> tasks;
+    std::mutex mutex;
+    std::condition_variable taskAvailable;
+    bool stopping;
+
+    /**
+     * \brief Worker loop, executes queued tasks until the pool is destroyed
+     */
+    void work();
+};
@@ -0,0 +1,277 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+#include "TileScheduler.h"
+#include "ThreadPool.h"
+
+using namespace glm;
+
+namespace
+{
+    // tiles costing this many times the mean of the previous run are split up front
+    const double SplitCost = 2.0;
+
+    /**
+     * \brief Part of a tile of the regular grid, costs are gathered per grid tile
+     */
+    struct Task
+    {
+        TileScheduler::Tile tile;
+        int gridTile;
+    };
+
+    /**
+     * \brief Tiles of a thread, the owner takes them from the front and thieves from the back
+     */
+    struct Queue
+    {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+
+    /**
+     * \brief Splits a task into quadrants, or halves along the only axis wide enough. Splits are
+     * aligned to the minimum tile size
+     * \return False if the task is too small to split
+     */
+    bool split(const Task& task, int minTileSize, std::vector<Task>& parts)
+    {
+        const ivec2 size = task.tile.size;
+        const bool splitX = size.x >= minTileSize * 2;
+        const bool splitY = size.y >= minTileSize * 2;
+
+        if (!splitX && !splitY) return false;
+
+        const ivec2 half(splitX ? size.x / 2 / minTileSize * minTileSize : size.x,
+                         splitY ? size.y / 2 / minTileSize * minTileSize : size.y);
+
+        for (int y = 0; y < size.y; y += half.y)
+        {
+            for (int x = 0; x < size.x; x += half.x)
+            {
+                const ivec2 offset(x, y);
+                parts.push_back({ { task.tile.offset + offset, min(half, size - offset) }, task.gridTile });
+            }
+        }
+
+        return true;
+    }
+}
+
+TileScheduler::Report::Report() : threads(0), tiles(0), splits(0), steals(0), seconds(0) {}
+
+double TileScheduler::Report::getImbalance() const
+{
+    if (busySeconds.empty()) return 1;
+
+    double total = 0;
+
+    for (double busy : busySeconds) { total += busy; }
+
+    const double mean = total / busySeconds.size();
+
+    return mean > 0 ? *std::max_element(busySeconds.begin(), busySeconds.end()) / mean : 1;
+}
+
+double TileScheduler::Report::getEfficiency() const
+{
+    if (busySeconds.empty() || seconds <= 0) return 1;
+
+    double total = 0;
+
+    for (double busy : busySeconds) { total += busy; }
+
+    return std::min(total / busySeconds.size() / seconds, 1.0);
+}
+
+TileScheduler::TileScheduler(int tileSize, int minTileSize) : tileSize(std::max(tileSize, 1)), costSize(0)
+{
+    this->minTileSize = clamp(minTileSize, 1, this->tileSize);
+}
+
+void TileScheduler::run(const ivec2& size, const std::function<void(const Tile&)>& function)
+{
+    using Clock = std::chrono::steady_clock;
+    const auto start = Clock::now();
+    const ivec2 grid = (max(size, ivec2(0)) + tileSize - 1) / tileSize;
+    const int gridTiles = grid.x * grid.y;
+
+    report = Report();
+
+    if (gridTiles == 0) return;
+
+    // expensive tiles of the previous run over the same image are split into quadrants until their
+    // parts cost about the mean
+    const bool measured = costSize == size && costs.size() == static_cast<size_t>(gridTiles);
+    double meanCost = 0;
+
+    if (measured)
+    {
+        for (double cost : costs) { meanCost += cost; }
+
+        meanCost /= gridTiles;
+    }
+
+    std::vector<Task> tasks;
+    std::vector<Task> parts;
+
+    for (int i = 0; i < gridTiles; i++)
+    {
+        const ivec2 offset = ivec2(i % grid.x, i / grid.x) * tileSize;
+        const Task task = { { offset, min(ivec2(tileSize), size - offset) }, i };
+        double cost = measured ? costs[i] : 0;
+        std::vector<Task> pending(1, task);
+
+        while (meanCost > 0 && cost > meanCost * SplitCost)
+        {
+            parts.clear();
+
+            for (const Task& part : pending)
+            {
+                if (split(part, minTileSize, parts)) report.splits++;
+                else parts.push_back(part);
+            }
+
+            if (parts.size() == pending.size()) break;
+
+            cost *= static_cast<double>(pending.size()) / parts.size();
+            pending.swap(parts);
+        }
+
+        tasks.insert(tasks.end(), pending.begin(), pending.end());
+    }
+
+    // each thread starts with a contiguous run of tiles, neighbouring pixels stay on one thread
+    ThreadPool& pool = ThreadPool::instance();
+    const int threads = std::min(static_cast<int>(pool.getThreadCount()), static_cast<int>(tasks.size()));
+    std::vector<Queue> queues(threads);
+
+    for (int t = 0; t < threads; t++)
+    {
+        const size_t first = tasks.size() * t / threads;
+        const size_t last = tasks.size() * (t + 1) / threads;
+        queues[t].tasks.assign(tasks.begin() + first, tasks.begin() + last);
+    }
+
+    std::atomic<size_t> remaining(tasks.size());
+    std::atomic<size_t> splits(0);
+    std::atomic<size_t> steals(0);
+    std::atomic<int> starving(0);
+    std::vector<double> busySeconds(threads, 0.0);
+    // seconds per grid tile measured by each thread, merged once the run is done
+    std::vector<std::vector<std::pair<int, double>>> measurements(threads);
+
+    pool.parallelFor(0, threads, [&](int thread)
+    {
+        Queue& own = queues[thread];
+        bool wasStarving = false;
+
+        while (remaining > 0)
+        {
+            Task task;
+            bool found = false;
+
+            {
+                std::lock_guard<std::mutex> lock(own.mutex);
+
+                if (!own.tasks.empty())
+                {
+                    task = own.tasks.front();
+                    own.tasks.pop_front();
+                    found = true;
+
+                    // a tile taken while other threads wait is shared with them
+                    std::vector<Task> pieces;
+
+                    if (starving > 0 && split(task, minTileSize, pieces))
+                    {
+                        task = pieces.front();
+                        own.tasks.insert(own.tasks.begin(), pieces.begin() + 1, pieces.end());
+                        remaining += pieces.size() - 1;
+                        splits++;
+                    }
+                }
+            }
+
+            // once its own queue is empty a thread steals from the back of the others, away from
+            // the tiles their owners take next
+            for (int i = 1; !found && i < threads; i++)
+            {
+                Queue& victim = queues[(thread + i) % threads];
+                std::lock_guard<std::mutex> lock(victim.mutex);
+
+                if (!victim.tasks.empty())
+                {
+                    task = victim.tasks.back();
+                    victim.tasks.pop_back();
+                    found = true;
+                    steals++;
+                }
+            }
+
+            if (found == wasStarving)
+            {
+                starving += found ? -1 : 1;
+                wasStarving = !found;
+            }
+
+            if (!found)
+            {
+                // the remaining tiles are running, or about to be split by their owner
+                std::this_thread::yield();
+                continue;
+            }
+
+            const auto tileStart = Clock::now();
+            function(task.tile);
+            const double seconds = std::chrono::duration<double>(Clock::now() - tileStart).count();
+            busySeconds[thread] += seconds;
+            measurements[thread].push_back({ task.gridTile, seconds });
+            remaining--;
+        }
+
+        if (wasStarving) starving--;
+    });
+
+    costs.assign(gridTiles, 0.0);
+    costSize = size;
+
+    for (auto& measured : measurements)
+    {
+        for (auto& measurement : measured) { costs[measurement.first] += measurement.second; }
+    }
+
+    report.threads = threads;
+    report.splits += splits;
+    report.steals = steals;
+    report.busySeconds = busySeconds;
+
+    for (auto& measured : measurements) { report.tiles += measured.size(); }
+
+    report.seconds = std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+void TileScheduler::resetCosts()
+{
+    costs.clear();
+    costSize = ivec2(0);
+}
+
+const TileScheduler::Report& TileScheduler::getReport() const
+{
+    return report;
+}
+
+int TileScheduler::getTileSize() const
+{
+    return tileSize;
+}
+
+int TileScheduler::getMinTileSize() const
+{
+    return minTileSize;
+}
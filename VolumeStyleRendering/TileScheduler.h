@@ -0,0 +1,82 @@
+#pragma once
+#include <functional>
+#include <vector>
+#include <cinder/CinderGlm.h>
+
+/**
+ * \brief Splits an image into tiles processed by the thread pool threads with work stealing
+ */
+class TileScheduler
+{
+public:
+    /**
+     * \brief A rectangle of pixels, rows from the bottom of the image
+     */
+    struct Tile
+    {
+        glm::ivec2 offset;
+        glm::ivec2 size;
+    };
+
+    /**
+     * \brief Load balance of a run
+     */
+    struct Report
+    {
+        // threads taking part, tiles processed, split and taken from another thread's queue
+        unsigned threads;
+        size_t tiles;
+        size_t splits;
+        size_t steals;
+        // time each thread spent inside the tile function
+        std::vector<double> busySeconds;
+        double seconds;
+
+        Report();
+        /**
+         * \brief Busiest thread's work relative to the mean
+         * \return 1 when the work was spread evenly, the thread count when a single thread did it all
+         */
+        double getImbalance() const;
+        /**
+         * \brief Share of the run the threads spent working
+         * \return The mean busy time over the run time, 1 when no thread waited
+         */
+        double getEfficiency() const;
+    };
+
+    /**
+     * \brief Creates a scheduler
+     * \param tileSize Pixels along each side of the tiles the image is split into
+     * \param minTileSize Tiles aren't split below this size, keep it a multiple of any pixel
+     * blocks the tile function processes together
+     */
+    explicit TileScheduler(int tileSize = 32, int minTileSize = 8);
+
+    /**
+     * \brief Calls function for tiles covering the image, spread across the workers and the
+     * calling thread, returns once all tiles have been processed
+     * \param size Image size in pixels
+     * \param function Work for a single tile, called concurrently
+     */
+    void run(const glm::ivec2& size, const std::function<void(const Tile&)>& function);
+    /**
+     * \brief Forgets the tile costs of the previous run, the next run starts from even tiles
+     */
+    void resetCosts();
+
+    /**
+     * \brief Load balance of the last run
+     * \return The report
+     */
+    const Report &getReport() const;
+    int getTileSize() const;
+    int getMinTileSize() const;
+private:
+    int tileSize;
+    int minTileSize;
+    // seconds spent on each tile of the last run and the image size they were measured with
+    std::vector<double> costs;
+    glm::ivec2 costSize;
+    Report report;
+};
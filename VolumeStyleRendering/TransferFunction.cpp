@@ -7,7 +7,7 @@
 using namespace glm;
 using namespace cinder;
 
-TransferFunction::TransferFunction() : threshold(vec2(0, 255)), updateColorTexture(false)
+TransferFunction::TransferFunction() : threshold(vec2(0, 255)), updateColorTexture(false), revision(0)
 {
     colorPoints.push_back(TransferFunctionColorPoint(vec3(1), 0));
     colorPoints.push_back(TransferFunctionColorPoint(vec3(1), 255));
@@ -72,8 +72,11 @@ void TransferFunction::setThreshold(int minIso, int maxIso)
     minIso = clamp(minIso, 0, maxIso - 1);
     maxIso = clamp(maxIso, minIso + 1, 255);
 
+    if (threshold == ivec2(minIso, maxIso)) return;
+
     threshold.x = minIso;
     threshold.y = maxIso;
+    revision++;
 }
 
 const ivec2& TransferFunction::getThreshold() const
@@ -160,6 +163,12 @@ void TransferFunction::updateFunction()
 
     // update texture needs to be update on next query
     updateColorTexture = true;
+    revision++;
+}
+
+unsigned TransferFunction::getRevision() const
+{
+    return revision;
 }
 
 const std::vector<TransferFunctionColorPoint> &TransferFunction::getColorPoints() const
@@ -193,12 +202,63 @@ const gl::Texture1dRef& TransferFunction::getColorMappingTexture()
     else if(updateColorTexture)
     {
         colorMappingTexture->update(getIndexedTransferFunction().data(), GL_RGBA, GL_FLOAT, 0, 256, 0);
-        updateColorTexture = true;
+        updateColorTexture = false;
     }
 
     return colorMappingTexture;
 }
 
+const gl::Texture2dRef& TransferFunction::getPreintegratedTexture()
+{
+    if (!colorMappingTexture) getColorMappingTexture();
+
+    if (!preintegratedTexture)
+    {
+        auto format = gl::Texture2d::Format().minFilter(GL_LINEAR)
+                                             .magFilter(GL_LINEAR)
+                                             .wrap(GL_CLAMP_TO_EDGE)
+                                             .internalFormat(GL_RGBA32F);
+        format.setDataType(GL_FLOAT);
+        preintegratedTexture = gl::Texture2d::create(PreintegrationTable::Size, PreintegrationTable::Size, format);
+    }
+
+    // the threshold doesn't mark the function for update, changes are found by the table
+    if (!preintegrationTable.update(indexedTransferFunction, threshold)) return preintegratedTexture;
+
+    const int size = PreintegrationTable::Size;
+    const ivec2 range = preintegrationTable.getChangedRange();
+    const vec4* table = preintegrationTable.getTable().data();
+    GLint rowLength;
+    glGetIntegerv(GL_UNPACK_ROW_LENGTH, &rowLength);
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, size);
+
+    // segments from rows before the changed entries reach them from the first changed column on,
+    // segments from rows after them up to the last changed column
+    if (range.x > 0)
+    {
+        preintegratedTexture->update(table + range.x, GL_RGBA, GL_FLOAT, 0, size - range.x, range.x,
+                                     ivec2(range.x, 0));
+    }
+
+    preintegratedTexture->update(table + range.x * size, GL_RGBA, GL_FLOAT, 0, size, range.y - range.x + 1,
+                                 ivec2(0, range.x));
+
+    if (range.y < size - 1)
+    {
+        preintegratedTexture->update(table + (range.y + 1) * size, GL_RGBA, GL_FLOAT, 0, range.y + 1,
+                                     size - range.y - 1, ivec2(0, range.y + 1));
+    }
+
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, rowLength);
+
+    return preintegratedTexture;
+}
+
+const PreintegrationTable& TransferFunction::getPreintegrationTable() const
+{
+    return preintegrationTable;
+}
+
 void TransferFunction::setColor(const int index, const vec3& color)
 {
     // off limits
@@ -3,6 +3,7 @@
 
 #include "TransferFunctionPoint.h"
 #include "CubicSpline.h"
+#include "PreintegrationTable.h"
 
 class RaycastVolume;
 
@@ -29,6 +30,18 @@ public:
     const std::vector<TransferFunctionAlphaPoint> &getAlphaPoints() const;
     const std::array<glm::vec4, 256> &getIndexedTransferFunction() const;
     const cinder::gl::Texture1dRef &getColorMappingTexture();
+    /**
+     * \brief Color and opacity integrated over the segment between a front and a back sample
+     * value, rows only covering unchanged entries are kept across edits
+     * \return The 256x256 pre-integrated table indexed by (back, front)
+     */
+    const cinder::gl::Texture2dRef &getPreintegratedTexture();
+    const PreintegrationTable &getPreintegrationTable() const;
+    /**
+     * \brief Counts the function and threshold changes, compared to find out if the function changed
+     * \return The revision
+     */
+    unsigned getRevision() const;
 private:
     glm::ivec2 threshold;
     std::vector<TransferFunctionColorPoint> colorPoints;
@@ -37,6 +50,9 @@ private:
     std::vector<CubicSpline> colorSpline;
     std::array<glm::vec4, 256> indexedTransferFunction;
     bool updateColorTexture;
+    unsigned revision;
 
     cinder::gl::Texture1dRef colorMappingTexture;
+    PreintegrationTable preintegrationTable;
+    cinder::gl::Texture2dRef preintegratedTexture;
 };
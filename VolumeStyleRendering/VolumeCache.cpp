@@ -0,0 +1,258 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sys/stat.h>
+
+#include "VolumeCache.h"
+#include "MappedFile.h"
+
+using namespace glm;
+
+const char* VolumeCache::HistogramSection = "histogram";
+const char* VolumeCache::GradientsSection = "gradients";
+const char* VolumeCache::WindowSection = "window";
+const char* VolumeCache::BrickRangesSection = "brick ranges";
+
+namespace
+{
+    const char Magic[4] = { 'V', 'C', 'C', 'H' };
+    const uint32_t Version = 5;
+    const size_t PageSize = 4096;
+    // bytes hashed from the start, middle and end of the sources
+    const size_t SampleBytes = 64 * 1024;
+
+    struct CacheHeader
+    {
+        char magic[4];
+        uint32_t version;
+        VolumeCacheKey key;
+        uint32_t sectionCount;
+        uint32_t reserved;
+    };
+
+    struct CacheSection
+    {
+        char name[24];
+        uint64_t offset;
+        uint64_t bytes;
+    };
+
+    /**
+     * \brief 64 bits FNV-1a hash, continued from the given hash value
+     */
+    uint64_t hashBytes(const uint8_t* data, size_t bytes, uint64_t hash)
+    {
+        for (size_t i = 0; i < bytes; i++)
+        {
+            hash ^= data[i];
+            hash *= 1099511628211ull;
+        }
+
+        return hash;
+    }
+
+    /**
+     * \brief Reads a file's size and modification time
+     * \return False if the file doesn't exist
+     */
+    bool fileStatus(const std::string& filepath, uint64_t& bytes, int64_t& modifiedTime)
+    {
+#if defined(_WIN32)
+        struct __stat64 status;
+
+        if (_stat64(filepath.c_str(), &status) != 0) return false;
+#else
+        struct stat status;
+
+        if (stat(filepath.c_str(), &status) != 0) return false;
+#endif
+        bytes = static_cast<uint64_t>(status.st_size);
+        modifiedTime = static_cast<int64_t>(status.st_mtime);
+
+        return true;
+    }
+}
+
+bool VolumeCacheKey::operator==(const VolumeCacheKey& other) const
+{
+    return memcmp(this, &other, sizeof(VolumeCacheKey)) == 0;
+}
+
+VolumeCache::Writer::Writer(const VolumeCacheKey& key) : key(key) {}
+
+void VolumeCache::Writer::addSection(const std::string& name, std::vector<uint8_t> data)
+{
+    auto section = std::find_if(sections.begin(), sections.end(),
+                                [&name](const std::pair<std::string, std::vector<uint8_t>>& s)
+                                {
+                                    return s.first == name;
+                                });
+
+    if (section != sections.end())
+    {
+        section->second = move(data);
+        return;
+    }
+
+    sections.emplace_back(name.substr(0, sizeof(CacheSection::name) - 1), move(data));
+}
+
+bool VolumeCache::Writer::write(const std::string& path) const
+{
+    const std::string temporary = path + ".tmp";
+
+    {
+        std::ofstream output(temporary, std::ios::binary | std::ios::trunc);
+
+        if (!output.good()) return false;
+
+        CacheHeader header;
+        memset(&header, 0, sizeof(CacheHeader));
+        memcpy(header.magic, Magic, sizeof(Magic));
+        header.version = Version;
+        header.key = key;
+        header.sectionCount = static_cast<uint32_t>(sections.size());
+
+        // section data starts at page boundaries after the section table
+        std::vector<CacheSection> table(sections.size());
+        uint64_t offset = sizeof(CacheHeader) + table.size() * sizeof(CacheSection);
+
+        for (size_t i = 0; i < sections.size(); i++)
+        {
+            memset(&table[i], 0, sizeof(CacheSection));
+            memcpy(table[i].name, sections[i].first.c_str(), sections[i].first.size());
+            table[i].offset = (offset + PageSize - 1) / PageSize * PageSize;
+            table[i].bytes = sections[i].second.size();
+            offset = table[i].offset + table[i].bytes;
+        }
+
+        output.write(reinterpret_cast<const char*>(&header), sizeof(CacheHeader));
+        output.write(reinterpret_cast<const char*>(table.data()), table.size() * sizeof(CacheSection));
+
+        for (size_t i = 0; i < sections.size(); i++)
+        {
+            output.seekp(table[i].offset);
+            output.write(reinterpret_cast<const char*>(sections[i].second.data()), sections[i].second.size());
+        }
+
+        if (!output.good()) return false;
+    }
+
+    // rename doesn't replace existing files on every platform
+    std::remove(path.c_str());
+
+    return std::rename(temporary.c_str(), path.c_str()) == 0;
+}
+
+VolumeCache::VolumeCache(const std::string& path, const VolumeCacheKey& key) : valid(false)
+{
+    file = std::make_unique<MappedFile>(path, false);
+
+    if (!file->isOpen() || file->size() < sizeof(CacheHeader)) return;
+
+    CacheHeader header;
+    memcpy(&header, file->data(), sizeof(CacheHeader));
+
+    // written for another volume or by an incompatible version
+    if (memcmp(header.magic, Magic, sizeof(Magic)) != 0 || header.version != Version || !(header.key == key)) return;
+
+    if (file->size() < sizeof(CacheHeader) + header.sectionCount * sizeof(CacheSection)) return;
+
+    auto table = reinterpret_cast<const CacheSection*>(file->data() + sizeof(CacheHeader));
+
+    for (uint32_t i = 0; i < header.sectionCount; i++)
+    {
+        if (table[i].offset + table[i].bytes > file->size()) return;
+    }
+
+    valid = true;
+}
+
+VolumeCache::~VolumeCache() {}
+
+bool VolumeCache::isValid() const
+{
+    return valid;
+}
+
+bool VolumeCache::getSection(const std::string& name, const uint8_t*& data, size_t& bytes) const
+{
+    if (!valid) return false;
+
+    CacheHeader header;
+    memcpy(&header, file->data(), sizeof(CacheHeader));
+    auto table = reinterpret_cast<const CacheSection*>(file->data() + sizeof(CacheHeader));
+
+    for (uint32_t i = 0; i < header.sectionCount; i++)
+    {
+        if (strncmp(table[i].name, name.c_str(), sizeof(CacheSection::name)) == 0)
+        {
+            data = file->data() + table[i].offset;
+            bytes = static_cast<size_t>(table[i].bytes);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+std::string VolumeCache::PathFor(const std::string& source)
+{
+    std::string path = source;
+
+    // slice directories get a sibling cache file
+    while (!path.empty() && (path.back() == '/' || path.back() == '\\')) path.pop_back();
+
+    return path + ".vcache";
+}
+
+VolumeCacheKey VolumeCache::ComputeKey(const std::vector<std::string>& files, const ivec3& dimensions,
+                                       size_t bytesPerVoxel)
+{
+    VolumeCacheKey key;
+    memset(&key, 0, sizeof(VolumeCacheKey));
+    key.contentHash = 14695981039346656037ull;
+    key.dimensions[0] = dimensions.x;
+    key.dimensions[1] = dimensions.y;
+    key.dimensions[2] = dimensions.z;
+    key.bytesPerVoxel = static_cast<uint32_t>(bytesPerVoxel);
+    key.residentBytesPerVoxel = key.bytesPerVoxel;
+    key.residentDimensions[0] = dimensions.x;
+    key.residentDimensions[1] = dimensions.y;
+    key.residentDimensions[2] = dimensions.z;
+
+    // stacks of many slices sample less of each file
+    const size_t sampleBytes = std::max<size_t>(SampleBytes / std::max<size_t>(files.size(), 1), PageSize);
+    std::vector<uint8_t> sample(sampleBytes);
+
+    for (const auto& filepath : files)
+    {
+        uint64_t bytes;
+        int64_t modifiedTime;
+
+        if (!fileStatus(filepath, bytes, modifiedTime))
+        {
+            key.sourceBytes = 0;
+            return key;
+        }
+
+        key.sourceBytes += bytes;
+        key.modifiedTime = std::max(key.modifiedTime, modifiedTime);
+        key.contentHash = hashBytes(reinterpret_cast<const uint8_t*>(filepath.c_str()), filepath.size(),
+                                    key.contentHash);
+
+        std::ifstream input(filepath, std::ios::binary);
+        const uint64_t offsets[3] = { 0, bytes / 2, bytes > sampleBytes ? bytes - sampleBytes : 0 };
+
+        for (uint64_t offset : offsets)
+        {
+            input.seekg(offset);
+            input.read(reinterpret_cast<char*>(sample.data()), sampleBytes);
+            key.contentHash = hashBytes(sample.data(), static_cast<size_t>(input.gcount()), key.contentHash);
+            input.clear();
+        }
+    }
+
+    return key;
+}
@@ -0,0 +1,114 @@
+#pragma once
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+#include <cinder/CinderGlm.h>
+
+class MappedFile;
+
+/**
+ * \brief Identifies the source a cache was derived from. Any change to the source files or
+ * the parameters used to read them produces a different key
+ */
+struct VolumeCacheKey
+{
+    uint64_t sourceBytes;
+    int64_t modifiedTime;
+    // hash of sampled ranges of the source files
+    uint64_t contentHash;
+    int32_t dimensions[3];
+    uint32_t bytesPerVoxel;
+    // bytes per voxel after conversion and the percentiles its window was picked from
+    uint32_t residentBytesPerVoxel;
+    float windowPercentiles[2];
+    // settings the cached gradients were computed with
+    uint32_t gradientSettings;
+    // dimensions after reductions to the resident budget and the filter they were reduced with
+    int32_t residentDimensions[3];
+    uint32_t residentFilter;
+
+    bool operator==(const VolumeCacheKey& other) const;
+};
+
+/**
+ * \brief Sidecar file storing data derived from a volume, such as its histogram, gradients and
+ * acceleration structures, so reopening the same volume skips their computation. The file holds
+ * named sections, each aligned to a page so they can be used straight from the memory mapping
+ */
+class VolumeCache
+{
+public:
+    /**
+     * \brief Collects sections and writes them into a cache file
+     */
+    class Writer
+    {
+    public:
+        explicit Writer(const VolumeCacheKey& key);
+
+        /**
+         * \brief Adds a named section, replacing any previous section with the same name
+         * \param name Section name, at most 23 characters
+         * \param data The section contents
+         */
+        void addSection(const std::string& name, std::vector<uint8_t> data);
+        /**
+         * \brief Writes the cache to a temporary file and moves it over the given path once
+         * complete, so readers never see a partially written cache
+         * \param path The cache file path
+         * \return True if the cache was written
+         */
+        bool write(const std::string& path) const;
+    private:
+        VolumeCacheKey key;
+        std::vector<std::pair<std::string, std::vector<uint8_t>>> sections;
+    };
+
+    /**
+     * \brief Maps the cache at the given path, it's only valid if it was written for the given key
+     * \param path The cache file path
+     * \param key Key of the volume being loaded
+     */
+    VolumeCache(const std::string& path, const VolumeCacheKey& key);
+    ~VolumeCache();
+
+    /**
+     * \brief Determines if the cache exists, has a known version and matches the key
+     * \return True if the sections can be used
+     */
+    bool isValid() const;
+    /**
+     * \brief Finds the section with the given name
+     * \param name The section name
+     * \param data Receives the start of the mapped section
+     * \param bytes Receives the section size
+     * \return False if the cache doesn't contain the section
+     */
+    bool getSection(const std::string& name, const uint8_t*& data, size_t& bytes) const;
+
+    /**
+     * \brief Sidecar cache path of the given volume file or slice directory
+     * \param source The volume source path
+     * \return The cache file path
+     */
+    static std::string PathFor(const std::string& source);
+    /**
+     * \brief Computes the key of a volume from its files' sizes and modification times and a
+     * hash of sampled ranges of their contents
+     * \param files The volume source files
+     * \param dimensions The volume dimensions
+     * \param bytesPerVoxel Voxel size the volume is read with
+     * \return The volume key, zero sized if a file can't be read
+     */
+    static VolumeCacheKey ComputeKey(const std::vector<std::string>& files, const glm::ivec3& dimensions,
+                                     size_t bytesPerVoxel);
+
+    static const char* HistogramSection;
+    static const char* GradientsSection;
+    static const char* WindowSection;
+    static const char* BrickRangesSection;
+private:
+    std::unique_ptr<MappedFile> file;
+    bool valid;
+};
@@ -0,0 +1,968 @@
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <future>
+#include <vector>
+
+#include "VolumeLoader.h"
+#include "MappedFile.h"
+#include "BrickedVolume.h"
+#include "ImageStack.h"
+#include "CompressedVolume.h"
+#include "HistogramEngine.h"
+#include "OccupancyGrid.h"
+#include "LightVolume.h"
+#include "ThreadPool.h"
+
+using namespace glm;
+
+namespace
+{
+    // slices sampled to pick the conversion window
+    const int WindowSampleSlices = 32;
+}
+
+VolumeLoadOptions::VolumeLoadOptions() : hostMemoryBudget(256 * 1024 * 1024), convertTo8Bits(false),
+                                         windowPercentiles(0.1f, 99.9f), precomputeGradients(true),
+                                         residentMemoryBudget(static_cast<size_t>(2048) * 1024 * 1024),
+                                         downsampleFilter(VolumePyramid::Filter::Average), residentLevel(-1),
+                                         lightVolumeScale(0), halveResident(false),
+                                         pyramidFilter(VolumePyramid::Filter::Average), uploadSlabs(true) {}
+
+VolumeLoadJob::VolumeLoadJob(const ivec3& dimensions, const vec3& ratios, const std::string& filepath,
+                             VoxelType voxelType, const VolumeLoadOptions& options) : dimensions(dimensions),
+                                                                                ratios(ratios), residentDimensions(0),
+                                                                                residentRatios(1), level(0),
+                                                                                filepath(filepath),
+                                                                                described(false),
+                                                                                voxelType(voxelType),
+                                                                                options(options), sliceBytes(0),
+                                                                                sourceSliceBytes(0), totalBytes(0),
+                                                                                stage(Stage::Reading), bytesRead(0),
+                                                                                bytesUploaded(0), cancelled(false),
+                                                                                decodeSeconds(0), histogramSeconds(0),
+                                                                                histogramBytes(0), readySlices(0),
+                                                                                hasReadySlab(false), cacheKey(),
+                                                                                derivedDataCached(false),
+                                                                                cachedGradients(nullptr),
+                                                                                halvedLevel(), converting(false),
+                                                                                window(0, 65535)
+{
+    initializeSizes();
+    // compressed raws are decompressed slab by slab instead of mapped
+    worker = std::thread(CompressedVolume::IsCompressed(filepath) ? &VolumeLoadJob::runCompressed :
+                         &VolumeLoadJob::runRaw, this);
+}
+
+VolumeLoadJob::VolumeLoadJob(const std::string& filepath, const VolumeLoadOptions& options) : dimensions(0), ratios(1),
+                                                                                           residentDimensions(0),
+                                                                                           residentRatios(1),
+                                                                                           level(0),
+                                                                                           filepath(filepath),
+                                                                                           described(true),
+                                                                                           voxelType(VoxelType::UInt8),
+                                                                                           options(options),
+                                                                                           sliceBytes(0),
+                                                                                           sourceSliceBytes(0),
+                                                                                           totalBytes(0),
+                                                                                           stage(Stage::Reading),
+                                                                                           bytesRead(0),
+                                                                                           bytesUploaded(0),
+                                                                                           cancelled(false),
+                                                                                           decodeSeconds(0),
+                                                                                           histogramSeconds(0),
+                                                                                           histogramBytes(0),
+                                                                                           readySlices(0),
+                                                                                           hasReadySlab(false),
+                                                                                           cacheKey(),
+                                                                                           derivedDataCached(false),
+                                                                                           cachedGradients(nullptr),
+                                                                                           halvedLevel(),
+                                                                                           converting(false),
+                                                                                           window(0, 65535)
+{
+    // a directory holds an image stack
+    if (ImageStack::IsStackDirectory(filepath))
+    {
+        imageStack = std::make_unique<ImageStack>(filepath);
+
+        if (!imageStack->isOpen())
+        {
+            fail(imageStack->getError());
+            return;
+        }
+
+        // volume parameters come from the slice images
+        dimensions = imageStack->getDimensions();
+        voxelType = imageStack->getVoxelType();
+    }
+    else
+    {
+        bricked = std::make_unique<BrickedVolume>(filepath);
+
+        if (!bricked->isOpen())
+        {
+            fail(bricked->getError());
+            return;
+        }
+
+        // volume parameters come from the header
+        dimensions = bricked->getDimensions();
+        ratios = bricked->getRatios();
+        voxelType = bricked->getVoxelType();
+    }
+
+    initializeSizes();
+    worker = std::thread(imageStack ? &VolumeLoadJob::runImageStack : &VolumeLoadJob::runBricked, this);
+}
+
+VolumeLoadJob::~VolumeLoadJob()
+{
+    cancel();
+
+    if (worker.joinable()) worker.join();
+}
+
+std::shared_ptr<VolumeLoadJob> VolumeLoadJob::reread(const VolumeLoadOptions& options) const
+{
+    // the resident volume is read like this one, only the derived data follows the given options
+    VolumeLoadOptions rereadOptions = this->options;
+    rereadOptions.gradientSettings = options.gradientSettings;
+    rereadOptions.precomputeGradients = options.precomputeGradients;
+    rereadOptions.lightVolumeScale = options.lightVolumeScale;
+    rereadOptions.halveResident = options.halveResident;
+    rereadOptions.pyramidFilter = options.pyramidFilter;
+    rereadOptions.residentLevel = level;
+    rereadOptions.uploadSlabs = false;
+
+    if (described) return std::make_shared<VolumeLoadJob>(filepath, rereadOptions);
+
+    return std::make_shared<VolumeLoadJob>(dimensions, ratios, filepath, voxelType, rereadOptions);
+}
+
+void VolumeLoadJob::runRaw()
+{
+    file = std::make_unique<MappedFile>(filepath);
+
+    // error opening given filepath
+    if (!file->isOpen())
+    {
+        fail("Couldn't open volume file " + filepath);
+        return;
+    }
+
+    // the raw data has to cover the requested dimensions
+    if (file->size() < totalBytes)
+    {
+        fail("Volume file " + filepath + " has " + std::to_string(file->size()) + " bytes, " +
+             std::to_string(totalBytes) + " bytes are needed for the given dimensions");
+        return;
+    }
+
+    const bool cachedStatistics = openDerivedData({ filepath });
+
+    if (!needsSlabs())
+    {
+        stage = Stage::Ready;
+        return;
+    }
+
+    if (converting)
+    {
+        chooseWindow([this](int z, uint8_t* destination)
+        {
+            memcpy(destination, file->data() + z * sourceSliceBytes, sourceSliceBytes);
+            return true;
+        });
+    }
+
+    VolumeSlabStream stream(*file, dimensions, GetVoxelSize(voxelType), computeSlabDepth());
+
+    // the next slab is read while the current one is processed and uploaded
+    const bool streamed = stream.run([this, &stream, cachedStatistics](const VolumeSlab& slab)
+    {
+        if (cancelled) return false;
+
+        // cpu-side preprocessing
+        const VolumeSlab resident = residentSlab(slab);
+
+        if (!cachedStatistics) accumulateStatistics(resident);
+        bytesRead += slab.bytes;
+
+        if (slab.index == stream.getSlabCount() - 1) stage = Stage::Uploading;
+
+        return handOver(resident);
+    });
+
+    if (!streamed || cancelled)
+    {
+        stage = Stage::Cancelled;
+        return;
+    }
+
+    // mapping isn't needed anymore once all slabs are uploaded
+    file->close();
+    stage = Stage::Preprocessing;
+
+    if (finishDerivedData()) stage = Stage::Ready;
+}
+
+void VolumeLoadJob::runBricked()
+{
+    const bool cachedStatistics = openDerivedData({ filepath });
+
+    if (!needsSlabs())
+    {
+        stage = Stage::Ready;
+        return;
+    }
+
+    // statistics come from the brick metadata, no voxel has to be scanned. The metadata bins
+    // the source values so converted volumes are counted while converting instead
+    if (!cachedStatistics && !converting)
+    {
+        statistics.setDomain(bricked->getValueDomain().x, bricked->getValueDomain().y);
+
+        for (int i = 0; i < bricked->getTotalBricks(); i++)
+        {
+            const BrickInfo& info = bricked->getBrickInfo(i);
+            statistics.merge(info.histogram, info.minValue, info.maxValue);
+        }
+    }
+
+    if (converting)
+    {
+        chooseWindow([this](int z, uint8_t* destination)
+        {
+            bricked->copySlices(z, 1, destination);
+            return true;
+        });
+    }
+
+    const int slabDepth = computeSlabDepth();
+    std::vector<uint8_t> staging(slabDepth * sourceSliceBytes);
+    bricked->prefetchSlices(0, slabDepth);
+
+    for (int index = 0, zOffset = 0; zOffset < dimensions.z; index++, zOffset += slabDepth)
+    {
+        if (cancelled) break;
+
+        VolumeSlab slab;
+        slab.index = index;
+        slab.zOffset = zOffset;
+        slab.depth = min(slabDepth, dimensions.z - zOffset);
+        slab.data = staging.data();
+        slab.bytes = slab.depth * sourceSliceBytes;
+
+        // bricks of the next slab are read while this one is assembled and uploaded
+        bricked->prefetchSlices(zOffset + slab.depth, slabDepth);
+        bricked->copySlices(slab.zOffset, slab.depth, staging.data());
+        bytesRead += slab.bytes;
+
+        const VolumeSlab resident = residentSlab(slab);
+
+        if (converting && !cachedStatistics) accumulateStatistics(resident);
+
+        if (zOffset + slab.depth >= dimensions.z) stage = Stage::Uploading;
+
+        if (!handOver(resident)) break;
+    }
+
+    if (cancelled)
+    {
+        stage = Stage::Cancelled;
+        return;
+    }
+
+    bricked = nullptr;
+    stage = Stage::Preprocessing;
+
+    if (finishDerivedData()) stage = Stage::Ready;
+}
+
+void VolumeLoadJob::runImageStack()
+{
+    const bool cachedStatistics = openDerivedData(imageStack->getFiles());
+
+    runDecoded([this](int zOffset, int depth, uint8_t* destination)
+    {
+        return imageStack->decodeSlices(zOffset, depth, destination);
+    }, [this] { return imageStack->getError(); }, cachedStatistics);
+}
+
+void VolumeLoadJob::runCompressed()
+{
+    compressed = std::make_unique<CompressedVolume>(filepath);
+
+    if (!compressed->isOpen())
+    {
+        fail(compressed->getError());
+        return;
+    }
+
+    // indexed files know their decompressed size, others fail once the data runs out
+    if (compressed->getUncompressedBytes() > 0 && compressed->getUncompressedBytes() < totalBytes)
+    {
+        fail("Volume file " + filepath + " decompresses to " + std::to_string(compressed->getUncompressedBytes()) +
+             " bytes, " + std::to_string(totalBytes) + " bytes are needed for the given dimensions");
+        return;
+    }
+
+    const bool cachedStatistics = openDerivedData({ filepath });
+
+    runDecoded([this](int zOffset, int depth, uint8_t* destination)
+    {
+        return compressed->read(zOffset * sourceSliceBytes, depth * sourceSliceBytes, destination);
+    }, [this] { return compressed->getError(); }, cachedStatistics);
+
+    compressed = nullptr;
+}
+
+void VolumeLoadJob::runDecoded(const std::function<bool(int, int, uint8_t*)>& decodeSlices,
+                               const std::function<std::string()>& decodeError, bool cachedStatistics)
+{
+    if (!needsSlabs())
+    {
+        stage = Stage::Ready;
+        return;
+    }
+
+    if (converting && !chooseWindow([&decodeSlices](int z, uint8_t* destination)
+    {
+        return decodeSlices(z, 1, destination);
+    }))
+    {
+        fail(decodeError());
+        return;
+    }
+
+    const int slabDepth = computeSlabDepth();
+    std::vector<uint8_t> buffers[2] = { std::vector<uint8_t>(slabDepth * sourceSliceBytes),
+                                        std::vector<uint8_t>(slabDepth * sourceSliceBytes) };
+
+    auto decode = [this, &decodeSlices, slabDepth](int zOffset, uint8_t* destination)
+    {
+        const auto start = std::chrono::steady_clock::now();
+        const bool decoded = decodeSlices(zOffset, min(slabDepth, dimensions.z - zOffset), destination);
+        decodeSeconds = decodeSeconds + std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        return decoded;
+    };
+
+    std::future<bool> next = std::async(std::launch::async, decode, 0, buffers[0].data());
+
+    for (int index = 0, zOffset = 0; zOffset < dimensions.z; index++, zOffset += slabDepth)
+    {
+        if (!next.get())
+        {
+            fail(decodeError());
+            return;
+        }
+
+        if (cancelled) break;
+
+        VolumeSlab slab;
+        slab.index = index;
+        slab.zOffset = zOffset;
+        slab.depth = min(slabDepth, dimensions.z - zOffset);
+        slab.data = buffers[index % 2].data();
+        slab.bytes = slab.depth * sourceSliceBytes;
+
+        // the next slab is decoded while this one is processed and uploaded
+        if (zOffset + slab.depth < dimensions.z)
+        {
+            next = std::async(std::launch::async, decode, zOffset + slab.depth, buffers[(index + 1) % 2].data());
+        }
+
+        // cpu-side preprocessing
+        const VolumeSlab resident = residentSlab(slab);
+
+        if (!cachedStatistics) accumulateStatistics(resident);
+
+        bytesRead += slab.bytes;
+
+        if (zOffset + slab.depth >= dimensions.z) stage = Stage::Uploading;
+
+        if (!handOver(resident)) break;
+    }
+
+    // decoding may still write to the buffers
+    if (next.valid()) next.wait();
+
+    if (cancelled)
+    {
+        stage = Stage::Cancelled;
+        return;
+    }
+
+    stage = Stage::Preprocessing;
+
+    if (finishDerivedData()) stage = Stage::Ready;
+}
+
+bool VolumeLoadJob::openDerivedData(const std::vector<std::string>& files)
+{
+    cacheKey = VolumeCache::ComputeKey(files, dimensions, GetVoxelSize(voxelType));
+    cacheKey.gradientSettings = options.gradientSettings.getKey();
+
+    // derived data of reduced volumes depends on the resolution and filter
+    cacheKey.residentDimensions[0] = residentDimensions.x;
+    cacheKey.residentDimensions[1] = residentDimensions.y;
+    cacheKey.residentDimensions[2] = residentDimensions.z;
+    cacheKey.residentFilter = level > 0 ? static_cast<uint32_t>(options.downsampleFilter) : 0;
+
+    // derived data of converted volumes depends on the window
+    if (converting)
+    {
+        cacheKey.residentBytesPerVoxel = sizeof(uint8_t);
+        cacheKey.windowPercentiles[0] = options.windowPercentiles.x;
+        cacheKey.windowPercentiles[1] = options.windowPercentiles.y;
+    }
+
+    auto cache = std::make_shared<VolumeCache>(VolumeCache::PathFor(filepath), cacheKey);
+
+    if (cache->isValid()) derivedData = cache;
+
+    derivedDataCached = restoreDerivedData();
+
+    // computed from the resident slabs as they are uploaded
+    if (!derivedDataCached)
+    {
+        occupancyGrid = std::make_shared<OccupancyGrid>();
+        occupancyGrid->begin(residentDimensions);
+
+        // on-the-fly normals only need the occupancy grid
+        if (options.precomputeGradients) gradientEngine->begin(getVoxelType(), residentDimensions);
+    }
+
+    if (options.lightVolumeScale > 0)
+    {
+        lightVolume = std::make_shared<LightVolume>();
+        lightVolume->begin(residentDimensions, LightVolume::GetSize(residentDimensions, options.lightVolumeScale));
+    }
+
+    // volumes too small for a pyramid have no first level
+    if (options.halveResident && VolumePyramid::GetLevelCount(residentDimensions) > 0)
+    {
+        halvedLevel.dimensions = VolumePyramid::GetHalvedDimensions(residentDimensions);
+        halvedLevel.voxels.resize(static_cast<size_t>(halvedLevel.dimensions.x) * halvedLevel.dimensions.y *
+                                  halvedLevel.dimensions.z * GetVoxelSize(getVoxelType()));
+        halvedLevel.seconds = 0;
+        halvedLevel.gradientSeconds = 0;
+    }
+
+    const uint8_t* data;
+    size_t bytes;
+
+    return derivedData && derivedData->getSection(VolumeCache::HistogramSection, data, bytes) &&
+           statistics.restore(data, bytes);
+}
+
+bool VolumeLoadJob::needsSlabs() const
+{
+    // rereads restoring everything from the cache don't read the volume
+    return options.uploadSlabs || !derivedDataCached || lightVolume || !halvedLevel.voxels.empty();
+}
+
+bool VolumeLoadJob::restoreDerivedData()
+{
+    const GradientEngine::Encoding encoding = options.gradientSettings.encoding;
+    const size_t gradientBytes = static_cast<size_t>(residentDimensions.x) * residentDimensions.y *
+                                 residentDimensions.z * GradientEngine::GetEncodedSize(encoding);
+    const uint8_t* data;
+    size_t bytes;
+
+    if (!derivedData) return false;
+
+    if (options.precomputeGradients &&
+        (!derivedData->getSection(VolumeCache::GradientsSection, data, bytes) || bytes != gradientBytes))
+    {
+        return false;
+    }
+
+    const uint8_t* rangeData;
+    size_t rangeBytes;
+    auto grid = std::make_shared<OccupancyGrid>();
+
+    if (!derivedData->getSection(VolumeCache::BrickRangesSection, rangeData, rangeBytes) ||
+        !grid->restore(rangeData, rangeBytes) || grid->getDimensions() != residentDimensions)
+    {
+        return false;
+    }
+
+    // encoded normals straight from the mapped cache
+    cachedGradients = options.precomputeGradients ? data : nullptr;
+    occupancyGrid = grid;
+
+    return true;
+}
+
+void VolumeLoadJob::addDerivedData(const VolumeSlab& slab)
+{
+    if (cancelled) return;
+
+    if (lightVolume) lightVolume->addSlices(slab.data, getVoxelType(), slab.zOffset, slab.depth);
+
+    if (!halvedLevel.voxels.empty()) halveSlab(slab);
+
+    if (derivedDataCached) return;
+
+    occupancyGrid->addSlices(slab.data, getVoxelType(), slab.zOffset, slab.depth);
+
+    if (options.precomputeGradients) gradientEngine->addSlices(slab.data, slab.depth);
+}
+
+void VolumeLoadJob::halveSlab(const VolumeSlab& slab)
+{
+    const auto start = std::chrono::steady_clock::now();
+    const ivec3 size(residentDimensions.x, residentDimensions.y, slab.depth);
+    const ivec3 halved = VolumePyramid::GetHalvedDimensions(size);
+    const int zOffset = slab.zOffset / 2;
+
+    // the last slice of an odd depth is dropped, like the full volume drops it
+    if (zOffset + halved.z > halvedLevel.dimensions.z) return;
+
+    const size_t halvedSliceBytes = static_cast<size_t>(halved.x) * halved.y * GetVoxelSize(getVoxelType());
+    VolumePyramid::Downsample(slab.data, getVoxelType(), size, options.pyramidFilter,
+                              halvedLevel.voxels.data() + zOffset * halvedSliceBytes);
+    halvedLevel.seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+bool VolumeLoadJob::finishDerivedData()
+{
+    if (!derivedDataCached && options.precomputeGradients) computedGradients = gradientEngine->finish();
+
+    if (lightVolume) lightVolume->finish();
+
+    return !cancelled;
+}
+
+bool VolumeLoadJob::chooseWindow(const std::function<bool(int, uint8_t*)>& readSlice)
+{
+    const uint8_t* data;
+    size_t bytes;
+
+    // window of a previous load, the cached gradients were computed with it
+    if (derivedData && derivedData->getSection(VolumeCache::WindowSection, data, bytes) && bytes == 2 * sizeof(uint16_t))
+    {
+        uint16_t bounds[2];
+        memcpy(bounds, data, sizeof(bounds));
+        window = WindowLevel(bounds[0], bounds[1]);
+        return true;
+    }
+
+    // slices are converted as they stream in, so the window comes from a sample of the volume
+    HistogramEngine histogram(VoxelType::UInt16, 65536);
+    std::vector<uint8_t> slice(sourceSliceBytes);
+    const int samples = min(dimensions.z, WindowSampleSlices);
+
+    for (int i = 0; i < samples && !cancelled; i++)
+    {
+        // middle slice of equally thick ranges
+        if (!readSlice((2 * i + 1) * dimensions.z / (2 * samples), slice.data())) return false;
+
+        histogram.accumulate(slice.data(), sourceSliceBytes / sizeof(uint16_t));
+    }
+
+    window = WindowLevel::FromPercentiles(histogram.getCounts().data(), options.windowPercentiles.x, options.windowPercentiles.y);
+
+    return true;
+}
+
+void VolumeLoadJob::accumulateStatistics(const VolumeSlab& slab)
+{
+    // rereads keep the statistics of the first load
+    if (!options.uploadSlabs) return;
+
+    const auto start = std::chrono::steady_clock::now();
+    statistics.accumulate(slab, getVoxelType());
+    histogramSeconds = histogramSeconds + std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    histogramBytes += slab.bytes;
+}
+
+VolumeSlab VolumeLoadJob::convertSlab(const VolumeSlab& slab)
+{
+    ThreadPool& pool = ThreadPool::instance();
+    const int parts = static_cast<int>(pool.getThreadCount());
+    const size_t count = slab.bytes / sizeof(uint16_t);
+    // parts start at multiples of the widest kernel's vector and together cover the whole slab
+    const size_t partCount = ((count + parts - 1) / parts + 31) / 32 * 32;
+    auto source = reinterpret_cast<const uint16_t*>(slab.data);
+
+    convertedSlab.resize(count);
+    fullHistogram.resize(65536, 0);
+    partHistograms.resize(parts, std::vector<uint32_t>(65536));
+
+    // each thread counts into its own histogram
+    pool.parallelFor(0, parts, [this, source, count, partCount](int part)
+    {
+        const size_t begin = min(count, part * partCount);
+        const size_t end = min(count, begin + partCount);
+        auto& histogram = partHistograms[part];
+        std::fill(histogram.begin(), histogram.end(), 0);
+        window.convert(source + begin, convertedSlab.data() + begin, end - begin, histogram.data());
+    });
+
+    for (const auto& histogram : partHistograms)
+    {
+        for (size_t i = 0; i < histogram.size(); i++) { fullHistogram[i] += histogram[i]; }
+    }
+
+    VolumeSlab converted = slab;
+    converted.data = convertedSlab.data();
+    converted.bytes = count;
+
+    return converted;
+}
+
+VolumeSlab VolumeLoadJob::reduceSlab(const VolumeSlab& slab)
+{
+    const VoxelType type = getVoxelType();
+    const uint8_t* source = slab.data;
+    ivec3 size(dimensions.x, dimensions.y, slab.depth);
+
+    // slabs start at multiples of the reduced block, so each one is halved on its own
+    for (int i = 0; i < level; i++)
+    {
+        const ivec3 halved = VolumePyramid::GetHalvedDimensions(size);
+        auto& reduced = reducedSlabs[i % 2];
+        reduced.resize(static_cast<size_t>(halved.x) * halved.y * halved.z * GetVoxelSize(type));
+        VolumePyramid::Downsample(source, type, size, options.downsampleFilter, reduced.data());
+        source = reduced.data();
+        size = halved;
+    }
+
+    VolumeSlab reduced = slab;
+    reduced.zOffset = slab.zOffset >> level;
+    // a short last slab may only hold slices past the rounded down depth
+    reduced.depth = max(min(size.z, residentDimensions.z - reduced.zOffset), 0);
+    reduced.data = source;
+    reduced.bytes = reduced.depth * sliceBytes;
+
+    return reduced;
+}
+
+VolumeSlab VolumeLoadJob::residentSlab(const VolumeSlab& slab)
+{
+    const VolumeSlab converted = converting ? convertSlab(slab) : slab;
+
+    return level > 0 ? reduceSlab(converted) : converted;
+}
+
+void VolumeLoadJob::initializeSizes()
+{
+    // only 16 bits sources are windowed, floats are kept at full precision
+    converting = voxelType == VoxelType::UInt16 && options.convertTo8Bits;
+    sourceSliceBytes = static_cast<size_t>(dimensions.x) * dimensions.y * GetVoxelSize(voxelType);
+    totalBytes = sourceSliceBytes * dimensions.z;
+
+    // the volume and gradient textures have to fit the resident budget
+    const size_t voxelBytes = GetVoxelSize(getVoxelType()) + (options.precomputeGradients ?
+                              GradientEngine::GetEncodedSize(options.gradientSettings.encoding) : 0);
+    residentDimensions = dimensions;
+    level = 0;
+
+    // rereads reduce like the load they derive data for
+    while (options.residentLevel >= 0 ? level < options.residentLevel :
+           static_cast<size_t>(residentDimensions.x) * residentDimensions.y * residentDimensions.z * voxelBytes >
+           options.residentMemoryBudget && residentDimensions != ivec3(1))
+    {
+        residentDimensions = VolumePyramid::GetHalvedDimensions(residentDimensions);
+        level++;
+    }
+
+    // rounded down dimensions stretch the voxels, so the volume keeps the extent of the source
+    const float sourceSize = static_cast<float>(max(dimensions.x, max(dimensions.y, dimensions.z)));
+    const float residentSize = static_cast<float>(max(residentDimensions.x, max(residentDimensions.y,
+                                                                                residentDimensions.z)));
+    residentRatios = level > 0 ? ratios * vec3(dimensions) / vec3(residentDimensions) * (residentSize / sourceSize) :
+                                 ratios;
+    sliceBytes = static_cast<size_t>(residentDimensions.x) * residentDimensions.y * GetVoxelSize(getVoxelType());
+    gradientEngine = std::make_unique<GradientEngine>(options.gradientSettings, options.hostMemoryBudget);
+}
+
+int VolumeLoadJob::computeSlabDepth() const
+{
+    const size_t voxelSize = GetVoxelSize(voxelType);
+    // converting keeps a half sized slab besides the two source slabs, reducing the slabs of each level
+    const size_t budget = converting || level > 0 ? options.hostMemoryBudget * 4 / 5 : options.hostMemoryBudget;
+    const int depth = VolumeSlabStream::SlabDepthForBudget(dimensions, voxelSize, budget);
+    // halving pairs the resident slices of each slab
+    const int block = 1 << (options.halveResident ? level + 1 : level);
+
+    return max(depth / block, 1) * block;
+}
+
+bool VolumeLoadJob::handOver(const VolumeSlab& slab)
+{
+    // nothing left to upload in slices dropped by a reduction
+    if (slab.depth == 0) return !cancelled;
+
+    if (!options.uploadSlabs)
+    {
+        addDerivedData(slab);
+        bytesUploaded = min(bytesUploaded + (slab.depth * sourceSliceBytes << level), totalBytes);
+
+        return !cancelled;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        readySlab = slab;
+        readySlices = 0;
+        hasReadySlab = true;
+    }
+
+    // the rendering thread uploads the slab meanwhile
+    addDerivedData(slab);
+
+    std::unique_lock<std::mutex> lock(mutex);
+    slabUploaded.wait(lock, [this] { return !hasReadySlab || cancelled; });
+
+    return !cancelled;
+}
+
+void VolumeLoadJob::fail(const std::string& message)
+{
+    error = message;
+    stage = Stage::Failed;
+}
+
+void VolumeLoadJob::cancel()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        cancelled = true;
+    }
+
+    slabUploaded.notify_all();
+    // the engine stops at the next slice
+    if (gradientEngine) gradientEngine->cancel();
+
+    if (isActive()) stage = Stage::Cancelled;
+}
+
+void VolumeLoadJob::complete()
+{
+    stage = Stage::Done;
+}
+
+bool VolumeLoadJob::pendingUpload(VolumeSlab& slab) const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+
+    if (!hasReadySlab || cancelled) return false;
+
+    slab = readySlab;
+    slab.zOffset += readySlices;
+    slab.depth -= readySlices;
+    slab.data += readySlices * sliceBytes;
+    slab.bytes = slab.depth * sliceBytes;
+
+    return true;
+}
+
+void VolumeLoadJob::uploaded(int slices)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        if (!hasReadySlab) return;
+
+        slices = min(slices, readySlab.depth - readySlices);
+        readySlices += slices;
+        // progress is measured in source bytes
+        bytesUploaded = min(bytesUploaded + (slices * sourceSliceBytes << level), totalBytes);
+
+        // source slices beyond the last whole block were dropped by the reduction
+        if (readySlab.zOffset + readySlices == residentDimensions.z) bytesUploaded = totalBytes;
+
+        // whole slab uploaded, worker can proceed
+        if (readySlices < readySlab.depth) return;
+
+        hasReadySlab = false;
+    }
+
+    slabUploaded.notify_all();
+}
+
+bool VolumeLoadJob::isActive() const
+{
+    const Stage current = stage;
+
+    return current == Stage::Reading || current == Stage::Uploading || current == Stage::Preprocessing ||
+           current == Stage::Ready;
+}
+
+VolumeLoadJob::Stage VolumeLoadJob::getStage() const
+{
+    return stage;
+}
+
+const char* VolumeLoadJob::getStageName() const
+{
+    switch (stage.load())
+    {
+    case Stage::Reading: return "Reading";
+    case Stage::Uploading: return "Uploading";
+    case Stage::Preprocessing: return "Preprocessing";
+    case Stage::Ready: return "Ready";
+    case Stage::Done: return "Done";
+    case Stage::Cancelled: return "Cancelled";
+    case Stage::Failed: return "Failed";
+    }
+
+    return "";
+}
+
+const std::string& VolumeLoadJob::getError() const
+{
+    return error;
+}
+
+const std::string& VolumeLoadJob::getFilepath() const
+{
+    return filepath;
+}
+
+size_t VolumeLoadJob::getBytesRead() const
+{
+    return bytesRead;
+}
+
+size_t VolumeLoadJob::getBytesUploaded() const
+{
+    return bytesUploaded;
+}
+
+size_t VolumeLoadJob::getTotalBytes() const
+{
+    return totalBytes;
+}
+
+double VolumeLoadJob::getHistogramThroughput() const
+{
+    const double seconds = histogramSeconds;
+
+    return seconds > 0 ? histogramBytes / seconds : 0;
+}
+
+double VolumeLoadJob::getDecodeThroughput() const
+{
+    const double seconds = decodeSeconds;
+
+    return seconds > 0 ? bytesRead / seconds : 0;
+}
+
+const ivec3& VolumeLoadJob::getDimensions() const
+{
+    return residentDimensions;
+}
+
+const ivec3& VolumeLoadJob::getSourceDimensions() const
+{
+    return dimensions;
+}
+
+int VolumeLoadJob::getLevel() const
+{
+    return level;
+}
+
+const vec3& VolumeLoadJob::getRatios() const
+{
+    return residentRatios;
+}
+
+VoxelType VolumeLoadJob::getVoxelType() const
+{
+    return converting ? VoxelType::UInt8 : voxelType;
+}
+
+VoxelType VolumeLoadJob::getSourceVoxelType() const
+{
+    return voxelType;
+}
+
+bool VolumeLoadJob::isConverted() const
+{
+    return converting;
+}
+
+const WindowLevel& VolumeLoadJob::getWindow() const
+{
+    return window;
+}
+
+vec2 VolumeLoadJob::getClippedPercentages() const
+{
+    uint64_t total = 0, below = 0, above = 0;
+
+    for (size_t i = 0; i < fullHistogram.size(); i++)
+    {
+        total += fullHistogram[i];
+
+        if (i < window.getLow()) below += fullHistogram[i];
+        else if (i > window.getHigh()) above += fullHistogram[i];
+    }
+
+    if (total == 0) return vec2(0);
+
+    return vec2(below, above) * 100.0f / static_cast<float>(total);
+}
+
+const VolumeStatistics& VolumeLoadJob::getStatistics() const
+{
+    return statistics;
+}
+
+const VolumeLoadOptions& VolumeLoadJob::getOptions() const
+{
+    return options;
+}
+
+const VolumeCacheKey& VolumeLoadJob::getCacheKey() const
+{
+    return cacheKey;
+}
+
+const std::shared_ptr<VolumeCache>& VolumeLoadJob::getDerivedData() const
+{
+    return derivedData;
+}
+
+bool VolumeLoadJob::isDerivedDataCached() const
+{
+    return derivedDataCached;
+}
+
+const std::shared_ptr<OccupancyGrid>& VolumeLoadJob::getOccupancyGrid() const
+{
+    return occupancyGrid;
+}
+
+const uint8_t* VolumeLoadJob::getGradients() const
+{
+    if (!options.precomputeGradients) return nullptr;
+
+    return derivedDataCached ? cachedGradients : computedGradients.data();
+}
+
+std::vector<uint8_t> VolumeLoadJob::takeGradients()
+{
+    return move(computedGradients);
+}
+
+const std::shared_ptr<LightVolume>& VolumeLoadJob::getLightVolume() const
+{
+    return lightVolume;
+}
+
+VolumePyramid::Level VolumeLoadJob::takeHalvedLevel()
+{
+    return std::move(halvedLevel);
+}
+
+const GradientEngine::Timings& VolumeLoadJob::getGradientTimings() const
+{
+    return gradientEngine->getTimings();
+}
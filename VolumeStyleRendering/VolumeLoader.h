@@ -0,0 +1,429 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "VolumeStream.h"
+#include "VolumeCache.h"
+#include "GradientEngine.h"
+#include "WindowLevel.h"
+#include "VolumePyramid.h"
+
+class MappedFile;
+class BrickedVolume;
+class OccupancyGrid;
+class LightVolume;
+class ImageStack;
+class CompressedVolume;
+
+/**
+ * \brief Settings applied while a volume is loaded
+ */
+struct VolumeLoadOptions
+{
+    // maximum amount of volume data kept in host memory, the slabs in flight and the slices the
+    // gradients are smoothed in each stay within it
+    size_t hostMemoryBudget;
+    // 16 bits volumes are windowed down to 8 bits, halving the resident size
+    bool convertTo8Bits;
+    // percentiles of the 16 bits values mapped to 0 and 255
+    glm::vec2 windowPercentiles;
+    // gradients are prepared with these settings, cached gradients have to match them
+    GradientEngine::Settings gradientSettings;
+    // the gradient texture is skipped when normals are computed while rendering
+    bool precomputeGradients;
+    // maximum size of the volume and gradient textures, larger volumes are halved while reading until they fit
+    size_t residentMemoryBudget;
+    // how the voxels of volumes over the resident budget are reduced
+    VolumePyramid::Filter downsampleFilter;
+    // times the volume is halved while reading, picked from the resident budget if negative
+    int residentLevel;
+    // light volume cells per resident voxel along each axis, the cells are averaged from the slabs. No
+    // light volume if zero
+    float lightVolumeScale;
+    // the first pyramid level is halved from the resident slabs with the pyramid filter
+    bool halveResident;
+    VolumePyramid::Filter pyramidFilter;
+    // rereads for derived data only don't hand their slabs for upload
+    bool uploadSlabs;
+
+    VolumeLoadOptions();
+};
+
+/**
+ * \brief Loads a raw volume, compressed raw volume, bricked volume or image stack on a background thread. The worker reads the volume slab by slab and
+ * does the CPU-side preprocessing, each processed slab is handed to the rendering thread for its
+ * upload and the worker only continues once the slab has been uploaded, so host memory stays
+ * bounded to two slabs. While a slab is uploaded its gradients and brick ranges are computed, so
+ * the derived data never needs the volume back from the GPU
+ */
+class VolumeLoadJob
+{
+public:
+    enum class Stage
+    {
+        Reading,
+        Uploading,
+        Preprocessing,
+        // derived data prepared, waiting to be swapped in
+        Ready,
+        Done,
+        Cancelled,
+        Failed
+    };
+
+    /**
+     * \brief Starts loading the given raw volume in the background
+     * \param dimensions The volume dimensions
+     * \param ratios The volume aspect ratios
+     * \param filepath The volume's raw data filepath, gz and zst files are decompressed while loading
+     * \param voxelType The volume voxel type
+     * \param options The load settings
+     */
+    VolumeLoadJob(const glm::ivec3& dimensions, const glm::vec3& ratios, const std::string& filepath,
+                  VoxelType voxelType, const VolumeLoadOptions& options);
+    /**
+     * \brief Starts loading the given bricked volume or image stack directory in the background,
+     * the volume parameters are read from the bricked volume header or the slice images
+     * \param filepath The bricked volume filepath or the slices directory
+     * \param options The load settings
+     */
+    VolumeLoadJob(const std::string& filepath, const VolumeLoadOptions& options);
+    ~VolumeLoadJob();
+
+    VolumeLoadJob(const VolumeLoadJob&) = delete;
+    VolumeLoadJob& operator=(const VolumeLoadJob&) = delete;
+
+    /**
+     * \brief Starts reading the same volume again for derived data that wasn't kept, at the
+     * resolution and conversion of this load and without handing the slabs for upload
+     * \param options The load settings, only their gradient, pyramid and light volume settings are used
+     * \return The new job, ready once the derived data is complete
+     */
+    std::shared_ptr<VolumeLoadJob> reread(const VolumeLoadOptions& options) const;
+
+    /**
+     * \brief Stops the background work as soon as possible
+     */
+    void cancel();
+    /**
+     * \brief Marks the load as finished once the rendering thread swapped the new volume in
+     */
+    void complete();
+    /**
+     * \brief Returns the part of the current slab that hasn't been uploaded yet
+     * \param slab Receives the pending slab range
+     * \return False if there's no slab waiting for upload
+     */
+    bool pendingUpload(VolumeSlab& slab) const;
+    /**
+     * \brief Notifies that the given number of slices of the pending slab were uploaded, once
+     * the whole slab is uploaded the worker proceeds with the next one
+     * \param slices Number of uploaded slices
+     */
+    void uploaded(int slices);
+    /**
+     * \brief Determines if the job is still running or waiting to be swapped in
+     * \return False once the job is done, cancelled or failed
+     */
+    bool isActive() const;
+
+    Stage getStage() const;
+    const char* getStageName() const;
+    const std::string &getError() const;
+    const std::string &getFilepath() const;
+    size_t getBytesRead() const;
+    size_t getBytesUploaded() const;
+    size_t getTotalBytes() const;
+    /**
+     * \brief Decoded bytes per second while loading an image stack or a compressed raw volume
+     * \return The decode throughput, zero for other inputs
+     */
+    double getDecodeThroughput() const;
+    /**
+     * \brief Bytes per second counted by the histogram engine while accumulating the statistics
+     * \return The histogram throughput, zero if the statistics came from metadata or the cache
+     */
+    double getHistogramThroughput() const;
+    /**
+     * \brief Dimensions of the volume handed for upload
+     * \return The source dimensions, halved for each level the volume is reduced by
+     */
+    const glm::ivec3 &getDimensions() const;
+    /**
+     * \brief Dimensions of the volume in the volume files
+     * \return The source dimensions
+     */
+    const glm::ivec3 &getSourceDimensions() const;
+    /**
+     * \brief Number of times the volume is halved while reading so it fits the resident memory budget
+     * \return The level, zero for the full resolution
+     */
+    int getLevel() const;
+    /**
+     * \brief Aspect ratios of the uploaded voxels, reduced volumes keep the extent of the source
+     * \return The volume aspect ratios
+     */
+    const glm::vec3 &getRatios() const;
+    const VolumeLoadOptions &getOptions() const;
+    /**
+     * \brief Type of the voxels handed for upload
+     * \return The source voxel type, 8 bits if the source is converted
+     */
+    VoxelType getVoxelType() const;
+    /**
+     * \brief Type of the voxels in the volume files
+     * \return The source voxel type
+     */
+    VoxelType getSourceVoxelType() const;
+    /**
+     * \brief Determines if the 16 bits source is windowed down to 8 bits
+     * \return True if the volume is converted
+     */
+    bool isConverted() const;
+    /**
+     * \brief Window the 16 bits source is mapped to 8 bits with
+     * \return The conversion window
+     */
+    const WindowLevel &getWindow() const;
+    /**
+     * \brief Percentages of voxels clipped below and above the conversion window, from the
+     * full 16 bits histogram counted while converting
+     * \return Clipped percentages at the low and high end
+     */
+    glm::vec2 getClippedPercentages() const;
+    const VolumeStatistics &getStatistics() const;
+    /**
+     * \brief Key identifying the loaded volume, known once the worker started reading
+     * \return The derived data cache key
+     */
+    const VolumeCacheKey &getCacheKey() const;
+    /**
+     * \brief Data derived from a previous load of the same volume
+     * \return The sidecar cache, null if there's no valid cache for this volume
+     */
+    const std::shared_ptr<VolumeCache> &getDerivedData() const;
+    /**
+     * \brief Determines if the gradients and brick ranges were restored from the derived data
+     * \return False if they were computed while loading
+     */
+    bool isDerivedDataCached() const;
+    /**
+     * \brief Brick ranges of the resident volume, complete once the job is ready
+     * \return The occupancy grid
+     */
+    const std::shared_ptr<OccupancyGrid> &getOccupancyGrid() const;
+    /**
+     * \brief Encoded gradients of the resident volume, complete once the job is ready
+     * \return The gradients in the encoding of the options, null if they aren't precomputed
+     */
+    const uint8_t* getGradients() const;
+    /**
+     * \brief Moves the gradients computed while loading out of the job, for the derived data cache
+     * \return The encoded gradients, empty if they were restored or aren't precomputed
+     */
+    std::vector<uint8_t> takeGradients();
+    /**
+     * \brief Cell averages of the resident volume, complete once the job is ready. The light
+     * itself is propagated by the caller
+     * \return The light volume, null if the options have no light volume scale
+     */
+    const std::shared_ptr<LightVolume> &getLightVolume() const;
+    /**
+     * \brief Moves the first pyramid level halved from the slabs out of the job, complete once the
+     * job is ready
+     * \return The level without gradients, empty if it wasn't requested or the volume has no
+     * coarser levels
+     */
+    VolumePyramid::Level takeHalvedLevel();
+    /**
+     * \brief Time the gradient engine spent on the slabs
+     * \return The gradient timings, zero if the gradients were restored
+     */
+    const GradientEngine::Timings &getGradientTimings() const;
+private:
+    // load parameters
+    glm::ivec3 dimensions;
+    glm::vec3 ratios;
+    // resolution handed for upload
+    glm::ivec3 residentDimensions;
+    glm::vec3 residentRatios;
+    int level;
+    std::string filepath;
+    // parameters read from a bricked volume header or the slice images
+    bool described;
+    VoxelType voxelType;
+    VolumeLoadOptions options;
+    // bytes per slice as uploaded and as read from the source
+    size_t sliceBytes;
+    size_t sourceSliceBytes;
+    size_t totalBytes;
+
+    // progress
+    std::atomic<Stage> stage;
+    std::atomic<size_t> bytesRead;
+    std::atomic<size_t> bytesUploaded;
+    std::atomic<bool> cancelled;
+    std::atomic<double> decodeSeconds;
+    std::atomic<double> histogramSeconds;
+    std::atomic<size_t> histogramBytes;
+    std::string error;
+
+    // slab handed to the rendering thread
+    mutable std::mutex mutex;
+    std::condition_variable slabUploaded;
+    VolumeSlab readySlab;
+    int readySlices;
+    bool hasReadySlab;
+
+    std::unique_ptr<MappedFile> file;
+    std::unique_ptr<BrickedVolume> bricked;
+    std::unique_ptr<ImageStack> imageStack;
+    std::unique_ptr<CompressedVolume> compressed;
+    VolumeStatistics statistics;
+    VolumeCacheKey cacheKey;
+    std::shared_ptr<VolumeCache> derivedData;
+
+    // gradients and brick ranges, from the cache or computed from the slabs as they are uploaded
+    bool derivedDataCached;
+    std::unique_ptr<GradientEngine> gradientEngine;
+    std::shared_ptr<OccupancyGrid> occupancyGrid;
+    const uint8_t* cachedGradients;
+    std::vector<uint8_t> computedGradients;
+    // cell averages and the first pyramid level aren't cached, they're always taken from the slabs
+    std::shared_ptr<LightVolume> lightVolume;
+    VolumePyramid::Level halvedLevel;
+
+    // 16 to 8 bits conversion
+    bool converting;
+    WindowLevel window;
+    std::vector<uint8_t> convertedSlab;
+    std::vector<std::vector<uint32_t>> partHistograms;
+    std::vector<uint64_t> fullHistogram;
+
+    // halved slabs of each level
+    std::vector<uint8_t> reducedSlabs[2];
+
+    std::thread worker;
+
+    /**
+     * \brief Background work for raw volumes, streams the volume and waits for each slab upload
+     */
+    void runRaw();
+    /**
+     * \brief Background work for bricked volumes, assembles the bricks of each slab and waits
+     * for its upload. Statistics are taken from the brick metadata
+     */
+    void runBricked();
+    /**
+     * \brief Background work for image stacks, decodes the slices of the next slab in parallel
+     * while the current one is uploaded
+     */
+    void runImageStack();
+    /**
+     * \brief Background work for compressed raw volumes, decompresses the next slab in parallel
+     * while the current one is uploaded
+     */
+    void runCompressed();
+    /**
+     * \brief Common work of the decoded inputs, decodes the next slab on another thread while
+     * the current one is processed and uploaded
+     * \param decodeSlices Decodes the given range of slices into the given buffer
+     * \param decodeError Describes why decoding failed
+     * \param cachedStatistics True if the statistics were restored from the derived data
+     */
+    void runDecoded(const std::function<bool(int, int, uint8_t*)>& decodeSlices,
+                    const std::function<std::string()>& decodeError, bool cachedStatistics);
+    /**
+     * \brief Opens the sidecar cache of the volume and restores the statistics from it
+     * \param files The volume source files
+     * \return True if the statistics were restored and don't need to be accumulated
+     */
+    bool openDerivedData(const std::vector<std::string>& files);
+    /**
+     * \brief Takes the gradients and brick ranges of the resident volume from the derived data
+     * \return False if the cache has no gradients or brick ranges matching the load options
+     */
+    bool restoreDerivedData();
+    /**
+     * \brief Determines if the derived data needs the slabs of the volume
+     * \return False for rereads whose derived data was restored from the cache
+     */
+    bool needsSlabs() const;
+    /**
+     * \brief Adds a resident slab to the gradients, brick ranges, light volume cells and first
+     * pyramid level computed while loading
+     * \param slab The slab as handed for upload
+     */
+    void addDerivedData(const VolumeSlab& slab);
+    /**
+     * \brief Halves a resident slab into the first pyramid level, slabs start at even slices
+     * \param slab The slab as handed for upload
+     */
+    void halveSlab(const VolumeSlab& slab);
+    /**
+     * \brief Encodes the gradients of the last slices once every slab was added
+     * \return False if the job was cancelled meanwhile
+     */
+    bool finishDerivedData();
+    /**
+     * \brief Picks the conversion window from the percentiles of evenly spaced sample slices, or
+     * reuses the window of the derived data so cached gradients stay valid
+     * \param readSlice Reads the 16 bits slice at the given z into the given buffer
+     * \return False if a slice couldn't be read
+     */
+    bool chooseWindow(const std::function<bool(int, uint8_t*)>& readSlice);
+    /**
+     * \brief Adds the resident slab to the statistics, timing the histogram engine
+     * \param slab The slab as handed for upload
+     */
+    void accumulateStatistics(const VolumeSlab& slab);
+    /**
+     * \brief Converts a 16 bits slab to 8 bits on the thread pool, counting the full 16 bits
+     * histogram in the same pass
+     * \param slab The 16 bits slab
+     * \return The converted slab, valid until the next conversion
+     */
+    VolumeSlab convertSlab(const VolumeSlab& slab);
+    /**
+     * \brief Halves a slab for each level the volume is reduced by, on the thread pool
+     * \param slab The slab as converted
+     * \return The reduced slab, valid until the next reduction. Its depth is zero if the slab
+     * only holds slices dropped by the rounded down dimensions
+     */
+    VolumeSlab reduceSlab(const VolumeSlab& slab);
+    /**
+     * \brief Converts and reduces a slab read from the source
+     * \param slab The source slab
+     * \return The slab to upload
+     */
+    VolumeSlab residentSlab(const VolumeSlab& slab);
+    /**
+     * \brief Sets the slice sizes and total size once the volume parameters are known, and picks
+     * the largest level fitting the resident memory budget
+     */
+    void initializeSizes();
+    /**
+     * \brief Thickness of the slabs so the slabs in flight fit the host memory budget, reduced
+     * and halved volumes read whole blocks of slices
+     * \return The slab depth in slices
+     */
+    int computeSlabDepth() const;
+    /**
+     * \brief Hands a processed slab to the rendering thread, adds it to the derived data and waits
+     * until it's uploaded
+     * \param slab The slab to upload
+     * \return False if the job was cancelled meanwhile
+     */
+    bool handOver(const VolumeSlab& slab);
+    /**
+     * \brief Stops the job with an error message
+     * \param message The error description
+     */
+    void fail(const std::string& message);
+};
@@ -0,0 +1,418 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <emmintrin.h>
+#include <immintrin.h>
+
+#include "VolumePyramid.h"
+#include "CpuFeatures.h"
+#include "ThreadPool.h"
+
+#if defined(__GNUC__)
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define TARGET_AVX2
+#endif
+
+using namespace glm;
+
+namespace
+{
+    /**
+     * \brief Seconds elapsed since the given time point
+     */
+    double secondsSince(const std::chrono::steady_clock::time_point& start)
+    {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    // larger of two values, picks the second one for nan like the max instructions
+    inline float maximum(float a, float b)
+    {
+        return a > b ? a : b;
+    }
+
+    /**
+     * \brief Reduces pairs of neighbouring columns of four rows, the rows of a 2x2x2 block's two
+     * slices, from the given output on. Each output averages or keeps the maximum of eight values,
+     * rows of a single voxel pair it with itself
+     */
+    template <typename T>
+    void reduceRowsFrom(const T* const* rows, int width, float* out, int begin, int count, bool maximumFilter)
+    {
+        for (int i = begin; i < count; i++)
+        {
+            const int x0 = i * 2;
+            const int x1 = std::min(x0 + 1, width - 1);
+            float values[8];
+
+            for (int k = 0; k < 4; k++)
+            {
+                values[k] = static_cast<float>(rows[k][x0]);
+                values[k + 4] = static_cast<float>(rows[k][x1]);
+            }
+
+            if (maximumFilter)
+            {
+                const float a = maximum(maximum(values[0], values[1]), maximum(values[2], values[3]));
+                const float b = maximum(maximum(values[4], values[5]), maximum(values[6], values[7]));
+                out[i] = maximum(a, b);
+            }
+            else
+            {
+                const float a = (values[0] + values[1]) + (values[2] + values[3]);
+                const float b = (values[4] + values[5]) + (values[6] + values[7]);
+                out[i] = (a + b) * 0.125f;
+            }
+        }
+    }
+
+    template <typename T>
+    void reduceRowsScalar(const T* const* rows, int width, float* out, int count, bool maximumFilter)
+    {
+        reduceRowsFrom(rows, width, out, 0, count, maximumFilter);
+    }
+
+    /**
+     * \brief Loads four voxels widened to floats
+     */
+    inline __m128 loadSse2(const uint8_t* voxels)
+    {
+        int bytes;
+        memcpy(&bytes, voxels, sizeof(bytes));
+        const __m128i zero = _mm_setzero_si128();
+
+        return _mm_cvtepi32_ps(_mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(bytes), zero), zero));
+    }
+
+    inline __m128 loadSse2(const uint16_t* voxels)
+    {
+        const __m128i words = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(voxels));
+
+        return _mm_cvtepi32_ps(_mm_unpacklo_epi16(words, _mm_setzero_si128()));
+    }
+
+    inline __m128 loadSse2(const float* voxels)
+    {
+        return _mm_loadu_ps(voxels);
+    }
+
+    template <bool Maximum>
+    inline __m128 combineSse2(__m128 a, __m128 b)
+    {
+        return Maximum ? _mm_max_ps(a, b) : _mm_add_ps(a, b);
+    }
+
+    template <bool Maximum, typename T>
+    inline __m128 loadCombinedSse2(const T* const* rows, int x)
+    {
+        return combineSse2<Maximum>(combineSse2<Maximum>(loadSse2(rows[0] + x), loadSse2(rows[1] + x)),
+                                    combineSse2<Maximum>(loadSse2(rows[2] + x), loadSse2(rows[3] + x)));
+    }
+
+    /**
+     * \brief Four outputs per iteration, the even and odd columns are split with shuffles
+     */
+    template <bool Maximum, typename T>
+    void reduceRowsSse2Filter(const T* const* rows, int width, float* out, int count)
+    {
+        const __m128 scale = _mm_set1_ps(0.125f);
+        int i = 0;
+
+        for (; i + 4 <= count && (i + 4) * 2 <= width; i += 4)
+        {
+            const __m128 low = loadCombinedSse2<Maximum>(rows, i * 2);
+            const __m128 high = loadCombinedSse2<Maximum>(rows, i * 2 + 4);
+            const __m128 even = _mm_shuffle_ps(low, high, _MM_SHUFFLE(2, 0, 2, 0));
+            const __m128 odd = _mm_shuffle_ps(low, high, _MM_SHUFFLE(3, 1, 3, 1));
+            const __m128 result = combineSse2<Maximum>(even, odd);
+            _mm_storeu_ps(out + i, Maximum ? result : _mm_mul_ps(result, scale));
+        }
+
+        reduceRowsFrom(rows, width, out, i, count, Maximum);
+    }
+
+    template <typename T>
+    void reduceRowsSse2(const T* const* rows, int width, float* out, int count, bool maximumFilter)
+    {
+        if (maximumFilter) reduceRowsSse2Filter<true>(rows, width, out, count);
+        else reduceRowsSse2Filter<false>(rows, width, out, count);
+    }
+
+    /**
+     * \brief Loads eight voxels widened to floats
+     */
+    TARGET_AVX2 inline __m256 loadAvx2(const uint8_t* voxels)
+    {
+        const __m128i bytes = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(voxels));
+
+        return _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(bytes));
+    }
+
+    TARGET_AVX2 inline __m256 loadAvx2(const uint16_t* voxels)
+    {
+        const __m128i words = _mm_loadu_si128(reinterpret_cast<const __m128i*>(voxels));
+
+        return _mm256_cvtepi32_ps(_mm256_cvtepu16_epi32(words));
+    }
+
+    TARGET_AVX2 inline __m256 loadAvx2(const float* voxels)
+    {
+        return _mm256_loadu_ps(voxels);
+    }
+
+    template <bool Maximum>
+    TARGET_AVX2 inline __m256 combineAvx2(__m256 a, __m256 b)
+    {
+        return Maximum ? _mm256_max_ps(a, b) : _mm256_add_ps(a, b);
+    }
+
+    template <bool Maximum, typename T>
+    TARGET_AVX2 inline __m256 loadCombinedAvx2(const T* const* rows, int x)
+    {
+        return combineAvx2<Maximum>(combineAvx2<Maximum>(loadAvx2(rows[0] + x), loadAvx2(rows[1] + x)),
+                                    combineAvx2<Maximum>(loadAvx2(rows[2] + x), loadAvx2(rows[3] + x)));
+    }
+
+    template <bool Maximum, typename T>
+    TARGET_AVX2 void reduceRowsAvx2Filter(const T* const* rows, int width, float* out, int count)
+    {
+        const __m256 scale = _mm256_set1_ps(0.125f);
+        int i = 0;
+
+        for (; i + 8 <= count && (i + 8) * 2 <= width; i += 8)
+        {
+            const __m256 low = loadCombinedAvx2<Maximum>(rows, i * 2);
+            const __m256 high = loadCombinedAvx2<Maximum>(rows, i * 2 + 8);
+            // shuffles work per 128 bits lane, reorder the quadwords afterwards
+            const __m256 even = _mm256_castpd_ps(_mm256_permute4x64_pd(
+                _mm256_castps_pd(_mm256_shuffle_ps(low, high, _MM_SHUFFLE(2, 0, 2, 0))), 0xd8));
+            const __m256 odd = _mm256_castpd_ps(_mm256_permute4x64_pd(
+                _mm256_castps_pd(_mm256_shuffle_ps(low, high, _MM_SHUFFLE(3, 1, 3, 1))), 0xd8));
+            const __m256 result = combineAvx2<Maximum>(even, odd);
+            _mm256_storeu_ps(out + i, Maximum ? result : _mm256_mul_ps(result, scale));
+        }
+
+        reduceRowsFrom(rows, width, out, i, count, Maximum);
+    }
+
+    template <typename T>
+    TARGET_AVX2 void reduceRowsAvx2(const T* const* rows, int width, float* out, int count, bool maximumFilter)
+    {
+        if (maximumFilter) reduceRowsAvx2Filter<true>(rows, width, out, count);
+        else reduceRowsAvx2Filter<false>(rows, width, out, count);
+    }
+
+    enum class Kernel
+    {
+        Scalar,
+        Sse2,
+        Avx2
+    };
+
+    /**
+     * \brief Widest kernel supported by the processor, selected once
+     */
+    Kernel bestKernel()
+    {
+        static const Kernel kernel = CpuFeatures::HasAvx2() ? Kernel::Avx2 :
+                                     CpuFeatures::HasSse2() ? Kernel::Sse2 : Kernel::Scalar;
+        return kernel;
+    }
+
+    /**
+     * \brief Converts a reduced value back to the voxel type, averages of integers are rounded
+     */
+    template <typename T>
+    inline T fromFloat(float value)
+    {
+        return static_cast<T>(value + 0.5f);
+    }
+
+    template <>
+    inline float fromFloat<float>(float value)
+    {
+        return value;
+    }
+
+    /**
+     * \brief Reduces the blocks of a destination slice. The kernels widen the voxels to floats so
+     * every voxel type shares them, sums of eight 16 bits values are exact in floats
+     */
+    template <typename T>
+    void downsampleSlice(const T* source, const ivec3& dimensions, const ivec3& halved, int z,
+                         VolumePyramid::Filter filter, Kernel kernel, T* destination)
+    {
+        typedef void (*ReduceRows)(const T* const*, int, float*, int, bool);
+        const ReduceRows reduceRows = kernel == Kernel::Avx2 ? reduceRowsAvx2<T> :
+                                      kernel == Kernel::Sse2 ? reduceRowsSse2<T> : reduceRowsScalar<T>;
+        std::vector<float> out(halved.x);
+        const int slices[2] = { z * 2, std::min(z * 2 + 1, dimensions.z - 1) };
+
+        for (int y = 0; y < halved.y; y++)
+        {
+            // axes of a single voxel pair it with itself
+            const int lines[2] = { y * 2, std::min(y * 2 + 1, dimensions.y - 1) };
+            const T* rows[4];
+
+            for (int k = 0; k < 4; k++)
+            {
+                rows[k] = source + (static_cast<size_t>(slices[k / 2]) * dimensions.y + lines[k % 2]) * dimensions.x;
+            }
+
+            reduceRows(rows, dimensions.x, out.data(), halved.x, filter == VolumePyramid::Filter::Maximum);
+            T* target = destination + (static_cast<size_t>(z) * halved.y + y) * halved.x;
+
+            for (int x = 0; x < halved.x; x++) { target[x] = fromFloat<T>(out[x]); }
+        }
+    }
+
+    void downsample(const uint8_t* source, VoxelType type, const ivec3& dimensions, VolumePyramid::Filter filter,
+                    uint8_t* destination, Kernel kernel)
+    {
+        const ivec3 halved = VolumePyramid::GetHalvedDimensions(dimensions);
+
+        ThreadPool::instance().parallelFor(0, halved.z, [&](int z)
+        {
+            DispatchVoxelType(type, [&](auto tag)
+            {
+                using T = std::remove_pointer_t<decltype(tag)>;
+                downsampleSlice(reinterpret_cast<const T*>(source), dimensions, halved, z, filter, kernel,
+                                reinterpret_cast<T*>(destination));
+            });
+        });
+    }
+}
+
+const int VolumePyramid::MinSize;
+
+VolumePyramid::VolumePyramid(Filter filter) : filter(filter), voxelType(VoxelType::UInt8), cancelled(false) {}
+
+bool VolumePyramid::build(Level first, VoxelType type, const GradientEngine::Settings* gradientSettings)
+{
+    voxelType = type;
+    levels.clear();
+    levels.push_back(std::move(first));
+
+    while (!cancelled)
+    {
+        Level& last = levels.back();
+
+        if (gradientSettings)
+        {
+            // the smoothing footprint stays the same size in the volume
+            GradientEngine::Settings settings = *gradientSettings;
+            settings.radius = settings.radius >> static_cast<int>(levels.size());
+            GradientEngine engine(settings);
+            const auto start = std::chrono::steady_clock::now();
+
+            last.gradients = engine.compute(last.voxels.data(), type, last.dimensions);
+
+            last.gradientSeconds = secondsSince(start);
+        }
+
+        if (std::max(last.dimensions.x, std::max(last.dimensions.y, last.dimensions.z)) <= MinSize) break;
+
+        Level level;
+        level.dimensions = GetHalvedDimensions(last.dimensions);
+        level.gradientSeconds = 0;
+        const size_t count = static_cast<size_t>(level.dimensions.x) * level.dimensions.y * level.dimensions.z;
+
+        const auto start = std::chrono::steady_clock::now();
+        level.voxels.resize(count * GetVoxelSize(type));
+        Downsample(last.voxels.data(), type, last.dimensions, filter, level.voxels.data());
+        level.seconds = secondsSince(start);
+
+        levels.push_back(std::move(level));
+    }
+
+    return !cancelled;
+}
+
+void VolumePyramid::cancel()
+{
+    cancelled = true;
+}
+
+const std::vector<VolumePyramid::Level>& VolumePyramid::getLevels() const
+{
+    return levels;
+}
+
+VolumePyramid::Level VolumePyramid::takeFirstLevel()
+{
+    Level first = Level();
+
+    if (levels.empty()) return first;
+
+    first = std::move(levels.front());
+    first.gradients.clear();
+    first.gradientSeconds = 0;
+    levels.clear();
+
+    return first;
+}
+
+VolumePyramid::Filter VolumePyramid::getFilter() const
+{
+    return filter;
+}
+
+VoxelType VolumePyramid::getVoxelType() const
+{
+    return voxelType;
+}
+
+size_t VolumePyramid::getBytes() const
+{
+    size_t bytes = 0;
+
+    for (auto& level : levels) { bytes += level.voxels.size() + level.gradients.size(); }
+
+    return bytes;
+}
+
+void VolumePyramid::Downsample(const uint8_t* source, VoxelType type, const ivec3& dimensions, Filter filter,
+                               uint8_t* destination)
+{
+    downsample(source, type, dimensions, filter, destination, bestKernel());
+}
+
+void VolumePyramid::DownsampleScalar(const uint8_t* source, VoxelType type, const ivec3& dimensions,
+                                     Filter filter, uint8_t* destination)
+{
+    downsample(source, type, dimensions, filter, destination, Kernel::Scalar);
+}
+
+ivec3 VolumePyramid::GetHalvedDimensions(const ivec3& dimensions)
+{
+    return max(dimensions / 2, ivec3(1));
+}
+
+int VolumePyramid::GetLevelCount(const ivec3& dimensions)
+{
+    int count = 0;
+
+    for (ivec3 size = dimensions; std::max(size.x, std::max(size.y, size.z)) > MinSize; count++)
+    {
+        size = GetHalvedDimensions(size);
+    }
+
+    return count;
+}
+
+int VolumePyramid::SelectLevel(float voxelsPerPixel, float bias, int levels)
+{
+    // a level per doubling of the footprint, finer voxels than pixels gain nothing
+    const float level = std::floor(std::log2(std::max(voxelsPerPixel, 1.0f)) + bias);
+
+    return static_cast<int>(std::min(std::max(level, 0.0f), static_cast<float>(levels)));
+}
+
+const char* VolumePyramid::GetKernelName()
+{
+    const Kernel kernel = bestKernel();
+
+    return kernel == Kernel::Avx2 ? "AVX2" : kernel == Kernel::Sse2 ? "SSE2" : "scalar";
+}
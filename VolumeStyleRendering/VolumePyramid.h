@@ -0,0 +1,129 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <vector>
+#include <cinder/CinderGlm.h>
+
+#include "VoxelType.h"
+#include "GradientEngine.h"
+
+/**
+ * \brief Coarser copies of a volume, each level halves the previous one along every axis. Levels
+ * are reduced from the one before them by averaging or keeping the maximum of each 2x2x2 block,
+ * slices are split between the thread pool threads and the blocks are combined with SSE2 or AVX2
+ * when available. Gradients of each level are prepared from its own voxels, so coarse normals
+ * follow the coarse surfaces
+ */
+class VolumePyramid
+{
+public:
+    enum class Filter
+    {
+        // mean of each 2x2x2 block, smooth overviews
+        Average,
+        // largest value of each 2x2x2 block, thin bright features stay visible
+        Maximum
+    };
+
+    /**
+     * \brief A coarser copy of the volume
+     */
+    struct Level
+    {
+        glm::ivec3 dimensions;
+        // voxels of the volume type, tightly packed in x, y, z order
+        std::vector<uint8_t> voxels;
+        // encoded gradients, empty if the pyramid was built without them
+        std::vector<uint8_t> gradients;
+        // time spent reducing the voxels and preparing the gradients, in seconds
+        double seconds;
+        double gradientSeconds;
+    };
+
+    explicit VolumePyramid(Filter filter = Filter::Average);
+
+    /**
+     * \brief Builds the levels below a first level halved elsewhere, like while loading, down to
+     * MinSize voxels along the largest axis
+     * \param first The first level, its voxels are moved into the pyramid
+     * \param type Type of the voxels
+     * \param gradientSettings Settings the gradients of each level are prepared with, no
+     * gradients if null. The filter radius is halved with each level
+     * \return False if the build was cancelled
+     */
+    bool build(Level first, VoxelType type, const GradientEngine::Settings* gradientSettings = nullptr);
+    /**
+     * \brief Stops a build running on another thread after the current level
+     */
+    void cancel();
+
+    /**
+     * \brief The coarser levels, the first one halves the volume
+     * \return Levels from the finest to the coarsest
+     */
+    const std::vector<Level> &getLevels() const;
+    /**
+     * \brief Moves the first level out for a later build from the same voxels, the pyramid can't
+     * be drawn afterwards
+     * \return The first level without its gradients, empty if nothing was built
+     */
+    Level takeFirstLevel();
+    Filter getFilter() const;
+    VoxelType getVoxelType() const;
+    /**
+     * \brief Memory held by the levels' voxels and gradients
+     * \return The size in bytes
+     */
+    size_t getBytes() const;
+
+    /**
+     * \brief Reduces each 2x2x2 block of a volume to a single voxel with the widest kernel the
+     * processor supports. Dimensions are halved and rounded down like the mip levels of a texture,
+     * axes of a single voxel reduce it with itself
+     * \param source The voxels, tightly packed in x, y, z order
+     * \param type Type of the voxels
+     * \param dimensions The source dimensions
+     * \param filter How the blocks are reduced
+     * \param destination Receives GetHalvedDimensions(dimensions) voxels
+     */
+    static void Downsample(const uint8_t* source, VoxelType type, const glm::ivec3& dimensions, Filter filter,
+                           uint8_t* destination);
+    /**
+     * \brief Reduces using only scalar code, reference for the vectorized kernels
+     */
+    static void DownsampleScalar(const uint8_t* source, VoxelType type, const glm::ivec3& dimensions,
+                                 Filter filter, uint8_t* destination);
+    /**
+     * \brief Dimensions of a volume after one reduction
+     * \param dimensions The volume dimensions
+     * \return Half the dimensions rounded down, at least one voxel
+     */
+    static glm::ivec3 GetHalvedDimensions(const glm::ivec3& dimensions);
+    /**
+     * \brief Number of levels build makes for a volume
+     * \param dimensions The volume dimensions
+     * \return The level count, without the full resolution
+     */
+    static int GetLevelCount(const glm::ivec3& dimensions);
+    /**
+     * \brief Level whose voxels best match the screen footprint of the volume voxels
+     * \param voxelsPerPixel Full resolution voxels covered by a pixel
+     * \param bias Added to the level, positive values trade quality for speed
+     * \param levels Number of levels available besides the full resolution
+     * \return The level, zero for the full resolution
+     */
+    static int SelectLevel(float voxelsPerPixel, float bias, int levels);
+    /**
+     * \brief Name of the kernel Downsample uses on this processor
+     * \return AVX2, SSE2 or scalar
+     */
+    static const char* GetKernelName();
+
+    // levels stop once the largest axis reaches this many voxels
+    static const int MinSize = 16;
+private:
+    Filter filter;
+    VoxelType voxelType;
+    std::vector<Level> levels;
+    std::atomic<bool> cancelled;
+};
@@ -4,6 +4,7 @@
 #include <CinderImGui.h>
 
 #include "RaycastVolume.h"
+#include "HeadlessRender.h"
 #include "PostProcess.h"
 #include "VolumeRenderingAppUi.h"
 
@@ -31,6 +32,14 @@ private:
 
 void VolumeRenderingApp::prepareSettings(Settings* settings)
 {
+    // headless renders exit before the window and its GL context are created
+    if (HeadlessRender::IsRequested(settings->getCommandLineArgs()))
+    {
+        HeadlessRender::Options options;
+        std::exit(HeadlessRender::ParseArguments(settings->getCommandLineArgs(), options) ?
+                  HeadlessRender::Run(options) : 2);
+    }
+
     settings->setWindowSize(1280, 720);
 }
 
@@ -45,6 +54,7 @@ void VolumeRenderingApp::setup()
 
 void VolumeRenderingApp::update()
 {
+    volume.update();
     VolumeRenderingAppUi::DrawUi(volume);
 }
 
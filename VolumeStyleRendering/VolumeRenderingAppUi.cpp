@@ -1,13 +1,22 @@
+#include <future>
+#include <cinder/Log.h>
 #include <CinderImGui.h>
 
 #include "VolumeRenderingAppUi.h"
 #include "RaycastVolume.h"
+#include "VolumeLoader.h"
+#include "BrickedVolume.h"
+#include "BrickCache.h"
+#include "CompressedVolume.h"
 #include "StyleTransferFunctionUi.h"
 #include "RenderingParams.h"
+#include "ThreadPool.h"
 
 using namespace glm;
 
 bool VolumeRenderingAppUi::loadNewVolume = false;
+bool VolumeRenderingAppUi::volumeLoading = false;
+bool VolumeRenderingAppUi::convertVolume = false;
 bool VolumeRenderingAppUi::showVolumeOptions = false;
 bool VolumeRenderingAppUi::showRendering = false;
 bool VolumeRenderingAppUi::showTransferFunction = false;
@@ -35,6 +44,13 @@ void VolumeRenderingAppUi::DrawUi(RaycastVolume& volume)
         showVolumeOptions = isClosed;
     }
 
+    // open modal dialog for the bricked volume conversion
+    if (convertVolume)
+    {
+        ui::OpenPopup("Convert to Bricked");
+        convertVolume = !VolumeConvertPopup(volume);
+    }
+
     // initialize transfer function ui
     static std::shared_ptr<StyleTransferFunctionUi> transferFunctionUi = nullptr;
 
@@ -91,6 +107,13 @@ void VolumeRenderingAppUi::DrawRenderingOptions(RaycastVolume& volume)
             volume.setShadowStepScale(sStepScale);
         }
 
+        static bool preintegrated = volume.isPreintegrated();
+
+        if (ui::Checkbox("Pre-integrated Transfer Function", &preintegrated))
+        {
+            volume.setPreintegrated(preintegrated);
+        }
+
         if (ui::InputFloat3("Aspect", value_ptr(aspectRatios)))
         {
             volume.setAspectratios(aspectRatios);
@@ -108,6 +131,247 @@ void VolumeRenderingAppUi::DrawRenderingOptions(RaycastVolume& volume)
         
         ui::Checkbox("Show FPS", &showFps);
 
+        if (ui::TreeNode("Gradient Mode"))
+        {
+            static int mode = static_cast<int>(volume.getGradientMode());
+            bool changed = false;
+
+            // in RaycastVolume::GradientMode order
+            changed |= ui::RadioButton("Precomputed", &mode, 0);
+            ui::SameLine();
+            changed |= ui::RadioButton("Central", &mode, 1);
+            ui::SameLine();
+            changed |= ui::RadioButton("Forward", &mode, 2);
+
+            if (changed)
+            {
+                volume.setGradientMode(static_cast<RaycastVolume::GradientMode>(mode));
+            }
+
+            mode = static_cast<int>(volume.getGradientMode());
+            ui::Text("Raycast: %.2f ms", volume.getRaycastMilliseconds());
+
+            if (volume.isBenchmarkingGradientModes())
+            {
+                ui::Text("Benchmarking...");
+            }
+            else if (ui::Button("Benchmark Gradient Modes"))
+            {
+                volume.benchmarkGradientModes();
+            }
+
+            const char* names[] = { "Precomputed", "Central", "Forward" };
+
+            for (auto& result : volume.getGradientBenchmark())
+            {
+                const char* name = names[static_cast<int>(result.mode)];
+
+                if (!result.measured)
+                {
+                    ui::Text("%s: gradients not resident", name);
+                    continue;
+                }
+
+                ui::Text("%s: %.1f MB, %.2f ms", name, result.gradientBytes / (1024.0f * 1024.0f),
+                         result.milliseconds);
+            }
+
+            ui::TreePop();
+        }
+
+        if (ui::TreeNode("Volume Pyramid"))
+        {
+            static int filter = static_cast<int>(volume.getPyramidFilter());
+            static bool automatic = volume.getPyramidLevel() < 0;
+            static int level = max(volume.getPyramidLevel(), 0);
+            static float levelBias = volume.getLevelBias();
+            const auto& pyramid = volume.getPyramid();
+            const int levels = volume.getPyramidLevelCount();
+            bool filterChanged = false;
+
+            // in VolumePyramid::Filter order
+            filterChanged |= ui::RadioButton("Average", &filter, 0);
+            ui::SameLine();
+            filterChanged |= ui::RadioButton("Maximum", &filter, 1);
+
+            if (filterChanged)
+            {
+                volume.setPyramidFilter(static_cast<VolumePyramid::Filter>(filter));
+            }
+
+            if (ui::Checkbox("Level From Footprint", &automatic))
+            {
+                volume.setPyramidLevel(automatic ? -1 : level);
+            }
+
+            if (automatic)
+            {
+                if (ui::SliderFloat("Quality Bias", &levelBias, -1.0f, 3.0f))
+                {
+                    volume.setLevelBias(levelBias);
+                }
+            }
+            else if (ui::SliderInt("Level", &level, 0, levels))
+            {
+                volume.setPyramidLevel(level);
+            }
+
+            ui::Text("Drawn level: %d", volume.getDrawnLevel());
+
+            if (volume.getResidentLevel() > 0)
+            {
+                const ivec3& source = volume.getSourceDimensions();
+                ui::Text("Loaded %d levels below the %d x %d x %d source", volume.getResidentLevel(), source.x,
+                         source.y, source.z);
+            }
+
+            if (!pyramid)
+            {
+                ui::Text("Built once a coarser level is drawn");
+            }
+            else
+            {
+                for (size_t i = 0; i < pyramid->getLevels().size(); i++)
+                {
+                    const auto& entry = pyramid->getLevels()[i];
+                    ui::Text("Level %d: %d x %d x %d, %.1f MB, %.1f ms + %.1f ms gradients", static_cast<int>(i + 1),
+                             entry.dimensions.x, entry.dimensions.y, entry.dimensions.z,
+                             (entry.voxels.size() + entry.gradients.size()) / (1024.0f * 1024.0f),
+                             entry.seconds * 1000, entry.gradientSeconds * 1000);
+                }
+
+                ui::Text("Total: %.1f MB using the %s kernel", pyramid->getBytes() / (1024.0f * 1024.0f),
+                         VolumePyramid::GetKernelName());
+            }
+
+            ui::TreePop();
+        }
+
+        if (ui::TreeNode("Progressive Refinement"))
+        {
+            ProgressiveRefinement& refinement = volume.getProgressiveRefinement();
+            static bool progressive = refinement.isEnabled();
+            static int factor = refinement.getFactor();
+            bool factorChanged = false;
+
+            if (ui::Checkbox("Enable", &progressive))
+            {
+                refinement.setEnabled(progressive);
+            }
+
+            // pixels along each side of a coarse block
+            factorChanged |= ui::RadioButton("2x2", &factor, 2);
+            ui::SameLine();
+            factorChanged |= ui::RadioButton("4x4", &factor, 4);
+            ui::SameLine();
+            factorChanged |= ui::RadioButton("8x8", &factor, 8);
+
+            if (factorChanged)
+            {
+                refinement.setFactor(factor);
+            }
+
+            ui::ProgressBar(refinement.getProgress(), ImVec2(-1, 0));
+            ui::TreePop();
+        }
+
+        if (ui::TreeNode("Temporal Accumulation"))
+        {
+            TemporalAccumulation& accumulation = volume.getTemporalAccumulation();
+            static bool temporal = accumulation.isEnabled();
+
+            if (ui::Checkbox("Enable", &temporal))
+            {
+                accumulation.setEnabled(temporal);
+            }
+
+            if (temporal)
+            {
+                ui::Text("Accumulated frames: %d", accumulation.getFrames());
+                ui::Text("Replaces the progressive refinement");
+            }
+
+            ui::TreePop();
+        }
+
+        if (ui::TreeNode("CPU Reference"))
+        {
+            if (volume.isRenderingReference())
+            {
+                ui::Text("Rendering...");
+            }
+            else
+            {
+                if (ui::Button("Raycast View On CPU"))
+                {
+                    volume.renderReference();
+                }
+
+                if (ui::Button("Benchmark Ray Packets"))
+                {
+                    volume.renderReference(true);
+                }
+            }
+
+            ui::Text("Traversal: %s", CpuRaycaster::GetKernelName());
+
+            if (const auto& raycaster = volume.getReferenceRaycaster())
+            {
+                const CpuRaycaster::Frame& frame = raycaster->getFrame();
+                ui::Text("%d x %d in %.1f ms", frame.size.x, frame.size.y, frame.seconds * 1000);
+                ui::Text("%.2f million rays, %.1f samples per ray", frame.rays / 1e6,
+                         frame.rays > 0 ? static_cast<double>(frame.samples) / frame.rays : 0.0);
+                ui::Text("%.2f million rays per second on %u threads%s", frame.getRaysPerSecond() / 1e6,
+                         ThreadPool::instance().getThreadCount(), frame.packets ? ", packets" : "");
+                ui::Text("%zu tiles, %zu split, %zu stolen", frame.schedule.tiles, frame.schedule.splits,
+                         frame.schedule.steals);
+                ui::Text("Load imbalance %.2f, %.0f%% busy", frame.schedule.getImbalance(),
+                         frame.schedule.getEfficiency() * 100);
+            }
+
+            if (const auto& benchmark = volume.getTraversalBenchmark())
+            {
+                ui::Text("Single rays %.2f, packets %.2f million rays per second",
+                         benchmark->scalarRaysPerSecond / 1e6, benchmark->packetRaysPerSecond / 1e6);
+                ui::Text("Largest difference %g%s", benchmark->maxDifference,
+                         benchmark->packets ? "" : ", packets unavailable");
+            }
+
+            ui::TreePop();
+        }
+
+        if (ui::TreeNode("Empty Space Skipping"))
+        {
+            static bool emptySpaceSkipping = volume.isEmptySpaceSkipping();
+            static bool sampleCounting = volume.isSampleCounting();
+
+            if (ui::Checkbox("Enable", &emptySpaceSkipping))
+            {
+                volume.setEmptySpaceSkipping(emptySpaceSkipping);
+            }
+
+            if (ui::Checkbox("Count Samples", &sampleCounting))
+            {
+                volume.setSampleCounting(sampleCounting);
+            }
+
+            if (auto& grid = volume.getOccupancyGrid())
+            {
+                const ivec3 bricks = grid->getBrickCount();
+                ui::Text("Occupied bricks: %zu of %d", grid->getOccupiedCount(), bricks.x * bricks.y * bricks.z);
+            }
+
+            const uvec2 samples = volume.getSampleCounts();
+
+            if (sampleCounting && samples.x + samples.y > 0)
+            {
+                ui::Text("Samples: %u taken, %u skipped (%.1f%%)", samples.x, samples.y,
+                         100.0f * samples.y / (static_cast<float>(samples.x) + samples.y));
+            }
+
+            ui::TreePop();
+        }
+
         ui::Separator();
         ui::Text("Post-effects");
 
@@ -153,6 +417,144 @@ void VolumeRenderingAppUi::DrawRenderingOptions(RaycastVolume& volume)
             ui::TreePop();
         }
 
+        ui::Separator();
+        ui::Text("Memory");
+
+        static bool derivedDataCaching = volume.isDerivedDataCaching();
+
+        if (ui::Checkbox("Cache Derived Data", &derivedDataCaching))
+        {
+            volume.setDerivedDataCaching(derivedDataCaching);
+        }
+
+        static bool convertTo8Bits = volume.isConvertingTo8Bits();
+        static vec2 windowPercentiles = volume.getWindowPercentiles();
+
+        // applies to the next loaded volume
+        if (ui::Checkbox("Convert 16 to 8 Bits", &convertTo8Bits))
+        {
+            volume.setConvertTo8Bits(convertTo8Bits);
+        }
+
+        if (convertTo8Bits && ui::InputFloat2("Window Percentiles", value_ptr(windowPercentiles)))
+        {
+            volume.setWindowPercentiles(windowPercentiles);
+        }
+
+        // applies to the next loaded volume
+        if (ui::TreeNode("Gradients"))
+        {
+            static int difference = static_cast<int>(volume.getGradientSettings().difference);
+            static int filter = static_cast<int>(volume.getGradientSettings().filter);
+            static int radius = volume.getGradientSettings().radius;
+            static int encoding = static_cast<int>(volume.getGradientSettings().encoding);
+            bool changed = false;
+
+            // in GradientEngine::Difference, Filter and Encoding order
+            changed |= ui::RadioButton("Central", &difference, 0);
+            ui::SameLine();
+            changed |= ui::RadioButton("Sobel", &difference, 1);
+            changed |= ui::RadioButton("Box", &filter, 0);
+            ui::SameLine();
+            changed |= ui::RadioButton("Gaussian", &filter, 1);
+            changed |= ui::InputInt("Radius", &radius);
+            changed |= ui::RadioButton("Spheremap", &encoding, 0);
+            ui::SameLine();
+            changed |= ui::RadioButton("Octahedral", &encoding, 1);
+
+            if (changed)
+            {
+                GradientEngine::Settings settings;
+                settings.difference = static_cast<GradientEngine::Difference>(difference);
+                settings.filter = static_cast<GradientEngine::Filter>(filter);
+                settings.radius = radius;
+                settings.encoding = static_cast<GradientEngine::Encoding>(encoding);
+                volume.setGradientSettings(settings);
+                radius = volume.getGradientSettings().radius;
+            }
+
+            static std::array<GradientEngine::EncodingBenchmark, 2> benchmark;
+            static bool benchmarked = false;
+
+            if (ui::Button("Benchmark Encodings"))
+            {
+                benchmark = GradientEngine::BenchmarkEncodings();
+                benchmarked = true;
+            }
+
+            if (benchmarked)
+            {
+                const char* names[] = { "Spheremap", "Octahedral" };
+
+                for (size_t i = 0; i < benchmark.size(); i++)
+                {
+                    ui::Text("%s: %d bytes, error %.3f mean %.3f max deg, %.0f / %.0f M normals/s", names[i],
+                             benchmark[i].bytesPerVoxel, benchmark[i].meanError, benchmark[i].maxError,
+                             benchmark[i].encodeRate / 1e6, benchmark[i].decodeRate / 1e6);
+                }
+
+                // memory the compact encoding saves on the loaded volume
+                if (auto& grid = volume.getOccupancyGrid())
+                {
+                    const ivec3 size = grid->getDimensions();
+                    const size_t voxels = static_cast<size_t>(size.x) * size.y * size.z;
+                    ui::Text("Octahedral saves %.1f MB on the loaded volume", voxels *
+                             (benchmark[0].bytesPerVoxel - benchmark[1].bytesPerVoxel) / (1024.0f * 1024.0f));
+                }
+            }
+
+            static GradientEngine::SmoothingBenchmark smoothing;
+            static bool smoothed = false;
+
+            if (ui::Button("Benchmark Smoothing"))
+            {
+                smoothing = GradientEngine::BenchmarkSmoothing();
+                smoothed = true;
+            }
+
+            if (smoothed)
+            {
+                ui::Text("%d taps: direct %.1f ms, separable %.1f ms, %.1fx faster", smoothing.taps,
+                         smoothing.bruteForceSeconds * 1000, smoothing.separableSeconds * 1000,
+                         smoothing.bruteForceSeconds / std::max(smoothing.separableSeconds, 1e-9));
+                ui::Text("Max difference %.2e over %zu voxels", smoothing.maxDifference, smoothing.voxels);
+            }
+
+            ui::TreePop();
+        }
+
+        if (ui::TreeNode("Brick Cache"))
+        {
+            static int cacheBudget = static_cast<int>(volume.getBrickCacheBudget() / (1024 * 1024));
+
+            if (ui::InputInt("Budget (MB)", &cacheBudget))
+            {
+                cacheBudget = max(cacheBudget, 1);
+                volume.setBrickCacheBudget(static_cast<size_t>(cacheBudget) * 1024 * 1024);
+            }
+
+            if (auto& cache = volume.getBrickCache())
+            {
+                const auto counters = cache->getCounters();
+                const auto& source = cache->getSource();
+                ui::Text("Bricks: %zu resident (%.1f MB)", cache->getResidentBricks(),
+                         cache->getResidentBytes() / (1024.0f * 1024.0f));
+                ui::Text("Brick size: %d, grid %d x %d x %d", source.getBrickSize(), source.getBrickCount().x,
+                         source.getBrickCount().y, source.getBrickCount().z);
+                ui::Text("Hits: %llu, misses: %llu", static_cast<unsigned long long>(counters.hits),
+                         static_cast<unsigned long long>(counters.misses));
+                ui::Text("Evictions: %llu, prefetched: %llu", static_cast<unsigned long long>(counters.evictions),
+                         static_cast<unsigned long long>(counters.prefetched));
+
+                if (ui::Button("Reset Counters"))
+                {
+                    cache->resetCounters();
+                }
+            }
+
+            ui::TreePop();
+        }
+
         ui::End();
     }
 }
@@ -184,6 +586,32 @@ void VolumeRenderingAppUi::DrawLightingSetup(RaycastVolume& volume)
             RenderingParams::ShadowsEnabled(shadows);
         }
 
+        if (shadows && ui::TreeNode("Light Volume"))
+        {
+            static bool lightVolumeShadows = volume.isLightVolumeShadows();
+            static float lightVolumeScale = volume.getLightVolumeScale();
+
+            if (ui::Checkbox("Enable", &lightVolumeShadows))
+            {
+                volume.setLightVolumeShadows(lightVolumeShadows);
+            }
+
+            if (ui::SliderFloat("Resolution", &lightVolumeScale, 1.0f / 16, 1.0f))
+            {
+                volume.setLightVolumeScale(lightVolumeScale);
+            }
+
+            const ivec3& lightVolumeSize = volume.getLightVolumeSize();
+
+            if (lightVolumeSize.x > 0)
+            {
+                ui::Text("%d x %d x %d cells, built in %.1f ms", lightVolumeSize.x, lightVolumeSize.y,
+                         lightVolumeSize.z, volume.getLightVolumeSeconds() * 1000);
+            }
+
+            ui::TreePop();
+        }
+
         changed |= ui::SliderFloat3("Rotation", value_ptr(rotation), -180, 180);
         changed |= ui::DragFloat3("Ambient", value_ptr(light.ambient), 0.01, 0, 1);
         changed |= ui::DragFloat3("Diffuse", value_ptr(light.diffuse), 0.01, 0, 1);
@@ -234,24 +662,195 @@ bool VolumeRenderingAppUi::VolumeLoadPopup(RaycastVolume& volume)
         static ivec3 slices = ivec3(1);
         static vec3 ratios = vec3(1);
         static int bits = 0;
-        // volume dimensions
-        ui::InputInt3("Slices", value_ptr(slices));
-        // volume aspectRatios
-        ui::InputFloat3("Aspect", value_ptr(ratios));
-        // node bit size
-        ui::RadioButton("8 bits", &bits, 0);
-        ui::SameLine();
-        ui::Dummy(ImVec2(ui::GetContentRegionAvailWidth() / 3, 0));
-        ui::SameLine();
-        ui::RadioButton("16 bits", &bits, 1);
-        // slices has to be positive
-        slices = max(slices, ivec3(1));
-
-        if (ui::Button("Load", ImVec2(ui::GetContentRegionAvailWidth(), 0)))
-        {
-            volume.loadFromFile(slices, ratios, path, bits == 1);
-            ui::CloseCurrentPopup();
-            isClosed = true;
+        static int memoryBudget = static_cast<int>(volume.getHostMemoryBudget() / (1024 * 1024));
+        static int residentBudget = static_cast<int>(volume.getResidentMemoryBudget() / (1024 * 1024));
+
+        if (!volumeLoading)
+        {
+            // volume dimensions
+            ui::InputInt3("Slices", value_ptr(slices));
+            // volume aspectRatios
+            ui::InputFloat3("Aspect", value_ptr(ratios));
+            // voxel type, in VoxelType order
+            ui::RadioButton("8 bits", &bits, 0);
+            ui::SameLine();
+            ui::RadioButton("16 bits", &bits, 1);
+            ui::SameLine();
+            ui::RadioButton("32 bits float", &bits, 2);
+            // host memory used while streaming the volume
+            ui::InputInt("Memory (MB)", &memoryBudget);
+            // texture memory of the volume and its gradients, larger volumes are halved
+            ui::InputInt("GPU Budget (MB)", &residentBudget);
+            // slices has to be positive
+            slices = max(slices, ivec3(1));
+            memoryBudget = max(memoryBudget, 1);
+            residentBudget = max(residentBudget, 1);
+
+            if (ui::Button("Load", ImVec2(ui::GetContentRegionAvailWidth(), 0)))
+            {
+                volume.setHostMemoryBudget(static_cast<size_t>(memoryBudget) * 1024 * 1024);
+                volume.setResidentMemoryBudget(static_cast<size_t>(residentBudget) * 1024 * 1024);
+                volume.loadFromFile(slices, ratios, path, static_cast<VoxelType>(bits));
+                volumeLoading = true;
+            }
+        }
+        else if (auto& job = volume.getLoadJob())
+        {
+            const float megabyte = 1024.0f * 1024.0f;
+            const float total = job->getTotalBytes() / megabyte;
+            const float read = job->getBytesRead() / megabyte;
+            const float uploaded = job->getBytesUploaded() / megabyte;
+            // load progress
+            ui::Text("%s", job->getStageName());
+            ui::ProgressBar(total > 0 ? read / total : 0, ImVec2(-1, 0),
+                            (std::to_string(static_cast<int>(read)) + " / " +
+                             std::to_string(static_cast<int>(total)) + " MB read").c_str());
+            ui::ProgressBar(total > 0 ? uploaded / total : 0, ImVec2(-1, 0),
+                            (std::to_string(static_cast<int>(uploaded)) + " / " +
+                             std::to_string(static_cast<int>(total)) + " MB uploaded").c_str());
+
+            if (job->getDecodeThroughput() > 0)
+            {
+                ui::Text("Decoding at %.1f MB/s", job->getDecodeThroughput() / megabyte);
+            }
+
+            if (job->getLevel() > 0)
+            {
+                const ivec3 resident = job->getDimensions();
+                ui::Text("Reduced %d levels to %d x %d x %d to fit the budget", job->getLevel(), resident.x,
+                         resident.y, resident.z);
+            }
+
+            if (job->getStage() == VolumeLoadJob::Stage::Failed)
+            {
+                ui::TextWrapped("%s", job->getError().c_str());
+
+                if (ui::Button("Close", ImVec2(ui::GetContentRegionAvailWidth(), 0)))
+                {
+                    volumeLoading = false;
+
+                    // bricked volumes and image stacks have no parameters to correct
+                    if (ci::fs::path(path).extension() == std::string(".") + BrickedVolume::Extension ||
+                        ci::fs::is_directory(path))
+                    {
+                        ui::CloseCurrentPopup();
+                        isClosed = true;
+                    }
+                }
+            }
+            else if (job->isActive())
+            {
+                if (ui::Button("Cancel", ImVec2(ui::GetContentRegionAvailWidth(), 0)))
+                {
+                    volume.cancelLoad();
+                }
+            }
+            else
+            {
+                // done or cancelled
+                volumeLoading = false;
+                ui::CloseCurrentPopup();
+                isClosed = true;
+            }
+        }
+
+        ui::EndPopup();
+    }
+
+    return isClosed;
+}
+
+bool VolumeRenderingAppUi::VolumeConvertPopup(RaycastVolume& volume)
+{
+    bool isClosed = false;
+
+    if (ui::BeginPopupModal("Convert to Bricked", nullptr, ImGuiWindowFlags_AlwaysAutoResize))
+    {
+        static ivec3 slices = ivec3(1);
+        static vec3 ratios = vec3(1);
+        static int bits = 0;
+        static int brickSize = 64;
+        static std::future<bool> conversion;
+        static std::atomic<int> bricksDone(0);
+        static std::string outputPath;
+        static std::string error;
+
+        if (!conversion.valid())
+        {
+            // volume dimensions
+            ui::InputInt3("Slices", value_ptr(slices));
+            // volume aspectRatios
+            ui::InputFloat3("Aspect", value_ptr(ratios));
+            // voxel type, in VoxelType order
+            ui::RadioButton("8 bits", &bits, 0);
+            ui::SameLine();
+            ui::RadioButton("16 bits", &bits, 1);
+            ui::SameLine();
+            ui::RadioButton("32 bits float", &bits, 2);
+            // brick size
+            ui::RadioButton("32^3 bricks", &brickSize, 32);
+            ui::SameLine();
+            ui::RadioButton("64^3 bricks", &brickSize, 64);
+            // slices has to be positive
+            slices = max(slices, ivec3(1));
+
+            if (ui::Button("Convert", ImVec2(ui::GetContentRegionAvailWidth() / 2, 0)))
+            {
+                auto fspath = cinder::app::getSaveFilePath(path + "." + BrickedVolume::Extension,
+                                                           { BrickedVolume::Extension });
+
+                if (!fspath.empty())
+                {
+                    // convert in the background, bricks are gathered by the thread pool
+                    outputPath = fspath.string();
+                    bricksDone = 0;
+                    conversion = std::async(std::launch::async, [source = path]
+                    {
+                        return BrickedVolume::ConvertRaw(source, outputPath, slices, ratios,
+                                                         static_cast<VoxelType>(bits), brickSize, &bricksDone,
+                                                         &error);
+                    });
+                }
+            }
+
+            ui::SameLine();
+
+            if (ui::Button("Close", ImVec2(ui::GetContentRegionAvailWidth(), 0)))
+            {
+                ui::CloseCurrentPopup();
+                isClosed = true;
+            }
+        }
+        else
+        {
+            const ivec3 brickCount = (slices + brickSize - 1) / brickSize;
+            const int totalBricks = brickCount.x * brickCount.y * brickCount.z;
+            // conversion progress
+            ui::ProgressBar(static_cast<float>(bricksDone) / totalBricks, ImVec2(-1, 0),
+                            (std::to_string(bricksDone) + " / " + std::to_string(totalBricks) + " bricks").c_str());
+
+            if (conversion.wait_for(std::chrono::seconds(0)) == std::future_status::ready)
+            {
+                if (conversion.get())
+                {
+                    // load the converted volume right away
+                    path = outputPath;
+                    volume.loadFromFile(path);
+                    volumeLoading = true;
+                    loadNewVolume = true;
+                    ui::CloseCurrentPopup();
+                    isClosed = true;
+                }
+                else
+                {
+                    CI_LOG_E(error);
+                }
+            }
+        }
+
+        if (!conversion.valid() && !error.empty())
+        {
+            ui::TextWrapped("%s", error.c_str());
         }
 
         ui::EndPopup();
@@ -272,12 +871,46 @@ void VolumeRenderingAppUi::DrawMainMenuBar(RaycastVolume& volume)
         {
             if (ui::MenuItem("Open"))
             {
-                auto fspath = cinder::app::getOpenFilePath(path, { "raw" });
+                auto fspath = cinder::app::getOpenFilePath(path, { "raw", CompressedVolume::Extensions[0],
+                                                                  CompressedVolume::Extensions[1],
+                                                                  BrickedVolume::Extension });
+
+                if (!fspath.empty())
+                {
+                    path = fspath.string();
+                    loadNewVolume = true;
+
+                    // bricked volumes describe themselves, no parameters needed
+                    if (fspath.extension() == std::string(".") + BrickedVolume::Extension)
+                    {
+                        volume.loadFromFile(path);
+                        volumeLoading = true;
+                    }
+                }
+            }
+
+            if (ui::MenuItem("Open Image Stack"))
+            {
+                auto fspath = cinder::app::getFolderPath(path);
 
                 if (!fspath.empty())
                 {
+                    // dimensions and bit depth come from the slice images
                     path = fspath.string();
                     loadNewVolume = true;
+                    volume.loadFromFile(path);
+                    volumeLoading = true;
+                }
+            }
+
+            if (ui::MenuItem("Convert to Bricked"))
+            {
+                auto fspath = cinder::app::getOpenFilePath(path, { "raw" });
+
+                if (!fspath.empty())
+                {
+                    path = fspath.string();
+                    convertVolume = true;
                 }
             }
             ui::EndMenu();
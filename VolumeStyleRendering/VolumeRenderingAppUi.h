@@ -7,12 +7,15 @@ public:
     static void DrawUi(RaycastVolume &volume);
 private:
     static bool VolumeLoadPopup(RaycastVolume &volume);
+    static bool VolumeConvertPopup(RaycastVolume &volume);
     static void DrawRenderingOptions(RaycastVolume &volume);
     static void DrawLightingSetup(RaycastVolume &volume);
     static void DrawRotationControls(RaycastVolume &volume);
     static void DrawMainMenuBar(RaycastVolume &volume);
 
     static bool loadNewVolume;
+    static bool volumeLoading;
+    static bool convertVolume;
     static bool showVolumeOptions;
     static bool showRendering;
     static bool showTransferFunction;
@@ -0,0 +1,111 @@
+#pragma once
+#include <limits>
+#include <cinder/CinderGlm.h>
+
+#include "VoxelType.h"
+
+/**
+ * \brief Samples a block of typed voxels on the CPU. Values are returned like the GPU reads them
+ * from the volume texture, normalized to [0..1] for integer voxels and unchanged for floats
+ */
+template <typename T>
+class VolumeSampler
+{
+public:
+    /**
+     * \brief Creates a sampler over tightly packed voxels stored in x, y, z order
+     * \param voxels The voxel data
+     * \param dimensions Number of voxels along each axis
+     */
+    VolumeSampler(const T* voxels, const glm::ivec3& dimensions) : voxels(voxels), dimensions(dimensions) {}
+
+    /**
+     * \brief Reads a single voxel, coordinates outside the block repeat the edge voxels
+     * \param voxel Voxel coordinates
+     * \return The voxel value
+     */
+    float fetch(const glm::ivec3& voxel) const
+    {
+        const glm::ivec3 p = glm::clamp(voxel, glm::ivec3(0), dimensions - 1);
+
+        return ToTexture(voxels[(static_cast<size_t>(p.z) * dimensions.y + p.y) * dimensions.x + p.x]);
+    }
+
+    /**
+     * \brief Trilinear interpolation between the eight voxels around the given position
+     * \param position Position in voxel coordinates, voxel centers lie at integer coordinates
+     * \return The interpolated value
+     */
+    float sample(const glm::vec3& position) const
+    {
+        return interpolate(position, &VolumeSampler::fetch);
+    }
+
+    /**
+     * \brief Reads a single voxel, coordinates outside the block read zero like a texture
+     * clamped to a black border
+     * \param voxel Voxel coordinates
+     * \return The voxel value
+     */
+    float fetchBorder(const glm::ivec3& voxel) const
+    {
+        if (glm::any(glm::lessThan(voxel, glm::ivec3(0))) || glm::any(glm::greaterThanEqual(voxel, dimensions)))
+        {
+            return 0;
+        }
+
+        return ToTexture(voxels[(static_cast<size_t>(voxel.z) * dimensions.y + voxel.y) * dimensions.x + voxel.x]);
+    }
+
+    /**
+     * \brief Trilinear interpolation like the volume texture lookup of the raycast shader
+     * \param coordinates Texture coordinates, [0..1] covers the block and the voxel centers lie
+     * half a voxel inside it. The black border is blended in outside the outer voxel centers
+     * \return The interpolated value
+     */
+    float sampleTexture(const glm::vec3& coordinates) const
+    {
+        return interpolate(coordinates * glm::vec3(dimensions) - 0.5f, &VolumeSampler::fetchBorder);
+    }
+
+    /**
+     * \brief Central differences gradient at the given voxel
+     * \param voxel Voxel coordinates
+     * \return The unnormalized gradient
+     */
+    glm::vec3 gradient(const glm::ivec3& voxel) const
+    {
+        return glm::vec3(fetch(voxel + glm::ivec3(1, 0, 0)) - fetch(voxel - glm::ivec3(1, 0, 0)),
+                         fetch(voxel + glm::ivec3(0, 1, 0)) - fetch(voxel - glm::ivec3(0, 1, 0)),
+                         fetch(voxel + glm::ivec3(0, 0, 1)) - fetch(voxel - glm::ivec3(0, 0, 1))) * 0.5f;
+    }
+
+    /**
+     * \brief Converts a voxel value to the value read from the volume texture
+     */
+    static float ToTexture(T value)
+    {
+        return VoxelTraits<T>::Normalized ? value / static_cast<float>(std::numeric_limits<T>::max()) :
+                                            static_cast<float>(value);
+    }
+private:
+    const T* voxels;
+    glm::ivec3 dimensions;
+
+    /**
+     * \brief Blends the eight voxels around a position in voxel coordinates read with the given fetch
+     */
+    float interpolate(const glm::vec3& position, float (VolumeSampler::*read)(const glm::ivec3&) const) const
+    {
+        const glm::vec3 base = glm::floor(position);
+        const glm::vec3 t = position - base;
+        const glm::ivec3 p = glm::ivec3(base);
+
+        const float x00 = glm::mix((this->*read)(p), (this->*read)(p + glm::ivec3(1, 0, 0)), t.x);
+        const float x10 = glm::mix((this->*read)(p + glm::ivec3(0, 1, 0)), (this->*read)(p + glm::ivec3(1, 1, 0)), t.x);
+        const float x01 = glm::mix((this->*read)(p + glm::ivec3(0, 0, 1)), (this->*read)(p + glm::ivec3(1, 0, 1)), t.x);
+        const float x11 = glm::mix((this->*read)(p + glm::ivec3(0, 1, 1)), (this->*read)(p + glm::ivec3(1, 1, 1)), t.x);
+
+        return glm::mix(glm::mix(x00, x10, t.y), glm::mix(x01, x11, t.y), t.z);
+    }
+};
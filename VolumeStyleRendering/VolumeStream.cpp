@@ -0,0 +1,244 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <future>
+#include <limits>
+
+#include "VolumeStream.h"
+#include "HistogramEngine.h"
+#include "MappedFile.h"
+
+using namespace glm;
+
+namespace
+{
+    /**
+     * \brief Touches every page of the given range so it's read from disk by the calling thread
+     * \param data Start of the range
+     * \param bytes Length of the range
+     * \return A value depending on the read bytes
+     */
+    uint8_t touchPages(const uint8_t* data, size_t bytes)
+    {
+        const size_t pageSize = 4096;
+        // volatile reads so page faults aren't optimized away
+        const volatile uint8_t* pages = data;
+        uint8_t value = 0;
+
+        for (size_t i = 0; i < bytes; i += pageSize) { value ^= pages[i]; }
+
+        return bytes > 0 ? value ^ pages[bytes - 1] : value;
+    }
+}
+
+VolumeStatistics::VolumeStatistics() : minValue(std::numeric_limits<float>::max()),
+                                       maxValue(std::numeric_limits<float>::lowest()), domainLow(0), binWidth(0)
+{
+    histogram.fill(0);
+}
+
+void VolumeStatistics::accumulate(const VolumeSlab& slab, VoxelType type)
+{
+    const size_t count = slab.bytes / GetVoxelSize(type);
+    HistogramEngine engine(type);
+
+    // float bins cover a domain widened to the slab values first
+    if (type == VoxelType::Float32)
+    {
+        const vec2 range = HistogramEngine::FindValueRange(type, slab.data, count);
+
+        if (range.x > range.y) return;
+
+        expandDomain(range.x, range.y);
+        engine.setDomain(domainLow, domainLow + 256 * binWidth);
+    }
+    else
+    {
+        binWidth = type == VoxelType::UInt16 ? 256.0f : 1.0f;
+    }
+
+    engine.accumulate(slab.data, count);
+
+    if (engine.getTotal() == 0) return;
+
+    for (int i = 0; i < 256; i++) { histogram[i] += engine.getCounts()[i]; }
+
+    minValue = std::min(minValue, engine.getValueRange().x);
+    maxValue = std::max(maxValue, engine.getValueRange().y);
+}
+
+void VolumeStatistics::expandDomain(float low, float high)
+{
+    // the first values define the initial domain
+    if (binWidth <= 0)
+    {
+        domainLow = low;
+        binWidth = std::max((high - low) / 255.0f, std::max(std::abs(low), 1.0f) * 1e-6f);
+        return;
+    }
+
+    while (low < domainLow || high >= domainLow + 256 * binWidth)
+    {
+        std::array<uint64_t, 256> merged;
+        merged.fill(0);
+
+        // growing downwards moves the current bins to the upper half
+        const int shift = low < domainLow ? 128 : 0;
+
+        for (int i = 0; i < 256; i++) { merged[shift + i / 2] += histogram[i]; }
+
+        if (shift > 0) domainLow -= 256 * binWidth;
+
+        binWidth *= 2;
+        histogram = merged;
+    }
+}
+
+void VolumeStatistics::merge(const uint32_t* counts, float minValue, float maxValue)
+{
+    for (int i = 0; i < 256; i++) { histogram[i] += counts[i]; }
+
+    this->minValue = std::min(this->minValue, minValue);
+    this->maxValue = std::max(this->maxValue, maxValue);
+}
+
+void VolumeStatistics::setDomain(float low, float high)
+{
+    domainLow = low;
+    binWidth = (high - low) / 256;
+}
+
+std::array<float, 256> VolumeStatistics::getNormalizedHistogram() const
+{
+    std::array<float, 256> normalized;
+    const uint64_t maxCount = std::max<uint64_t>(*std::max_element(histogram.begin(), histogram.end()), 1);
+
+    for (int i = 0; i < 256; i++)
+    {
+        normalized[i] = static_cast<float>(histogram[i]) / maxCount;
+    }
+
+    return normalized;
+}
+
+const std::array<uint64_t, 256>& VolumeStatistics::getHistogram() const
+{
+    return histogram;
+}
+
+vec2 VolumeStatistics::getValueRange() const
+{
+    return minValue > maxValue ? vec2(0) : vec2(minValue, maxValue);
+}
+
+vec2 VolumeStatistics::getDomain() const
+{
+    return vec2(domainLow, domainLow + 256 * binWidth);
+}
+
+std::vector<uint8_t> VolumeStatistics::save() const
+{
+    const float range[4] = { minValue, maxValue, domainLow, binWidth };
+    std::vector<uint8_t> data(sizeof(histogram) + sizeof(range));
+    memcpy(data.data(), histogram.data(), sizeof(histogram));
+    memcpy(data.data() + sizeof(histogram), range, sizeof(range));
+
+    return data;
+}
+
+bool VolumeStatistics::restore(const uint8_t* data, size_t bytes)
+{
+    float range[4];
+
+    if (bytes != sizeof(histogram) + sizeof(range)) return false;
+
+    memcpy(histogram.data(), data, sizeof(histogram));
+    memcpy(range, data + sizeof(histogram), sizeof(range));
+    minValue = range[0];
+    maxValue = range[1];
+    domainLow = range[2];
+    binWidth = range[3];
+
+    return true;
+}
+
+VolumeSlabStream::VolumeSlabStream(const MappedFile& file, const ivec3& dimensions, size_t voxelSize,
+                                   int slabDepth) : file(file), dimensions(dimensions)
+{
+    sliceBytes = static_cast<size_t>(dimensions.x) * dimensions.y * voxelSize;
+    this->slabDepth = clamp(slabDepth, 1, max(dimensions.z, 1));
+    slabCount = (dimensions.z + this->slabDepth - 1) / this->slabDepth;
+}
+
+int VolumeSlabStream::SlabDepthForBudget(const ivec3& dimensions, size_t voxelSize, size_t hostMemoryBudget)
+{
+    const size_t sliceBytes = static_cast<size_t>(dimensions.x) * dimensions.y * voxelSize;
+    // one slab is processed while the next one is read
+    const size_t slices = hostMemoryBudget / (2 * std::max<size_t>(sliceBytes, 1));
+
+    return static_cast<int>(clamp<size_t>(slices, 1, std::max(dimensions.z, 1)));
+}
+
+VolumeSlab VolumeSlabStream::slabAt(int index) const
+{
+    VolumeSlab slab;
+    slab.index = index;
+    slab.zOffset = index * slabDepth;
+    slab.depth = std::min(slabDepth, dimensions.z - slab.zOffset);
+    slab.data = file.data() + slab.zOffset * sliceBytes;
+    slab.bytes = slab.depth * sliceBytes;
+
+    return slab;
+}
+
+bool VolumeSlabStream::run(const std::function<bool(const VolumeSlab&)>& process) const
+{
+    if (!file.isOpen() || slabCount == 0) return false;
+
+    // read first slab upfront
+    VolumeSlab current = slabAt(0);
+    file.prefetch(current.data - file.data(), current.bytes);
+    touchPages(current.data, current.bytes);
+
+    for (int i = 0; i < slabCount; i++)
+    {
+        std::future<uint8_t> nextRead;
+
+        // read next slab while the current one is processed
+        if (i + 1 < slabCount)
+        {
+            const VolumeSlab next = slabAt(i + 1);
+            file.prefetch(next.data - file.data(), next.bytes);
+            nextRead = std::async(std::launch::async, touchPages, next.data, next.bytes);
+        }
+
+        const bool proceed = process(current);
+        // processed slab pages are no longer needed
+        file.release(current.data - file.data(), current.bytes);
+
+        if (nextRead.valid())
+        {
+            nextRead.wait();
+            current = slabAt(i + 1);
+        }
+
+        if (!proceed) return false;
+    }
+
+    return true;
+}
+
+int VolumeSlabStream::getSlabDepth() const
+{
+    return slabDepth;
+}
+
+int VolumeSlabStream::getSlabCount() const
+{
+    return slabCount;
+}
+
+size_t VolumeSlabStream::getSliceBytes() const
+{
+    return sliceBytes;
+}
@@ -0,0 +1,148 @@
+#pragma once
+#include <array>
+#include <functional>
+#include <vector>
+#include <cinder/CinderGlm.h>
+
+#include "VoxelType.h"
+
+class MappedFile;
+
+/**
+ * \brief A range of consecutive z slices of a raw volume
+ */
+struct VolumeSlab
+{
+    int index;
+    int zOffset;
+    int depth;
+    const uint8_t* data;
+    size_t bytes;
+};
+
+/**
+ * \brief Value statistics accumulated slab by slab while a volume is streamed in. The 256 bins
+ * of the histogram match the entries of the transfer function, integer values are binned over
+ * their whole range and float values over a domain that grows as new values come in
+ */
+class VolumeStatistics
+{
+public:
+    VolumeStatistics();
+    /**
+     * \brief Adds the slab values to the histogram and the value range, counted in parallel by
+     * the histogram engine. 16 bits values are binned by their high byte, non finite float
+     * values are ignored
+     * \param slab The slab to accumulate
+     * \param type The slab voxels type
+     */
+    void accumulate(const VolumeSlab& slab, VoxelType type);
+    /**
+     * \brief Adds precomputed statistics of a part of the volume, binned over the same domain
+     * \param counts Frequency of each of the 256 value bins
+     * \param minValue Minimum value of the part
+     * \param maxValue Maximum value of the part
+     */
+    void merge(const uint32_t* counts, float minValue, float maxValue);
+    /**
+     * \brief Sets the values covered by the histogram bins, needed to merge float statistics
+     * computed in advance
+     * \param low Value at the start of the first bin
+     * \param high Value at the end of the last bin
+     */
+    void setDomain(float low, float high);
+    /**
+     * \brief Histogram normalized to [0..1] by its most frequent value
+     * \return The normalized histogram
+     */
+    std::array<float, 256> getNormalizedHistogram() const;
+    /**
+     * \brief Frequency of each value bin
+     * \return The raw histogram counts
+     */
+    const std::array<uint64_t, 256> &getHistogram() const;
+    /**
+     * \brief Minimum and maximum voxel value found so far
+     * \return The value range in the volume's voxel units
+     */
+    glm::vec2 getValueRange() const;
+    /**
+     * \brief Values covered by the histogram bins, transfer functions are defined over it
+     * \return The start of the first bin and end of the last one
+     */
+    glm::vec2 getDomain() const;
+    /**
+     * \brief Serializes the statistics, used to cache them along the volume
+     * \return The histogram counts followed by the value range and domain
+     */
+    std::vector<uint8_t> save() const;
+    /**
+     * \brief Replaces the statistics with previously saved ones
+     * \param data Data written by save
+     * \param bytes Size of the data
+     * \return False if the data doesn't have the expected size
+     */
+    bool restore(const uint8_t* data, size_t bytes);
+private:
+    std::array<uint64_t, 256> histogram;
+    float minValue;
+    float maxValue;
+    float domainLow;
+    // zero until the domain is known
+    float binWidth;
+
+    /**
+     * \brief Doubles the bin width until the domain covers the given range, merging bin pairs
+     */
+    void expandDomain(float low, float high);
+};
+
+/**
+ * \brief Reads a mapped raw volume in z slabs. While a slab is being processed the next one is
+ * read from disk on a background thread, and once processed its pages are released so no more
+ * than two slabs are resident at any time
+ */
+class VolumeSlabStream
+{
+public:
+    /**
+     * \brief Creates a stream over the given mapped file
+     * \param file The mapped raw volume, it has to outlive the stream
+     * \param dimensions The volume dimensions
+     * \param voxelSize Size in bytes of each voxel
+     * \param slabDepth Number of z slices per slab
+     */
+    VolumeSlabStream(const MappedFile& file, const glm::ivec3& dimensions, size_t voxelSize, int slabDepth);
+    /**
+     * \brief Number of z slices per slab so that two slabs fit within the given host memory
+     * \param dimensions The volume dimensions
+     * \param voxelSize Size in bytes of each voxel
+     * \param hostMemoryBudget Maximum amount of resident volume data in bytes
+     * \return The slab depth, at least one slice
+     */
+    static int SlabDepthForBudget(const glm::ivec3& dimensions, size_t voxelSize, size_t hostMemoryBudget);
+    /**
+     * \brief Streams the volume calling process for every slab in z order
+     * \param process Slab processing function, the slab data is only valid during the call.
+     * Returning false stops the stream
+     * \return False if the stream was stopped before the last slab
+     */
+    bool run(const std::function<bool(const VolumeSlab&)>& process) const;
+
+    int getSlabDepth() const;
+    int getSlabCount() const;
+    size_t getSliceBytes() const;
+private:
+    const MappedFile& file;
+    glm::ivec3 dimensions;
+    size_t sliceBytes;
+    int slabDepth;
+    int slabCount;
+
+    /**
+     * \brief Describes the slab at the given index
+     * \param index The slab index
+     * \return The slab's z range and data location within the mapped file
+     */
+    VolumeSlab slabAt(int index) const;
+};
@@ -0,0 +1,112 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * \brief Scalar type of the voxels of a volume
+ */
+enum class VoxelType
+{
+    UInt8,
+    UInt16,
+    Float32
+};
+
+/**
+ * \brief Compile time description of each voxel type's C++ type
+ */
+template <typename T>
+struct VoxelTraits;
+
+template <>
+struct VoxelTraits<uint8_t>
+{
+    static const VoxelType Type = VoxelType::UInt8;
+    // normalized textures map the value range to [0..1]
+    static const bool Normalized = true;
+};
+
+template <>
+struct VoxelTraits<uint16_t>
+{
+    static const VoxelType Type = VoxelType::UInt16;
+    static const bool Normalized = true;
+};
+
+template <>
+struct VoxelTraits<float>
+{
+    static const VoxelType Type = VoxelType::Float32;
+    static const bool Normalized = false;
+};
+
+/**
+ * \brief Size of a voxel of the given type
+ * \param type The voxel type
+ * \return The voxel size in bytes
+ */
+inline size_t GetVoxelSize(VoxelType type)
+{
+    switch (type)
+    {
+    case VoxelType::UInt8: return sizeof(uint8_t);
+    case VoxelType::UInt16: return sizeof(uint16_t);
+    case VoxelType::Float32: return sizeof(float);
+    }
+
+    return 0;
+}
+
+/**
+ * \brief Name of the given voxel type, for reports
+ * \param type The voxel type
+ * \return 8 bits, 16 bits or 32 bits float
+ */
+inline const char* GetVoxelTypeName(VoxelType type)
+{
+    switch (type)
+    {
+    case VoxelType::UInt8: return "8 bits";
+    case VoxelType::UInt16: return "16 bits";
+    case VoxelType::Float32: return "32 bits float";
+    }
+
+    return "";
+}
+
+/**
+ * \brief Voxel type stored with the given size, file formats only store the voxel size since
+ * each supported size has a single type
+ * \param bytes The voxel size in bytes
+ * \param type Receives the voxel type
+ * \return False if no voxel type has the given size
+ */
+inline bool VoxelTypeFromSize(size_t bytes, VoxelType& type)
+{
+    switch (bytes)
+    {
+    case sizeof(uint8_t): type = VoxelType::UInt8; return true;
+    case sizeof(uint16_t): type = VoxelType::UInt16; return true;
+    case sizeof(float): type = VoxelType::Float32; return true;
+    }
+
+    return false;
+}
+
+/**
+ * \brief Calls a generic function with a null pointer of the C++ type matching the voxel type,
+ * so typed code is written once as a generic lambda:
+ * DispatchVoxelType(type, [&](auto tag) { using T = std::remove_pointer_t<decltype(tag)>; ... });
+ * \param type The voxel type
+ * \param function The generic function
+ */
+template <typename Function>
+void DispatchVoxelType(VoxelType type, Function&& function)
+{
+    switch (type)
+    {
+    case VoxelType::UInt8: function(static_cast<uint8_t*>(nullptr)); break;
+    case VoxelType::UInt16: function(static_cast<uint16_t*>(nullptr)); break;
+    case VoxelType::Float32: function(static_cast<float*>(nullptr)); break;
+    }
+}
@@ -0,0 +1,184 @@
+#include <algorithm>
+#include <emmintrin.h>
+#include <immintrin.h>
+
+#include "WindowLevel.h"
+#include "CpuFeatures.h"
+
+#if defined(__GNUC__)
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define TARGET_AVX2
+#endif
+
+namespace
+{
+    // values converted before their histogram is counted, small enough to stay in cache
+    const size_t BlockSize = 4096;
+
+    struct Kernel
+    {
+        uint16_t low;
+        uint16_t range;
+        uint16_t shift;
+        uint16_t scale;
+    };
+
+    inline uint8_t convertValue(const Kernel& kernel, uint16_t value)
+    {
+        const uint32_t offset = std::min<uint32_t>(value > kernel.low ? value - kernel.low : 0, kernel.range);
+
+        return static_cast<uint8_t>(((offset << kernel.shift) * kernel.scale) >> 16);
+    }
+
+    void convertBlockScalar(const Kernel& kernel, const uint16_t* source, uint8_t* destination, size_t count)
+    {
+        for (size_t i = 0; i < count; i++) { destination[i] = convertValue(kernel, source[i]); }
+    }
+
+    /**
+     * \brief Converts 8 values, clamping uses saturated subtraction since SSE2 has no unsigned 16 bits min/max
+     */
+    inline __m128i convertEightSse2(__m128i values, __m128i low, __m128i range, __m128i shift, __m128i scale)
+    {
+        __m128i offset = _mm_subs_epu16(values, low);
+        offset = _mm_sub_epi16(offset, _mm_subs_epu16(offset, range));
+
+        return _mm_mulhi_epu16(_mm_sll_epi16(offset, shift), scale);
+    }
+
+    void convertSse2(const Kernel& kernel, const uint16_t* source, uint8_t* destination, size_t count)
+    {
+        const __m128i low = _mm_set1_epi16(static_cast<short>(kernel.low));
+        const __m128i range = _mm_set1_epi16(static_cast<short>(kernel.range));
+        const __m128i shift = _mm_cvtsi32_si128(kernel.shift);
+        const __m128i scale = _mm_set1_epi16(static_cast<short>(kernel.scale));
+        size_t i = 0;
+
+        for (; i + 16 <= count; i += 16)
+        {
+            const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(source + i));
+            const __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(source + i + 8));
+            const __m128i bytes = _mm_packus_epi16(convertEightSse2(a, low, range, shift, scale),
+                                                   convertEightSse2(b, low, range, shift, scale));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(destination + i), bytes);
+        }
+
+        convertBlockScalar(kernel, source + i, destination + i, count - i);
+    }
+
+    TARGET_AVX2 void convertAvx2(const Kernel& kernel, const uint16_t* source, uint8_t* destination, size_t count)
+    {
+        const __m256i low = _mm256_set1_epi16(static_cast<short>(kernel.low));
+        const __m256i range = _mm256_set1_epi16(static_cast<short>(kernel.range));
+        const __m128i shift = _mm_cvtsi32_si128(kernel.shift);
+        const __m256i scale = _mm256_set1_epi16(static_cast<short>(kernel.scale));
+        size_t i = 0;
+
+        for (; i + 32 <= count; i += 32)
+        {
+            __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(source + i));
+            __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(source + i + 16));
+            a = _mm256_min_epu16(_mm256_subs_epu16(a, low), range);
+            b = _mm256_min_epu16(_mm256_subs_epu16(b, low), range);
+            a = _mm256_mulhi_epu16(_mm256_sll_epi16(a, shift), scale);
+            b = _mm256_mulhi_epu16(_mm256_sll_epi16(b, shift), scale);
+            // packing works per 128 bits lane, reorder the quadwords afterwards
+            const __m256i bytes = _mm256_permute4x64_epi64(_mm256_packus_epi16(a, b), 0xd8);
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(destination + i), bytes);
+        }
+
+        convertBlockScalar(kernel, source + i, destination + i, count - i);
+    }
+
+    typedef void (*ConvertKernel)(const Kernel&, const uint16_t*, uint8_t*, size_t);
+
+    /**
+     * \brief Widest kernel supported by the processor, selected once
+     */
+    ConvertKernel bestKernel()
+    {
+        static const ConvertKernel kernel = CpuFeatures::HasAvx2() ? convertAvx2 :
+                                            CpuFeatures::HasSse2() ? convertSse2 : convertBlockScalar;
+        return kernel;
+    }
+}
+
+WindowLevel::WindowLevel(uint16_t low, uint16_t high)
+{
+    this->low = std::min<uint16_t>(low, 65534);
+    this->high = std::max<uint16_t>(high, this->low + 1);
+    const uint32_t range = this->high - this->low;
+    shift = range < 256 ? 8 : 0;
+    // rounded up so the window's high value reaches 255, the error stays below one level
+    scale = static_cast<uint16_t>((255u * 65536u + (range << shift) - 1) / (range << shift));
+}
+
+void WindowLevel::convert(const uint16_t* source, uint8_t* destination, size_t count, uint32_t* histogram) const
+{
+    const Kernel kernel = { low, static_cast<uint16_t>(high - low), shift, scale };
+    const ConvertKernel convertBlock = bestKernel();
+
+    for (size_t offset = 0; offset < count; offset += BlockSize)
+    {
+        const size_t block = std::min(BlockSize, count - offset);
+        convertBlock(kernel, source + offset, destination + offset, block);
+
+        if (!histogram) continue;
+
+        // block is still in cache
+        for (size_t i = offset; i < offset + block; i++) { histogram[source[i]]++; }
+    }
+}
+
+void WindowLevel::convertScalar(const uint16_t* source, uint8_t* destination, size_t count) const
+{
+    const Kernel kernel = { low, static_cast<uint16_t>(high - low), shift, scale };
+    convertBlockScalar(kernel, source, destination, count);
+}
+
+uint16_t WindowLevel::getLow() const
+{
+    return low;
+}
+
+uint16_t WindowLevel::getHigh() const
+{
+    return high;
+}
+
+WindowLevel WindowLevel::FromPercentiles(const uint64_t* histogram, float lowPercentile, float highPercentile)
+{
+    uint64_t total = 0;
+
+    for (int i = 0; i < 65536; i++) { total += histogram[i]; }
+
+    const uint64_t lowCount = static_cast<uint64_t>(total * std::min(std::max(lowPercentile, 0.0f), 100.0f) / 100.0);
+    const uint64_t highCount = static_cast<uint64_t>(total * std::min(std::max(highPercentile, 0.0f), 100.0f) / 100.0);
+    int low = 0, high = 65535;
+    uint64_t cumulative = 0;
+
+    // first values whose cumulative count reaches each percentile
+    for (int i = 0; i < 65536; i++)
+    {
+        const uint64_t previous = cumulative;
+        cumulative += histogram[i];
+
+        if (previous <= lowCount && cumulative > lowCount) low = i;
+
+        if (previous < highCount && cumulative >= highCount)
+        {
+            high = i;
+            break;
+        }
+    }
+
+    return WindowLevel(static_cast<uint16_t>(low), static_cast<uint16_t>(high));
+}
+
+const char* WindowLevel::GetKernelName()
+{
+    const ConvertKernel kernel = bestKernel();
+
+    return kernel == convertAvx2 ? "AVX2" : kernel == convertSse2 ? "SSE2" : "scalar";
+}
@@ -0,0 +1,56 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * \brief Maps a window of 16 bits values linearly to the 8 bits range, values outside the window
+ * are clamped. The mapping uses 16 bits fixed point so the scalar and vectorized kernels
+ * produce identical results
+ */
+class WindowLevel
+{
+public:
+    /**
+     * \brief Creates the mapping for the given window
+     * \param low Value mapped to 0
+     * \param high Value mapped to 255
+     */
+    WindowLevel(uint16_t low, uint16_t high);
+
+    /**
+     * \brief Converts 16 bits values to 8 bits with the widest kernel the processor supports, and
+     * counts the source values in the same pass
+     * \param source The 16 bits values
+     * \param destination Receives the 8 bits values
+     * \param count Number of values
+     * \param histogram Optional 65536 bins histogram incremented with the source values
+     */
+    void convert(const uint16_t* source, uint8_t* destination, size_t count, uint32_t* histogram = nullptr) const;
+    /**
+     * \brief Converts using only scalar code, reference for the vectorized kernels
+     */
+    void convertScalar(const uint16_t* source, uint8_t* destination, size_t count) const;
+
+    uint16_t getLow() const;
+    uint16_t getHigh() const;
+
+    /**
+     * \brief Picks the window containing the values between the given percentiles
+     * \param histogram 65536 bins histogram of the 16 bits values
+     * \param lowPercentile Percentage of values mapped to 0 or below
+     * \param highPercentile Percentage of values mapped to 255 or below
+     * \return The window between both percentiles
+     */
+    static WindowLevel FromPercentiles(const uint64_t* histogram, float lowPercentile, float highPercentile);
+    /**
+     * \brief Name of the kernel convert uses on this processor
+     * \return AVX2, SSE2 or scalar
+     */
+    static const char* GetKernelName();
+private:
+    uint16_t low;
+    uint16_t high;
+    // window size shifted so it's at least 256, keeps the scale within 16 bits
+    uint16_t shift;
+    uint16_t scale;
+};
@@ -0,0 +1,40 @@
+#version 430
+layout(binding=0) uniform sampler2D coarseColor;
+layout(binding=1) uniform sampler2D coarseNormal;
+layout(binding=2) uniform sampler2D coarseShadow;
+layout(binding=3) uniform sampler2D coarsePosition;
+
+// pixels per block side and the pixel of each block to clear
+uniform int pixelStride;
+uniform ivec2 pixelSubset;
+// fills every pixel with the ray of its block instead of clearing a single pixel per block
+uniform bool upsample;
+
+in vec2 uvs;
+
+layout (location=0) out vec4 oColor;
+layout (location=1) out vec3 oNormal;
+layout (location=2) out float oShadow;
+layout (location=3) out vec3 oPosition;
+
+void main()
+{
+    ivec2 pixel = ivec2(gl_FragCoord.xy);
+
+    if (!upsample)
+    {
+        if (any(notEqual(pixel % pixelStride, pixelSubset))) discard;
+
+        oColor = vec4(0.0);
+        oNormal = vec3(0.0);
+        oShadow = 0.0;
+        oPosition = vec3(0.0);
+        return;
+    }
+
+    ivec2 block = min(pixel / pixelStride, textureSize(coarseColor, 0) - 1);
+    oColor = texelFetch(coarseColor, block, 0);
+    oNormal = texelFetch(coarseNormal, block, 0).xyz;
+    oShadow = texelFetch(coarseShadow, block, 0).x;
+    oPosition = texelFetch(coarsePosition, block, 0).xyz;
+}
@@ -1,4 +1,4 @@
-#version 420
+#version 430
 struct Light 
 {
     vec3 direction;
@@ -16,6 +16,16 @@ layout(binding=6) uniform sampler1D transferFunction;
 layout(binding=7) uniform isampler1D indexFunction;
 layout(binding=8) uniform sampler2DArray styleFunction;
 layout(binding=9) uniform sampler2D volumeAO;
+layout(binding=10) uniform sampler3D emptyDistance;
+layout(binding=11) uniform sampler3D lightVolume;
+layout(binding=12) uniform sampler2D preintegratedFunction;
+
+// samples taken and skipped by the primary rays
+layout(std430, binding=0) buffer SampleCounts
+{
+    uint samplesTaken;
+    uint samplesSkipped;
+};
 
 uniform mat4 ciModelView;
 uniform mat3 ciNormalMatrix;
@@ -23,13 +33,30 @@ uniform mat3 ciModelMatrixInverseTranspose;
 uniform Light light;
 
 uniform vec2 threshold;
+uniform vec2 valueMapping;
 uniform vec3 stepSize;
 uniform vec3 shadowStepSize;
 uniform int iterations;
 uniform bool diffuseShading;
 uniform bool raycastShadows;
+uniform bool lightVolumeShadows;
 uniform bool ambientOcclusion;
 uniform float stepScale;
+uniform bool preintegrated;
+uniform bool octahedralNormals;
+uniform int gradientMode;
+uniform bool emptySpaceSkipping;
+uniform vec3 brickScale;
+// bricks the samples of a coarser level reach past the brick ranges
+uniform int skipMargin;
+uniform bool countSamples;
+// progressive refinement, only pixels of the subset within each block are raycast
+uniform int pixelStride;
+uniform ivec2 pixelSubset;
+// full resolution pixels per drawn pixel, for the lookups made per screen pixel
+uniform float pixelScale;
+// added to the noise of every pixel while frames are accumulated, 0 keeps the jitter static
+uniform float jitterOffset;
 
 in vec4 position;
 
@@ -49,6 +76,21 @@ vec3 decode(vec2 enc)
     return n;
 }
 
+// octahedral normal encoding, the lower hemisphere is folded over the diagonals of the square
+// "A Survey of Efficient Representations for Independent Unit Vectors", Cigolle et al. 2014
+vec3 decodeOctahedral(vec2 enc)
+{
+    vec3 n = vec3(enc, 1.0 - abs(enc.x) - abs(enc.y));
+    float fold = max(-n.z, 0.0);
+    n.xy -= mix(vec2(-fold), vec2(fold), greaterThanEqual(n.xy, vec2(0)));
+    return normalize(n);
+}
+
+vec3 decodeNormal(vec2 enc)
+{
+    return octahedralNormals ? decodeOctahedral(enc) : decode(enc);
+}
+
 vec2 litsphere(vec3 eye, vec3 normal) 
 {
     vec3 reflected = reflect(eye, normal);
@@ -88,6 +130,64 @@ vec4 styleMapping(vec3 eye, vec3 normal, float opacity)
     return styleIndex0 < 0 ? style1 : styleIndex1 < 0 ? style0 : mix(style0, style1, weight);
 }
 
+// maps the volume texture value to the transfer function domain, float volumes aren't normalized
+float density(vec3 pos)
+{
+    return texture(volume, pos).x * valueMapping.x + valueMapping.y;
+}
+
+// normal at pos from the precomputed gradients or differences of the volume taken on-the-fly,
+// modes as in RaycastVolume::GradientMode
+vec3 sampleNormal(vec3 pos, float value)
+{
+    if (gradientMode == 0) return decodeNormal(texture(gradients, pos).xy);
+
+    vec3 h = 1.0 / vec3(textureSize(volume, 0));
+    vec3 gradient;
+
+    if (gradientMode == 1)
+    {
+        gradient = vec3(density(pos + vec3(h.x, 0, 0)) - density(pos - vec3(h.x, 0, 0)),
+                        density(pos + vec3(0, h.y, 0)) - density(pos - vec3(0, h.y, 0)),
+                        density(pos + vec3(0, 0, h.z)) - density(pos - vec3(0, 0, h.z)));
+    }
+    else
+    {
+        // reuses the sample, three fetches instead of six
+        gradient = vec3(density(pos + vec3(h.x, 0, 0)), density(pos + vec3(0, h.y, 0)),
+                        density(pos + vec3(0, 0, h.z))) - value;
+    }
+
+    // flat regions have no direction, like zero encoded gradients
+    float magnitude = length(gradient);
+    return magnitude > 0.0 ? gradient / magnitude : vec3(0, 0, 1);
+}
+
+// number of steps that stay inside empty bricks around pos, zero if the brick may be visible
+int emptySteps(vec3 pos, vec3 step)
+{
+    if (!emptySpaceSkipping) return 0;
+
+    vec3 cell = pos * brickScale;
+    ivec3 brick = clamp(ivec3(floor(cell)), ivec3(0), textureSize(emptyDistance, 0) - 1);
+    // chebyshev distance in bricks to the nearest occupied brick, less the bricks coarser samples reach
+    int distance = int(texelFetch(emptyDistance, brick, 0).r * 255.0 + 0.5) - skipMargin;
+
+    if (distance <= 0) return 0;
+
+    // bricks closer than the distance are empty, steps until the ray leaves their cube
+    vec3 cellStep = step * brickScale;
+    vec3 bound = vec3(brick) + mix(vec3(1 - distance), vec3(distance), greaterThan(cellStep, vec3(0)));
+    vec3 t = mix(vec3(1e30), (bound - cell) / cellStep, greaterThan(abs(cellStep), vec3(1e-8)));
+
+    return int(min(t.x, min(t.y, t.z))) + 1;
+}
+
+bool outside(vec3 pos)
+{
+    return any(lessThan(pos, vec3(0))) || any(greaterThan(pos, vec3(1)));
+}
+
 float voxelOcclusion(vec3 rayStart, vec3 rayDir)
 {
     vec3 step = rayDir * shadowStepSize;
@@ -95,7 +195,20 @@ float voxelOcclusion(vec3 rayStart, vec3 rayDir)
 
     for(int i = 0; i < iterations; i++)
     {
-        float opacity = texture(volume, pos).x;
+        int skip = emptySteps(pos, step);
+
+        // jump over the empty brick
+        if (skip > 0)
+        {
+            pos += step * skip;
+            i += skip - 1;
+
+            if (outside(pos)) return 0.0;
+
+            continue;
+        }
+
+        float opacity = density(pos);
 
         if(opacity >= threshold.x && opacity <= threshold.y)
         {
@@ -118,6 +231,9 @@ float voxelOcclusion(vec3 rayStart, vec3 rayDir)
 
 void main(void)
 {
+    if (pixelStride > 1 && any(notEqual(ivec2(gl_FragCoord.xy) % pixelStride, pixelSubset))) discard;
+
+    vec2 fragCoord = gl_FragCoord.xy * pixelScale;
     vec2 texC = position.xy / position.w;
     texC.x = 0.5 * texC.x + 0.5;
     texC.y = 0.5 * texC.y - 0.5;
@@ -136,20 +252,58 @@ void main(void)
     vec3 step = dir * stepSize;
     
     // jitter ray starting position to reduce artifacts
-    pos += step * texture(bakedNoise, gl_FragCoord.xy / 256).x;
+    float jitter = texture(bakedNoise, fragCoord / 256).x;
+    pos += step * (jitterOffset > 0.0 ? fract(jitter + jitterOffset) : jitter);
+
+    uint taken = 0;
+    uint skipped = 0;
+    // light blocked from the blended samples, weighted by their contribution
+    float shadow = 0.0;
+    // value of the previous sample, segments restart after skipped bricks
+    float previousValue = 0.0;
+    bool restart = true;
 
     for(int i = 0; i < iterations; i++)
     {
-        value.a = texture(volume, pos).x;
+        int skip = emptySteps(pos, step);
 
-        if(value.a >= threshold.x && value.a <= threshold.y)
+        // jump over the empty brick, whole steps keep the jittered sample positions
+        if (skip > 0)
+        {
+            skip = min(skip, iterations - i);
+            pos += step * skip;
+            i += skip - 1;
+            skipped += uint(skip);
+
+            restart = true;
+
+            if (outside(pos)) break;
+
+            continue;
+        }
+
+        value.a = density(pos);
+        taken++;
+
+        // transfer function integrated over the segment from the previous sample, the
+        // threshold is part of the table
+        vec4 segment = vec4(0);
+
+        if(preintegrated)
+        {
+            segment = texture(preintegratedFunction, vec2(value.a, restart ? value.a : previousValue));
+            previousValue = value.a;
+            restart = false;
+        }
+
+        if(preintegrated ? segment.a > 0.0 : value.a >= threshold.x && value.a <= threshold.y)
         {
             float aOcclusion = 1.0;
             // assigned color from transfer function for this density
-            src = texture(colorMappingFunction, value.a);
+            src = preintegrated ? vec4(segment.rgb, 1.0) : texture(colorMappingFunction, value.a);
 
             // gradient value
-            value.xyz = decode(texture(gradients, pos).xy);
+            value.xyz = sampleNormal(pos, value.a);
             vec3 wsNormal = normalize(ciModelMatrixInverseTranspose * value.xyz);
 
             // style transfer, view space calculation
@@ -157,12 +311,13 @@ void main(void)
             vec3 vsNormal = normalize(ciNormalMatrix * value.xyz);
             src *= styleMapping(eye, vsNormal, value.a);
 
-            // opacity correction
-            src.a = 1 - pow((1 - src.a), stepScale / 0.5);
+            // opacity correction, pre-integrated segments hold their mean extinction per half voxel
+            src.a = preintegrated ? src.a * (1.0 - exp(-segment.a * stepScale / 0.5)) :
+                                    1 - pow((1 - src.a), stepScale / 0.5);
 
             if(ambientOcclusion) 
             {
-                aOcclusion = texelFetch(volumeAO, ivec2(gl_FragCoord.xy), 0).x;
+                aOcclusion = texelFetch(volumeAO, ivec2(fragCoord), 0).x;
             }
 
             if(diffuseShading)
@@ -179,6 +334,11 @@ void main(void)
                 src.rgb *= aOcclusion;
             }
 
+            if(lightVolumeShadows)
+            {
+                shadow += (1.0 - dst.a) * src.a * (1.0 - texture(lightVolume, pos).r);
+            }
+
             // front to back blending
             src.rgb *= src.a;
             dst = (1.0 - dst.a) * src + dst;
@@ -195,13 +355,23 @@ void main(void)
             break;
     }
 
-    if(raycastShadows)
+    if(raycastShadows && lightVolumeShadows)
+    {
+        oShadow = shadow * 0.5;
+    }
+    else if(raycastShadows)
     {
         // use world direction in this case since raycast is done in world space
         vec3 lightDir = normalize(-light.direction);
         oShadow = voxelOcclusion(pos, -lightDir) * 0.5;
     }
 
+    if (countSamples)
+    {
+        atomicAdd(samplesTaken, taken);
+        atomicAdd(samplesSkipped, skipped);
+    }
+
     oColor = dst;
     // store normal and position in view-space
     oNormal = ciNormalMatrix * value.xyz;
@@ -0,0 +1,86 @@
+#version 430
+layout(binding=0) uniform sampler2D color;
+layout(binding=1) uniform sampler2D shadow;
+layout(binding=2) uniform sampler2D position;
+layout(binding=3) uniform sampler2D historyColor;
+layout(binding=4) uniform sampler2D historyShadow;
+layout(binding=5) uniform sampler2D historyPosition;
+
+// current view space to the clip and view space of the history
+uniform mat4 reprojection;
+uniform mat4 previousView;
+// share of the history in the blend, 0 discards it
+uniform float historyWeight;
+// the history is clamped to the current neighbourhood while the view moves
+uniform bool clampHistory;
+
+in vec2 uvs;
+
+layout (location=0) out vec4 oColor;
+layout (location=1) out float oShadow;
+layout (location=2) out vec3 oPosition;
+
+// history positions further away than this share of the view depth show another surface
+const float DepthTolerance = 0.05;
+
+void main()
+{
+    ivec2 pixel = ivec2(gl_FragCoord.xy);
+    vec4 current = texelFetch(color, pixel, 0);
+    float currentShadow = texelFetch(shadow, pixel, 0).x;
+    vec3 viewPosition = texelFetch(position, pixel, 0).xyz;
+
+    oColor = current;
+    oShadow = currentShadow;
+    oPosition = viewPosition;
+
+    // no ray outside of the cube
+    if (historyWeight <= 0.0 || viewPosition == vec3(0.0)) return;
+
+    // where the ray's end was drawn in the history
+    vec4 clip = reprojection * vec4(viewPosition, 1.0);
+
+    if (clip.w <= 0.0) return;
+
+    vec2 uv = clip.xy / clip.w * 0.5 + 0.5;
+
+    if (any(lessThan(uv, vec2(0.0))) || any(greaterThan(uv, vec2(1.0)))) return;
+
+    // disocclusions, the pixel showed nothing or another surface
+    ivec2 size = textureSize(historyPosition, 0);
+    vec3 previous = texelFetch(historyPosition, min(ivec2(uv * size), size - 1), 0).xyz;
+    vec3 expected = (previousView * vec4(viewPosition, 1.0)).xyz;
+
+    if (previous == vec3(0.0) || distance(previous, expected) > DepthTolerance * abs(expected.z)) return;
+
+    vec4 history = texture(historyColor, uv);
+    float historyShadowValue = texture(historyShadow, uv).x;
+
+    if (clampHistory)
+    {
+        vec4 low = current;
+        vec4 high = current;
+        float lowShadow = currentShadow;
+        float highShadow = currentShadow;
+
+        for (int y = -1; y <= 1; y++)
+        {
+            for (int x = -1; x <= 1; x++)
+            {
+                ivec2 neighbour = clamp(pixel + ivec2(x, y), ivec2(0), textureSize(color, 0) - 1);
+                vec4 value = texelFetch(color, neighbour, 0);
+                float shadowValue = texelFetch(shadow, neighbour, 0).x;
+                low = min(low, value);
+                high = max(high, value);
+                lowShadow = min(lowShadow, shadowValue);
+                highShadow = max(highShadow, shadowValue);
+            }
+        }
+
+        history = clamp(history, low, high);
+        historyShadowValue = clamp(historyShadowValue, lowShadow, highShadow);
+    }
+
+    oColor = mix(current, history, historyWeight);
+    oShadow = mix(currentShadow, historyShadowValue, historyWeight);
+}